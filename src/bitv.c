@@ -15,6 +15,13 @@
 #include <bitv_priv.h>
 #include <stdio.h>
 #include "sasatom.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__powerpc64__) && defined(__VSX__) && defined(_ARCH_PWR8)
+#include <altivec.h>
+#endif
 
 void
 bitv_init (bitv_cb_t * cb, size_t unit)
@@ -501,3 +508,191 @@ bitv_free_marked (bitv_cb_t * cb, bitv_word * bvec, bitv_word * endvec,
 
   return rc;
 }
+
+/* Search kernels for bitv_find_run.  Each reduces a word so that a
+   bit remains set only where it ends a run of at least units free
+   (1) bits, by and-ing the word with itself shifted by a doubling
+   distance.  Covering n units takes ceil(log2(n)) steps, and the
+   vector forms do the same steps on 2 or 4 words at once.  */
+
+static inline bitv_word
+bitv_run_reduce (bitv_word vec, size_t units)
+{
+  size_t covered = 1;
+
+  while (covered < units)
+    {
+      size_t shift = units - covered;
+
+      if (shift > covered)
+	shift = covered;
+      vec &= vec << shift;
+      covered += shift;
+    }
+  return vec;
+}
+
+static long
+bitv_find_run_scalar (const bitv_word * bvec, long start, long end,
+		      size_t units)
+{
+  for (long i = start; i < end; i++)
+    {
+      if (bitv_run_reduce (bvec[i], units))
+	return i;
+    }
+  return -1;
+}
+
+#if defined(__x86_64__)
+static long
+bitv_find_run_sse2 (const bitv_word * bvec, long start, long end,
+		    size_t units)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  long i = start;
+
+  for (; (i + 2) <= end; i += 2)
+    {
+      __m128i vec = _mm_loadu_si128 ((const __m128i *) &bvec[i]);
+      size_t covered = 1;
+
+      while (covered < units)
+	{
+	  size_t shift = units - covered;
+
+	  if (shift > covered)
+	    shift = covered;
+	  vec = _mm_and_si128 (vec,
+			       _mm_sll_epi64 (vec,
+					      _mm_cvtsi32_si128 (shift)));
+	  covered += shift;
+	}
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (vec, zero)) != 0xffff)
+	return bitv_find_run_scalar (bvec, i, i + 2, units);
+    }
+  return bitv_find_run_scalar (bvec, i, end, units);
+}
+
+__attribute__ ((target ("avx2")))
+static long
+bitv_find_run_avx2 (const bitv_word * bvec, long start, long end,
+		    size_t units)
+{
+  long i = start;
+
+  for (; (i + 4) <= end; i += 4)
+    {
+      __m256i vec = _mm256_loadu_si256 ((const __m256i *) &bvec[i]);
+      size_t covered = 1;
+
+      while (covered < units)
+	{
+	  size_t shift = units - covered;
+
+	  if (shift > covered)
+	    shift = covered;
+	  vec = _mm256_and_si256 (vec,
+				  _mm256_sll_epi64 (vec,
+						    _mm_cvtsi32_si128
+						    (shift)));
+	  covered += shift;
+	}
+      if (!_mm256_testz_si256 (vec, vec))
+	return bitv_find_run_scalar (bvec, i, i + 4, units);
+    }
+  return bitv_find_run_sse2 (bvec, i, end, units);
+}
+
+/* The library is built for the x86_64 baseline, so AVX2 is chosen at
+   run time.  */
+static int bitv_have_avx2 = -1;
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static long
+bitv_find_run_neon (const bitv_word * bvec, long start, long end,
+		    size_t units)
+{
+  long i = start;
+
+  for (; (i + 2) <= end; i += 2)
+    {
+      uint64x2_t vec = vld1q_u64 ((const uint64_t *) &bvec[i]);
+      size_t covered = 1;
+
+      while (covered < units)
+	{
+	  size_t shift = units - covered;
+
+	  if (shift > covered)
+	    shift = covered;
+	  vec = vandq_u64 (vec, vshlq_u64 (vec, vdupq_n_s64 (shift)));
+	  covered += shift;
+	}
+      if (vmaxvq_u32 (vreinterpretq_u32_u64 (vec)))
+	return bitv_find_run_scalar (bvec, i, i + 2, units);
+    }
+  return bitv_find_run_scalar (bvec, i, end, units);
+}
+#elif defined(__powerpc64__) && defined(__VSX__) && defined(_ARCH_PWR8)
+static long
+bitv_find_run_vsx (const bitv_word * bvec, long start, long end,
+		   size_t units)
+{
+  const vector unsigned long long zero = { 0, 0 };
+  long i = start;
+
+  for (; (i + 2) <= end; i += 2)
+    {
+      vector unsigned long long vec =
+	vec_xl (0, (const unsigned long long *) &bvec[i]);
+      size_t covered = 1;
+
+      while (covered < units)
+	{
+	  size_t shift = units - covered;
+
+	  if (shift > covered)
+	    shift = covered;
+	  vec = vec_and (vec, vec_sl (vec, vec_splats ((unsigned long long)
+						       shift)));
+	  covered += shift;
+	}
+      if (vec_any_ne (vec, zero))
+	return bitv_find_run_scalar (bvec, i, i + 2, units);
+    }
+  return bitv_find_run_scalar (bvec, i, end, units);
+}
+#endif
+
+long
+bitv_find_run (const bitv_word * bvec, long start, long end, size_t units)
+{
+/* Assumes:
+	units is greater than 0 and no more than bits_per_long
+   returns:
+	the index of the first word in bvec[start .. end-1] with a run of
+	at least units free units, or -1 if there is none.
+*/
+  /* Callers usually start at a word they expect to have room, check
+     it before paying for the vector setup.  */
+  if (start >= end)
+    return -1;
+  if (bitv_run_reduce (bvec[start], units))
+    return start;
+  start++;
+
+#if defined(__x86_64__)
+  if (__builtin_expect (bitv_have_avx2 < 0, 0))
+    bitv_have_avx2 = __builtin_cpu_supports ("avx2");
+  if (bitv_have_avx2)
+    return bitv_find_run_avx2 (bvec, start, end, units);
+  else
+    return bitv_find_run_sse2 (bvec, start, end, units);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  return bitv_find_run_neon (bvec, start, end, units);
+#elif defined(__powerpc64__) && defined(__VSX__) && defined(_ARCH_PWR8)
+  return bitv_find_run_vsx (bvec, start, end, units);
+#else
+  return bitv_find_run_scalar (bvec, start, end, units);
+#endif
+}
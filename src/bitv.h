@@ -163,4 +163,19 @@ bitv_free_marked (bitv_cb_t *cb, bitv_word *bvec, bitv_word *endvec,
 extern __C__ size_t
 bitv_free_space (const bitv_cb_t *cb, const bitv_word *bvec);
 
+/* 
+   Find the first bit vector word, from bvec[start] up to but not
+   including bvec[end], with a run of at least units free units.
+   This only locates candidates for bitv_alloc_marked and friends, it
+   does not allocate. Uses SSE2/AVX2, NEON or VSX to test several
+   words at once where available.
+
+   Assumes:
+	units is greater than 0 and no more than bits_per_long
+   returns:
+	the index of the candidate word or -1 if there is none
+*/
+extern __C__ long
+bitv_find_run (const bitv_word *bvec, long start, long end, size_t units);
+
 #endif /* _BITV_H */
@@ -197,3 +197,230 @@ FreeNode* freeNode_allocSpace(FreeNode *freeNode, FreeNode **head, node_size_t s
 
    return (temp);
 }
+
+// size indexed variant, see freenode.h
+#define FNH_BITS (sizeof(unsigned long)*8)
+#define FNH_PREV(n) (((FreeNode **)(n))[nodeAlign/sizeof(FreeNode *)])
+#define FNH_FOOTER(n, s) (*(node_size_t *)((char *)(n)+(s)-sizeof(node_size_t)))
+
+static inline unsigned int
+freeNodeHeap_bin (node_size_t granules)
+{
+   unsigned int bin;
+
+   if (granules < freeNode_exactBins)
+      return (unsigned int)granules;
+   bin = freeNode_exactBins + (sizeof(long)*8 - 1 - __builtin_clzl(granules))
+         - __builtin_ctz(freeNode_exactBins);
+   return (bin < freeNode_bins) ? bin : (freeNode_bins - 1);
+}
+
+static inline unsigned long
+freeNodeHeap_granule (const FreeNodeHeap *heap, const void *addr)
+{
+   return (unsigned long)((const char *)addr - heap->heapBase) / nodeAlign;
+}
+
+static inline int
+freeNodeHeap_testBit (const FreeNodeHeap *heap, unsigned long g)
+{
+   return (heap->freeBits[g / FNH_BITS] >> (g % FNH_BITS)) & 1;
+}
+
+static inline void
+freeNodeHeap_setBit (FreeNodeHeap *heap, unsigned long g)
+{
+   heap->freeBits[g / FNH_BITS] |= 1UL << (g % FNH_BITS);
+}
+
+static inline void
+freeNodeHeap_clearBit (FreeNodeHeap *heap, unsigned long g)
+{
+   heap->freeBits[g / FNH_BITS] &= ~(1UL << (g % FNH_BITS));
+}
+
+static void
+freeNodeHeap_insertNode (FreeNodeHeap *heap, FreeNode *node, node_size_t size)
+{
+   unsigned long g = freeNodeHeap_granule (heap, node);
+   unsigned int bin;
+
+   node->nodeSize = size;
+   FNH_FOOTER(node, size) = size;
+   freeNodeHeap_setBit (heap, g);
+   freeNodeHeap_setBit (heap, g + size / nodeAlign - 1);
+   heap->fragments++;
+   if (size >= 2*nodeAlign) {
+      bin = freeNodeHeap_bin (size / nodeAlign);
+      node->nextNode = heap->bins[bin];
+      FNH_PREV(node) = NULL;
+      if (node->nextNode)
+         FNH_PREV(node->nextNode) = node;
+      heap->bins[bin] = node;
+      heap->binMap |= 1U << bin;
+   } else {
+      node->nextNode = NULL;
+   }
+}
+
+static void
+freeNodeHeap_removeNode (FreeNodeHeap *heap, FreeNode *node)
+{
+   unsigned long g = freeNodeHeap_granule (heap, node);
+   node_size_t size = node->nodeSize;
+   unsigned int bin;
+
+   freeNodeHeap_clearBit (heap, g);
+   freeNodeHeap_clearBit (heap, g + size / nodeAlign - 1);
+   heap->fragments--;
+   if (size >= 2*nodeAlign) {
+      bin = freeNodeHeap_bin (size / nodeAlign);
+      if (FNH_PREV(node))
+         FNH_PREV(node)->nextNode = node->nextNode;
+      else
+         heap->bins[bin] = node->nextNode;
+      if (node->nextNode)
+         FNH_PREV(node->nextNode) = FNH_PREV(node);
+      if (heap->bins[bin] == NULL)
+         heap->binMap &= ~(1U << bin);
+   }
+}
+
+void freeNodeHeap_init (FreeNodeHeap *heap, node_size_t size)
+{
+   unsigned long granules = size / nodeAlign;
+   unsigned long words = (granules + FNH_BITS - 1) / FNH_BITS;
+   unsigned long i;
+   char *base;
+
+   base = (char *)&heap->freeBits[words];
+   base = (char *)(((unsigned long)base + nodeRound) & ~(unsigned long)nodeRound);
+
+   heap->heapBase = base;
+   heap->heapSize = (size - (base - (char *)heap)) & ~(node_size_t)nodeRound;
+   heap->freeSpace = 0;
+   heap->fragments = 0;
+   heap->binMap = 0;
+   heap->reserved = 0;
+   for (i = 0; i < freeNode_bins; i++)
+      heap->bins[i] = NULL;
+   for (i = 0; i < words; i++)
+      heap->freeBits[i] = 0;
+
+   if (heap->heapSize) {
+      freeNodeHeap_insertNode (heap, (FreeNode *)base, heap->heapSize);
+      heap->freeSpace = heap->heapSize;
+   }
+}
+
+void *freeNodeHeap_allocSpace (FreeNodeHeap *heap, node_size_t size)
+{
+   FreeNode *node = NULL;
+   node_size_t nSize;
+   unsigned int bin, mask;
+
+   nSize = (node_size_t)((size+nodeRound)/nodeAlign)*nodeAlign;
+   if (nSize == 0)
+      nSize = nodeAlign;
+
+   bin = freeNodeHeap_bin (nSize / nodeAlign);
+   // an exact bin head always fits, otherwise try the head of the
+   // bin before taking the smallest larger bin.
+   node = heap->bins[bin];
+   if ((node == NULL) || (node->nodeSize < nSize)) {
+      mask = (bin + 1 < freeNode_bins) ? heap->binMap & (~0U << (bin + 1)) : 0;
+      if (mask) {
+         node = heap->bins[__builtin_ctz(mask)];
+      } else {
+         // last resort, first fit within the bin
+         while (node && (node->nodeSize < nSize))
+            node = node->nextNode;
+      }
+   }
+   if (node == NULL)
+      return NULL;
+
+   freeNodeHeap_removeNode (heap, node);
+   if (node->nodeSize > nSize)
+      freeNodeHeap_insertNode (heap, (FreeNode *)((char *)node + nSize),
+                               node->nodeSize - nSize);
+   heap->freeSpace -= nSize;
+
+   return node;
+}
+
+int freeNodeHeap_deallocSpace (FreeNodeHeap *heap, void *freeNode, node_size_t size)
+{
+   char *start = (char *)freeNode;
+   char *end;
+   node_size_t nSize, total;
+   unsigned long g;
+   FreeNode *right;
+
+   nSize = (node_size_t)((size + nodeRound ) / nodeAlign ) * nodeAlign ;
+   if (nSize == 0)
+      nSize = nodeAlign;
+   end = start + nSize;
+
+   if ((start < heap->heapBase) || (end > heap->heapBase + heap->heapSize)
+       || (((unsigned long)(start - heap->heapBase)) & nodeRound))
+      return -1;
+
+   // a block that is already free still has a boundary bit set, unless
+   // it was merged with free nodes on both sides.
+   g = freeNodeHeap_granule (heap, start);
+   if (freeNodeHeap_testBit (heap, g)
+       || freeNodeHeap_testBit (heap, g + nSize / nodeAlign - 1))
+      return -1;
+
+   total = nSize;
+   if ((g > 0) && freeNodeHeap_testBit (heap, g - 1)) {
+      // merge with the free node before
+      node_size_t before = *(node_size_t *)(start - sizeof(node_size_t));
+      start -= before;
+      freeNodeHeap_removeNode (heap, (FreeNode *)start);
+      total += before;
+   }
+   if ((end < heap->heapBase + heap->heapSize)
+       && freeNodeHeap_testBit (heap, freeNodeHeap_granule (heap, end))) {
+      // merge with the free node after
+      right = (FreeNode *)end;
+      total += right->nodeSize;
+      freeNodeHeap_removeNode (heap, right);
+   }
+   freeNodeHeap_insertNode (heap, (FreeNode *)start, total);
+   heap->freeSpace += nSize;
+
+   return 0;
+}
+
+node_size_t freeNodeHeap_freeSpaceTotal (const FreeNodeHeap *heap)
+{
+   return heap->freeSpace;
+}
+
+node_size_t freeNodeHeap_freeFragmentsTotal (const FreeNodeHeap *heap)
+{
+   return heap->fragments;
+}
+
+node_size_t freeNodeHeap_maxFragment (const FreeNodeHeap *heap)
+{
+   node_size_t freeSize = 0;
+   unsigned int bin;
+   FreeNode *head;
+
+   if (heap->binMap == 0)
+      return heap->fragments ? nodeAlign : 0;
+
+   bin = 31 - __builtin_clz(heap->binMap);
+   head = heap->bins[bin];
+   if (bin < freeNode_exactBins)
+      return head->nodeSize;
+   while (head) {
+      if (freeSize < head->nodeSize)
+         freeSize = head->nodeSize;
+      head = head->nextNode;
+   }
+   return freeSize;
+}
@@ -26,6 +26,32 @@ struct freeNode
 };
 typedef struct freeNode FreeNode;
 
+/* Size indexed variant of the free list. Free nodes of 2 or more
+   granules (nodeAlign bytes) are kept on doubly linked lists binned
+   by size, exact below freeNode_exactBins granules and by power of two
+   above. A bit set in freeBits marks the first and last granule of
+   each free node and the node size is repeated in its last word, so
+   deallocation finds and merges free neighbours without a list walk.
+   Single granule nodes are not binned, they are only reclaimed when a
+   neighbour is freed. The free space statistics are kept as counters.
+   freeNodeHeap_deallocSpace returns -1 for a block outside the heap or
+   one that is already free.  */
+#define freeNode_bins		32
+#define freeNode_exactBins	8
+
+struct freeNodeHeap
+{
+  char            *heapBase;
+  node_size_t     heapSize;
+  node_size_t     freeSpace;
+  node_size_t     fragments;
+  unsigned int    binMap;
+  unsigned int    reserved;
+  FreeNode        *bins[freeNode_bins];
+  unsigned long   freeBits[1];
+};
+typedef struct freeNodeHeap FreeNodeHeap;
+
 
 #ifdef __cplusplus
 #define __C__ "C"
@@ -51,4 +77,22 @@ freeNode_freeFragmentsTotal (const FreeNode *freeNode);
 extern __C__ node_size_t
 freeNode_maxFragment (const FreeNode *freeNode);
 
+extern __C__ void
+freeNodeHeap_init (FreeNodeHeap *heap, node_size_t size);
+
+extern __C__ void*
+freeNodeHeap_allocSpace (FreeNodeHeap *heap, node_size_t size);
+
+extern __C__ int
+freeNodeHeap_deallocSpace (FreeNodeHeap *heap, void *freeNode, node_size_t size);
+
+extern __C__ node_size_t
+freeNodeHeap_freeSpaceTotal (const FreeNodeHeap *heap);
+
+extern __C__ node_size_t
+freeNodeHeap_freeFragmentsTotal (const FreeNodeHeap *heap);
+
+extern __C__ node_size_t
+freeNodeHeap_maxFragment (const FreeNodeHeap *heap);
+
 #endif
@@ -10,6 +10,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "sasallocpriv.h"
 #include "freenode.h"
 #ifdef __SAS__
@@ -22,6 +23,7 @@
 #ifdef __SASSIM__
 #include "sassim.h"
 #endif
+#include "sasslabheap.h"
 
 #ifndef __SAS__
 void  *SASAnchor;
@@ -129,6 +131,57 @@ void *getSASFinder()
 #endif
 }
 
+/* Alignments (log2) block headers are probed at, innermost first.  */
+static const unsigned char sasHeaderLevels[] =
+  { 9, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28 };
+
+/* Record a new block header in its region's block map.  */
+static void
+SASBlockMapSet (SASBlockHeader *header, long blockSize)
+{
+#ifdef __SASSIM__
+    uintptr_t		addr = (uintptr_t)header;
+    SASRegionState_t	*region = getSASRegionStateByAddr (addr);
+    unsigned char	*map;
+    unsigned long	lo, hi, m;
+    unsigned int	i;
+
+    if ((region == NULL) || (region->blockMap == NULL)
+	|| (addr >= region->regionHigh) || (blockSize <= 0))
+	return;
+    map = &region->blockMap[(addr - region->regionLow) >> SAS_BLOCKMAP_SHIFT];
+
+    if ((addr & (default_page - 1)) || (blockSize < default_page))
+    {
+	// Small blocks are found by probing within the granule(s).
+	hi = ((addr & (default_page - 1)) + blockSize - 1) >> SAS_BLOCKMAP_SHIFT;
+	for (lo = 0; lo <= hi; lo++)
+	    __sync_fetch_and_or (&map[lo], SAS_BLOCKMAP_SUBPAGE);
+	return;
+    }
+
+    // Granules at offset [2^prev, 2^m) are found at alignment 2^m.
+    lo = 0;
+    for (i = 0; i < sizeof (sasHeaderLevels); i++)
+    {
+	m = sasHeaderLevels[i];
+	if (m < SAS_BLOCKMAP_SHIFT)
+	    continue;
+	if (addr & ((1UL << m) - 1))
+	    break;
+	hi = 1UL << m;
+	if (hi > (unsigned long)blockSize)
+	    hi = blockSize;
+	if (hi > lo)
+	    memset (&map[lo >> SAS_BLOCKMAP_SHIFT], m,
+		    (hi - lo) >> SAS_BLOCKMAP_SHIFT);
+	lo = hi;
+	if (lo >= (unsigned long)blockSize)
+	    break;
+    }
+#endif
+}
+
 void initSOMSASBlock(   SASBlockHeader *header, sas_type_t sasType,
 			long blockSize, void *blockHeap)
 {
@@ -155,6 +208,8 @@ void initSOMSASBlock(   SASBlockHeader *header, sas_type_t sasType,
 
     header->baseBlock  = header;
     header->nextBlock   = NULL;
+
+    SASBlockMapSet (header, blockSize);
 }
 
 #ifdef __SAS__
@@ -450,101 +505,61 @@ SASBlockHeader *SASFindHeader (const void *nearObj)
 #endif
    uintptr_t		temp	= (uintptr_t)nearObj;
     SASBlockHeader	*block = NULL;
+    unsigned char	*entry = NULL;
+    unsigned char	e = 0;
+    unsigned int	i;
    
 #ifdef __SAS__
     if ((temp >= 0x40000000) && (temp < 0xC0000000))
     {
 #else
 #ifdef __SASSIM__
-    if ( ((temp >= getfastMemLow()) && (temp < getfastMemHigh())) || 
-         ((temp >= __SAS_TEMP_ADDRESS) && (temp < (__SAS_TEMP_FREE)))) {
-#endif
-#endif
-	temp = temp & block__mask512;
-	block = (SASBlockHeader *)temp;
+    SASRegionState_t	*region = NULL;
 
-#ifdef __SASDebugPrint__
-   sas_printf("SASFindHeader mask=%lx -> %p \n",block__mask512, block);
-#endif
-	if ( !SOMSASCheckBlockSig(block) )
-	{
-	    temp = temp & block__mask1k;
-	    block = (SASBlockHeader *)temp;
+    if ((temp >= getfastMemLow()) && (temp < getfastMemHigh()))
+	region = getSASRegionState ();
+    else if (!((temp >= __SAS_TEMP_ADDRESS) && (temp < (__SAS_TEMP_FREE))))
+	region = getSASRegionStateByAddr (temp);
 
-	    if ( !SOMSASCheckBlockSig(block) )
+    if ( region || 
+         ((temp >= __SAS_TEMP_ADDRESS) && (temp < (__SAS_TEMP_FREE))) ) {
+	if (region && region->blockMap && (temp < region->regionHigh))
+	{
+	    entry = &region->blockMap[(temp - region->regionLow)
+				      >> SAS_BLOCKMAP_SHIFT];
+	    e = *entry;
+	    if ((e & SAS_BLOCKMAP_LEVEL) && !(e & SAS_BLOCKMAP_SUBPAGE))
 	    {
-		temp = temp & block__mask4k;
-		block = (SASBlockHeader *)temp;
-
-		if ( !SOMSASCheckBlockSig(block) )
-		{
-#ifdef block__mask16k
-		  temp = temp & block__mask16k;
-		  block = (SASBlockHeader *)temp;
-
-		  if ( !SOMSASCheckBlockSig(block) )
-		  {
-#endif
-		    temp = temp & block__mask64k;
-		    block = (SASBlockHeader *)temp;
-
-		    if ( !SOMSASCheckBlockSig(block) )
-		    {
-#ifdef block__mask256k
-		      temp = temp & block__mask256;
-		      block = (SASBlockHeader *)temp;
-
-		      if ( !SOMSASCheckBlockSig(block) )
-		      {
-#endif
-			temp = temp & block__mask1m;
-			block = (SASBlockHeader *)temp;
-
-			if ( !SOMSASCheckBlockSig(block) )
-			{
-			    temp = temp & block__mask4m;
-			    block = (SASBlockHeader *)temp;
-
-			    if ( !SOMSASCheckBlockSig(block) )
-			    {
-				temp = temp & block__mask16m;
-				block = (SASBlockHeader *)temp;
-
-				if ( !SOMSASCheckBlockSig(block) )
-				{
-#ifdef block__mask64m
-				  temp = temp & block__mask64m;
-				  block = (SASBlockHeader *)temp;
-
-				  if ( !SOMSASCheckBlockSig(block) )
-				  {
-#ifdef block__mask256m
-				    temp = temp & block__mask256m;
-				    block = (SASBlockHeader *)temp;
-
-				    if ( !SOMSASCheckBlockSig(block) )
-				    {
-				      block = NULL;
-				    }
-#else
-				    block = NULL;
-#endif
-				  }
-#else
-				    block = NULL;
+		block = (SASBlockHeader *)
+		    (temp & ~((1UL << (e & SAS_BLOCKMAP_LEVEL)) - 1));
+		if ( SOMSASCheckBlockSig(block) )
+		    return block;
+	    }
+	}
 #endif
-				}
-			    }
-			}
-#ifdef block__mask256k
-		      }
 #endif
-		    }
-#ifdef block__mask16k
-		  }
+	block = NULL;
+	for (i = 0; i < sizeof (sasHeaderLevels); i++)
+	{
+	    block = (SASBlockHeader *)(temp & ~((1UL << sasHeaderLevels[i]) - 1));
+#ifdef __SASDebugPrint__
+	    sas_printf("SASFindHeader level=%d -> %p \n", sasHeaderLevels[i], block);
 #endif
-		}
-	   }
+	    if ( SOMSASCheckBlockSig(block) )
+		break;
+	    block = NULL;
+	}
+	// Remember where the header was found for this granule.
+	if (block && entry)
+	{
+	    unsigned char n;
+
+	    if (sasHeaderLevels[i] < SAS_BLOCKMAP_SHIFT)
+		n = e | SAS_BLOCKMAP_SUBPAGE;
+	    else
+		n = sasHeaderLevels[i] | (e & SAS_BLOCKMAP_SUBPAGE);
+	    if (n != e)
+		__sync_bool_compare_and_swap (entry, e, n);
 	}
 #ifdef __SASDebugPrint__
 	    sas_printf("SASFindHeader low=%lx, high=%lx, tmp_low=%lx, tmp_hign=%lx\n",
@@ -571,8 +586,12 @@ void* SASSOMHeapAlloc (SASBlockHeader *block, long allocSize)
 
     if (block)
     {
-	temp = freeNode_allocSpace(block->blockFreeSpace, &block->blockFreeSpace,
-						allocSize);
+	if (SOMSASGetBlockFreeNodeHeap (block))
+	    temp = freeNodeHeap_allocSpace(SOMSASGetBlockFreeNodeHeap (block),
+					   allocSize);
+	else
+	    temp = freeNode_allocSpace(block->blockFreeSpace,
+				       &block->blockFreeSpace, allocSize);
     };
 
 #ifdef __SASDebugPrint__
@@ -596,8 +615,14 @@ void* SASNearAlloc (void *nearObj, long allocSize)
 #endif
     if (block)
     {
-	temp = freeNode_allocSpace(block->blockFreeSpace, &block->blockFreeSpace,
-						allocSize);
+	if (SOMSASCheckBlockSigAndType (block, SAS_SLABHEAP_TYPE))
+	    temp = SASSlabHeapAllocNoLock (block, allocSize);
+	else if (SOMSASGetBlockFreeNodeHeap (block))
+	    temp = freeNodeHeap_allocSpace(SOMSASGetBlockFreeNodeHeap (block),
+					   allocSize);
+	else
+	    temp = freeNode_allocSpace(block->blockFreeSpace,
+				       &block->blockFreeSpace, allocSize);
     }
     else
     {
@@ -624,8 +649,12 @@ SASSOMHeapDealloc (SASBlockHeader *block, void *memAddr, long allocSize)
 #endif
     if (block)
     {
-	freeNode_deallocSpace(((freeNode *)memAddr), &block->blockFreeSpace,
-					allocSize);
+	if (SOMSASGetBlockFreeNodeHeap (block))
+	    freeNodeHeap_deallocSpace(SOMSASGetBlockFreeNodeHeap (block),
+				      memAddr, allocSize);
+	else
+	    freeNode_deallocSpace(((freeNode *)memAddr),
+				  &block->blockFreeSpace, allocSize);
     }
 }
 
@@ -643,8 +672,14 @@ void  SASNearDealloc (void *memAddr, long allocSize)
 #endif
     if (block)
     {
-	freeNode_deallocSpace(((freeNode *)memAddr), &block->blockFreeSpace,
-					allocSize);
+	if (SOMSASCheckBlockSigAndType (block, SAS_SLABHEAP_TYPE))
+	    SASSlabHeapFreeNoLock (block, memAddr, allocSize);
+	else if (SOMSASGetBlockFreeNodeHeap (block))
+	    freeNodeHeap_deallocSpace(SOMSASGetBlockFreeNodeHeap (block),
+				      memAddr, allocSize);
+	else
+	    freeNode_deallocSpace(((freeNode *)memAddr),
+				  &block->blockFreeSpace, allocSize);
     }
     else {
 #ifdef __SAS__
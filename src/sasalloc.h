@@ -173,6 +173,17 @@ SOMSASGetBlockType (const SASBlockHeader* header)
     return (header->blockType);
 }
 
+/* Return the size indexed free space of a version 1 simple heap
+   block, or NULL if the block uses the blockFreeSpace list.  */
+static inline FreeNodeHeap *
+SOMSASGetBlockFreeNodeHeap (const SASBlockHeader* header)
+{
+    if (((header->blockType & SAS_TYPE_MASK) == SAS_SIMPLEHEAP_TYPE)
+	&& (header->blockType & SAS_SEGREGATED_VERSION))
+	return (FreeNodeHeap *)((char *)header + heap_offset);
+    return NULL;
+}
+
 extern __C__ SASBlockHeader *
 SASFindHeader (const void *nearObj);
 
@@ -13,20 +13,167 @@
 #define _SASAllocPriv_H
 
 #include "sasalloc.h"
+#include "sphtimer.h"
 
-extern unsigned long memLow __attribute__ ((visibility ("hidden")));
-extern unsigned long memHigh __attribute__ ((visibility ("hidden")));
+/* Maximum number of SAS regions a process can join at once.  */
+#define SAS_MAX_REGIONS	8
+
+/* Process local state of a joined region. The region is free if
+   regionLow is 0.  */
+typedef struct SASRegionState
+{
+  unsigned long regionLow;
+  unsigned long regionHigh;
+  unsigned long regionBase;
+  unsigned long regionSize;
+  unsigned long segmentSize;
+  int *memIDs;
+  char *storePath;
+  /* Directory of the segment files, storePath or for a volatile
+     region its tmpfs directory.  */
+  char *segPath;
+  int hugePages;
+  unsigned long joinOptions;
+  int lockMemID;
+  /* Changed when the region is released, see SASBlockCachePut.  */
+  unsigned long cacheGen;
+  /* Shared block map of the region (SAS_BLOCKMAP_NAME), or NULL.  */
+  unsigned char *blockMap;
+  /* The segments are on tmpfs or hugetlbfs, whose pages follow the
+     mbind policy of the mapping. Page cache pages of a disk backed
+     store follow the policy of the thread faulting them in.  */
+  int numaShmem;
+  /* Join marker file of the process in the store's checkpoint
+     directory, held locked while joined, or NULL.  */
+  char *joinMark;
+  int joinMarkFD;
+} SASRegionState_t;
+
+/* The block map has an entry for each 4KB granule of the region,
+   maintained by initSOMSASBlock, so SASFindHeader can go directly to
+   the header of the block containing an address. The low bits of an
+   entry are the log2 alignment of the innermost block header (of 4KB
+   or larger) covering the granule, 0 if not known, and the SUBPAGE
+   flag marks granules also holding smaller blocks, which are found by
+   probing. Entries are hints, a header is always checked for its
+   signature before use.  */
+#define SAS_BLOCKMAP_NAME	"SASBLKMAP"
+#define SAS_BLOCKMAP_SHIFT	12
+#define SAS_BLOCKMAP_LEVEL	0x3f
+#define SAS_BLOCKMAP_SUBPAGE	0x80
+
+extern SASRegionState_t sasRegionTable[SAS_MAX_REGIONS]
+  __attribute__ ((visibility ("hidden")));
+/* The region selected by this thread, NULL selects region 0.  */
+extern __thread SASRegionState_t *sasThreadRegion
+  __attribute__ ((visibility ("hidden"), tls_model ("initial-exec")));
+
+static inline SASRegionState_t *
+getSASRegionState ()
+{
+  SASRegionState_t *region = sasThreadRegion;
+  return region ? region : &sasRegionTable[0];
+}
+
+/* Return true if addr is in the joined region, including its lock
+   table range.  */
+static inline int
+SASRegionContains (SASRegionState_t *region, unsigned long addr)
+{
+  return (region->regionLow
+	  && (((addr >= region->regionLow) && (addr < region->regionHigh))
+	      || ((addr >= (region->regionHigh + region->segmentSize))
+		  && (addr < (region->regionHigh + (4 * region->segmentSize))))));
+}
+
+/* Return the joined region containing addr, including its lock
+   table range, or NULL. The thread's selected region is tried first,
+   as it holds most addresses.  */
+static inline SASRegionState_t *
+getSASRegionStateByAddr (unsigned long addr)
+{
+  SASRegionState_t *region = getSASRegionState ();
+  int i;
+
+  if (SASRegionContains (region, addr))
+    return region;
+  for (i = 0; i < SAS_MAX_REGIONS; i++)
+    {
+      region = &sasRegionTable[i];
+      if (SASRegionContains (region, addr))
+	return region;
+    }
+  return NULL;
+}
+
+/* Within the library read the selected region's geometry directly,
+   rather than through the exported accessors of sasconf.h.  */
+#undef __SAS_BASE_ADDRESS
+#undef RegionSize
+#undef SegmentSize
+#define __SAS_BASE_ADDRESS	(getSASRegionState ()->regionBase)
+#define RegionSize		(getSASRegionState ()->regionSize)
+#define SegmentSize		(getSASRegionState ()->segmentSize)
+
+/* Allocation latency hooks of the allocator entry points, see
+   SASLatencyEnable. SASLatencyStart returns 0 if the histograms of
+   the region are disabled and SASLatencyRecord ignores a 0 start.  */
+extern sphtimer_t SASLatencyStart (void)
+  __attribute__ ((visibility ("hidden")));
+extern void SASLatencyRecord (int point, sphtimer_t start)
+  __attribute__ ((visibility ("hidden")));
+
+/* Per thread heap magazines, see sasHeapMagazineDepth. Objects are
+   held per heap and size, and SASHeapMagazineDrain_t is called to free
+   n objects to the heap together when a magazine is full or flushed.
+   SASHeapMagazinePut returns 0 if the object is not held, or -1 if it
+   is already held (a double free). Before a heap is destroyed, or a
+   sub heap freed, SASHeapMagazineDiscard drops the calling thread's
+   magazines of heaps within its block.
+   SASHeapMagazineReturn frees the thread's magazines of heap, so the
+   free space of the heap can be reported.
+
+   Magazines of other threads are invalidated by the heap's stamp, a
+   word of its header given to SASHeapMagazinePut. A stamp is set to a
+   value unique within the region when a magazine is first filled for
+   the heap, and cleared when the heap is initialized, destroyed or
+   (for a sub heap) freed. A magazine records the stamp of its heap,
+   and of the compound heap owning a sub heap (rootStamp), and is only
+   drained or used while both are unchanged.  */
+typedef void (*SASHeapMagazineDrain_t) (void *heap, void **objs, int n,
+					block_size_t size);
+
+/* The stamp of a SAS_RUNTIME_SIMPLEHEAP is the word after its block
+   header, which is below heap_offset and otherwise unused.  */
+static inline unsigned long *
+SASSimpleHeapMagazineStamp (void *heap)
+{
+  return (unsigned long *) ((SASBlockHeader *) heap + 1);
+}
+
+extern unsigned long *SASCompoundHeapMagazineStamp (void *heap)
+  __attribute__ ((visibility ("hidden")));
+extern void *SASHeapMagazineGet (void *heap, block_size_t size)
+  __attribute__ ((visibility ("hidden")));
+extern int SASHeapMagazinePut (void *heap, void *obj, block_size_t size,
+			       SASHeapMagazineDrain_t drain,
+			       unsigned long *stamp, unsigned long *rootStamp)
+  __attribute__ ((visibility ("hidden")));
+extern void SASHeapMagazineDiscard (void *block, block_size_t size)
+  __attribute__ ((visibility ("hidden")));
+extern void SASHeapMagazineReturn (void *heap)
+  __attribute__ ((visibility ("hidden")));
 
 static inline unsigned long
 getfastMemLow ()
 {
-  return memLow;
+  return getSASRegionState ()->regionLow;
 }
 
 static inline unsigned long
 getfastMemHigh ()
 {
-  return memHigh;
+  return getSASRegionState ()->regionHigh;
 }
 
 #endif /* _SASAllocPriv_H */
@@ -31,22 +31,73 @@ typedef struct
     || defined (__loongarch__) \
     || defined (__riscv)
   unsigned int compactUseList:1;
-  unsigned long reserved0:63;
+  unsigned int hugePages:1;
+  unsigned int volatileStore:1;
+  unsigned int buddyBitmap:1;
+  unsigned long reserved0:60;
 #else
-  unsigned long reserved0:63;
+  unsigned long reserved0:60;
+  unsigned int buddyBitmap:1;
+  unsigned int volatileStore:1;
+  unsigned int hugePages:1;
   unsigned int compactUseList:1;
 #endif
 #else
 #if __BYTE_ORDER == __ORDER_LITTLE_ENDIAN__
   unsigned int compactUseList:1;
-  unsigned int reserved0:31;
+  unsigned int hugePages:1;
+  unsigned int volatileStore:1;
+  unsigned int buddyBitmap:1;
+  unsigned int reserved0:28;
 #else
-  unsigned int reserved0:31;
+  unsigned int reserved0:28;
+  unsigned int buddyBitmap:1;
+  unsigned int volatileStore:1;
+  unsigned int hugePages:1;
   unsigned int compactUseList:1;
 #endif
 #endif
 } regionFlags;
 
+/* Number of block orders (4KB << order) counted by SASAnchorStats_t.  */
+#define SAS_STATS_ORDERS	36
+/* Set in SASAnchorStats_t.valid when the counters match the trees.  */
+#define SAS_STATS_VALID		0x5341535354415431L
+
+/* Region statistics maintained in the anchor as the region is
+   allocated from, so they can be read without the region lock or a
+   walk of the trees. The per order counts of the free and uncommitted
+   trees and of used bytes are updated with the region lock held, the
+   rest with atomic adds.  */
+typedef struct {
+	long		valid;
+	long		freeBlocks[SAS_STATS_ORDERS];
+	long		uncommittedBlocks[SAS_STATS_ORDERS];
+	long		usedBytes[SAS_STATS_ORDERS];
+	long		segmentsCommitted;
+	long		allocCount;
+	long		allocFailures;
+	long		deallocCount;
+	long		lockAcquires;
+	long		lockWaits;
+	long		lockWaitTicks;
+} SASAnchorStats_t;
+
+#define SAS_STATS_LAT_POINTS	5
+#define SAS_STATS_LAT_BUCKETS	32
+
+/* Allocation latency histograms of the allocator entry points,
+   counting the calls by the log2 of their sphgettimer ticks. Only
+   collected while enabled is set. Each thread counts its own calls
+   and adds them in batches with atomic adds.  */
+typedef struct {
+	long		enabled;
+	long		count[SAS_STATS_LAT_POINTS];
+	long		totalTicks[SAS_STATS_LAT_POINTS];
+	long		maxTicks[SAS_STATS_LAT_POINTS];
+	long		hist[SAS_STATS_LAT_POINTS][SAS_STATS_LAT_BUCKETS];
+} SASAnchorLatency_t;
+
 typedef struct {
 	unsigned long	regionSize;
 	void		*finder;
@@ -62,6 +113,18 @@ typedef struct {
 	msemaphore	SASSem;
 #  endif
 	regionFlags	rFlags;
+	unsigned long	segmentSize;
+	unsigned long	regionBase;
+	/* List of segments managed by the lock-free buddy bitmaps.  */
+	void		*buddyArenas;
+	/* Bit per segment of the region, set for the arenas.  */
+	unsigned long	*buddyIndex;
+	/* Arena the last buddy allocation was made from.  */
+	void		*buddyCurrent;
+	/* Count of the heap magazine stamps given out.  */
+	long		heapStamps;
+	SASAnchorStats_t stats;
+	SASAnchorLatency_t latency;
 # endif
 } SASAnchor_t;
 
@@ -10,12 +10,12 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "sasalloc.h"
+#include "sasallocpriv.h"
 #include "freenode.h"
-#ifdef __SASDebugPrint__
 #include "sasio.h"
-#endif
 #include "sasanchr.h"
 #include "sassim.h"
 #include "saslock.h"
@@ -37,14 +37,32 @@ typedef struct SASCompoundExpandList
   SASCompoundHeapHeader *heap[254];
 } SASCompoundExpandList;
 
+/* Set of the blocks of the expand list with room, below their
+   loadFactor, indexed like the list. A bit of the summary is set for
+   each nonzero word of the map, so the first block with room is found
+   by testing summaryWords words plus one, not each block. Set bits
+   are hints, checked before the block is used. The summary words are
+   followed by the map words in bits.  */
+typedef struct SASCompoundRoomMap
+{
+  block_size_t words;
+  block_size_t summaryWords;
+  unsigned long bits[1];
+} SASCompoundRoomMap;
+
+#define ROOM_BITS (sizeof (unsigned long) * 8)
+
 typedef struct SASCompoundHeapHeader
 {
   SASBlockHeader blockHeader;
   block_size_t pageSize;
   long loadFactor;
-  void *dummy2;
-  void *dummy3;
-  void *dummy4;
+  /* Room map of the expand list, in the header block.  */
+  SASCompoundRoomMap *roomMap;
+  /* Index of this block in the expand list of its header block.  */
+  block_size_t expandIndex;
+  /* Heap magazine stamp, see sasallocpriv.h.  */
+  unsigned long magazineStamp;
   SASSimpleSpace_t expandSpace;
   SASCompoundExpandList *expandList;
   freeNode *headerFreeSpace;
@@ -113,6 +131,14 @@ SASCompoundHeapContains (SASCompoundHeapHeader * headerBlock,
   return ((containedHeap > containerLow) && (containedHeap < containerHigh));
 }
 
+unsigned long *
+SASCompoundHeapMagazineStamp (void *heap)
+{
+  return &((SASCompoundHeapHeader *) heap)->magazineStamp;
+}
+
+/* Return a sub heap to its block. Clearing the sub heap also clears
+   its heap magazine stamp.  */
 static inline void
 SASCompoundHeapFreeInternal (SASCompoundHeapHeader * headerBlock,
 			     SASSimpleHeap_t free_block)
@@ -126,6 +152,319 @@ SASCompoundHeapFreeInternal (SASCompoundHeapHeader * headerBlock,
 			 simpleSize);
 }
 
+static inline block_size_t
+SASCompoundRoomMapWords (block_size_t max_count)
+{
+  return (max_count + ROOM_BITS - 1) / ROOM_BITS;
+}
+
+static inline block_size_t
+SASCompoundRoomMapSize (block_size_t max_count)
+{
+  block_size_t words = SASCompoundRoomMapWords (max_count);
+  block_size_t summaryWords = SASCompoundRoomMapWords (words);
+
+  return offsetof (SASCompoundRoomMap, bits)
+    + ((summaryWords + words) * sizeof (unsigned long));
+}
+
+static void
+SASCompoundRoomMapInit (SASCompoundRoomMap * map, block_size_t max_count)
+{
+  memset (map, 0, SASCompoundRoomMapSize (max_count));
+  map->words = SASCompoundRoomMapWords (max_count);
+  map->summaryWords = SASCompoundRoomMapWords (map->words);
+}
+
+static inline void
+SASCompoundRoomSet (SASCompoundRoomMap * map, block_size_t i, int room)
+{
+  unsigned long *summary = map->bits;
+  unsigned long *word = &map->bits[map->summaryWords + (i / ROOM_BITS)];
+  block_size_t w = i / ROOM_BITS;
+
+  if (room)
+    {
+      *word |= 1UL << (i % ROOM_BITS);
+      summary[w / ROOM_BITS] |= 1UL << (w % ROOM_BITS);
+    }
+  else
+    {
+      *word &= ~(1UL << (i % ROOM_BITS));
+      if (*word == 0)
+	summary[w / ROOM_BITS] &= ~(1UL << (w % ROOM_BITS));
+    }
+}
+
+/* Return the lowest index set in the map, or count if none.  */
+static inline block_size_t
+SASCompoundRoomFirst (SASCompoundRoomMap * map, block_size_t count)
+{
+  block_size_t s, w, i;
+
+  for (s = 0; s < map->summaryWords; s++)
+    {
+      if (map->bits[s])
+	{
+	  w = (s * ROOM_BITS) + __builtin_ctzl (map->bits[s]);
+	  i = (w * ROOM_BITS)
+	    + __builtin_ctzl (map->bits[map->summaryWords + w]);
+	  return (i < count) ? i : count;
+	}
+    }
+  return count;
+}
+
+/* Return the room map of headerBlock, with headerBlock locked. The
+   header words of a heap created before SAS_COMPOUNDHEAP_ROOM_VERSION
+   may hold garbage, so the room map and expand index are cleared on
+   first use and the map rebuilt. The magazine stamp is left, as any
+   value is a valid stamp and sub heaps may already be held under it.  */
+static inline SASCompoundRoomMap *
+SASCompoundHeapRoomMapOf (SASCompoundHeapHeader * headerBlock)
+{
+  if (!(headerBlock->blockHeader.blockType & SAS_COMPOUNDHEAP_ROOM_VERSION))
+    {
+      headerBlock->roomMap = NULL;
+      headerBlock->expandIndex = 0;
+      headerBlock->blockHeader.blockType |= SAS_COMPOUNDHEAP_ROOM_VERSION;
+    }
+  return headerBlock->roomMap;
+}
+
+/* Return the index of block in the expand list of headerBlock, or
+   the count of the list if not found.  */
+static block_size_t
+SASCompoundHeapIndexOf (SASCompoundHeapHeader * headerBlock,
+			SASCompoundHeapHeader * block)
+{
+  SASCompoundExpandList *list = headerBlock->expandList;
+  block_size_t i = block->expandIndex;
+
+  if ((i < list->count) && (list->heap[i] == block))
+    return i;
+  /* Blocks of heaps created before the index was kept.  */
+  for (i = 0; i < list->count; i++)
+    {
+      if (list->heap[i] == block)
+	{
+	  block->expandIndex = i;
+	  break;
+	}
+    }
+  return i;
+}
+
+/* Update the room map of headerBlock for block, after a page of block
+   is allocated or freed.  */
+static void
+SASCompoundHeapRoomUpdate (SASCompoundHeapHeader * headerBlock,
+			   SASCompoundHeapHeader * block)
+{
+  SASCompoundRoomMap *map;
+  block_size_t i;
+
+  if (!SASCompoundHeapIsExpanding (headerBlock))
+    return;
+  map = SASCompoundHeapRoomMapOf (headerBlock);
+  if (map == NULL)
+    return;
+  i = SASCompoundHeapIndexOf (headerBlock, block);
+  if (i < headerBlock->expandList->count)
+    SASCompoundRoomSet (map, i, (SASCompoundHeapPercentUsed (block)
+				 < block->loadFactor));
+}
+
+/* Set the room map of headerBlock for all the blocks of its list.  */
+static void
+SASCompoundHeapRoomFill (SASCompoundHeapHeader * headerBlock)
+{
+  SASCompoundExpandList *list = headerBlock->expandList;
+  SASCompoundHeapHeader *expandBlock;
+  block_size_t i;
+
+  for (i = 0; i < list->count; i++)
+    {
+      expandBlock = list->heap[i];
+      expandBlock->expandIndex = i;
+      SASCompoundRoomSet (headerBlock->roomMap, i,
+			  (SASCompoundHeapPercentUsed (expandBlock)
+			   < expandBlock->loadFactor));
+    }
+}
+
+/* Move the expand list of headerBlock to a new directory with a room
+   map after the list, sized as a heap block for the initial list and
+   twice the previous directory after, so the list grows with the heap
+   at a constant amortized cost. Returns 0 if successful.  */
+static int
+SASCompoundHeapExpandGrow (SASCompoundHeapHeader * headerBlock)
+{
+  SASCompoundExpandList *list = headerBlock->expandList;
+  SASCompoundRoomMap *oldMap = SASCompoundHeapRoomMapOf (headerBlock);
+  SASSimpleSpace_t oldSpace = headerBlock->expandSpace;
+  SASSimpleSpace_t expandBlock;
+  SASCompoundExpandList *expandNew;
+  block_size_t spaceSize, countNew, fixed;
+
+  if (oldSpace == NULL)
+    spaceSize = headerBlock->blockHeader.blockSize - default_page;
+  else
+    spaceSize = (((SASBlockHeader *) oldSpace)->blockSize * 2)
+      - default_page;
+  fixed = offsetof (SASCompoundExpandList, heap)
+    + offsetof (SASCompoundRoomMap, bits) + (2 * sizeof (unsigned long));
+  countNew = ((spaceSize - fixed) * ROOM_BITS)
+    / ((sizeof (void *) * ROOM_BITS) + 1);
+  while ((offsetof (SASCompoundExpandList, heap)
+	  + (countNew * sizeof (void *))
+	  + SASCompoundRoomMapSize (countNew)) > spaceSize)
+    countNew--;
+  if (countNew <= list->count)
+    return -1;
+
+  expandBlock = SASSimpleSpaceCreate (spaceSize);
+  if (expandBlock == NULL)
+    {
+#ifdef __SASDebugPrint__
+      sas_printf
+	("SASCompoundHeapExpandGrow(%p) extended expand list alloc failed\n",
+	 headerBlock);
+#endif
+      return -1;
+    }
+#ifdef __SASDebugPrint__
+  sas_printf ("SASCompoundHeapExpandGrow(%p) expand list @%p for %zu\n",
+	      headerBlock, expandBlock, countNew);
+#endif
+  expandNew = (SASCompoundExpandList *) SASSimpleSpaceToAddr (expandBlock);
+  expandNew->count = list->count;
+  expandNew->max_count = countNew;
+  memcpy (expandNew->heap, list->heap,
+	  list->count * sizeof (SASCompoundHeapHeader *));
+  headerBlock->roomMap = (SASCompoundRoomMap *) &expandNew->heap[countNew];
+  SASCompoundRoomMapInit (headerBlock->roomMap, countNew);
+  headerBlock->expandSpace = expandBlock;
+  headerBlock->expandList = expandNew;
+  SASCompoundHeapRoomFill (headerBlock);
+
+  if (oldSpace != NULL)
+    SASSimpleSpaceDestroy (oldSpace);
+  else if (oldMap != NULL)
+    {
+      /* Return the room map of the initial list to the header.  */
+      block_size_t mapSize = SASCompoundRoomMapSize (list->max_count);
+      freeNode_init ((freeNode *) oldMap, mapSize);
+      freeNode_deallocSpace ((freeNode *) oldMap,
+			     &headerBlock->headerFreeSpace, mapSize);
+    }
+  return 0;
+}
+
+/* Create the room map of the expand list of headerBlock, for heaps
+   created before the map was kept.  */
+static void
+SASCompoundHeapRoomInit (SASCompoundHeapHeader * headerBlock)
+{
+  SASCompoundExpandList *list = headerBlock->expandList;
+  SASCompoundRoomMap *map;
+
+  if (headerBlock->expandSpace == NULL)
+    {
+      map = (SASCompoundRoomMap *)
+	freeNode_allocSpace (headerBlock->headerFreeSpace,
+			     &headerBlock->headerFreeSpace,
+			     SASCompoundRoomMapSize (list->max_count));
+      if (map != NULL)
+	{
+	  SASCompoundRoomMapInit (map, list->max_count);
+	  headerBlock->roomMap = map;
+	  SASCompoundHeapRoomFill (headerBlock);
+	}
+    }
+  else
+    SASCompoundHeapExpandGrow (headerBlock);
+}
+
+/* Return a block of the expand list of headerBlock below its
+   loadFactor, other than lastHeader, the first in list order, or
+   NULL if none. If lock, the block is returned locked, unless it is
+   headerBlock or lastHeader (already held).  */
+static SASCompoundHeapHeader *
+SASCompoundHeapFindRoom (SASCompoundHeapHeader * headerBlock,
+			 SASCompoundHeapHeader * lastHeader, int lock)
+{
+  SASCompoundExpandList *list = headerBlock->expandList;
+  SASCompoundHeapHeader *expandBlock;
+  block_size_t i;
+  int locked;
+
+  if (SASCompoundHeapRoomMapOf (headerBlock) == NULL)
+    SASCompoundHeapRoomInit (headerBlock);
+  if (headerBlock->roomMap == NULL)
+    {
+      for (i = 0; i < list->count - 1; i++)
+	{
+	  expandBlock = list->heap[i];
+	  locked = lock && (i > 0);
+	  if (locked)
+	    SASLock (expandBlock, SasUserLock__WRITE);
+	  if (SASCompoundHeapPercentUsed (expandBlock)
+	      < expandBlock->loadFactor)
+	    return expandBlock;
+	  if (locked)
+	    SASUnlock (expandBlock);
+	}
+      return NULL;
+    }
+
+  list = headerBlock->expandList;
+  while ((i = SASCompoundRoomFirst (headerBlock->roomMap, list->count))
+	 < list->count)
+    {
+      expandBlock = list->heap[i];
+      locked = lock && (expandBlock != headerBlock)
+	&& (expandBlock != lastHeader);
+      if (locked)
+	SASLock (expandBlock, SasUserLock__WRITE);
+      if ((expandBlock != lastHeader)
+	  && (SASCompoundHeapPercentUsed (expandBlock)
+	      < expandBlock->loadFactor))
+	return expandBlock;
+      SASCompoundRoomSet (headerBlock->roomMap, i, 0);
+      if (locked)
+	SASUnlock (expandBlock);
+    }
+  return NULL;
+}
+
+/* Return the block of the expand list of headerBlock containing page,
+   or NULL.  */
+static SASCompoundHeapHeader *
+SASCompoundHeapBlockOf (SASCompoundHeapHeader * headerBlock, void *page)
+{
+  SASCompoundExpandList *list = headerBlock->expandList;
+  SASCompoundHeapHeader *expandBlock;
+  block_size_t i;
+
+  expandBlock = (SASCompoundHeapHeader *) ((SASBlockHeader *) page)->baseBlock;
+  if ((expandBlock != NULL)
+      && SOMSASCheckBlockSigAndType ((SASBlockHeader *) expandBlock,
+				     SAS_RUNTIME_COMPOUNDHEAP)
+      && ((expandBlock == headerBlock)
+	  || (expandBlock->blockHeader.baseBlock
+	      == &headerBlock->blockHeader))
+      && SASCompoundHeapContains (expandBlock, page))
+    return expandBlock;
+  for (i = 0; i < list->count; i++)
+    {
+      expandBlock = list->heap[i];
+      if (SASCompoundHeapContains (expandBlock, page))
+	return expandBlock;
+    }
+  return NULL;
+}
+
 SASCompoundHeap_t
 SASCompoundHeapExpandInit (void *heap_seg,
 			   block_size_t heap_size, block_size_t page_size)
@@ -142,7 +481,9 @@ SASCompoundHeapExpandInit (void *heap_seg,
     {
       heapStart = (char *) heapBlock + alloc_page;
       initSOMSASBlock ((SASBlockHeader *) heapBlock,
-		       SAS_RUNTIME_COMPOUNDHEAP, heap_size, heapStart);
+		       (SAS_RUNTIME_COMPOUNDHEAP
+			| SAS_COMPOUNDHEAP_ROOM_VERSION), heap_size,
+		       heapStart);
     }
 
   heapBlock->pageSize = page_size;
@@ -152,6 +493,9 @@ SASCompoundHeapExpandInit (void *heap_seg,
   freeNode_init (heapBlock->headerFreeSpace, remaining);
 
   heapBlock->expandList = NULL;
+  heapBlock->roomMap = NULL;
+  heapBlock->expandIndex = 0;
+  heapBlock->magazineStamp = 0;
   heapBlock->loadFactor = DEFAULT_LOAD_FACTOR;
 
   return (SASCompoundHeap_t) heapBlock;
@@ -175,7 +519,9 @@ SASCompoundHeapInit (void *heap_seg,
     {
       heapStart = (char *) heapBlock + alloc_page;
       initSOMSASBlock ((SASBlockHeader *) heapBlock,
-		       SAS_RUNTIME_COMPOUNDHEAP, heap_size, heapStart);
+		       (SAS_RUNTIME_COMPOUNDHEAP
+			| SAS_COMPOUNDHEAP_ROOM_VERSION), heap_size,
+		       heapStart);
     }
 
   heapBlock->pageSize = page_size;
@@ -186,6 +532,10 @@ SASCompoundHeapInit (void *heap_seg,
   heapBlock->blockHeader.baseBlock = (SASBlockHeader *) heapBlock;
   heapBlock->blockHeader.nextBlock = (SASBlockHeader *) heapBlock;
   heapBlock->loadFactor = 100;
+  heapBlock->expandSpace = NULL;
+  heapBlock->roomMap = NULL;
+  heapBlock->expandIndex = 0;
+  heapBlock->magazineStamp = 0;
 
   if (expanding)
     {
@@ -203,6 +553,7 @@ SASCompoundHeapInit (void *heap_seg,
 	  list->count = 1;
 	  list->max_count = 254;
 	  list->heap[0] = heapBlock;
+	  SASCompoundHeapRoomInit (heapBlock);
 #ifdef __SASDebugPrint__
 	}
       else
@@ -227,69 +578,33 @@ SASCompoundHeapExpandCreate (SASCompoundHeap_t heap)
   SASBlockHeader *heapBlock = NULL;
   SASCompoundHeap_t newHeap = NULL;
 
-  heapBlock = (SASBlockHeader *) SASBlockAlloc ((long) heap_size);
-  if (heapBlock)
+  if ((list->count >= list->max_count)
+      && SASCompoundHeapExpandGrow (headerBlock))
     {
-      if (list->count < list->max_count)
-	{
-	  SASCompoundHeapHeader *newHeader, *prevHeader;
-	  newHeap = SASCompoundHeapExpandInit (heapBlock,
-					       heap_size, page_size);
-	  newHeader = (SASCompoundHeapHeader *) newHeap;
-	  newHeader->blockHeader.baseBlock = &headerBlock->blockHeader;
-	  newHeader->blockHeader.nextBlock = &headerBlock->blockHeader;
-	  newHeader->loadFactor = headerBlock->loadFactor;
-	  prevHeader = list->heap[list->count - 1];
-	  list->heap[list->count] = newHeader;
-	  list->count++;
-	  prevHeader->blockHeader.nextBlock = &newHeader->blockHeader;
-	}
-      else
-	{
-	  if (headerBlock->expandSpace == NULL)
-	    {
-	      SASSimpleSpace_t expandBlock;
-	      SASCompoundExpandList *expandNew;
-	      long countNew;
-	      expandBlock = SASSimpleSpaceCreate (heap_size - default_page);
-	      if (expandBlock)
-		{
 #ifdef __SASDebugPrint__
-		  sas_printf
-		    ("SASCompoundHeapExpandCreate(%p) extended expand list @%p\n",
-		     headerBlock, expandBlock);
-#endif
-		  expandNew = (SASCompoundExpandList *)
-		    SASSimpleSpaceToAddr (expandBlock);
-		  countNew =
-		    ((heap_size - default_page) / sizeof (void *)) - 2;
-		  memcpy (expandNew, list, sizeof (SASCompoundExpandList));
-		  headerBlock->expandSpace = expandBlock;
-		  headerBlock->expandList = expandNew;
-		  expandNew->max_count = countNew;
-		  SASBlockDealloc (heapBlock, heap_size);
-		  newHeap = SASCompoundHeapExpandCreate (heap);
-		}
-	      else
-		{
-#ifdef __SASDebugPrint__
-		  sas_printf
-		    ("SASCompoundHeapExpandCreate(%p) extended expand list alloc failed\n",
-		     headerBlock);
-#endif
-		  SASBlockDealloc (heapBlock, heap_size);
-		}
-	    }
-	  else
-	    {
-#ifdef __SASDebugPrint__
-	      sas_printf
-		("SASCompoundHeapExpandCreate(%p) failed, list full\n",
-		 headerBlock);
+      sas_printf ("SASCompoundHeapExpandCreate(%p) failed, list full\n",
+		  headerBlock);
 #endif
-	      SASBlockDealloc (heapBlock, heap_size);
-	    }
-	}
+      return NULL;
+    }
+  list = headerBlock->expandList;
+
+  heapBlock = (SASBlockHeader *) SASBlockAlloc ((long) heap_size);
+  if (heapBlock)
+    {
+      SASCompoundHeapHeader *newHeader, *prevHeader;
+      newHeap = SASCompoundHeapExpandInit (heapBlock, heap_size, page_size);
+      newHeader = (SASCompoundHeapHeader *) newHeap;
+      newHeader->blockHeader.baseBlock = &headerBlock->blockHeader;
+      newHeader->blockHeader.nextBlock = &headerBlock->blockHeader;
+      newHeader->loadFactor = headerBlock->loadFactor;
+      newHeader->expandIndex = list->count;
+      prevHeader = list->heap[list->count - 1];
+      list->heap[list->count] = newHeader;
+      list->count++;
+      prevHeader->blockHeader.nextBlock = &newHeader->blockHeader;
+      if (SASCompoundHeapRoomMapOf (headerBlock) != NULL)
+	SASCompoundRoomSet (headerBlock->roomMap, newHeader->expandIndex, 1);
 #ifdef __SASDebugPrint__
     }
   else
@@ -349,6 +664,7 @@ SASCompoundHeapSetLoadFactor (SASCompoundHeap_t * heap, int load)
 				  SAS_RUNTIME_COMPOUNDHEAP))
     {
       headerBlock->loadFactor = load;
+      SASCompoundHeapRoomUpdate (headerBlock, headerBlock);
     }
 }
 
@@ -406,23 +722,13 @@ SASCompoundHeapAllocNoLock (SASCompoundHeap_t heap)
 	{
 	  SASCompoundExpandList *list = headerBlock->expandList;
 	  SASCompoundHeapHeader *expandHeader;
-	  block_size_t i;
 	  expandHeader = list->heap[list->count - 1];
 
 	  if (SASCompoundHeapPercentUsed (expandHeader)
 	      >= expandHeader->loadFactor)
 	    {
-	      expandHeader = NULL;
-	      for (i = 0; i < list->count - 1; i++)
-		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (SASCompoundHeapPercentUsed (expandBlock)
-		      < expandBlock->loadFactor)
-		    {
-		      expandHeader = expandBlock;
-		      break;
-		    }
-		}
+	      expandHeader =
+		SASCompoundHeapFindRoom (headerBlock, expandHeader, 0);
 	      if (expandHeader == NULL)
 		{
 		  expandHeader = (SASCompoundHeapHeader *)
@@ -430,7 +736,10 @@ SASCompoundHeapAllocNoLock (SASCompoundHeap_t heap)
 		}
 	    }
 	  if (expandHeader != NULL)
-	    newHeap = SASCompoundHeapAllocInternal (expandHeader);
+	    {
+	      newHeap = SASCompoundHeapAllocInternal (expandHeader);
+	      SASCompoundHeapRoomUpdate (headerBlock, expandHeader);
+	    }
 	}
       else
 	{
@@ -446,23 +755,52 @@ SASCompoundHeapAllocNoLock (SASCompoundHeap_t heap)
   return newHeap;
 }
 
+/* Reuse a sub heap from the calling thread's heap magazine. It is
+   cleared and initialized, as SASCompoundHeapFreeInternal and
+   SASCompoundHeapAllocInternal would, outside the heap lock.  */
+static SASSimpleHeap_t
+SASCompoundHeapMagazineGet (SASCompoundHeapHeader * headerBlock)
+{
+  block_size_t simpleSize = headerBlock->pageSize;
+  SASBlockHeader *simpleBlock;
+  SASBlockHeader *baseBlock;
+
+  simpleBlock = (SASBlockHeader *) SASHeapMagazineGet (headerBlock,
+						       simpleSize);
+  if (simpleBlock == NULL)
+    return NULL;
+  baseBlock = simpleBlock->baseBlock;
+  memset (simpleBlock, 0, simpleSize);
+  SASSimpleHeapInit (simpleBlock, SAS_RUNTIME_SIMPLEHEAP, simpleSize);
+  simpleBlock->baseBlock = baseBlock;
+  return simpleBlock;
+}
+
 SASSimpleHeap_t
 SASCompoundHeapAlloc (SASCompoundHeap_t heap)
 {
   SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
   SASSimpleHeap_t newHeap = NULL;
+  sphtimer_t tStart = SASLatencyStart ();
 
   if (SOMSASCheckBlockSigAndType (headerBlock, SAS_RUNTIME_COMPOUNDHEAP))
     {
       SASCompoundHeapHeader *heapHeader = (SASCompoundHeapHeader *) heap;
+      if (sasHeapMagazineDepth)
+	{
+	  newHeap = SASCompoundHeapMagazineGet (heapHeader);
+	  if (newHeap != NULL)
+	    {
+	      SASLatencyRecord (SAS_LATENCY_COMPOUND_ALLOC, tStart);
+	      return newHeap;
+	    }
+	}
       SASLock (heap, SasUserLock__WRITE);
       if (SASCompoundHeapIsExpanding (heapHeader))
 	{
 	  SASCompoundExpandList *list = heapHeader->expandList;
 	  SASCompoundHeapHeader *lastHeader;
 	  SASCompoundHeapHeader *expandHeader = NULL;
-	  block_size_t i;
-	  block_size_t last_lock = 0;
 	  lastHeader = list->heap[list->count - 1];
 	  if (lastHeader != heapHeader)
 	    SASLock (lastHeader, SasUserLock__WRITE);
@@ -470,40 +808,33 @@ SASCompoundHeapAlloc (SASCompoundHeap_t heap)
 	  if (SASCompoundHeapPercentUsed (lastHeader)
 	      >= heapHeader->loadFactor)
 	    {
-	      last_lock = list->count - 1;
-	      for (i = 0; i < list->count - 1; i++)
+	      /* The block found is returned locked.  */
+	      expandHeader =
+		SASCompoundHeapFindRoom (heapHeader, lastHeader, 1);
+	      if (expandHeader != NULL)
 		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (i > 0)
-		    SASLock (expandBlock, SasUserLock__WRITE);
-		  if (SASCompoundHeapPercentUsed (expandBlock)
-		      < expandBlock->loadFactor)
-		    {
-		      expandHeader = expandBlock;
-		      last_lock = i + 1;
-		      break;
-		    }
+		  newHeap = SASCompoundHeapAllocInternal (expandHeader);
+		  SASCompoundHeapRoomUpdate (heapHeader, expandHeader);
+		  if (expandHeader != heapHeader)
+		    SASUnlock (expandHeader);
 		}
-	      if (expandHeader == NULL)
+	      else
 		{
 		  expandHeader = (SASCompoundHeapHeader *)
 		    SASCompoundHeapExpandCreate (heap);
-		}
-	      /* Need to check again, in case the
-	       * SASCompoundHeapExpandCreate is needed but fails.  */
-	      if (expandHeader != NULL)
-		newHeap = SASCompoundHeapAllocInternal (expandHeader);
-              /* Now that we have allocated from a CompoundHeap, we can
-               * unlock any (other than first and last) from the
-               * ExpandList that we have accessed.  */
-	      for (i = 1; i < last_lock; i++)
-		{
-		  SASUnlock (list->heap[i]);
+		  /* Need to check again, in case the
+		   * SASCompoundHeapExpandCreate is needed but fails.  */
+		  if (expandHeader != NULL)
+		    {
+		      newHeap = SASCompoundHeapAllocInternal (expandHeader);
+		      SASCompoundHeapRoomUpdate (heapHeader, expandHeader);
+		    }
 		}
 	    }
 	  else
 	    {
 	      newHeap = SASCompoundHeapAllocInternal (lastHeader);
+	      SASCompoundHeapRoomUpdate (heapHeader, lastHeader);
 	    }
 
 	  if (lastHeader != heapHeader)
@@ -521,6 +852,7 @@ SASCompoundHeapAlloc (SASCompoundHeap_t heap)
       sas_printf ("SASCompoundHeapAlloc(%p) type check failed\n", heap);
 #endif
     }
+  SASLatencyRecord (SAS_LATENCY_COMPOUND_ALLOC, tStart);
   return newHeap;
 }
 
@@ -535,18 +867,15 @@ SASCompoundHeapFreeNoLock (SASCompoundHeap_t heap, SASSimpleHeap_t free_block)
       if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) headerBlock,
 				      SAS_RUNTIME_COMPOUNDHEAP))
 	{
+	  SASHeapMagazineDiscard (free_block, headerBlock->pageSize);
 	  if (SASCompoundHeapIsExpanding (headerBlock))
 	    {
-	      SASCompoundExpandList *list = headerBlock->expandList;
-	      block_size_t i;
-	      for (i = 0; i < list->count; i++)
+	      SASCompoundHeapHeader *expandBlock =
+		SASCompoundHeapBlockOf (headerBlock, free_block);
+	      if (expandBlock != NULL)
 		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (SASCompoundHeapContains (expandBlock, free_block))
-		    {
-		      SASCompoundHeapFreeInternal (expandBlock, free_block);
-		      break;
-		    }
+		  SASCompoundHeapFreeInternal (expandBlock, free_block);
+		  SASCompoundHeapRoomUpdate (headerBlock, expandBlock);
 		}
 	    }
 	  else
@@ -582,53 +911,92 @@ SASCompoundHeapFreeNoLock (SASCompoundHeap_t heap, SASSimpleHeap_t free_block)
     }
 }
 
+/* Free a sub heap, with the header block of the compound heap
+   locked. Returns 0, or -1 if the sub heap is not in the heap.  */
+static int
+SASCompoundHeapFreeLocked (SASCompoundHeapHeader * headerBlock,
+			   SASSimpleHeap_t free_block)
+{
+  if (SASCompoundHeapIsExpanding (headerBlock))
+    {
+      SASCompoundHeapHeader *expandBlock =
+	SASCompoundHeapBlockOf (headerBlock, free_block);
+      if (expandBlock != NULL)
+	{
+	  if (expandBlock != headerBlock)
+	    SASLock (expandBlock, SasUserLock__WRITE);
+	  SASCompoundHeapFreeInternal (expandBlock, free_block);
+	  SASCompoundHeapRoomUpdate (headerBlock, expandBlock);
+	  if (expandBlock != headerBlock)
+	    SASUnlock (expandBlock);
+	  return 0;
+	}
+    }
+  else
+    {
+      if (SASCompoundHeapContains (headerBlock, free_block))
+	{
+	  SASCompoundHeapFreeInternal (headerBlock, free_block);
+	  return 0;
+	}
+    }
+#ifdef __SASDebugPrint__
+  sas_printf ("SASCompoundHeapFree(%p, %p) free block not contained\n",
+	      headerBlock, free_block);
+#endif
+  return -1;
+}
+
+/* Free a batch of sub heaps from a heap magazine under one lock.  */
+static void
+SASCompoundHeapMagazineDrain (void *heap, void **objs, int n,
+			      block_size_t size __attribute__ ((unused)))
+{
+  int i;
+
+  SASLock (heap, SasUserLock__WRITE);
+  for (i = 0; i < n; i++)
+    if (SASCompoundHeapFreeLocked ((SASCompoundHeapHeader *) heap, objs[i]))
+      sas_printf ("SASCompoundHeapFree(%p, %p) failed in magazine\n",
+		  heap, objs[i]);
+  SASUnlock (heap);
+}
+
 void
 SASCompoundHeapFree (SASCompoundHeap_t heap, SASSimpleHeap_t free_block)
 {
   SASCompoundHeapHeader *headerBlock = (SASCompoundHeapHeader *) heap;
+  int rc;
 
   if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) free_block,
 				  SAS_RUNTIME_SIMPLEHEAP))
     {
-      SASLock (heap, SasUserLock__WRITE);
       if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) headerBlock,
 				      SAS_RUNTIME_COMPOUNDHEAP))
 	{
-	  if (SASCompoundHeapIsExpanding (headerBlock))
-	    {
-	      SASCompoundExpandList *list = headerBlock->expandList;
-	      block_size_t i;
-	      for (i = 0; i < list->count; i++)
-		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (i > 0)
-		    SASLock (expandBlock, SasUserLock__WRITE);
-		  if (SASCompoundHeapContains (expandBlock, free_block))
-		    {
-		      SASCompoundHeapFreeInternal (expandBlock, free_block);
-		      if (i > 0)
-			SASUnlock (heap);
-		      break;
-		    }
-		  if (i > 0)
-		    SASUnlock (heap);
-		}
-	    }
-	  else
+	  /* Objects cached for the sub heap, by any thread, go with it.  */
+	  SASHeapMagazineDiscard (free_block, headerBlock->pageSize);
+	  if (sasHeapMagazineDepth)
 	    {
-	      if (SASCompoundHeapContains (headerBlock, free_block))
+	      *SASSimpleHeapMagazineStamp (free_block) = 0;
+	      rc = SASHeapMagazinePut (heap, free_block, headerBlock->pageSize,
+				       SASCompoundHeapMagazineDrain,
+				       &headerBlock->magazineStamp,
+				       &headerBlock->magazineStamp);
+	      if (rc > 0)
+		return;
+	      if (rc < 0)
 		{
-		  SASCompoundHeapFreeInternal (headerBlock, free_block);
 #ifdef __SASDebugPrint__
-		}
-	      else
-		{
-		  sas_printf
-		    ("SASCompoundHeapFree(%p, %p) free block not contained\n",
-		     heap, free_block);
+		  sas_printf ("SASCompoundHeapFree(%p, %p) double free\n",
+			      heap, free_block);
 #endif
+		  return;
 		}
 	    }
+	  SASLock (heap, SasUserLock__WRITE);
+	  SASCompoundHeapFreeLocked (headerBlock, free_block);
+	  SASUnlock (heap);
 #ifdef __SASDebugPrint__
 	}
       else
@@ -637,7 +1005,6 @@ SASCompoundHeapFree (SASCompoundHeap_t heap, SASSimpleHeap_t free_block)
 		      heap, free_block);
 #endif
 	}
-      SASUnlock (heap);
 #ifdef __SASDebugPrint__
     }
   else
@@ -648,6 +1015,19 @@ SASCompoundHeapFree (SASCompoundHeap_t heap, SASSimpleHeap_t free_block)
     }
 }
 
+/* Return the header block of the compound heap of compoundHeader,
+   itself unless it is an expansion block.  */
+static inline SASCompoundHeapHeader *
+SASCompoundHeapBaseOf (SASCompoundHeapHeader * compoundHeader)
+{
+  if (!SASCompoundHeapIsExpanding (compoundHeader)
+      && (compoundHeader->blockHeader.baseBlock
+	  != (SASBlockHeader *) compoundHeader)
+      && (compoundHeader->blockHeader.baseBlock != NULL))
+    return (SASCompoundHeapHeader *) compoundHeader->blockHeader.baseBlock;
+  return compoundHeader;
+}
+
 SASSimpleHeap_t
 SASCompoundHeapNearAllocNoLock (void *nearObj)
 {
@@ -792,7 +1172,10 @@ SASCompoundHeapNearDeallocNoLock (void *nearObj)
       if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) compoundHeader,
 				      SAS_RUNTIME_COMPOUNDHEAP))
 	{
+	  SASHeapMagazineDiscard (nearHeader, compoundHeader->pageSize);
 	  SASCompoundHeapFreeInternal (compoundHeader, nearHeader);
+	  SASCompoundHeapRoomUpdate (SASCompoundHeapBaseOf (compoundHeader),
+				     compoundHeader);
 #ifdef __SASDebugPrint__
 	}
       else
@@ -822,9 +1205,19 @@ SASCompoundHeapNearDealloc (void *nearObj)
       if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) compoundHeader,
 				      SAS_RUNTIME_COMPOUNDHEAP))
 	{
-	  SASLock (compoundHeader, SasUserLock__WRITE);
+	  SASCompoundHeapHeader *baseHeader =
+	    SASCompoundHeapBaseOf (compoundHeader);
+	  /* Lock the header first, as SASCompoundHeapAlloc, as it holds
+	   * the room map of the heap.  */
+	  SASLock (baseHeader, SasUserLock__WRITE);
+	  if (compoundHeader != baseHeader)
+	    SASLock (compoundHeader, SasUserLock__WRITE);
+	  SASHeapMagazineDiscard (nearHeader, compoundHeader->pageSize);
 	  SASCompoundHeapFreeInternal (compoundHeader, nearHeader);
-	  SASUnlock (compoundHeader);
+	  SASCompoundHeapRoomUpdate (baseHeader, compoundHeader);
+	  if (compoundHeader != baseHeader)
+	    SASUnlock (compoundHeader);
+	  SASUnlock (baseHeader);
 #ifdef __SASDebugPrint__
 	}
       else
@@ -896,6 +1289,7 @@ SASCompoundHeapFreeSpace (SASCompoundHeap_t heap)
 
   if (SOMSASCheckBlockSigAndType (headerBlock, SAS_RUNTIME_COMPOUNDHEAP))
     {
+      SASHeapMagazineReturn (heap);
       SASLock (heap, SasUserLock__WRITE);
       SASCompoundExpandList *list =
 	((SASCompoundHeapHeader *) headerBlock)->expandList;
@@ -1206,6 +1600,7 @@ SASCompoundHeapDestroyNoLock (SASCompoundHeap_t heap)
 	{
 	  for (i = 1; i < list->count; i++)
 	    {
+	      SASHeapMagazineDiscard (list->heap[i], heapSize);
 	      SASBlockDealloc (list->heap[i], heapSize);
 	      list->heap[i] = NULL;
 	    }
@@ -1215,6 +1610,10 @@ SASCompoundHeapDestroyNoLock (SASCompoundHeap_t heap)
 	      SASSimpleSpaceDestroy (headerBlock->expandSpace);
 	    }
 	}
+      SASHeapMagazineDiscard (heap, heapSize);
+      /* Invalidates the magazines of the heap and its sub heaps in
+         every thread.  */
+      headerBlock->magazineStamp = 0;
       SASBlockDealloc (heap, heapSize);
 #ifdef __SASDebugPrint__
     }
@@ -1291,23 +1690,13 @@ SPHCompoundPCQAllocNoLock (SASCompoundHeap_t heap)
 	{
 	  SASCompoundExpandList *list = headerBlock->expandList;
 	  SASCompoundHeapHeader *expandHeader;
-	  block_size_t i;
 	  expandHeader = list->heap[list->count - 1];
 
 	  if (SASCompoundHeapPercentUsed (expandHeader)
 	      >= expandHeader->loadFactor)
 	    {
-	      expandHeader = NULL;
-	      for (i = 0; i < list->count - 1; i++)
-		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (SASCompoundHeapPercentUsed (expandBlock)
-		      < expandBlock->loadFactor)
-		    {
-		      expandHeader = expandBlock;
-		      break;
-		    }
-		}
+	      expandHeader =
+		SASCompoundHeapFindRoom (headerBlock, expandHeader, 0);
 	      if (expandHeader == NULL)
 		{
 		  expandHeader = (SASCompoundHeapHeader *)
@@ -1315,7 +1704,10 @@ SPHCompoundPCQAllocNoLock (SASCompoundHeap_t heap)
 		}
 	    }
 	  if (expandHeader != NULL)
-	    newHeap = SPHCompoundPCQAllocInternal (expandHeader);
+	    {
+	      newHeap = SPHCompoundPCQAllocInternal (expandHeader);
+	      SASCompoundHeapRoomUpdate (headerBlock, expandHeader);
+	    }
 	}
       else
 	{
@@ -1346,8 +1738,6 @@ SPHCompoundPCQAlloc (SASCompoundHeap_t heap)
 	  SASCompoundExpandList *list = heapHeader->expandList;
 	  SASCompoundHeapHeader *lastHeader;
 	  SASCompoundHeapHeader *expandHeader = NULL;
-	  block_size_t i;
-	  block_size_t last_lock = 0;
 	  lastHeader = list->heap[list->count - 1];
 	  if (lastHeader != heapHeader)
 	    SASLock (lastHeader, SasUserLock__WRITE);
@@ -1355,40 +1745,33 @@ SPHCompoundPCQAlloc (SASCompoundHeap_t heap)
 	  if (SASCompoundHeapPercentUsed (lastHeader)
 	      >= heapHeader->loadFactor)
 	    {
-	      last_lock = list->count - 1;
-	      for (i = 0; i < list->count - 1; i++)
+	      /* The block found is returned locked.  */
+	      expandHeader =
+		SASCompoundHeapFindRoom (heapHeader, lastHeader, 1);
+	      if (expandHeader != NULL)
 		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (i > 0)
-		    SASLock (expandBlock, SasUserLock__WRITE);
-		  if (SASCompoundHeapPercentUsed (expandBlock)
-		      < expandBlock->loadFactor)
-		    {
-		      expandHeader = expandBlock;
-		      last_lock = i + 1;
-		      break;
-		    }
+		  newHeap = SPHCompoundPCQAllocInternal (expandHeader);
+		  SASCompoundHeapRoomUpdate (heapHeader, expandHeader);
+		  if (expandHeader != heapHeader)
+		    SASUnlock (expandHeader);
 		}
-	      if (expandHeader == NULL)
+	      else
 		{
 		  expandHeader = (SASCompoundHeapHeader *)
 		    SASCompoundHeapExpandCreate (heap);
-		}
-	      /* Need to check again, in case the
-	       * SASCompoundHeapExpandCreate is needed but fails.  */
-	      if (expandHeader != NULL)
-		newHeap = SPHCompoundPCQAllocInternal (expandHeader);
-              /* Now that we have allocated from a CompoundHeap, we can
-               * unlock any (other than first and last) from the
-               * ExpandList that we have accessed.  */
-	      for (i = 1; i < last_lock; i++)
-		{
-		  SASUnlock (list->heap[i]);
+		  /* Need to check again, in case the
+		   * SASCompoundHeapExpandCreate is needed but fails.  */
+		  if (expandHeader != NULL)
+		    {
+		      newHeap = SPHCompoundPCQAllocInternal (expandHeader);
+		      SASCompoundHeapRoomUpdate (heapHeader, expandHeader);
+		    }
 		}
 	    }
 	  else
 	    {
 	      newHeap = SPHCompoundPCQAllocInternal (lastHeader);
+	      SASCompoundHeapRoomUpdate (heapHeader, lastHeader);
 	    }
 
 	  if (lastHeader != heapHeader)
@@ -1435,16 +1818,12 @@ SPHCompoundPCQFreeNoLock (SASCompoundHeap_t heap, SPHSinglePCQueue_t free_block)
 	{
 	  if (SASCompoundHeapIsExpanding (headerBlock))
 	    {
-	      SASCompoundExpandList *list = headerBlock->expandList;
-	      block_size_t i;
-	      for (i = 0; i < list->count; i++)
+	      SASCompoundHeapHeader *expandBlock =
+		SASCompoundHeapBlockOf (headerBlock, free_block);
+	      if (expandBlock != NULL)
 		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (SASCompoundHeapContains (expandBlock, free_block))
-		    {
-			  SPHCompoundPCQFreeInternal (expandBlock, free_block);
-		      break;
-		    }
+		  SPHCompoundPCQFreeInternal (expandBlock, free_block);
+		  SASCompoundHeapRoomUpdate (headerBlock, expandBlock);
 		}
 	    }
 	  else
@@ -1494,22 +1873,16 @@ SPHCompoundPCQFree (SASCompoundHeap_t heap, SPHSinglePCQueue_t free_block)
 	{
 	  if (SASCompoundHeapIsExpanding (headerBlock))
 	    {
-	      SASCompoundExpandList *list = headerBlock->expandList;
-	      block_size_t i;
-	      for (i = 0; i < list->count; i++)
+	      SASCompoundHeapHeader *expandBlock =
+		SASCompoundHeapBlockOf (headerBlock, free_block);
+	      if (expandBlock != NULL)
 		{
-		  SASCompoundHeapHeader *expandBlock = list->heap[i];
-		  if (i > 0)
+		  if (expandBlock != headerBlock)
 		    SASLock (expandBlock, SasUserLock__WRITE);
-		  if (SASCompoundHeapContains (expandBlock, free_block))
-		    {
-			  SPHCompoundPCQFreeInternal (expandBlock, free_block);
-		      if (i > 0)
-			SASUnlock (heap);
-		      break;
-		    }
-		  if (i > 0)
-		    SASUnlock (heap);
+		  SPHCompoundPCQFreeInternal (expandBlock, free_block);
+		  SASCompoundHeapRoomUpdate (headerBlock, expandBlock);
+		  if (expandBlock != headerBlock)
+		    SASUnlock (expandBlock);
 		}
 	    }
 	  else
@@ -59,6 +59,9 @@
  * initialize it as a compound heap, and chain it the original.
  * If expansion is successful the requested simple heap is allocated
  * from the new space.
+ * The list of expansion blocks moves to a directory twice as large
+ * when full, and keeps a bitmap of the blocks below their load factor,
+ * so the block to allocate from is found without testing each block.
  * Finally the storage associated with entire collection of related data
  * structures allocated from a Compound Heap can be freed for reuse
  * (destroyed) with one call.
@@ -34,116 +34,135 @@
  * Next establish the maximum allocation (segment) size for shared 
  * segment units with the shared region and the maximum size of
  * segment store files.
+ *
+ * These are the defaults for new stores. The geometry of each store
+ * is recorded in its anchor block at creation, and __SAS_BASE_ADDRESS,
+ * RegionSize and SegmentSize below reflect the region selected by the
+ * calling thread. See setSASRegionGeometry and SASRegionJoin in sassim.h.
  */
 #ifdef __powerpc__
 # ifdef __powerpc64__
 #  define	__WORDSIZE_64
 #  ifdef __BIGREGION__
-#   define	__SAS_BASE_ADDRESS	0x80000000000L
-#   define	RegionSize  		0x40000000000L	/* 4TB */
-#   define	SegmentSize		0x00010000000L	/* 256MB */
+#   define	__SAS_DEFAULT_BASE_ADDRESS	0x80000000000L
+#   define	__SAS_DEFAULT_REGION_SIZE	0x40000000000L	/* 4TB */
+#   define	__SAS_DEFAULT_SEGMENT_SIZE	0x00010000000L	/* 256MB */
 #  else
-#   define	__SAS_BASE_ADDRESS	0x0a000000000L
-#   define	RegionSize  		0x04000000000L	/* 256GB */
-#   define	SegmentSize		0x00010000000L	/* 256MB */
+#   define	__SAS_DEFAULT_BASE_ADDRESS	0x0a000000000L
+#   define	__SAS_DEFAULT_REGION_SIZE	0x04000000000L	/* 256GB */
+#   define	__SAS_DEFAULT_SEGMENT_SIZE	0x00010000000L	/* 256MB */
 #  endif
 #  define	__SAS_SHMAP_MAX	0x1000000L	/* 16MB */
 # else
 #  ifdef __BIGREGION__
-#   define	__SAS_BASE_ADDRESS	0x80000000UL
-#   define	RegionSize		0x40000000UL	/* 1GB */
-#   define	SegmentSize		0x01000000UL	/*  16MB */
+#   define	__SAS_DEFAULT_BASE_ADDRESS	0x80000000UL
+#   define	__SAS_DEFAULT_REGION_SIZE	0x40000000UL	/* 1GB */
+#   define	__SAS_DEFAULT_SEGMENT_SIZE	0x01000000UL	/*  16MB */
 #   define	__SAS_SHMAP_MAX		0x1000000UL
 #  else
-#   define	__SAS_BASE_ADDRESS	0x60000000UL
-#   define	RegionSize		0x10000000UL	/* 256MB */
-#   define	SegmentSize		0x01000000UL	/*  16MB */
+#   define	__SAS_DEFAULT_BASE_ADDRESS	0x60000000UL
+#   define	__SAS_DEFAULT_REGION_SIZE	0x10000000UL	/* 256MB */
+#   define	__SAS_DEFAULT_SEGMENT_SIZE	0x01000000UL	/*  16MB */
 #  endif
 # endif
 #endif
 
 #ifdef __x86_64__
 #  define	__WORDSIZE_64
-#  define	__SAS_BASE_ADDRESS	0x400000000000L
-#  define	RegionSize  		0x200000000000L	/* 32TB */
-# define	SegmentSize		0x000010000000L	/* 256MB */
+#  define	__SAS_DEFAULT_BASE_ADDRESS	0x400000000000L
+#  define	__SAS_DEFAULT_REGION_SIZE	0x200000000000L	/* 32TB */
+# define	__SAS_DEFAULT_SEGMENT_SIZE	0x000010000000L	/* 256MB */
 #  define	__SAS_SHMAP_MAX		0x000001000000L	/* 16MB */
 #endif
 
 #ifdef __s390x__
 # define     __WORDSIZE_64
-# define     __SAS_BASE_ADDRESS      0x20000000000L   /* 2TB */
-# define     RegionSize              0x10000000000L   /* 1TB */
-# define     SegmentSize             0x00000400000L   /* 4MB */
-# define     __SAS_SHMAP_MAX         0x00000400000L   /* 4MB */
+# define     __SAS_DEFAULT_BASE_ADDRESS  0x20000000000L   /* 2TB */
+# define     __SAS_DEFAULT_REGION_SIZE   0x10000000000L   /* 1TB */
+# define     __SAS_DEFAULT_SEGMENT_SIZE  0x00000400000L   /* 4MB */
+# define     __SAS_SHMAP_MAX             0x00000400000L   /* 4MB */
 #endif
 
 #ifdef __aarch64__
 # define     __WORDSIZE_64
-# define     __SAS_BASE_ADDRESS      0x4000000000L   /* 512GB */
-# define     RegionSize              0x2000000000L   /* 128GB */
-# define     SegmentSize             0x0010000000L   /* 256MB */
-# define     __SAS_SHMAP_MAX         0x0001000000L   /* 16MB */
+# define     __SAS_DEFAULT_BASE_ADDRESS  0x4000000000L   /* 512GB */
+# define     __SAS_DEFAULT_REGION_SIZE   0x2000000000L   /* 128GB */
+# define     __SAS_DEFAULT_SEGMENT_SIZE  0x0010000000L   /* 256MB */
+# define     __SAS_SHMAP_MAX             0x0001000000L   /* 16MB */
 #endif
 
 #ifdef __arm__
-# define     __SAS_BASE_ADDRESS      0x60000000UL
-# define     RegionSize              0x20000000UL    /* 512MB */
-# define     SegmentSize             0x01000000UL    /*  16MB */
-# define     __SAS_SHMAP_MAX         0x01000000UL    /*  16MB */
+# define     __SAS_DEFAULT_BASE_ADDRESS  0x60000000UL
+# define     __SAS_DEFAULT_REGION_SIZE   0x20000000UL    /* 512MB */
+# define     __SAS_DEFAULT_SEGMENT_SIZE  0x01000000UL    /*  16MB */
+# define     __SAS_SHMAP_MAX             0x01000000UL    /*  16MB */
 #endif
 
 #ifdef __mips64
 # define     __WORDSIZE_64
-# define     __SAS_BASE_ADDRESS      0x4000000000L   /* 256GB */
-# define     RegionSize              0x2000000000L   /* 128GB */
-# define     SegmentSize             0x0010000000L   /* 256MB */
-# define     __SAS_SHMAP_MAX         0x0001000000L   /*  16MB */
+# define     __SAS_DEFAULT_BASE_ADDRESS  0x4000000000L   /* 256GB */
+# define     __SAS_DEFAULT_REGION_SIZE   0x2000000000L   /* 128GB */
+# define     __SAS_DEFAULT_SEGMENT_SIZE  0x0010000000L   /* 256MB */
+# define     __SAS_SHMAP_MAX             0x0001000000L   /*  16MB */
 #endif
 
 #ifdef __mips__
-# define     __SAS_BASE_ADDRESS      0x60000000UL    /* 1.5GB */
-# define     RegionSize              0x10000000UL    /* 256MB */
-# define     SegmentSize             0x01000000UL    /*  16MB */
-# define     __SAS_SHMAP_MAX         0x01000000UL    /*  16MB */
+# define     __SAS_DEFAULT_BASE_ADDRESS  0x60000000UL    /* 1.5GB */
+# define     __SAS_DEFAULT_REGION_SIZE   0x10000000UL    /* 256MB */
+# define     __SAS_DEFAULT_SEGMENT_SIZE  0x01000000UL    /*  16MB */
+# define     __SAS_SHMAP_MAX             0x01000000UL    /*  16MB */
 #endif
 
 #ifdef __loongarch__
 # define     __WORDSIZE_64
-# define     __SAS_BASE_ADDRESS      0x4000000000L   
-# define     RegionSize              0x2000000000L   /* 128GB */
-# define     SegmentSize             0x0010000000L   /* 256MB */
-# define     __SAS_SHMAP_MAX         0x0001000000L   /* 16MB */
+# define     __SAS_DEFAULT_BASE_ADDRESS  0x4000000000L   
+# define     __SAS_DEFAULT_REGION_SIZE   0x2000000000L   /* 128GB */
+# define     __SAS_DEFAULT_SEGMENT_SIZE  0x0010000000L   /* 256MB */
+# define     __SAS_SHMAP_MAX             0x0001000000L   /* 16MB */
 #endif
 
 #ifdef __riscv
   #if __riscv_xlen == 32
-  # define     __SAS_BASE_ADDRESS      0x80000000UL    /* 2GB   */
-  # define     RegionSize              0x10000000UL    /* 256MB */
-  # define     SegmentSize             0x01000000UL    /* 16MB  */
-  # define     __SAS_SHMAP_MAX         0x01000000UL    /* 16MB  */
+  # define     __SAS_DEFAULT_BASE_ADDRESS  0x80000000UL    /* 2GB   */
+  # define     __SAS_DEFAULT_REGION_SIZE   0x10000000UL    /* 256MB */
+  # define     __SAS_DEFAULT_SEGMENT_SIZE  0x01000000UL    /* 16MB  */
+  # define     __SAS_SHMAP_MAX             0x01000000UL    /* 16MB  */
   #elif __riscv_xlen == 64
   # define     __WORDSIZE_64
-  # define     __SAS_BASE_ADDRESS      0x1000000000L    /* 64GB */
-  # define     RegionSize              0x1000000000L    /* 64GB */
-  # define     SegmentSize             0x0010000000L    /* 256MB */
-  # define     __SAS_SHMAP_MAX         0x0001000000L    /* 16MB */
+  # define     __SAS_DEFAULT_BASE_ADDRESS  0x1000000000L    /* 64GB */
+  # define     __SAS_DEFAULT_REGION_SIZE   0x1000000000L    /* 64GB */
+  # define     __SAS_DEFAULT_SEGMENT_SIZE  0x0010000000L    /* 256MB */
+  # define     __SAS_SHMAP_MAX             0x0001000000L    /* 16MB */
   #endif
 #endif
 
 /* 
  * If the platform is not recognized above, select some resonable default.
  */
-#ifndef __SAS_BASE_ADDRESS
+#ifndef __SAS_DEFAULT_BASE_ADDRESS
 # ifdef __GNUC__
-#  define __SAS_BASE_ADDRESS	0x60000000UL
+#  define __SAS_DEFAULT_BASE_ADDRESS	0x60000000UL
 # else
-#  define __SAS_BASE_ADDRESS	0x40000000UL
+#  define __SAS_DEFAULT_BASE_ADDRESS	0x40000000UL
 # endif
-# define	RegionSize	0x20000000UL	/* 512MB */
-# define	SegmentSize	0x00400000UL	/*   4MB */
+# define	__SAS_DEFAULT_REGION_SIZE	0x20000000UL	/* 512MB */
+# define	__SAS_DEFAULT_SEGMENT_SIZE	0x00400000UL	/*   4MB */
+#endif
+
+/* Geometry of the region selected by the calling thread.  */
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern unsigned long getSASRegionBase (void);
+extern unsigned long getSASRegionSize (void);
+extern unsigned long getSASSegmentSize (void);
+#ifdef __cplusplus
+}
 #endif
 
+#define __SAS_BASE_ADDRESS	(getSASRegionBase ())
+#define RegionSize		(getSASRegionSize ())
+#define SegmentSize		(getSASSegmentSize ())
 
 #define __SAS_TEMP_ADDRESS (__SAS_BASE_ADDRESS + RegionSize + SegmentSize)
 
@@ -151,7 +170,12 @@
 
 
 #ifndef __SAS_SHMAP_MAX
-# define __SAS_SHMAP_MAX SegmentSize
+# define __SAS_SHMAP_MAX __SAS_DEFAULT_SEGMENT_SIZE
+#endif
+
+/* tmpfs directory holding the segments of volatile regions.  */
+#ifndef __SAS_VOLATILE_DIR
+# define __SAS_VOLATILE_DIR	"/dev/shm"
 #endif
 
 #ifndef __WORDSIZE_64
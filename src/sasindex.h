@@ -553,4 +553,22 @@ SASIndexAllocSize (SASIndex_t btree);
 extern __C__ block_size_t
 SASIndexFreeSpace (SASIndex_t btree);
 
+/*!
+ * \brief Compact the expanding SAS Index \a btree.
+ *
+ * Moves the nodes held in the expansion blocks of \a btree, last
+ * block first, into the free node pages of the blocks kept, and frees
+ * the expansion blocks emptied, returning their address space to the
+ * region. Blocks holding (or listing) spill pages are kept. The
+ * function holds the write lock of \a btree and of its expansion
+ * blocks while the nodes are moved. Node pointers held by enumerations
+ * in progress are no longer valid after the compaction.
+ *
+ * @param btree Handle of the SASIndex_t to compact.
+ * @return The count of expansion blocks freed, or -1 if \a btree is
+ * not a SAS_RUNTIME_INDEX.
+ */
+extern __C__ int
+SASIndexCompact (SASIndex_t btree);
+
 #endif /* __SAS_INDEX_H */
@@ -20,16 +20,33 @@
 #include "saslock.h"
 #include "sasmlock.h"
 #include "sassimpleheap.h"
+#include "sasallocpriv.h"
 
 int    SasLockOwner = 0;
-static sasshm_t	SasLockMemID = -1;
-static SasMasterLock *ml = 0;
 
 const static unsigned int kMasterLockSize = 256;
 
+/* Each joined region has its own lock table, following the region.
+   Return the master lock of the region containing addr, or of the
+   region selected by this thread.  */
+static SasMasterLock *
+SASLockMaster (vm_address_t addr)
+{
+    SASRegionState_t *region = getSASRegionStateByAddr ((unsigned long)addr);
+
+    if ( region == 0 )
+	region = getSASRegionState ();
+    if ( region->regionLow == 0 )
+	return 0;
+    return (SasMasterLock*) ((SASBlockHeader*)
+		(region->regionHigh + region->segmentSize))->special;
+}
+
 void
 SASLockReset (void)
 {
+    SasMasterLock *ml = SASLockMaster (0);
+
     if ( ml == 0 ) {
 	fprintf(stderr, "SASLockReset: locks not initialized: exiting\n");
 	return;
@@ -47,9 +64,12 @@ void
 SASLockInit (void)
 {
     char *lock_addr = (char *)__SAS_TEMP_ADDRESS;
-    SasLockMemID = SASAllocateShmNameProj(sasStorePath, 'L',
-                                          lock_addr, __SAS_SHMAP_MAX);
-    if ( SasLockMemID != -1 )
+    SASRegionState_t *region = getSASRegionState ();
+    SasMasterLock *ml;
+
+    region->lockMemID = SASAllocateShmNameProj(region->storePath, 'L',
+                                               lock_addr, __SAS_SHMAP_MAX);
+    if ( region->lockMemID != -1 )
     {
     	if (errno != EEXIST)
 	{
@@ -60,8 +80,6 @@ SASLockInit (void)
 	    ml = new (shm_locks) SasMasterLock(kMasterLockSize);
 	    setSASBlockSpecial (lock_addr, ml);
 	    SasLockOwner = 1;
-	} else {
-	    ml = (SasMasterLock*) getSASBlockSpecial (lock_addr); 
 	}
     }
 }
@@ -70,25 +88,25 @@ void
 SASLock(vm_address_t addr,
 	sas_userlock_request_t lockT)
 {
-    ml->lock(addr, lockT);
+    SASLockMaster (addr)->lock(addr, lockT);
 }	
 	
 void
 SASUnlock(vm_address_t addr)
 {
-    ml->unlock(addr);
+    SASLockMaster (addr)->unlock(addr);
 }
 	
 void
 SASLockPrintDetailedStats(void)
 {
-    ml->printDetailedStats();
+    SASLockMaster (0)->printDetailedStats();
 }
 	
 void
 SASLockPrintHighLevelStats(void)
 {
-    ml->printHighLevelStats();
+    SASLockMaster (0)->printHighLevelStats();
 }
 
 void
@@ -105,7 +123,7 @@ SASLockRemove (void)
     char *lock_addr = (char *)__SAS_TEMP_ADDRESS;
     
     SASDetachShm( lock_addr );
-    SASRemoveShmID( SasLockMemID );
+    SASRemoveShmID( getSASRegionState ()->lockMemID );
 }
 
 void
@@ -47,6 +47,23 @@ int  sasMsyncRelease(void *startAddr, size_t size)
 }
 
 
+int  sasMsyncRemove(void *startAddr, size_t size)
+{
+#ifdef MADV_REMOVE
+	unsigned long pageRnd  = getpagesize() - 1;
+	unsigned long addr = ((unsigned long)startAddr + pageRnd) & ~pageRnd;
+	unsigned long endAddr = ((unsigned long)startAddr + size) & ~pageRnd;
+
+	/* Only whole pages, partial pages may hold live data.  */
+	if (endAddr <= addr)
+	  return 0;
+	return madvise((void*)addr, (size_t)(endAddr - addr), MADV_REMOVE);
+#else
+	return -1;
+#endif
+}
+
+
 int  sasMsyncPurge(void *startAddr, size_t size, int asyncBool)
 {
 	int rc;
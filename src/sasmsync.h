@@ -56,6 +56,19 @@ extern __C__ int sasMsyncPurge(void *startAddr, size_t size, int asyncBool);
 */
 extern __C__ int sasMsyncRelease(void *startAddr, size_t size);
 
+/** \brief Discard a range of pages and free their backing storage.
+*
+*   Mark all pages fully within range MADV_REMOVE, which punches a hole
+*   in the backing file. Both the real memory and the file blocks are
+*   freed and the pages read as zeros afterwards. Only for ranges whose
+*   contents are no longer needed (for example deallocated blocks).
+*
+*	@param startAddr starting address of the remove range.
+*	@param size of the remove range.
+*	@return Zero on success and ERRNO otherwise.
+*/
+extern __C__ int sasMsyncRemove(void *startAddr, size_t size);
+
 /** \brief Inform the kernel that those pages will be needed soon.
 *
 *   Mark all pages in range MADV_WILLNEED.
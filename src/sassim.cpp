@@ -14,8 +14,11 @@
 // test for storage allocation
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
 #include <fcntl.h>
 #include <sys/ipc.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
 /*
 #ifdef __USE_SHM
 #include <sys/shm.h>
@@ -33,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <semaphore.h>
 
@@ -43,18 +47,40 @@
 #include "sasio.h"
 #include "freenode.h"
 #include "sasanchr.h"
-#include "sasalloc.h"
+#include "sasallocpriv.h"
 #include "ultree.h"
 #include "sassim.h"
 #include "saslock.h"
 #include "sasconf.h"
 #include "sasstname.h"
+#include "sasatom.h"
+#include "sasmsync.h"
 #include "sphthread.h"
+#include "sphtimer.h"
 
 #define	createOnlyFlags (IPC_EXCL | IPC_CREAT | 0666 )
 #define	createFlags (IPC_CREAT | 0666 )
 #define	attachFlags ( 0666 )
 
+#ifndef TMPFS_MAGIC
+#define TMPFS_MAGIC 0x01021994
+#endif
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+/* Linux memory policy modes and flags, for mbind(2) and move_pages(2)
+   via syscall so no libnuma is required.  */
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT	0
+#define MPOL_PREFERRED	1
+#define MPOL_BIND	2
+#define MPOL_INTERLEAVE	3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE	(1 << 1)
+#endif
+
 typedef struct
 {
   SASBlockHeader header;
@@ -66,12 +92,65 @@ typedef struct
   uLongTreeNode *root;
 } roottype;
 
-unsigned long memLow __attribute__ ((visibility ("hidden")));
-unsigned long memHigh __attribute__ ((visibility ("hidden")));
+/* Regions joined by this process. The legacy SASJoinRegion APIs
+   join into the calling thread's region (region 0 by default) and
+   SASRegionJoin into the next free region. The macros below name
+   the fields of the calling thread's region.  */
+SASRegionState_t sasRegionTable[SAS_MAX_REGIONS] = {
+  {0, 0, __SAS_DEFAULT_BASE_ADDRESS, __SAS_DEFAULT_REGION_SIZE,
+   __SAS_DEFAULT_SEGMENT_SIZE, NULL, NULL, NULL, 0, 0, -1}
+};
+__thread SASRegionState_t *sasThreadRegion = NULL;
+
+#define memLow		(getSASRegionState ()->regionLow)
+#define memHigh		(getSASRegionState ()->regionHigh)
+#define mem_IDs		(getSASRegionState ()->memIDs)
+/* Geometry of the region (see sasconf.h). Set from the anchor block
+   of an existing store, or from the requested geometry when a new
+   store is created.  */
+#define sasRegionBase	(getSASRegionState ()->regionBase)
+#define sasRegionSize	(getSASRegionState ()->regionSize)
+#define sasSegmentSize	(getSASRegionState ()->segmentSize)
+/* Process local copy of the anchors hugePages flag, so the segment
+   attach path does not need to reference the anchor block.  */
+#define sasHugePages	(getSASRegionState ()->hugePages)
+/* SAS_JOIN_* options from the join, applied when segments are
+   attached eagerly (at join or by SASAttachNewSegs).  */
+#define sasJoinOptions	(getSASRegionState ()->joinOptions)
+/* The region's segments are on tmpfs (SAS_REGION_VOLATILE).  */
+#define sasVolatile	((getSASRegionMode () & SAS_REGION_VOLATILE) != 0)
+
+static void *SASBlockCacheGet (unsigned long blockSize);
+void *SASBlockAllocNoLock (unsigned long blockSize);
+
+/* NUMA placement (SAS_NUMA_*) for segments attached by this process.  */
+static int sasNumaPolicy = SAS_NUMA_DEFAULT;
+static int sasNumaNode = 0;
+
+/* Geometry requested via setSASRegionGeometry for new stores.  */
+static unsigned long sasReqRegionBase = __SAS_DEFAULT_BASE_ADDRESS;
+static unsigned long sasReqRegionSize = __SAS_DEFAULT_REGION_SIZE;
+static unsigned long sasReqSegmentSize = __SAS_DEFAULT_SEGMENT_SIZE;
+/* Count of joined regions, the SIGSEGV handler is installed while
+   this is non-zero.  */
+static int sasJoinedRegions = 0;
 
 key_t sas_key;
-int *mem_IDs;
 int sasClearOnDealloc = 0;
+int sasReleaseOnDealloc = 0;
+int sasBlockCacheDepth = 0;
+/* Count of segments attached on demand from the SIGSEGV handler.  */
+static long sasLazyAttachCount = 0;
+/* Size of the join attach worker pool, 0 selects automatically.  */
+static int sasJoinThreads = 0;
+/* Phase timings of the last join.  */
+static SASJoinStats_t sasJoinStats;
+/* Statistics of the last checkpoint.  */
+static SASCheckpointStats_t sasCkptStats;
+
+/* Maximum and minimum segment counts for a parallel join.  */
+#define SAS_JOIN_MAX_THREADS	16
+#define SAS_JOIN_PARALLEL_MIN	32
 
 #ifdef __WORDSIZE_64
 #define maxLog2 36
@@ -407,6 +486,20 @@ p2RemUsed (uLongTreeNode ** root, unsigned long size, void *loc)
     }
 }
 
+/* Return the per order block counts kept in the region statistics
+   for the free or uncommitted tree at root, or NULL for other trees.  */
+static long *
+p2Stats (uLongTreeNode ** root)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+  if (root == &(anchor->anchors.free))
+    return anchor->anchors.stats.freeBlocks;
+  if (root == &(anchor->anchors.uncommitted))
+    return anchor->anchors.stats.uncommittedBlocks;
+  return NULL;
+}
+
 static void *
 p2Alloc (uLongTreeNode ** root, unsigned long size)
 {
@@ -417,6 +510,7 @@ p2Alloc (uLongTreeNode ** root, unsigned long size)
   unsigned long result = 0;
   unsigned int j;
   unsigned int ui, uj;
+  long *stats = p2Stats (root);
 
 #ifdef __SASDebugPrint__
   sas_printf ("p2Alloc (%p, %lu)\n", root, size);
@@ -441,6 +535,8 @@ p2Alloc (uLongTreeNode ** root, unsigned long size)
 	      ui = longToOffset (k);
 	      uj = longToSize (k);
 	      result = l;	// nodeToLong(ui, j);
+	      if (stats)
+		stats[uj]--;
 	      if (j == uj)
 		{
 		  SASNearDealloc (n, sizeof (uLongTreeNode));
@@ -465,6 +561,8 @@ p2Alloc (uLongTreeNode ** root, unsigned long size)
 		      n->init (k, m);
 		      (*root)->insertNode (root, n);
 		      n = NULL;
+		      if (stats)
+			stats[uj]++;
 		    }
 #ifdef __SASDebugPrint__
 		  sas_printf ("\n");
@@ -495,7 +593,8 @@ p2Alloc (uLongTreeNode ** root, unsigned long size)
 }
 
 //#define __SASDebugPrint__ 1
-static void
+// Returns the key of the resulting (coalesced) block
+static unsigned long
 p2Dealloc (uLongTreeNode ** root, unsigned long size, void *loc)
 {
   uLongTreeNode *n;
@@ -505,6 +604,7 @@ p2Dealloc (uLongTreeNode ** root, unsigned long size, void *loc)
   unsigned long keys, ui;
   unsigned int uj;
   int flag;
+  long *stats = p2Stats (root);
 
   keys = nodeToLong ((val - memLow), SizeToLog2 (size));
   n = NULL;
@@ -534,6 +634,8 @@ p2Dealloc (uLongTreeNode ** root, unsigned long size, void *loc)
 	      n = n->removeNode (nn);
 	      SASNearDealloc (n, sizeof (uLongTreeNode));
 	      n = NULL;
+	      if (stats)
+		stats[uj]--;
 	      if (keys > k)
 		{
 		  ui = longToOffset (k);
@@ -570,9 +672,12 @@ p2Dealloc (uLongTreeNode ** root, unsigned long size, void *loc)
 
   n->init (keys, val);
   (*root)->insertNode (root, n);
+  if (stats)
+    stats[longToSize (keys)]++;
 #ifdef __SASDebugPrint__
   sas_printf ("\n -->%p,%p\n", (void *) keys, (void *) val);
 #endif
+  return keys;
 }
 
 static void
@@ -600,6 +705,24 @@ setSASmemrange (unsigned long low, unsigned long high)
     memHigh = high;
 }
 
+unsigned long
+getSASRegionBase (void)
+{
+  return sasRegionBase;
+}
+
+unsigned long
+getSASRegionSize (void)
+{
+  return sasRegionSize;
+}
+
+unsigned long
+getSASSegmentSize (void)
+{
+  return sasSegmentSize;
+}
+
 int
 getSASUseListFlag (void)
 {
@@ -630,6 +753,367 @@ setSASCompactUseList (void)
     anchor->anchors.rFlags.compactUseList = 1;
 }
 
+int
+getSASBlockAllocFlag (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  int flag = 0;
+
+  if (anchor != NULL)
+    flag = anchor->anchors.rFlags.buddyBitmap;
+
+  return flag;
+}
+
+void
+setSASTreeBlockAlloc (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+  if (anchor != NULL)
+    anchor->anchors.rFlags.buddyBitmap = 0;
+}
+
+void
+setSASBitmapBlockAlloc (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+  if (anchor != NULL)
+    anchor->anchors.rFlags.buddyBitmap = 1;
+}
+
+unsigned long
+getSASRegionMode (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  unsigned long mode = SAS_REGION_DEFAULT;
+
+  if (anchor != NULL)
+    {
+      if (anchor->anchors.rFlags.hugePages)
+	mode |= SAS_REGION_HUGEPAGE;
+      if (anchor->anchors.rFlags.volatileStore)
+	mode |= SAS_REGION_VOLATILE;
+    }
+
+  return mode;
+}
+
+static void
+setSASHugePages (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+  if (anchor != NULL)
+    anchor->anchors.rFlags.hugePages = 1;
+}
+
+static void
+setSASVolatile (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+  if (anchor != NULL)
+    anchor->anchors.rFlags.volatileStore = 1;
+}
+
+/* Return true if the directory is on tmpfs.  */
+static int
+SASStoreIsTmpfs (const char *store_name)
+{
+  struct statfs fs_buf;
+
+  if (statfs (store_name, &fs_buf) == 0)
+    return ((unsigned int) fs_buf.f_type == (unsigned int) TMPFS_MAGIC);
+
+  return 0;
+}
+
+/* Select the segment directory of the region being joined. A volatile
+   region keeps its segments in a tmpfs directory named for the device
+   and inode of the store directory, so every process joining the store
+   finds it. The tmpfs directory is used if it holds an anchor, or if a
+   new volatile region is requested and the store has no anchor.
+   Returns true if the region is volatile.  */
+static int
+SASSetSegPath (SASRegionState_t *region, unsigned long mode)
+{
+  char volPath[STORE_NAME_SIZE];
+  char anchorName[STORE_NAME_SIZE + 16];
+  struct stat stat_buf;
+
+  region->segPath = region->storePath;
+  if (stat (region->storePath, &stat_buf))
+    return 0;
+  if (SASStoreIsTmpfs (region->storePath))
+    return (mode & SAS_REGION_VOLATILE) != 0;
+
+  sas_sprintf (volPath, "%s/SASVOL.%lx.%lx", __SAS_VOLATILE_DIR,
+	       (unsigned long) stat_buf.st_dev,
+	       (unsigned long) stat_buf.st_ino);
+  sas_sprintf (anchorName, "%s/SAS00000.DAT", volPath);
+  if ((access (anchorName, F_OK) == 0)
+      || ((mode & SAS_REGION_VOLATILE) && !SASSegIndexExists (0)
+	  && ((mkdir (volPath, 0777) == 0) || (errno == EEXIST))))
+    {
+      region->segPath = strdup (volPath);
+      if (region->segPath == NULL)
+	region->segPath = region->storePath;
+    }
+  return region->segPath != region->storePath;
+}
+
+/* Free the segment directory of a region.  */
+static void
+SASFreeSegPath (SASRegionState_t *region)
+{
+  if (region->segPath != region->storePath)
+    free (region->segPath);
+  region->segPath = NULL;
+}
+
+/* Return true if the store directory is a hugetlbfs mount. In that
+   case every segment is backed by huge pages whatever the mode.  */
+static int
+SASStoreIsHugeTLB (const char *store_name)
+{
+  struct statfs fs_buf;
+
+  if (statfs (store_name, &fs_buf) == 0)
+    return ((unsigned int) fs_buf.f_type == (unsigned int) HUGETLBFS_MAGIC);
+
+  return 0;
+}
+
+/* Map the region's block map (see sasallocpriv.h), creating it for a
+   new region. Regions created without a block map (or restored from a
+   checkpoint, or snapshots) do without, SASFindHeader then probes.  */
+static void
+SASBlockMapOpen (SASRegionState_t *region, int create)
+{
+  char name[STORE_NAME_SIZE + 16];
+  size_t size = RegionSize >> SAS_BLOCKMAP_SHIFT;
+  struct stat stat_buf;
+  void *map;
+  int fd;
+
+  if ((sasJoinOptions & SAS_JOIN_SNAPSHOT)
+      || SASStoreIsHugeTLB (region->segPath))
+    return;
+  sas_sprintf (name, "%s/%s", region->segPath, SAS_BLOCKMAP_NAME);
+  fd = open (name, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0666);
+  if (fd == -1)
+    return;
+  if ((create && ftruncate (fd, size))
+      || fstat (fd, &stat_buf) || ((size_t) stat_buf.st_size != size))
+    {
+      close (fd);
+      return;
+    }
+  map = mmap (NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+  close (fd);
+  if (map != MAP_FAILED)
+    region->blockMap = (unsigned char *) map;
+}
+
+static void
+SASBlockMapClose (SASRegionState_t *region)
+{
+  if (region->blockMap != NULL)
+    munmap (region->blockMap, RegionSize >> SAS_BLOCKMAP_SHIFT);
+  region->blockMap = NULL;
+}
+
+static void
+SASBlockMapRemove (SASRegionState_t *region)
+{
+  char name[STORE_NAME_SIZE + 16];
+
+  sas_sprintf (name, "%s/%s", region->segPath, SAS_BLOCKMAP_NAME);
+  unlink (name);
+}
+
+/* Return the memory policy mode and node mask for a SAS_NUMA_*
+   policy.  */
+static int
+SASNumaMode (int policy, int node, unsigned long *nodemask)
+{
+  *nodemask = 0;
+  switch (policy)
+    {
+    case SAS_NUMA_INTERLEAVE:
+      /* The kernel limits the mask to the nodes with memory.  */
+      *nodemask = ~0UL;
+      return MPOL_INTERLEAVE;
+    case SAS_NUMA_PREFERRED:
+      *nodemask = 1UL << node;
+      return MPOL_PREFERRED;
+    case SAS_NUMA_BIND:
+      *nodemask = 1UL << node;
+      return MPOL_BIND;
+    default:
+      return MPOL_DEFAULT;
+    }
+}
+
+/* Apply a SAS_NUMA_* policy to the address range. flags may include
+   MPOL_MF_MOVE to migrate pages already faulted in. The policy of
+   the range only places new pages of tmpfs and hugetlbfs stores, see
+   SASNumaFault.  */
+static int
+SASNumaBind (void *addr, unsigned long size, int policy, int node,
+	     unsigned int flags)
+{
+#ifdef SYS_mbind
+  unsigned long nodemask;
+  int mode;
+  long rc;
+
+  if ((node < 0) || (node >= SAS_NUMA_MAX_NODES))
+    return EINVAL;
+
+  mode = SASNumaMode (policy, node, &nodemask);
+  rc = syscall (SYS_mbind, addr, size, mode,
+		(mode == MPOL_DEFAULT) ? NULL : &nodemask,
+		(mode == MPOL_DEFAULT) ? 0 : (SAS_NUMA_MAX_NODES + 1), flags);
+  if (rc)
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASNumaBind:mbind failed! %s:\n", strerror (errno));
+#endif
+      return errno;
+    }
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/* Fault in the pages of the range, for write if write is set.
+   Kernels without MADV_POPULATE_* fail with EINVAL, in that case
+   touch each page.  */
+static void
+SASPopulate (void *addr, unsigned long size, int write)
+{
+  volatile char *page = (volatile char *) addr;
+  volatile char *end = page + size;
+  unsigned long pgsize = getpagesize ();
+
+  if (madvise (addr, size, write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ)
+      == 0)
+    return;
+  for (; page < end; page += pgsize)
+    {
+      if (write)
+	*page = *page;
+      else
+	(void) *page;
+    }
+}
+
+/* Fault in the range with the calling thread's memory policy set to
+   a SAS_NUMA_* policy, then restore the thread's policy. The page
+   cache of a disk backed store ignores the mbind policy of the
+   mapping and allocates each page by the policy of the thread that
+   faults it in. Pages already in the page cache are not moved.  */
+static int
+SASNumaFault (void *addr, unsigned long size, int policy, int node,
+	      int write)
+{
+#if defined (SYS_set_mempolicy) && defined (SYS_get_mempolicy)
+  /* get_mempolicy needs room for all possible nodes.  */
+  unsigned long oldmask[1024 / (8 * sizeof (unsigned long))];
+  unsigned long nodemask;
+  int mode, oldmode;
+
+  if ((node < 0) || (node >= SAS_NUMA_MAX_NODES))
+    return EINVAL;
+  memset (oldmask, 0, sizeof (oldmask));
+  if (syscall (SYS_get_mempolicy, &oldmode, oldmask,
+	       (unsigned long) (8 * sizeof (oldmask)), NULL, 0))
+    return errno;
+  mode = SASNumaMode (policy, node, &nodemask);
+  if (syscall (SYS_set_mempolicy, mode,
+	       (mode == MPOL_DEFAULT) ? NULL : &nodemask,
+	       (mode == MPOL_DEFAULT) ? 0 : (SAS_NUMA_MAX_NODES + 1)))
+    return errno;
+  SASPopulate (addr, size, write);
+  syscall (SYS_set_mempolicy, oldmode,
+	   (oldmode == MPOL_DEFAULT) ? NULL : oldmask,
+	   (oldmode == MPOL_DEFAULT) ? 0 : (8 * sizeof (oldmask)));
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+int
+setSASNumaPolicy (int policy, int node)
+{
+  if ((policy < SAS_NUMA_DEFAULT) || (policy > SAS_NUMA_BIND)
+      || (node < 0) || (node >= SAS_NUMA_MAX_NODES))
+    return EINVAL;
+
+  sasNumaPolicy = policy;
+  sasNumaNode = node;
+  return 0;
+}
+
+/* Apply the region page mode to a newly mapped segment. Segments are
+   SegmentSize aligned within a SegmentSize aligned region, so with
+   the usual 2MB/16MB huge page sizes every segment is fully eligible
+   for transparent huge pages. For hugetlbfs stores the kernel ignores
+   (EINVAL) the advice, as the mapping is already huge page backed.
+   The process NUMA policy (setSASNumaPolicy) is applied first, if the
+   region's pages follow it.  */
+static void
+SASAdviseSeg (void *segAddr, unsigned long size)
+{
+  if ((sasNumaPolicy != SAS_NUMA_DEFAULT) && getSASRegionState ()->numaShmem)
+    SASNumaBind (segAddr, size, sasNumaPolicy, sasNumaNode, 0);
+
+#ifdef MADV_HUGEPAGE
+  if (sasHugePages)
+    {
+      if (madvise (segAddr, size, MADV_HUGEPAGE))
+	{
+#ifdef __SASDebugPrint__
+	  sas_printf ("SASAdviseSeg:madvise failed! %s:\n", strerror (errno));
+#endif
+	}
+    }
+#endif
+}
+
+/* Warm up an eagerly attached segment as requested by the join
+   options. SAS_JOIN_WILLNEED starts asynchronous read ahead of the
+   backing file. SAS_JOIN_POPULATE also pre-faults the page tables so
+   the first reference to each page does not take a minor fault. For
+   a disk backed store this is where the process NUMA policy places
+   the segment's pages.  */
+static void
+SASPrefaultSeg (void *segAddr, unsigned long size)
+{
+  if (sasJoinOptions & (SAS_JOIN_WILLNEED | SAS_JOIN_POPULATE))
+    madvise (segAddr, size, MADV_WILLNEED);
+
+  if (sasJoinOptions & SAS_JOIN_POPULATE)
+    {
+      if ((sasNumaPolicy == SAS_NUMA_DEFAULT)
+	  || getSASRegionState ()->numaShmem
+	  || SASNumaFault (segAddr, size, sasNumaPolicy, sasNumaNode, 0))
+	SASPopulate (segAddr, size, 0);
+    }
+}
+
 static int
 initSASSem (SASAnchor_t * anchor)
 {
@@ -655,9 +1139,23 @@ seizeSASSem (SASAnchor_t * anchor)
 {
   int rc;
 #ifdef __GNUC__
-  rc = sem_wait (&anchor->SASSem);
+  rc = sem_trywait (&anchor->SASSem);
+  if (rc != 0)
+    {
+      // Contended, time the wait for the region statistics.
+      sphtimer_t tStart = sphgettimer ();
+
+      rc = sem_wait (&anchor->SASSem);
+      if (rc == 0)
+	{
+	  anchor->stats.lockWaits++;
+	  anchor->stats.lockWaitTicks += sphgettimer () - tStart;
+	}
+    }
   if (rc != 0)
     sas_printf ("seizeSASSem: sem_wait failed: %s\n", strerror (errno));
+  else
+    anchor->stats.lockAcquires++;
 #else
   rc = msem_lock (&(anchor->SASSem), 0);
   if (rc != 0)
@@ -726,12 +1224,23 @@ initRegion ()
   anchorBlock->special = anchorBlock + 1;
   anchor = (SASAnchor_t *) anchorBlock->special;
   anchor->regionSize = RegionSize;
+  anchor->segmentSize = SegmentSize;
+  anchor->regionBase = memLow;
   anchor->finder = NULL;
   anchor->uncommitted = NULL;
   anchor->free = NULL;
   anchor->used = NULL;
   anchor->region = NULL;
   anchor->allocated = NULL;
+  anchor->buddyArenas = NULL;
+  anchor->buddyIndex = NULL;
+  anchor->buddyCurrent = NULL;
+  anchor->heapStamps = 0;
+  memset (&anchor->stats, 0, sizeof (anchor->stats));
+  anchor->stats.uncommittedBlocks[SizeToLog2 (SegmentSize)] = 1;
+  anchor->stats.usedBytes[SizeToLog2 (block__Size1M)] = block__Size1M;
+  anchor->stats.segmentsCommitted = 1;
+  anchor->stats.valid = SAS_STATS_VALID;
 
 #ifdef __SASDebugPrint__
   sas_printf ("initRegion uncommitted %lx\n", SegmentSize);
@@ -841,12 +1350,17 @@ SASAttachSegByName (void *baseAddr, unsigned long size,
       rc = 3;
     }
 #else
-  fd = open (name, O_RDWR);
+  // A snapshot is mapped copy on write and its files are not changed.
+  if (sasJoinOptions & SAS_JOIN_SNAPSHOT)
+    fd = open (name, O_RDONLY);
+  else
+    fd = open (name, O_RDWR);
   if (fd != -1)
     {
       BaseAddr1 = mmap (baseAddr, size,
 			(PROT_READ | PROT_WRITE),
-			(MAP_SHARED | MAP_FIXED), fd, 0);
+			(((sasJoinOptions & SAS_JOIN_SNAPSHOT)
+			  ? MAP_PRIVATE : MAP_SHARED) | MAP_FIXED), fd, 0);
       if ((long) BaseAddr1 == -1)
 	{
 	  sas_printf ("SASAttachSegByName:mmap failed! %s:\n",
@@ -854,7 +1368,10 @@ SASAttachSegByName (void *baseAddr, unsigned long size,
 	  rc = 2;
 	}
       else
-	mem_IDs[segIndex] = 1;
+	{
+	  mem_IDs[segIndex] = 1;
+	  SASAdviseSeg (BaseAddr1, size);
+	}
       close (fd);
     }
   else
@@ -927,6 +1444,49 @@ SASRemoveSegByAddr (void *segAddr, unsigned long size)
   return rc;
 }
 
+/* Create and map a segment of a volatile region with a single open.
+   The file is on tmpfs, so there is no need to sync it.  */
+static int
+SASCreateVolatileSeg (void *segAddr, unsigned long size, int segIndex,
+		      char *name)
+{
+  void *addr;
+  int fd;
+  int rc = 0;
+
+  fd = open (name, (O_CREAT | O_EXCL | O_RDWR), (0766));
+  if (fd == -1)
+    {
+      sas_printf ("SASCreateVolatileSeg:open failed! %s:\n",
+		  strerror (errno));
+      return 3;
+    }
+  if (ftruncate (fd, size))
+    {
+      sas_printf ("SASCreateVolatileSeg:truncate failed! %s:\n",
+		  strerror (errno));
+      rc = 1;
+    }
+  else
+    {
+      addr = mmap (segAddr, size, (PROT_READ | PROT_WRITE),
+		   (MAP_SHARED | MAP_FIXED), fd, 0);
+      if (addr == MAP_FAILED)
+	{
+	  sas_printf ("SASCreateVolatileSeg:mmap failed! %s:\n",
+		      strerror (errno));
+	  rc = 2;
+	}
+      else
+	{
+	  mem_IDs[segIndex] = 1;
+	  SASAdviseSeg (addr, size);
+	}
+    }
+  close (fd);
+  return rc;
+}
+
 int
 SASCreateSegByAddr (void *segAddr, unsigned long size)
 {
@@ -939,6 +1499,8 @@ SASCreateSegByAddr (void *segAddr, unsigned long size)
   sas_printf ("SASCreateSegByAddr(%p) -> %d\n", segAddr, segIndex);
 #endif
   SASSegNameIndexed (&name[0], segIndex);
+  if (sasVolatile)
+    return SASCreateVolatileSeg (segAddr, size, segIndex, name);
   rc = SASSegStoreCreateByName (name);
   if (rc)
     {
@@ -1004,6 +1566,8 @@ SASAttachAllocatedAddr (void *segAddr)
 	      if (SASAttachSegByAddr (segBase, blockSize))
 		sas_printf ("SASAttachAllocatedAddr:%s for %p:\n",
 			    "SASAttachSegByAddr failed", blockAddr);
+	      else
+		sas_fetch_and_add (&sasLazyAttachCount, 1);
 	      break;
 	    }
 	}
@@ -1011,17 +1575,94 @@ SASAttachAllocatedAddr (void *segAddr)
   while (n);
 }
 
-void
-SASAttachAllocatedSegs ()
+/* Attach the segment containing segAddr in region, from the SIGSEGV
+   handler of the faulting thread, which may have selected another
+   region.  */
+static void
+SASAttachRegionAddr (SASRegionState_t *region, void *segAddr)
+{
+  SASRegionState_t *saved = sasThreadRegion;
+
+  sasThreadRegion = region;
+  SASAttachAllocatedAddr (segAddr);
+  sasThreadRegion = saved;
+}
+
+static unsigned long
+SASTimerUsec (sphtimer_t ticks)
+{
+  sphtimer_t freq = sphfastcpufreq ();
+
+  if (freq == 0)
+    return 0;
+  return (unsigned long) ((ticks * 1000000ULL) / freq);
+}
+
+typedef struct
+{
+  void **segAddr;
+  unsigned long *segSize;
+  long count;
+  long next;
+  SASRegionState_t *region;
+} SASAttachWork_t;
+
+/* Attach worker for the join. Each worker (including the joining
+   thread) claims the next segment from the shared work list until
+   the list is exhausted.  */
+static void *
+SASAttachWorker (void *arg)
+{
+  SASAttachWork_t *work = (SASAttachWork_t *) arg;
+  SASRegionState_t *saved = sasThreadRegion;
+  long i;
+
+  // Workers attach into the joining thread's region.
+  sasThreadRegion = work->region;
+  while ((i = sas_fetch_and_add (&work->next, 1)) < work->count)
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASAttachAllocatedSegs segment <%p, %lx>\n",
+		  work->segAddr[i], work->segSize[i]);
+#endif
+      if (SASAttachSegByAddr (work->segAddr[i], work->segSize[i]))
+	sas_printf ("SASAttachAllocatedSegs:%s for %p:\n",
+		    "SASAttachSegByAddr failed", work->segAddr[i]);
+      else
+	SASPrefaultSeg (work->segAddr[i], work->segSize[i]);
+    }
+  sasThreadRegion = saved;
+
+  return NULL;
+}
+
+/* Attach all allocated segments (except the anchor segment) of the
+   region. If segMap is not NULL it is the result of a SAS store
+   directory scan and segments without a backing file are reported
+   and skipped. The segment list is collected first and then attached
+   by a pool of up to sasJoinThreads workers. Returns 0, or ENOMEM if
+   the list could not be allocated and nothing was attached.  */
+static int
+SASAttachAllocatedSegsMap (const char *segMap)
 {
   int cnt = 0;
   SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
   uLongTreeNode *n;
   uLongTreeNode *u = anchor->anchors.allocated;
+  SASAttachWork_t work;
+  pthread_t workers[SAS_JOIN_MAX_THREADS];
   void *blockAddr;
   unsigned long blockSize;
   unsigned long keys = 0;
-
+  unsigned long segIndex;
+  long max = 0;
+  int threads, started, i;
+
+  work.segAddr = NULL;
+  work.segSize = NULL;
+  work.count = 0;
+  work.next = 0;
+  work.region = getSASRegionState ();
   do
     {
       n = u->searchNextNode (u, keys);
@@ -1030,199 +1671,1443 @@ SASAttachAllocatedSegs ()
 	  blockAddr = (void *) n->getInfo ();
 	  keys = n->getKey ();
 	  blockSize = logTable[longToSize (keys)];
+	  segIndex = ((unsigned long) blockAddr - memLow) / SegmentSize;
 	  if (cnt != 0)
 	    {
-#ifdef __SASDebugPrint__
-	      sas_printf ("SASAttachAllocatedSegs segment <%p, %lx>\n",
-			  blockAddr, blockSize);
-#endif
-	      if (SASAttachSegByAddr (blockAddr, blockSize))
-		sas_printf ("SASAttachAllocatedSegs:%s for %p:\n",
-			    "SASAttachSegByAddr failed", blockAddr);
+	      if (segMap && !segMap[segIndex])
+		{
+		  sas_printf ("SASAttachAllocatedSegs:%s for %p:\n",
+			      "missing backing file", blockAddr);
+		}
+	      else
+		{
+		  if (work.count == max)
+		    {
+		      void **segAddr;
+		      unsigned long *segSize;
+
+		      max = max ? (max * 2) : 64;
+		      segAddr = (void **)
+			realloc (work.segAddr, max * sizeof (void *));
+		      if (segAddr != NULL)
+			work.segAddr = segAddr;
+		      segSize = (unsigned long *)
+			realloc (work.segSize, max * sizeof (unsigned long));
+		      if (segSize != NULL)
+			work.segSize = segSize;
+		      if ((segAddr == NULL) || (segSize == NULL))
+			{
+			  sas_printf ("SASAttachAllocatedSegs:%s\n",
+				      "malloc failed");
+			  free (work.segAddr);
+			  free (work.segSize);
+			  return ENOMEM;
+			}
+		    }
+		  work.segAddr[work.count] = blockAddr;
+		  work.segSize[work.count] = blockSize;
+		  work.count++;
+		}
 	    }
 	  cnt++;
 	};
     }
   while (n);
+
+  threads = sasJoinThreads;
+  if (threads == 0)
+    {
+      /* Auto: small regions are attached serially as the thread
+         create/join would cost more than it saves.  */
+      threads = 1;
+      if (work.count >= SAS_JOIN_PARALLEL_MIN)
+	threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+    }
+  if (threads > SAS_JOIN_MAX_THREADS)
+    threads = SAS_JOIN_MAX_THREADS;
+  if (threads > work.count)
+    threads = (int) work.count;
+
+  started = 0;
+  for (i = 1; i < threads; i++)
+    {
+      if (pthread_create (&workers[started], NULL, SASAttachWorker, &work))
+	break;
+      started++;
+    }
+  SASAttachWorker (&work);
+  for (i = 0; i < started; i++)
+    pthread_join (workers[i], NULL);
+
+  sasJoinStats.segments = work.count;
+  sasJoinStats.threads = started + 1;
+  free (work.segAddr);
+  free (work.segSize);
+  return 0;
 }
 
 void
-SASDetachAllocatedSegs ()
+SASAttachAllocatedSegs ()
 {
-  int cnt = 0;
+  SASAttachAllocatedSegsMap (NULL);
+}
+
+int
+SASAttachNewSegs (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  uLongTreeNode *n;
+  uLongTreeNode *u;
+  void **newSegs = NULL;
+  unsigned long *newSizes = NULL;
+  void *blockAddr;
+  unsigned long blockSize;
+  unsigned long keys = 0;
+  unsigned long segIndex;
+  int cnt = 0;
+  int max = 0;
+  int i;
+
+  /* Hold the anchor lock while walking the allocated list, as other
+     processes may be creating segments. The (potentially slow)
+     pre-fault is deferred until the lock is released.  */
+  SASSeize ();
+  u = anchor->anchors.allocated;
+  do
+    {
+      n = u->searchNextNode (u, keys);
+      if (n)
+	{
+	  blockAddr = (void *) n->getInfo ();
+	  keys = n->getKey ();
+	  blockSize = logTable[longToSize (keys)];
+	  segIndex = ((unsigned long) blockAddr - memLow) / SegmentSize;
+	  if (mem_IDs[segIndex] == 0)
+	    {
+	      if (SASAttachSegByAddr (blockAddr, blockSize))
+		{
+		  sas_printf ("SASAttachNewSegs:%s for %p:\n",
+			      "SASAttachSegByAddr failed", blockAddr);
+		}
+	      else
+		{
+		  if (cnt == max)
+		    {
+		      void **temp;
+		      unsigned long *sizes;
+		      max = max ? (max * 2) : 16;
+		      temp = (void **) realloc (newSegs, max * sizeof (void *));
+		      if (temp != NULL)
+			newSegs = temp;
+		      sizes = (unsigned long *)
+			realloc (newSizes, max * sizeof (unsigned long));
+		      if (sizes != NULL)
+			newSizes = sizes;
+		      if ((temp == NULL) || (sizes == NULL))
+			max = cnt;
+		    }
+		  if (cnt < max)
+		    {
+		      newSegs[cnt] = blockAddr;
+		      newSizes[cnt] = blockSize;
+		    }
+		  cnt++;
+		}
+	    }
+	}
+    }
+  while (n);
+  SASRelease ();
+
+  // Blocks larger than a segment are attached, so pre-faulted, whole.
+  for (i = 0; i < cnt && i < max; i++)
+    SASPrefaultSeg (newSegs[i], newSizes[i]);
+  free (newSegs);
+  free (newSizes);
+
+  return cnt;
+}
+
+long
+getSASLazyAttachCount (void)
+{
+  return sasLazyAttachCount;
+}
+
+void
+SASDetachAllocatedSegs ()
+{
+  int cnt = 0;
   SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
   uLongTreeNode *n;
   uLongTreeNode *u = anchor->anchors.allocated;
   void *blockAddr;
   unsigned long keys = 0;
 
-  do
+  do
+    {
+      n = u->searchNextNode (u, keys);
+      if (n)
+	{
+	  blockAddr = (void *) n->getInfo ();
+	  keys = n->getKey ();
+	  if (cnt != 0)
+	    {
+#ifdef __SASDebugPrint__
+	      unsigned long blockSize = logTable[longToSize (keys)];
+	      sas_printf ("SASDetachAllocatedSegs segment <%p, %lx>\n",
+			  blockAddr, blockSize);
+#endif
+	      SASDetachSegByAddr (blockAddr, SegmentSize);
+	    }
+	  cnt++;
+	};
+    }
+  while (n);
+}
+
+void
+SASRemoveAllocatedSegs ()
+{
+  int cnt = 0;
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  uLongTreeNode *n;
+  uLongTreeNode *u = anchor->anchors.allocated;
+  void *blockAddr;
+  unsigned long keys = 0;
+
+  do
+    {
+      n = u->searchNextNode (u, keys);
+      if (n)
+	{
+	  blockAddr = (void *) n->getInfo ();
+	  keys = n->getKey ();
+	  if (cnt > 0)
+	    {			/* What if segments are not contiguous? */
+	      if (SASRemoveSegByAddr (blockAddr, SegmentSize))
+		sas_printf ("SASRemoveAllocatedSegs:%s Error %s\n",
+			    "SASRemoveSegByAddr", strerror (errno));
+	    }
+	  cnt++;
+	};
+    }
+  while (n);
+}
+
+/* Lock-free buddy allocation (see setSASBitmapBlockAlloc). Whole
+   segments (arenas) are allocated from the region trees, under the
+   lock, and blocks smaller than a segment are then allocated within
+   the arenas using a free bitmap per order. A set bit marks a free
+   block of that order. The two buddies of a pair are adjacent bits of
+   the same word, so a block is coalesced with its buddy, or marked
+   free, by a single compare and swap and coalescing needs no lock.
+   The arena header and bitmaps occupy the first block of the arena.
+   A bit per segment in the arena index (buddyIndex) finds the arena
+   of a block being freed. Arenas are never freed, as a thread may
+   still be claiming a block from one without the lock.  */
+typedef struct SASBuddyArena
+{
+  struct SASBuddyArena *next;
+  unsigned long maxOrder;
+  /* Word index of each orders bitmap within bits.  */
+  unsigned long bitsOffset[maxLog2];
+  /* Approximate free blocks of each order, lets empty orders be
+     skipped without scanning their bitmaps.  */
+  long freeCount[maxLog2];
+  /* Word of each order's bitmap to start the next scan from.  */
+  unsigned long hint[maxLog2];
+  unsigned long bits[1];
+} SASBuddyArena_t;
+
+#define buddyBits	(sizeof (unsigned long) * 8)
+
+static inline unsigned long
+SASBuddyWords (SASBuddyArena_t *arena, unsigned long order)
+{
+  unsigned long nbits = 1UL << (arena->maxOrder - order);
+
+  return (nbits + buddyBits - 1) / buddyBits;
+}
+
+/* Claim a free block of the order, return its index or -1.  */
+static long
+SASBuddyClaim (SASBuddyArena_t *arena, unsigned long order)
+{
+  unsigned long *bits = &arena->bits[arena->bitsOffset[order]];
+  unsigned long words = SASBuddyWords (arena, order);
+  unsigned long start = arena->hint[order];
+  unsigned long i, w, cur, bit;
+
+  if (arena->freeCount[order] <= 0)
+    return -1;
+  if (start >= words)
+    start = 0;
+  for (i = 0; i < words; i++)
+    {
+      w = start + i;
+      if (w >= words)
+	w -= words;
+      cur = bits[w];
+      while (cur != 0)
+	{
+	  bit = cur & -cur;
+	  if (sas_compare_and_swap ((long int *) &bits[w], cur, cur & ~bit))
+	    {
+	      sas_atomic_dec_long (&arena->freeCount[order]);
+	      arena->hint[order] = w;
+	      return (w * buddyBits) + __builtin_ctzl (bit);
+	    }
+	  cur = bits[w];
+	}
+    }
+  return -1;
+}
+
+static void *
+SASBuddyArenaAlloc (SASBuddyArena_t *arena, unsigned long order)
+{
+  unsigned long j;
+  long idx = -1;
+
+  if (order > arena->maxOrder)
+    return NULL;
+  for (j = order; j <= arena->maxOrder; j++)
+    {
+      idx = SASBuddyClaim (arena, j);
+      if (idx >= 0)
+	break;
+    }
+  if (idx < 0)
+    return NULL;
+
+  // Keep the low half of each split, the high half is free.
+  while (j > order)
+    {
+      j--;
+      idx <<= 1;
+      sas_fetch_and_or_long (&arena->bits[arena->bitsOffset[j]
+					   + ((idx + 1) / buddyBits)],
+			     1UL << ((idx + 1) % buddyBits));
+      sas_atomic_inc_long (&arena->freeCount[j]);
+    }
+  return (char *) arena + ((unsigned long) idx << (order + 12));
+}
+
+static void
+SASBuddyArenaFree (SASBuddyArena_t *arena, void *blockAddr,
+		   unsigned long order)
+{
+  unsigned long idx = ((unsigned long) blockAddr - (unsigned long) arena)
+    >> (order + 12);
+  unsigned long *word;
+  unsigned long cur, mine, buddy;
+
+  while (1)
+    {
+      word = &arena->bits[arena->bitsOffset[order] + (idx / buddyBits)];
+      mine = 1UL << (idx % buddyBits);
+      buddy = (order < arena->maxOrder) ? 1UL << ((idx ^ 1) % buddyBits) : 0;
+      do
+	{
+	  cur = *word;
+	  if (cur & mine)
+	    {
+	      sas_printf ("!SASBuddyFree integrity check failed %p\n",
+			  blockAddr);
+	      return;
+	    }
+	}
+      while (!sas_compare_and_swap ((long int *) word, cur,
+				    (cur & buddy) ? (cur & ~buddy)
+						  : (cur | mine)));
+      if (!(cur & buddy))
+	{
+	  sas_atomic_inc_long (&arena->freeCount[order]);
+	  arena->hint[order] = idx / buddyBits;
+	  return;
+	}
+      // Took the free buddy, free the pair as one block.
+      sas_atomic_dec_long (&arena->freeCount[order]);
+      idx >>= 1;
+      order++;
+    }
+}
+
+/* Initialize a new arena in a segment allocated from the trees.  */
+static SASBuddyArena_t *
+SASBuddyArenaInit (void *segAddr)
+{
+  SASBuddyArena_t *arena = (SASBuddyArena_t *) segAddr;
+  unsigned long maxOrder = SizeToLog2 (SegmentSize);
+  unsigned long words = 0;
+  unsigned long hdr, j, k;
+
+  memset (arena, 0, sizeof (SASBuddyArena_t));
+  arena->maxOrder = maxOrder;
+  for (k = 0; k <= maxOrder; k++)
+    {
+      arena->bitsOffset[k] = words;
+      words += SASBuddyWords (arena, k);
+    }
+  hdr = sizeof (SASBuddyArena_t) + (words * sizeof (unsigned long));
+  memset (arena->bits, 0, words * sizeof (unsigned long));
+
+  // Reserve the first block for the header, its buddies are free.
+  for (j = 0; (logTable[j] < hdr) && (j < maxOrder); j++)
+    ;
+  for (k = j; k < maxOrder; k++)
+    {
+      arena->bits[arena->bitsOffset[k]] = 2UL;
+      arena->freeCount[k] = 1;
+    }
+  return arena;
+}
+
+/* Return the arena of the segment containing blockAddr, or NULL,
+   from the segment's bit in the arena index.  */
+static SASBuddyArena_t *
+SASBuddyArenaOf (void *blockAddr)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  unsigned long *index = anchor->anchors.buddyIndex;
+  unsigned long seg;
+
+  if ((index == NULL) || ((unsigned long) blockAddr < memLow)
+      || ((unsigned long) blockAddr >= memHigh))
+    return NULL;
+  seg = ((unsigned long) blockAddr - memLow) / SegmentSize;
+  if (!(index[seg / buddyBits] & (1UL << (seg % buddyBits))))
+    return NULL;
+  return (SASBuddyArena_t *) (memLow + (seg * SegmentSize));
+}
+
+/* Allocate the arena index, with the region lock held, when the first
+   arena is added. Returns NULL if it does not fit in a block.  */
+static unsigned long *
+SASBuddyIndexNoLock (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  unsigned long words = ((RegionSize / SegmentSize) + buddyBits - 1)
+    / buddyBits;
+  unsigned long size = block__Size4K;
+  unsigned long *index;
+
+  if (anchor->anchors.buddyIndex)
+    return anchor->anchors.buddyIndex;
+  while (size < (words * sizeof (unsigned long)))
+    size <<= 1;
+  if (size > SegmentSize)
+    return NULL;
+  index = (unsigned long *) SASBlockAllocNoLock (size);
+  if (index)
+    {
+      memset (index, 0, size);
+      __sync_synchronize ();
+      anchor->anchors.buddyIndex = index;
+    }
+  return index;
+}
+
+/* Allocate from the buddy arenas without the region lock, adding an
+   arena (with the lock) if they are full. The arena of the last
+   allocation is tried first, so the list is only walked when it is
+   full.  */
+static void *
+SASBuddyAlloc (unsigned long blockSize)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  unsigned long order = SizeToLog2 (blockSize);
+  SASBuddyArena_t *arena, *head, *current;
+  unsigned long *index;
+  unsigned long seg;
+  void *temp = NULL;
+  void *segAddr;
+
+  current = (SASBuddyArena_t *) anchor->anchors.buddyCurrent;
+  if (current)
+    {
+      temp = SASBuddyArenaAlloc (current, order);
+      if (temp)
+	return temp;
+    }
+  head = (SASBuddyArena_t *) anchor->anchors.buddyArenas;
+  for (arena = head; arena != NULL; arena = arena->next)
+    {
+      if (arena == current)
+	continue;
+      temp = SASBuddyArenaAlloc (arena, order);
+      if (temp)
+	{
+	  anchor->anchors.buddyCurrent = arena;
+	  return temp;
+	}
+    }
+
+  SASSeize ();
+  // Another thread may have added an arena meanwhile.
+  if (anchor->anchors.buddyArenas == head)
+    {
+      index = SASBuddyIndexNoLock ();
+      segAddr = index ? SASBlockAllocNoLock (SegmentSize) : NULL;
+      if (segAddr)
+	{
+	  arena = SASBuddyArenaInit (segAddr);
+	  arena->next = head;
+	  seg = ((unsigned long) segAddr - memLow) / SegmentSize;
+	  __sync_synchronize ();
+	  sas_fetch_and_or_long (&index[seg / buddyBits],
+				 1UL << (seg % buddyBits));
+	  anchor->anchors.buddyArenas = arena;
+	  anchor->anchors.buddyCurrent = arena;
+	}
+    }
+  arena = (SASBuddyArena_t *) anchor->anchors.buddyArenas;
+  SASRelease ();
+
+  if (arena != head)
+    temp = SASBuddyArenaAlloc (arena, order);
+  return temp;
+}
+
+/* Free a block to its buddy arena without the region lock. Returns
+   0, or -1 if the block is not in an arena.  */
+static int
+SASBuddyDealloc (void *blockAddr, unsigned long blockSize)
+{
+  SASBuddyArena_t *arena;
+
+  if (blockSize >= SegmentSize)
+    return -1;
+  arena = SASBuddyArenaOf (blockAddr);
+  if (arena == NULL)
+    return -1;
+  SASBuddyArenaFree (arena, blockAddr, SizeToLog2 (blockSize));
+  return 0;
+}
+
+/* Per thread allocation counts, added to the statistics of the
+   region (shared) every SAS_STATS_BATCH calls.  */
+#define SAS_STATS_BATCH	64
+
+typedef struct
+{
+  SASAnchorStats_t *shared;
+  long pending;
+  long allocCount;
+  long allocFailures;
+  long deallocCount;
+} SASStatsThread_t;
+
+static __thread SASStatsThread_t sasStatsThread;
+
+static void SASBlockCacheThreadInit (void);
+
+/* Add the counts of this thread to the statistics they were taken
+   for, if that region is still joined, and clear them.  */
+static void
+SASStatsFlushThread (SASStatsThread_t *t)
+{
+  SASAnchorStats_t *shared = t->shared;
+
+  if (t->pending && getSASRegionStateByAddr ((unsigned long) shared))
+    {
+      if (t->allocCount)
+	sas_fetch_and_add (&shared->allocCount, t->allocCount);
+      if (t->allocFailures)
+	sas_fetch_and_add (&shared->allocFailures, t->allocFailures);
+      if (t->deallocCount)
+	sas_fetch_and_add (&shared->deallocCount, t->deallocCount);
+    }
+  memset (t, 0, sizeof (*t));
+}
+
+static void
+SASStatsFlush (void)
+{
+  SASStatsFlushThread (&sasStatsThread);
+}
+
+/* Count allocated of requested blocks, and deallocated blocks, in the
+   region statistics, without the region lock.  */
+static void
+SASStatsCount (int allocated, int requested, int deallocated)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  SASStatsThread_t *t = &sasStatsThread;
+
+  if (t->shared != &anchor->anchors.stats)
+    {
+      SASStatsFlushThread (t);
+      t->shared = &anchor->anchors.stats;
+      SASBlockCacheThreadInit ();
+    }
+  t->allocCount += allocated;
+  if (allocated < requested)
+    t->allocFailures++;
+  t->deallocCount += deallocated;
+  if (++t->pending >= SAS_STATS_BATCH)
+    {
+      SASAnchorStats_t *shared = t->shared;
+      SASStatsFlushThread (t);
+      t->shared = shared;
+    }
+}
+
+/* Add the entries of the tree u to the per order block counts and
+   byte counts, if not NULL. Returns the total bytes of the entries.  */
+static unsigned long
+SASStatsCountTree (uLongTreeNode *u, long *blocks, long *bytes)
+{
+  uLongTreeNode *n;
+  unsigned long keys = 0;
+  unsigned long total = 0;
+  unsigned int order;
+
+  if (u == NULL)
+    return 0;
+  do
+    {
+      n = u->searchNextNode (u, keys);
+      if (n)
+	{
+	  keys = n->getKey ();
+	  order = longToSize (keys);
+	  if (blocks)
+	    blocks[order]++;
+	  if (bytes)
+	    bytes[order] += logTable[order];
+	  total += logTable[order];
+	}
+    }
+  while (n);
+  return total;
+}
+
+/* Recount the region statistics from the trees, with the region lock
+   held. For stores created before the statistics were kept.  */
+static void
+SASRegionStatsRebuild (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  SASAnchorStats_t *stats = &anchor->anchors.stats;
+  unsigned long segBytes;
+
+  memset (stats, 0, sizeof (*stats));
+  SASStatsCountTree (anchor->anchors.free, stats->freeBlocks, NULL);
+  SASStatsCountTree (anchor->anchors.uncommitted, stats->uncommittedBlocks,
+		     NULL);
+  SASStatsCountTree (anchor->anchors.used, NULL, stats->usedBytes);
+  segBytes = SASStatsCountTree (anchor->anchors.allocated, NULL, NULL);
+  stats->segmentsCommitted = segBytes / SegmentSize;
+  stats->valid = SAS_STATS_VALID;
+}
+
+/* Take a block from the free or uncommitted trees of the calling
+   thread's region, with the region lock held, without recording it
+   on the used tree. If extend is set a new segment is created when
+   the trees have no space.  */
+static void *
+SASBlockTakeNoLock (unsigned long blockSize, int extend)
+{
+  void *temp = NULL;
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  uLongTreeNode **nn = &(anchor->anchors.free);
+  uLongTreeNode **uu;
+
+  if (anchor->anchors.free)
+    {
+      temp = p2Alloc (nn, blockSize);
+    }
+  if (!temp)
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASBlockAlloc no free space for %lx\n", blockSize);
+#endif
+      nn = &(anchor->anchors.uncommitted);
+      temp = p2Alloc (nn, blockSize);
+      if (!temp && extend)
+	{
+	  void *segAddr;
+#ifdef __SASDebugPrint__
+	  sas_printf ("SASBlockAlloc no uncommitted %lx\n", blockSize);
+#endif
+	  nn = &(anchor->anchors.region);
+	  segAddr = p2Alloc (nn, SegmentSize);
+	  if (segAddr)
+	    {
+	      if (!SASCreateSegByAddr (segAddr, SegmentSize))
+		{
+		  uu = &(anchor->anchors.allocated);
+		  p2AddUsed (uu, SegmentSize, segAddr);
+		  anchor->anchors.stats.segmentsCommitted++;
+		  nn = &(anchor->anchors.uncommitted);
+		  p2Dealloc (nn, SegmentSize, segAddr);
+		  temp = SASBlockTakeNoLock (blockSize, 0);
+		}
+	      else
+		{
+		  sas_printf ("SASBlockAlloc attach failed %lx\n", blockSize);
+		}
+	    }
+	  else
+	    {
+	      sas_printf ("SASBlockAlloc no region %lx\n", blockSize);
+	    }
+	}
+    }
+  return temp;
+}
+
+/* Record a block on the used tree, with the region lock held.  */
+static void
+SASBlockAddUsedNoLock (void *blockAddr, unsigned long blockSize)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  uLongTreeNode **uu = &(anchor->anchors.used);
+
+  if (anchor->anchors.rFlags.compactUseList)
+    p2AddUsedCompact (uu, blockSize, blockAddr);
+  else
+    p2AddUsed (uu, blockSize, blockAddr);
+}
+
+void *
+SASBlockAllocNoLock (unsigned long blockSize)
+{
+  void *temp;
+
+#ifdef __SASDebugPrint__
+  sas_printf ("SASBlockAlloc (%lx)\n", blockSize);
+#endif
+  temp = SASBlockTakeNoLock (blockSize, 1);
+  if (temp)
+    {
+      SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+      SASBlockAddUsedNoLock (temp, blockSize);
+      anchor->anchors.stats.usedBytes[SizeToLog2 (blockSize)] += blockSize;
+    }
+  return temp;
+}
+
+void *
+SASBlockAlloc (unsigned long blockSize)
+{
+  void *temp = NULL;
+  sphtimer_t tStart = SASLatencyStart ();
+#ifdef __SASDebugPrint__
+  sas_printf ("SASBlockAlloc (%lx)\n", blockSize);
+#endif
+  if (blockSize <= SegmentSize)
+    {
+      SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+      temp = SASBlockCacheGet (blockSize);
+      if ((temp == NULL) && (blockSize < SegmentSize)
+	  && anchor->anchors.rFlags.buddyBitmap)
+	temp = SASBuddyAlloc (blockSize);
+      if (temp == NULL)
+	{
+	  SASSeize ();
+	  temp = SASBlockAllocNoLock (blockSize);
+	  SASRelease ();
+	}
+    }
+  else
+    {
+      sas_printf ("SASBlockAlloc blocksize exceeds segment size\n");
+    }
+  SASStatsCount (temp ? 1 : 0, 1, 0);
+  SASLatencyRecord (SAS_LATENCY_BLOCK_ALLOC, tStart);
+  return temp;
+}
+
+int
+SASBlockAllocMany (unsigned long blockSize, int count, void **blocks)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  unsigned long run, maxRun, off;
+  char *chunk;
+  int n = 0;
+  sphtimer_t tStart = SASLatencyStart ();
+
+  if (blockSize > SegmentSize)
+    {
+      sas_printf ("SASBlockAllocMany blocksize exceeds segment size\n");
+      SASStatsCount (0, count, 0);
+      SASLatencyRecord (SAS_LATENCY_BLOCK_ALLOC_MANY, tStart);
+      return 0;
+    }
+
+  if ((blockSize < SegmentSize) && anchor->anchors.rFlags.buddyBitmap)
+    {
+      while ((n < count) && ((blocks[n] = SASBuddyAlloc (blockSize)) != NULL))
+	n++;
+      SASStatsCount (n, count, 0);
+      SASLatencyRecord (SAS_LATENCY_BLOCK_ALLOC_MANY, tStart);
+      return n;
+    }
+
+  SASSeize ();
+  while (n < count)
+    {
+      // Take the remaining blocks as one power of 2 run where the
+      // trees allow, before creating a segment.
+      maxRun = blockSize;
+      while ((maxRun < SegmentSize)
+	     && ((maxRun << 1) <= blockSize * (unsigned long) (count - n)))
+	maxRun <<= 1;
+      chunk = NULL;
+      for (run = maxRun; run >= blockSize; run >>= 1)
+	{
+	  chunk = (char *) SASBlockTakeNoLock (run, 0);
+	  if (chunk)
+	    break;
+	}
+      if (!chunk)
+	{
+	  run = maxRun;
+	  chunk = (char *) SASBlockTakeNoLock (run, 1);
+	  if (!chunk)
+	    break;
+	}
+      // The run is recorded as one used block, p2RemUsed splits it as
+      // the blocks are deallocated.
+      SASBlockAddUsedNoLock (chunk, run);
+      anchor->anchors.stats.usedBytes[SizeToLog2 (blockSize)] += run;
+      for (off = 0; off < run; off += blockSize)
+	blocks[n++] = chunk + off;
+    }
+  SASRelease ();
+  SASStatsCount (n, count, 0);
+  SASLatencyRecord (SAS_LATENCY_BLOCK_ALLOC_MANY, tStart);
+  return n;
+}
+
+void *
+SASBlockAllocNode (unsigned long blockSize, int node)
+{
+  void *temp = SASBlockAlloc (blockSize);
+  SASRegionState_t *region;
+
+  if (temp != NULL)
+    {
+      SASNumaBind (temp, blockSize, SAS_NUMA_PREFERRED, node, MPOL_MF_MOVE);
+      // The page cache of a disk backed store is placed by the faulting
+      // thread's policy, so fault the block in on the node.
+      region = getSASRegionStateByAddr ((unsigned long) temp);
+      if ((region != NULL) && !region->numaShmem)
+	SASNumaFault (temp, blockSize, SAS_NUMA_PREFERRED, node, 1);
+    }
+  return temp;
+}
+
+int
+SASNumaResidency (unsigned long *nodePages, int maxNodes)
+{
+#ifdef SYS_move_pages
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  uLongTreeNode *n;
+  uLongTreeNode *u;
+  unsigned long pgsize = getpagesize ();
+  unsigned long keys = 0;
+  unsigned long blockSize, off, i, cnt;
+  unsigned char vec[1024];
+  void *pages[1024];
+  int status[1024];
+  char *blockAddr;
+  int nodes = 0;
+
+  if (anchor == NULL)
+    return -1;
+  memset (nodePages, 0, maxNodes * sizeof (unsigned long));
+  u = anchor->anchors.allocated;
+  SASSeize ();
+  do
+    {
+      n = u->searchNextNode (u, keys);
+      if (n)
+	{
+	  blockAddr = (char *) n->getInfo ();
+	  keys = n->getKey ();
+	  blockSize = logTable[longToSize (keys)];
+	  /* mincore fails for segments not yet (lazily) attached.  */
+	  if (mincore (blockAddr, pgsize, vec)
+	      && SASAttachSegByAddr (blockAddr, blockSize))
+	    continue;
+	  for (off = 0; off < blockSize; off += (1024 * pgsize))
+	    {
+	      unsigned long len = blockSize - off;
+	      if (len > (1024 * pgsize))
+		len = 1024 * pgsize;
+	      /* Only count pages in the page cache. Touching those maps
+	         them in this process, which move_pages needs to report
+	         their node.  */
+	      if (mincore (blockAddr + off, len, vec))
+		break;
+	      cnt = 0;
+	      for (i = 0; i < (len / pgsize); i++)
+		{
+		  if (vec[i] & 1)
+		    {
+		      pages[cnt] = blockAddr + off + (i * pgsize);
+		      (void) *(volatile char *) pages[cnt];
+		      cnt++;
+		    }
+		}
+	      if ((cnt == 0)
+		  || syscall (SYS_move_pages, 0, cnt, pages, NULL, status, 0))
+		continue;
+	      for (i = 0; i < cnt; i++)
+		{
+		  if ((status[i] >= 0) && (status[i] < maxNodes))
+		    {
+		      nodePages[status[i]]++;
+		      if (status[i] >= nodes)
+			nodes = status[i] + 1;
+		    }
+		}
+	    }
+	}
+    }
+  while (n);
+  SASRelease ();
+
+  return nodes;
+#else
+  return -1;
+#endif
+}
+
+/* Return true if deallocated blocks of the current region are
+   released, see sasReleaseOnDealloc and SAS_JOIN_RELEASE.  */
+static inline int
+SASReleaseOnDealloc (void)
+{
+  return sasReleaseOnDealloc || (sasJoinOptions & SAS_JOIN_RELEASE);
+}
+
+/* Release a segment of the current region that is entirely free.
+   Punch out the segment file's blocks and unmap it in this process.
+   The file keeps its size, so other processes sharing the store keep
+   a valid (zero filled) mapping, and a later allocation from the
+   segment attaches it again on demand.  */
+static void
+SASReleaseFreeSeg (void *segAddr)
+{
+  unsigned long segIndex = ((unsigned long) segAddr - memLow) / SegmentSize;
+
+#ifdef __SASDebugPrint__
+  sas_printf ("SASReleaseFreeSeg(%p) -> %lu\n", segAddr, segIndex);
+#endif
+#if defined(FALLOC_FL_PUNCH_HOLE) && !defined(__USE_SHM)
+  char name[STORE_NAME_SIZE];
+  int fd;
+
+  SASSegNameIndexed (&name[0], segIndex);
+  fd = open (name, O_RDWR);
+  if (fd != -1)
+    {
+      if (fallocate (fd, (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE),
+		     0, SegmentSize))
+	{
+#ifdef __SASDebugPrint__
+	  sas_printf ("SASReleaseFreeSeg:fallocate failed! %s:\n",
+		      strerror (errno));
+#endif
+	}
+      close (fd);
+    }
+#endif
+  if (mem_IDs[segIndex])
+    SASDetachSegByAddr (segAddr, SegmentSize);
+}
+
+/* Return a block to the free tree of the calling thread's region,
+   with the region lock held. The block was already zeroed or punched
+   out by SASBlockScrub.  */
+static void
+SASBlockFreeNoLock (void *blockAddr, unsigned long blockSize)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  uLongTreeNode **nn;
+  uLongTreeNode **uu;
+  unsigned long keys;
+
+  uu = &(anchor->anchors.used);
+  p2RemUsed (uu, blockSize, blockAddr);
+  anchor->anchors.stats.usedBytes[SizeToLog2 (blockSize)] -= blockSize;
+  nn = &(anchor->anchors.free);
+  keys = p2Dealloc (nn, blockSize, blockAddr);
+
+  // Release the segments this block completed as entirely free. Other
+  // segments of a larger coalesced block were released when they
+  // became free.
+  if (SASReleaseOnDealloc () && (logTable[longToSize (keys)] >= SegmentSize))
+    {
+      unsigned long segMask = ~(SegmentSize - 1);
+      unsigned long seg = (unsigned long) blockAddr & segMask;
+      unsigned long end = (unsigned long) blockAddr + blockSize;
+
+      do
+	{
+	  SASReleaseFreeSeg ((void *) seg);
+	  seg += SegmentSize;
+	}
+      while (seg < end);
+    }
+}
+
+/* Prepare a block owned by the caller for reuse, without the region
+   lock. If punch is set, blocks larger than a page are punched out,
+   otherwise (or if that fails) the header page is cleared.  */
+static void
+SASBlockScrub (void *blockAddr, unsigned long blockSize, int punch)
+{
+  if (punch && (blockSize > (unsigned long) getpagesize ())
+      && (sasMsyncRemove (blockAddr, blockSize) == 0))
+    return;
+
+//  initialize block to zeros, needed only in windows/AIX/OS2
+  if (blockSize > 4096)
+    memset (blockAddr, 0, 4096);
+  else
+    memset (blockAddr, 0, blockSize);
+
+  if (sasClearOnDealloc && (blockSize > 4096))
+    memset ((char *) blockAddr + 4096, 0, blockSize - 4096);
+}
+
+/* Per thread cache of recently deallocated blocks, for each region
+   and small block size. Cached blocks stay on the region's used tree,
+   so they are owned by the thread until returned to the free tree in
+   batches, under a single region lock, by SASBlockCacheDrain. A
+   cache filled before its region was released (cacheGen changed) is
+   discarded.  */
+typedef struct
+{
+  unsigned long gen;
+  int count[SAS_BLOCK_CACHE_CLASSES];
+  void *blocks[SAS_BLOCK_CACHE_CLASSES][SAS_BLOCK_CACHE_DEPTH];
+} SASBlockCache_t;
+
+static __thread SASBlockCache_t sasBlockCache[SAS_MAX_REGIONS];
+static __thread int sasBlockCacheThread = 0;
+static pthread_key_t sasBlockCacheKey;
+static pthread_once_t sasBlockCacheOnce = PTHREAD_ONCE_INIT;
+
+static SASBlockCache_t *
+SASBlockCacheCheck (SASRegionState_t *region)
+{
+  SASBlockCache_t *cache = &sasBlockCache[region - sasRegionTable];
+
+  if (cache->gen != region->cacheGen)
+    {
+      memset (cache->count, 0, sizeof (cache->count));
+      cache->gen = region->cacheGen;
+    }
+  return cache;
+}
+
+/* Return the oldest n blocks of a size class to the region.  */
+static void
+SASBlockCacheDrain (SASRegionState_t *region, int cls, int n)
+{
+  SASRegionState_t *saved = sasThreadRegion;
+  SASBlockCache_t *cache = SASBlockCacheCheck (region);
+  unsigned long blockSize = logTable[cls];
+  void **blocks = cache->blocks[cls];
+  int i;
+
+  if (n > cache->count[cls])
+    n = cache->count[cls];
+  if (n == 0)
+    return;
+
+  sasThreadRegion = region;
+  for (i = 0; i < n; i++)
+    {
+      if (SASReleaseOnDealloc ())
+	SASBlockScrub (blocks[i], blockSize, 1);
+      if (SASBuddyDealloc (blocks[i], blockSize) == 0)
+	blocks[i] = NULL;
+    }
+  SASSeize ();
+  for (i = 0; i < n; i++)
+    if (blocks[i] != NULL)
+      SASBlockFreeNoLock (blocks[i], blockSize);
+  SASRelease ();
+  sasThreadRegion = saved;
+
+  cache->count[cls] -= n;
+  memmove (&blocks[0], &blocks[n], cache->count[cls] * sizeof (void *));
+}
+
+static void SASHeapMagazineExit (void);
+
+static void
+SASBlockCacheExit (void *arg __attribute__ ((unused)))
+{
+  SASHeapMagazineExit ();
+  SASBlockCacheFlush ();
+  SASStatsFlush ();
+  SASLatencyFlush ();
+}
+
+/* Thread specific destructors do not run for the thread that calls
+   exit (or returns from main).  */
+static void
+SASBlockCacheAtExit (void)
+{
+  if (sasBlockCacheThread)
+    SASBlockCacheExit (NULL);
+}
+
+static void
+SASBlockCacheKeyInit (void)
+{
+  pthread_key_create (&sasBlockCacheKey, SASBlockCacheExit);
+  atexit (SASBlockCacheAtExit);
+}
+
+/* Flush the thread's block cache, heap magazines, allocation and
+   latency counts when it exits.  */
+static void
+SASBlockCacheThreadInit (void)
+{
+  if (!sasBlockCacheThread)
     {
-      n = u->searchNextNode (u, keys);
-      if (n)
-	{
-	  blockAddr = (void *) n->getInfo ();
-	  keys = n->getKey ();
-	  if (cnt != 0)
-	    {
-#ifdef __SASDebugPrint__
-	      unsigned long blockSize = logTable[longToSize (keys)];
-	      sas_printf ("SASDetachAllocatedSegs segment <%p, %lx>\n",
-			  blockAddr, blockSize);
-#endif
-	      SASDetachSegByAddr (blockAddr, SegmentSize);
-	    }
-	  cnt++;
-	};
+      pthread_once (&sasBlockCacheOnce, SASBlockCacheKeyInit);
+      pthread_setspecific (sasBlockCacheKey, &sasBlockCacheThread);
+      sasBlockCacheThread = 1;
     }
-  while (n);
+}
+
+/* Cache a deallocated block, return 0 if it is not cacheable.  */
+static int
+SASBlockCachePut (void *blockAddr, unsigned long blockSize)
+{
+  SASRegionState_t *region = getSASRegionState ();
+  SASBlockCache_t *cache;
+  unsigned int cls;
+  int depth = sasBlockCacheDepth;
+
+  if (depth > SAS_BLOCK_CACHE_DEPTH)
+    depth = SAS_BLOCK_CACHE_DEPTH;
+  if ((depth <= 0) || (region->regionLow == 0))
+    return 0;
+  cls = SizeToLog2 (blockSize);
+  if ((cls >= SAS_BLOCK_CACHE_CLASSES) || (logTable[cls] != blockSize))
+    return 0;
+
+  SASBlockCacheThreadInit ();
+
+  cache = SASBlockCacheCheck (region);
+  if (cache->count[cls] >= depth)
+    SASBlockCacheDrain (region, cls, cache->count[cls] - (depth / 2));
+
+  SASBlockScrub (blockAddr, blockSize, 0);
+  cache->blocks[cls][cache->count[cls]++] = blockAddr;
+  return 1;
+}
+
+/* Return the most recently cached block of blockSize, or NULL.  */
+static void *
+SASBlockCacheGet (unsigned long blockSize)
+{
+  SASRegionState_t *region = getSASRegionState ();
+  SASBlockCache_t *cache;
+  unsigned int cls;
+
+  if (region->regionLow == 0)
+    return NULL;
+  cls = SizeToLog2 (blockSize);
+  if ((cls >= SAS_BLOCK_CACHE_CLASSES) || (logTable[cls] != blockSize))
+    return NULL;
+
+  cache = SASBlockCacheCheck (region);
+  if (cache->count[cls] == 0)
+    return NULL;
+  return cache->blocks[cls][--cache->count[cls]];
 }
 
 void
-SASRemoveAllocatedSegs ()
+SASBlockCacheFlush (void)
 {
-  int cnt = 0;
-  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
-  uLongTreeNode *n;
-  uLongTreeNode *u = anchor->anchors.allocated;
-  void *blockAddr;
-  unsigned long keys = 0;
+  int i, cls;
 
-  do
+  for (i = 0; i < SAS_MAX_REGIONS; i++)
     {
-      n = u->searchNextNode (u, keys);
-      if (n)
-	{
-	  blockAddr = (void *) n->getInfo ();
-	  keys = n->getKey ();
-	  if (cnt > 0)
-	    {			/* What if segments are not contiguous? */
-	      if (SASRemoveSegByAddr (blockAddr, SegmentSize))
-		sas_printf ("SASRemoveAllocatedSegs:%s Error %s\n",
-			    "SASRemoveSegByAddr", strerror (errno));
-	    }
-	  cnt++;
-	};
+      if (sasRegionTable[i].regionLow == 0)
+	continue;
+      for (cls = 0; cls < SAS_BLOCK_CACHE_CLASSES; cls++)
+	SASBlockCacheDrain (&sasRegionTable[i], cls, SAS_BLOCK_CACHE_DEPTH);
     }
-  while (n);
 }
 
-void *
-SASBlockAllocNoLock (unsigned long blockSize)
+/* Per thread magazines of objects freed to SASSimpleHeaps and
+   SASCompoundHeaps, direct mapped by heap and size. Held objects stay
+   allocated in the heap, so they are owned by the thread until freed
+   to the heap in batches, under a single heap lock, by the drain
+   function of the magazine. A magazine filled before the region of
+   its heap was released (cacheGen changed), or whose heap was since
+   destroyed by any thread (its stamps changed, see sasallocpriv.h), is
+   discarded. The table is allocated on first use, so only its address
+   is in static TLS.  */
+typedef struct
 {
-  void *temp = NULL;
-  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
-  uLongTreeNode **nn = &(anchor->anchors.free);
-  uLongTreeNode **uu = &(anchor->anchors.used);
+  void *heap;
+  block_size_t size;
+  SASRegionState_t *region;
+  unsigned long gen;
+  unsigned long *stamp;
+  unsigned long stampVal;
+  unsigned long *rootStamp;
+  unsigned long rootStampVal;
+  SASHeapMagazineDrain_t drain;
+  int count;
+  void *objs[SAS_HEAP_MAGAZINE_DEPTH];
+} SASHeapMagazine_t;
+
+int sasHeapMagazineDepth = 0;
+static __thread SASHeapMagazine_t *sasHeapMagazines
+  __attribute__ ((tls_model ("initial-exec"))) = NULL;
+
+static inline SASHeapMagazine_t *
+SASHeapMagazineOf (SASHeapMagazine_t *table, void *heap, block_size_t size)
+{
+  unsigned long hash = ((unsigned long) heap >> 12) ^ (size >> 4);
 
-#ifdef __SASDebugPrint__
-  sas_printf ("SASBlockAlloc (%lx)\n", blockSize);
-#endif
+  return &table[hash & (SAS_HEAP_MAGAZINES - 1)];
+}
 
-  if (anchor->anchors.free)
-    {
-      temp = p2Alloc (nn, blockSize);
-    }
-  if (!temp)
+/* Return true if the heap of the magazine is still the one its
+   objects were freed to. The region is checked first, the stamps are
+   in the heap's header.  */
+static inline int
+SASHeapMagazineValid (SASHeapMagazine_t *mag)
+{
+  return ((mag->gen == mag->region->cacheGen)
+	  && (*mag->stamp == mag->stampVal)
+	  && (*mag->rootStamp == mag->rootStampVal));
+}
+
+/* Return the stamp of a heap, giving it a new value (unique within
+   region) if it has none.  */
+static unsigned long
+SASHeapMagazineStampOf (SASRegionState_t *region, unsigned long *stamp)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) region->regionLow;
+  unsigned long val;
+
+  if (*stamp == 0)
     {
-#ifdef __SASDebugPrint__
-      sas_printf ("SASBlockAlloc no free space for %lx\n", blockSize);
-#endif
-      nn = &(anchor->anchors.uncommitted);
-      temp = p2Alloc (nn, blockSize);
-      if (temp)
-	{
-	  if (anchor->anchors.rFlags.compactUseList)
-	    p2AddUsedCompact (uu, blockSize, temp);
-	  else
-	    p2AddUsed (uu, blockSize, temp);
-	}
-      else
-	{
-	  void *segAddr;
-#ifdef __SASDebugPrint__
-	  sas_printf ("SASBlockAlloc no uncommitted %lx\n", blockSize);
-#endif
-	  nn = &(anchor->anchors.region);
-	  segAddr = p2Alloc (nn, SegmentSize);
-	  if (segAddr)
-	    {
-	      if (!SASCreateSegByAddr (segAddr, SegmentSize))
-		{
-		  uu = &(anchor->anchors.allocated);
-		  p2AddUsed (uu, SegmentSize, segAddr);
-		  nn = &(anchor->anchors.uncommitted);
-		  p2Dealloc (nn, SegmentSize, segAddr);
-		  temp = SASBlockAllocNoLock (blockSize);
-		}
-	      else
-		{
-		  sas_printf ("SASBlockAlloc attach failed %lx\n", blockSize);
-		}
-	    }
-	  else
-	    {
-	      sas_printf ("SASBlockAlloc no region %lx\n", blockSize);
-	    }
-	}
+      // Spread the values, so stale header words are unlikely matches.
+      val = (sas_fetch_and_add (&anchor->anchors.heapStamps, 1) + 1)
+	* (unsigned long) 0x9e3779b97f4a7c15ULL;
+      sas_compare_and_swap ((long int *) stamp, 0, val);
     }
-  else
+  return *stamp;
+}
+
+/* Free the oldest n objects of a magazine to its heap.  */
+static void
+SASHeapMagazineDrain (SASHeapMagazine_t *mag, int n)
+{
+  if (n > mag->count)
+    n = mag->count;
+  if (n <= 0)
+    return;
+
+  if (SASHeapMagazineValid (mag))
+    mag->drain (mag->heap, mag->objs, n, mag->size);
+  mag->count -= n;
+  memmove (&mag->objs[0], &mag->objs[n], mag->count * sizeof (void *));
+}
+
+void *
+SASHeapMagazineGet (void *heap, block_size_t size)
+{
+  SASHeapMagazine_t *table = sasHeapMagazines;
+  SASHeapMagazine_t *mag;
+
+  if (table == NULL)
+    return NULL;
+  mag = SASHeapMagazineOf (table, heap, size);
+  if ((mag->heap != heap) || (mag->size != size) || (mag->count == 0))
+    return NULL;
+  if (!SASHeapMagazineValid (mag))
     {
-      if (anchor->anchors.rFlags.compactUseList)
-	p2AddUsedCompact (uu, blockSize, temp);
-      else
-	p2AddUsed (uu, blockSize, temp);
+      mag->count = 0;
+      return NULL;
     }
-  return temp;
+  return mag->objs[--mag->count];
 }
 
-void *
-SASBlockAlloc (unsigned long blockSize)
+int
+SASHeapMagazinePut (void *heap, void *obj, block_size_t size,
+		    SASHeapMagazineDrain_t drain,
+		    unsigned long *stamp, unsigned long *rootStamp)
 {
-  void *temp = NULL;
-#ifdef __SASDebugPrint__
-  sas_printf ("SASBlockAlloc (%lx)\n", blockSize);
-#endif
-  if (blockSize <= SegmentSize)
+  SASHeapMagazine_t *table = sasHeapMagazines;
+  SASHeapMagazine_t *mag;
+  int depth = sasHeapMagazineDepth;
+  int i;
+
+  if (depth > SAS_HEAP_MAGAZINE_DEPTH)
+    depth = SAS_HEAP_MAGAZINE_DEPTH;
+  if ((depth <= 0) || (stamp == NULL) || (rootStamp == NULL))
+    return 0;
+  if (table == NULL)
     {
-      SASSeize ();
-      temp = SASBlockAllocNoLock (blockSize);
-      SASRelease ();
+      table = (SASHeapMagazine_t *) calloc (SAS_HEAP_MAGAZINES,
+					    sizeof (SASHeapMagazine_t));
+      if (table == NULL)
+	return 0;
+      sasHeapMagazines = table;
+      SASBlockCacheThreadInit ();
     }
-  else
+
+  mag = SASHeapMagazineOf (table, heap, size);
+  if ((mag->heap != heap) || (mag->size != size)
+      || !SASHeapMagazineValid (mag))
     {
-      sas_printf ("SASBlockAlloc blocksize exceeds segment size\n");
+      SASRegionState_t *region =
+	getSASRegionStateByAddr ((unsigned long) heap);
+
+      // Evict the magazine of another heap or size sharing the slot.
+      if (mag->heap != NULL)
+	SASHeapMagazineDrain (mag, mag->count);
+      mag->heap = NULL;
+      mag->count = 0;
+      if (region == NULL)
+	return 0;
+      mag->heap = heap;
+      mag->size = size;
+      mag->region = region;
+      mag->gen = region->cacheGen;
+      mag->stamp = stamp;
+      mag->stampVal = SASHeapMagazineStampOf (region, stamp);
+      mag->rootStamp = rootStamp;
+      mag->rootStampVal = SASHeapMagazineStampOf (region, rootStamp);
+      mag->drain = drain;
     }
-  return temp;
+  for (i = 0; i < mag->count; i++)
+    if (mag->objs[i] == obj)
+      return -1;
+  if (mag->count >= depth)
+    SASHeapMagazineDrain (mag, mag->count - (depth / 2));
+
+  mag->objs[mag->count++] = obj;
+  return 1;
+}
+
+void
+SASHeapMagazineDiscard (void *block, block_size_t size)
+{
+  SASHeapMagazine_t *table = sasHeapMagazines;
+  unsigned long low = (unsigned long) block;
+  int i;
+
+  if (table == NULL)
+    return;
+  for (i = 0; i < SAS_HEAP_MAGAZINES; i++)
+    {
+      unsigned long heap = (unsigned long) table[i].heap;
+      if ((heap >= low) && (heap < (low + size)))
+	{
+	  table[i].heap = NULL;
+	  table[i].count = 0;
+	}
+    }
+}
+
+void
+SASHeapMagazineReturn (void *heap)
+{
+  SASHeapMagazine_t *table = sasHeapMagazines;
+  int i;
+
+  if (table == NULL)
+    return;
+  for (i = 0; i < SAS_HEAP_MAGAZINES; i++)
+    if (table[i].heap == heap)
+      SASHeapMagazineDrain (&table[i], table[i].count);
+}
+
+void
+SASHeapMagazineFlush (void)
+{
+  SASHeapMagazine_t *table = sasHeapMagazines;
+  int i;
+
+  if (table == NULL)
+    return;
+  for (i = 0; i < SAS_HEAP_MAGAZINES; i++)
+    if (table[i].heap != NULL)
+      SASHeapMagazineDrain (&table[i], table[i].count);
+}
+
+static void
+SASHeapMagazineExit (void)
+{
+  SASHeapMagazineFlush ();
+  free (sasHeapMagazines);
+  sasHeapMagazines = NULL;
 }
 
 void
 SASBlockDealloc (void *blockAddr, unsigned long blockSize)
 {
-  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
-  uLongTreeNode **nn = &(anchor->anchors.free);
-  uLongTreeNode **uu = &(anchor->anchors.used);
+  SASRegionState_t *saved = sasThreadRegion;
+  SASRegionState_t *region =
+    getSASRegionStateByAddr ((unsigned long) blockAddr);
 
-  SASSeize ();
-  uu = &(anchor->anchors.used);
-  p2RemUsed (uu, blockSize, blockAddr);
+  // Return the block to the region it was allocated from.
+  if (region != NULL)
+    sasThreadRegion = region;
 
-//  initialize block to zeros, needed only in windows/AIX/OS2
-  if (blockSize > 4096)
-    memset (blockAddr, 0, 4096);
-  else
-    memset (blockAddr, 0, blockSize);
+  SASStatsCount (0, 0, 1);
+  if (!SASBlockCachePut (blockAddr, blockSize))
+    {
+      // The block is owned by the caller, so can be punched out unlocked.
+      SASBlockScrub (blockAddr, blockSize, SASReleaseOnDealloc ());
+      if (SASBuddyDealloc (blockAddr, blockSize))
+	{
+	  SASSeize ();
+	  SASBlockFreeNoLock (blockAddr, blockSize);
+	  SASRelease ();
+	}
+    }
+  sasThreadRegion = saved;
+}
+
+void
+SASBlockDeallocMany (unsigned long blockSize, int count, void **blocks)
+{
+  SASRegionState_t *saved = sasThreadRegion;
+  SASRegionState_t *region;
+  int i, j, k;
 
-  if (sasClearOnDealloc)
+  for (i = 0; i < count; i = j)
     {
-      SASRelease ();
-      if (blockSize > 4096)
-	memset ((char *) blockAddr + 4096, 0, blockSize - 4096);
+      // Free each run of blocks from the same region under one lock.
+      region = getSASRegionStateByAddr ((unsigned long) blocks[i]);
+      if (region != NULL)
+	sasThreadRegion = region;
+      for (j = i; (j < count)
+	   && (getSASRegionStateByAddr ((unsigned long) blocks[j]) == region);
+	   j++)
+	SASBlockScrub (blocks[j], blockSize, SASReleaseOnDealloc ());
       SASSeize ();
+      for (k = i; k < j; k++)
+	if (SASBuddyDealloc (blocks[k], blockSize))
+	  SASBlockFreeNoLock (blocks[k], blockSize);
+      SASRelease ();
+      SASStatsCount (0, 0, j - i);
+      sasThreadRegion = saved;
     }
-  nn = &(anchor->anchors.free);
-  p2Dealloc (nn, blockSize, blockAddr);
-  SASRelease ();
 }
 
 int
@@ -1319,12 +3204,11 @@ SASSigSegvHandler(int signal, siginfo_t * info, void *context)
 	sas_printf ("si_signo=%d si_code=%d\n", info->si_signo, info->si_code);
 #endif
 	if (signal == SIGSEGV) {
-		unsigned long reg_low = (unsigned long) memLow;
-		unsigned long reg_high = (unsigned long) memHigh;
 		unsigned long segv_addr = (unsigned long) info->si_addr;
-		if ((segv_addr >= reg_low) && (segv_addr < reg_high))
+		SASRegionState_t *region = getSASRegionStateByAddr (segv_addr);
+		if (region && (segv_addr < region->regionHigh))
 		{
-			SASAttachAllocatedAddr(info->si_addr);
+			SASAttachRegionAddr(region, info->si_addr);
 		} else {
 			if (oldSigSegV.sa_handler != SIG_DFL)
 			{
@@ -1378,34 +3262,265 @@ SASDisableSigSegv ()
 #endif
 }
 
+static int
+SASRegionGeometryValid (unsigned long base, unsigned long rsize,
+			unsigned long ssize)
+{
+  /* Segments hold the anchor block heap and blocks are aligned to
+     their size, so both sizes are powers of 2 within the logTable
+     and the base is segment aligned.  */
+  if ((ssize < block__Size1M) || (ssize & (ssize - 1))
+      || (rsize < ssize) || (rsize & (rsize - 1))
+      || (rsize > logTable[maxLog2 - 1])
+      || (base == 0) || (base & (ssize - 1))
+      || ((base + rsize + (4 * ssize)) < base)
+      || ((rsize / ssize) > (unsigned long) INT_MAX))
+    return 0;
+
+  return 1;
+}
+
+int
+setSASRegionGeometry (unsigned long regionBase, unsigned long regionSize,
+		      unsigned long segmentSize)
+{
+  if (regionBase == 0)
+    regionBase = __SAS_DEFAULT_BASE_ADDRESS;
+  if (regionSize == 0)
+    regionSize = __SAS_DEFAULT_REGION_SIZE;
+  if (segmentSize == 0)
+    segmentSize = __SAS_DEFAULT_SEGMENT_SIZE;
+
+  if (!SASRegionGeometryValid (regionBase, regionSize, segmentSize))
+    {
+      sas_printf ("setSASRegionGeometry (%lx, %lx, %lx) invalid\n",
+		  regionBase, regionSize, segmentSize);
+      return 1;
+    }
+
+  sasReqRegionBase = regionBase;
+  sasReqRegionSize = regionSize;
+  sasReqSegmentSize = segmentSize;
+  return 0;
+}
+
+/* Set the region geometry for joining the current SAS store. If the
+   store has an anchor segment, its recorded geometry is read (before
+   anything is mapped) and used. Anchors from stores created before
+   the geometry was recorded have zero fields and use the platform
+   defaults. Otherwise the requested geometry is used for the new
+   store.  */
+static int
+SASSetJoinGeometry (void)
+{
+  char storeName[STORE_NAME_SIZE];
+  SASAnchorBlock_t image;
+  ssize_t len = 0;
+  int fd;
+
+  sasRegionBase = sasReqRegionBase;
+  sasRegionSize = sasReqRegionSize;
+  sasSegmentSize = sasReqSegmentSize;
+
+  SASSegNameIndexed (storeName, 0);
+  fd = open (storeName, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  len = pread (fd, &image, sizeof (image), 0);
+  close (fd);
+  if (len != sizeof (image))
+    {
+      sas_printf ("SASJoinRegion:%s <%s>\n",
+		  "anchor segment too short", storeName);
+      return 1;
+    }
+
+  sasRegionBase = image.anchors.regionBase ?
+    image.anchors.regionBase : __SAS_DEFAULT_BASE_ADDRESS;
+  sasRegionSize = image.anchors.regionSize ?
+    image.anchors.regionSize : __SAS_DEFAULT_REGION_SIZE;
+  sasSegmentSize = image.anchors.segmentSize ?
+    image.anchors.segmentSize : __SAS_DEFAULT_SEGMENT_SIZE;
+
+  if (!SASRegionGeometryValid (sasRegionBase, sasRegionSize,
+			       sasSegmentSize))
+    {
+      sas_printf ("SASJoinRegion:%s (%lx, %lx, %lx)\n",
+		  "invalid anchor geometry",
+		  sasRegionBase, sasRegionSize, sasSegmentSize);
+      return 1;
+    }
+#ifdef __SASDebugPrint__
+  sas_printf ("SASJoinRegion geometry (%lx, %lx, %lx)\n",
+	      sasRegionBase, sasRegionSize, sasSegmentSize);
+#endif
+  return 0;
+}
+
+/* Check that the range of the region being joined (including its
+   guard page and lock table) does not overlap another joined region.  */
+static int
+SASRegionOverlaps (void)
+{
+  SASRegionState_t *region = getSASRegionState ();
+  unsigned long low = sasRegionBase;
+  unsigned long high = low + sasRegionSize + (4 * sasSegmentSize);
+  int i;
+
+  for (i = 0; i < SAS_MAX_REGIONS; i++)
+    {
+      SASRegionState_t *other = &sasRegionTable[i];
+      if ((other != region) && other->regionLow
+	  && (low < (other->regionHigh + (4 * other->segmentSize)))
+	  && (other->regionLow < high))
+	{
+	  sas_printf ("SASJoinRegion:%s %lx overlaps region %d at %lx\n",
+		      "region", low, i, other->regionLow);
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+/* Record that the process is joined to a checkpointed store, with a
+   marker file in the checkpoint directory dir held locked until the
+   region is detached cleanly. Called with dir locked.  */
+static void
+SASJoinMark (SASRegionState_t *region, const char *dir)
+{
+  char name[STORE_NAME_SIZE];
+  int fd;
+
+  if (region->joinMark != NULL)
+    return;
+  sas_sprintf (name, "%s/%s.XXXXXX", dir, SAS_JOIN_MARK);
+  fd = mkstemp (name);
+  if (fd == -1)
+    return;
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+  flock (fd, LOCK_EX);
+  region->joinMark = strdup (name);
+  region->joinMarkFD = fd;
+  if (region->joinMark == NULL)
+    {
+      unlink (name);
+      close (fd);
+    }
+}
+
+/* Remove the join marker of the region, on a clean detach.  */
+static void
+SASJoinUnmark (SASRegionState_t *region)
+{
+  if (region->joinMark == NULL)
+    return;
+  unlink (region->joinMark);
+  close (region->joinMarkFD);
+  free (region->joinMark);
+  region->joinMark = NULL;
+}
+
+/* If recover is set, restore the store from its checkpoint when a
+   process stopped while joined to it (its join marker is stale) and
+   no process is joined now. Then mark the join of this process. The
+   checkpoint directory is locked so concurrent joins do not restore
+   twice. Returns true if the store was restored.  */
+static int
+SASJoinRecover (SASRegionState_t *region, int recover)
+{
+  const char *store = region->storePath;
+  char name[STORE_NAME_SIZE];
+  SASCkptManifest_t m;
+  int live, stale;
+  int restored = 0;
+  int fd;
+
+  sas_sprintf (name, "%s/%s", store, SAS_CKPT_DIR);
+  fd = open (name, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  flock (fd, LOCK_EX);
+  if (recover && (SASStoreCkptRead (store, &m) == 0))
+    {
+      SASStoreJoinMarkScan (store, &live, &stale, 0);
+      if (stale && live)
+	sas_printf ("SASJoinRegion %s not restored, in use by %d"
+		    " processes\n", store, live);
+      else if (stale)
+	{
+	  sas_printf ("SASJoinRegion restoring %s from checkpoint %lx\n",
+		      store, m.generation);
+	  if (SASStoreCkptRestore (store) == 0)
+	    {
+	      SASStoreJoinMarkScan (store, &live, &stale, 1);
+	      restored = 1;
+	    }
+	}
+      free (m.segGen);
+    }
+  SASJoinMark (region, name);
+  flock (fd, LOCK_UN);
+  close (fd);
+  return restored;
+}
+
 int
-SASJoinRegionByName (const char *store_name)
+SASJoinRegionByNameMode (const char *store_name, unsigned long mode)
 {
-  int segs = (int) (RegionSize / SegmentSize);
-  size_t memIDsize = (RegionSize / SegmentSize) * sizeof (*mem_IDs);
+  SASRegionState_t *region = getSASRegionState ();
+  int segs;
+  size_t memIDsize;
+  sphtimer_t tStart, tAnchor, tScan, tAttach, tLock;
+  int restored = 0;
+  int volatileRegion;
   int rc = 1;
   int i;
 
+  tStart = sphgettimer ();
+  memset (&sasJoinStats, 0, sizeof (sasJoinStats));
+  sasJoinOptions = mode & SAS_JOIN_MASK;
+
   if (store_name != NULL)
     {
       int pathlen, malloclen;
       pathlen = strlen (store_name);
       malloclen = (pathlen + 2 + 8) & ~(7);
-      sasStorePath = (char *) malloc (malloclen);
-      sasStorePath = strcpy (sasStorePath, store_name);
-      if (sasStorePath[pathlen - 1] == '/')
-	sasStorePath[pathlen - 1] = 0;
+      region->storePath = (char *) malloc (malloclen);
+      region->storePath = strcpy (region->storePath, store_name);
+      if (region->storePath[pathlen - 1] == '/')
+	region->storePath[pathlen - 1] = 0;
+      if (region == &sasRegionTable[0])
+	sasStorePath = region->storePath;
 #ifdef __SASDebugPrint__
-      sas_printf ("SASJoinRegionByName (%s)\n", sasStorePath);
+      sas_printf ("SASJoinRegionByName (%s)\n", region->storePath);
 #endif
     }
   else
     {				/* Store Name is required for this API */
       return (3);
     }
+  volatileRegion = SASSetSegPath (region, mode);
+  region->numaShmem = (SASStoreIsTmpfs (region->segPath)
+		       || SASStoreIsHugeTLB (region->segPath));
+  // A snapshot is read only, so never marked or restored.
+  if (!(mode & SAS_JOIN_SNAPSHOT))
+    restored = SASJoinRecover (region, (mode & SAS_JOIN_RECOVER) != 0);
+  if (SASSetJoinGeometry () || SASRegionOverlaps ())
+    {
+      SASJoinUnmark (region);
+      if (region == &sasRegionTable[0])
+	sasStorePath = NULL;
+      SASFreeSegPath (region);
+      free (region->storePath);
+      region->storePath = NULL;
+      return (4);
+    }
+  segs = (int) (RegionSize / SegmentSize);
+  memIDsize = (RegionSize / SegmentSize) * sizeof (*mem_IDs);
   mem_IDs = (int *) malloc (memIDsize);
   if (mem_IDs == NULL)
     {
+      SASJoinUnmark (region);
       return (2);
     }
   else
@@ -1415,6 +3530,20 @@ SASJoinRegionByName (const char *store_name)
     }
   rc = SASAttachAnchorSeg ((char *) __SAS_BASE_ADDRESS,
 			   RegionSize, SegmentSize);
+  tAnchor = tScan = tAttach = sphgettimer ();
+  if (rc && (mode & SAS_JOIN_SNAPSHOT))
+    {
+      // A snapshot is never created by joining it.
+      free (mem_IDs);
+      mem_IDs = NULL;
+      if (region == &sasRegionTable[0])
+	sasStorePath = NULL;
+      SASFreeSegPath (region);
+      free (region->storePath);
+      region->storePath = NULL;
+      sasJoinOptions = 0;
+      return (5);
+    }
   if (rc)
     {
       // The Anchor segment does not exist in the named store.
@@ -1430,21 +3559,80 @@ SASJoinRegionByName (const char *store_name)
 #ifdef __SASDebugPrint__
 	  sas_printf ("SASJoinRegion anchor created\n");
 #endif
+	  SASBlockMapOpen (region, 1);
 	  initRegion ();
 	  // CompactUseList is now the default for new regions.
 	  setSASCompactUseList ();
+	  if ((mode & SAS_REGION_HUGEPAGE)
+	      || SASStoreIsHugeTLB (region->segPath))
+	    setSASHugePages ();
+	  if (volatileRegion)
+	    setSASVolatile ();
+	  sasHugePages = (getSASRegionMode () & SAS_REGION_HUGEPAGE) != 0;
+	  SASAdviseSeg ((void *) memLow, SegmentSize);
 	  // Allocate a guard page immediately after the region.
 	  mmap ((char *) getMemHigh (), pgsize,
 		(PROT_READ | PROT_WRITE),
 		(MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED), -1, 0);
 	};
+      tAnchor = tScan = tAttach = sphgettimer ();
     }
   else
     {
+      char *segMap;
 #ifdef __SASDebugPrint__
       sas_printf ("SASJoinRegion joined existing region\n");
 #endif
-      SASAttachAllocatedSegs ();
+      // Checkpoints and snapshots are taken holding the anchor lock.
+      // The lock of a (private) snapshot anchor is process local.
+      if (restored || (mode & SAS_JOIN_SNAPSHOT))
+	SASResetSem ();
+      // The block map does not describe the restored segments.
+      if (restored)
+	SASBlockMapRemove (region);
+      SASBlockMapOpen (region, 0);
+      // Stores created before the region statistics were kept in the
+      // anchor have no counters, count them once from the trees.
+      if (((SASAnchorBlock_t *) memLow)->anchors.stats.valid
+	  != SAS_STATS_VALID)
+	{
+	  SASSeize ();
+	  SASRegionStatsRebuild ();
+	  SASRelease ();
+	}
+      // The region mode is recorded in the anchor at creation.
+      sasHugePages = (getSASRegionMode () & SAS_REGION_HUGEPAGE) != 0;
+      SASAdviseSeg ((void *) memLow, SegmentSize);
+      // One pass over the store directory to find the backing files.
+      segMap = (char *) calloc (segs, sizeof (char));
+      if (segMap && (SASSegStoreScan (segMap, segs) < 0))
+	{
+	  free (segMap);
+	  segMap = NULL;
+	}
+      tScan = sphgettimer ();
+      rc = SASAttachAllocatedSegsMap (segMap);
+      free (segMap);
+      if (rc)
+	{
+	  // Nothing is attached, leave the region as before the join.
+	  SASDetachSegByAddr ((void *) memLow, SegmentSize);
+	  SASBlockMapClose (region);
+	  free (mem_IDs);
+	  mem_IDs = NULL;
+	  SASJoinUnmark (region);
+	  if (region == &sasRegionTable[0])
+	    sasStorePath = NULL;
+	  SASFreeSegPath (region);
+	  free (region->storePath);
+	  region->storePath = NULL;
+	  sasHugePages = 0;
+	  sasJoinOptions = 0;
+	  memLow = 0;
+	  memHigh = 0;
+	  return (2);
+	}
+      tAttach = sphgettimer ();
       /* Place guard page to protect Region from main stack. */
       mmap ((char *) getMemHigh (), 4096,
 	    (PROT_READ | PROT_WRITE),
@@ -1452,11 +3640,455 @@ SASJoinRegionByName (const char *store_name)
     }
 
   SASLockInit ();
-  SASEnableSigSegv ();
+  if (sasJoinedRegions++ == 0)
+    SASEnableSigSegv ();
+  tLock = sphgettimer ();
+
+  sasJoinStats.anchor_usec = SASTimerUsec (tAnchor - tStart);
+  sasJoinStats.scan_usec = SASTimerUsec (tScan - tAnchor);
+  sasJoinStats.attach_usec = SASTimerUsec (tAttach - tScan);
+  sasJoinStats.lock_usec = SASTimerUsec (tLock - tAttach);
+  sasJoinStats.total_usec = SASTimerUsec (tLock - tStart);
+
+  if (rc)
+    SASJoinUnmark (region);
+  return rc;
+}
+
+void
+setSASJoinThreads (int threads)
+{
+  if (threads >= 0)
+    sasJoinThreads = threads;
+}
+
+void
+getSASJoinStats (SASJoinStats_t *stats)
+{
+  *stats = sasJoinStats;
+}
+
+/* Return true if the segment file was modified since the time of
+   the previous checkpoint.  */
+static int
+SASSegModifiedSince (int fd, SASCkptManifest_t *prev)
+{
+  struct stat stat_buf;
+
+  if (fstat (fd, &stat_buf))
+    return 1;
+  return ((stat_buf.st_mtim.tv_sec > prev->time_sec)
+	  || ((stat_buf.st_mtim.tv_sec == prev->time_sec)
+	      && (stat_buf.st_mtim.tv_nsec >= prev->time_nsec)));
+}
+
+/* The anchor block holds the anchor and the allocation trees (tree
+   nodes are allocated near the root). Save an image of it, with the
+   region lock held, so a copy of the anchor segment made without the
+   lock can be made consistent by SASAnchorImageWrite.  */
+static char *
+SASAnchorImageSave (void)
+{
+  char *image = (char *) malloc (block__Size1M);
+
+  if (image != NULL)
+    memcpy (image, (void *) memLow, block__Size1M);
+  return image;
+}
+
+static int
+SASAnchorImageWrite (const char *name, const char *image)
+{
+  ssize_t len;
+  int fd;
+  int rc = 0;
+
+  fd = open (name, O_WRONLY);
+  if (fd == -1)
+    return errno;
+  len = pwrite (fd, image, block__Size1M, 0);
+  if (len != block__Size1M)
+    rc = (len == -1) ? errno : EIO;
+  else if (fsync (fd))
+    rc = errno;
+  close (fd);
+  return rc;
+}
+
+/* Add a segment to checkpoint m, copying it if it was written since
+   the previous checkpoint prev (or dirty is set), otherwise carrying
+   over the previous copy. Copies are reflinks where the file system
+   supports them.  */
+static int
+SASCheckpointSeg (const char *store, unsigned long segnum,
+		  SASCkptManifest_t *prev, SASCkptManifest_t *m, int dirty)
+{
+  char name[STORE_NAME_SIZE];
+  char ckpt[STORE_NAME_SIZE];
+  int fd;
+  int rc = 0;
+
+  SASSegNameIndexed (name, segnum);
+  fd = open (name, O_RDONLY);
+  if (fd == -1)
+    return errno;
+  sasCkptStats.segments++;
+  if (dirty || (prev->segGen[segnum] == 0)
+      || SASSegModifiedSince (fd, prev))
+    {
+      /* Writing back the (shared) page cache also write protects
+         the pages, so the next write through any mapping updates
+         the file time and marks the segment dirty again. A clone
+         shares the file's blocks, so needs the write back too.  */
+      if (fdatasync (fd))
+	rc = errno;
+      else
+	{
+	  SASSegCkptNameIndexed (ckpt, store, segnum, m->generation);
+	  unlink (ckpt);
+	  rc = SASSegStoreCloneByName (name, ckpt);
+	}
+      m->segGen[segnum] = m->generation;
+      sasCkptStats.copied++;
+    }
+  else
+    m->segGen[segnum] = prev->segGen[segnum];
+  close (fd);
+  return rc;
+}
+
+int
+SASCheckpoint (void)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  const char *store = getSASRegionState ()->storePath;
+  const char *segPath = getSASRegionState ()->segPath;
+  char name[STORE_NAME_SIZE];
+  char ckpt[STORE_NAME_SIZE];
+  SASCkptManifest_t prev, m;
+  struct statfs fs_buf;
+  struct timespec start;
+  uLongTreeNode *n;
+  uLongTreeNode *u;
+  unsigned long keys = 0;
+  unsigned long *segList;
+  unsigned long segnum, segs, nsegs, i;
+  char *image;
+  sphtimer_t tStart = sphgettimer ();
+  sphtimer_t tLock;
+  int allDirty = 0;
+  int dirfd;
+  int rc = 0;
+
+  memset (&sasCkptStats, 0, sizeof (sasCkptStats));
+  if (anchor == NULL)
+    return EINVAL;
+  segs = RegionSize / SegmentSize;
+
+  sas_sprintf (name, "%s/%s", store != NULL ? store : ".", SAS_CKPT_DIR);
+  if (mkdir (name, 0777) && (errno != EEXIST))
+    return errno;
+  // tmpfs does not update the file times for writes via mappings.
+  if ((statfs (segPath != NULL ? segPath : ".", &fs_buf) == 0)
+      && (((unsigned int) fs_buf.f_type == (unsigned int) TMPFS_MAGIC)
+	  || ((unsigned int) fs_buf.f_type == (unsigned int) HUGETLBFS_MAGIC)))
+    allDirty = 1;
+
+  memset (&m, 0, sizeof (m));
+  m.segs = segs;
+  m.segGen = (unsigned long *) calloc (segs, sizeof (unsigned long));
+  segList = (unsigned long *) calloc (segs, sizeof (unsigned long));
+  if ((m.segGen == NULL) || (segList == NULL))
+    {
+      free (m.segGen);
+      free (segList);
+      return ENOMEM;
+    }
+
+  // Checkpoints of the store, by any process, are taken one at a time.
+  dirfd = open (name, O_RDONLY);
+  if (dirfd != -1)
+    {
+      flock (dirfd, LOCK_EX);
+      // Joins before the first checkpoint found no directory to mark.
+      SASJoinMark (getSASRegionState (), name);
+    }
+
+  SASSeize ();
+  tLock = sphgettimer ();
+  if (SASStoreCkptRead (store, &prev) || (prev.segs != segs))
+    {
+      // No usable previous checkpoint, copy everything.
+      free (prev.segGen);
+      memset (&prev, 0, sizeof (prev));
+      prev.segGen = (unsigned long *) calloc (segs, sizeof (unsigned long));
+      allDirty = 1;
+    }
+  m.generation = prev.generation + 1;
+  SASStoreBootID (m.bootID, sizeof (m.bootID));
+  // File times are taken from the coarse clock.
+  clock_gettime (CLOCK_REALTIME_COARSE, &start);
+  m.time_sec = start.tv_sec;
+  m.time_nsec = start.tv_nsec;
+
+  nsegs = 0;
+  u = anchor->anchors.allocated;
+  do
+    {
+      n = u->searchNextNode (u, keys);
+      if (n)
+	{
+	  keys = n->getKey ();
+	  segList[nsegs++] = (n->getInfo () - memLow) / SegmentSize;
+	}
+    }
+  while (n);
+
+  /* Only the anchor and the allocation trees are imaged while they
+     can not change. The segments are copied after the lock is
+     released, each as found, and the image written over the copy of
+     the anchor segment.  */
+  image = SASAnchorImageSave ();
+  SASRelease ();
+  sasCkptStats.lock_usec = SASTimerUsec (sphgettimer () - tLock);
+
+  if ((prev.segGen == NULL) || (image == NULL))
+    rc = ENOMEM;
+  else
+    rc = SASCheckpointSeg (store, 0, &prev, &m, 1);
+  if (rc == 0)
+    rc = SASAnchorImageWrite (SASSegCkptNameIndexed (ckpt, store, 0,
+						     m.generation), image);
+  for (i = 0; (i < nsegs) && (rc == 0); i++)
+    {
+      segnum = segList[i];
+      if (segnum != 0)
+	rc = SASCheckpointSeg (store, segnum, &prev, &m, allDirty);
+    }
+
+  if (rc == 0)
+    rc = SASStoreCkptWrite (store, &m);
+
+  // Remove the copies superseded by this checkpoint, or if it failed
+  // the copies made for it.
+  for (i = 0; i < segs; i++)
+    {
+      if (rc == 0)
+	{
+	  if (prev.segGen && prev.segGen[i] && (prev.segGen[i] != m.segGen[i]))
+	    unlink (SASSegCkptNameIndexed (ckpt, store, i, prev.segGen[i]));
+	}
+      else if (m.segGen[i] == m.generation)
+	unlink (SASSegCkptNameIndexed (ckpt, store, i, m.generation));
+    }
+  if (dirfd != -1)
+    {
+      flock (dirfd, LOCK_UN);
+      close (dirfd);
+    }
+  free (prev.segGen);
+  free (m.segGen);
+  free (segList);
+  free (image);
+
+  if (rc == 0)
+    sasCkptStats.generation = m.generation;
+  else
+    sas_printf ("SASCheckpoint failed; %s\n", strerror (rc));
+  sasCkptStats.total_usec = SASTimerUsec (sphgettimer () - tStart);
+  return rc;
+}
+
+void
+getSASCheckpointStats (SASCheckpointStats_t *stats)
+{
+  *stats = sasCkptStats;
+}
+
+int
+SASCheckpointRestore (const char *store_name)
+{
+  return SASStoreCkptRestore (store_name);
+}
+
+int
+SASSnapshotCreate (const char *snap_dir)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  char name[STORE_NAME_SIZE];
+  char snap[STORE_NAME_SIZE];
+  uLongTreeNode *n;
+  uLongTreeNode *u;
+  unsigned long keys = 0;
+  unsigned long *segList;
+  unsigned long segnum, nsegs, segsMade, i;
+  char *image;
+  int dirMade;
+  int fd;
+  int rc = 0;
+
+  if ((anchor == NULL) || (snap_dir == NULL))
+    return EINVAL;
+  dirMade = (mkdir (snap_dir, 0777) == 0);
+  if (!dirMade && (errno != EEXIST))
+    return errno;
+  segList = (unsigned long *) calloc (RegionSize / SegmentSize,
+				      sizeof (unsigned long));
+  if (segList == NULL)
+    rc = ENOMEM;
+
+  /* As for SASCheckpoint, only the list of segments and an image of
+     the anchor block are taken with the region lock held.  */
+  nsegs = 0;
+  segsMade = 0;
+  image = NULL;
+  if (rc == 0)
+    {
+      SASSeize ();
+      u = anchor->anchors.allocated;
+      do
+	{
+	  n = u->searchNextNode (u, keys);
+	  if (n)
+	    {
+	      keys = n->getKey ();
+	      segList[nsegs++] = (n->getInfo () - memLow) / SegmentSize;
+	    }
+	}
+      while (n);
+      image = SASAnchorImageSave ();
+      SASRelease ();
+      if (image == NULL)
+	rc = ENOMEM;
+    }
+
+  for (i = 0; (i < nsegs) && (rc == 0); i++)
+    {
+      segnum = segList[i];
+      SASSegNameIndexed (name, segnum);
+      sas_sprintf (snap, "%s/SAS%05lX.DAT", snap_dir, segnum);
+      // Clones share the file's blocks, so write back the page cache.
+      fd = open (name, O_RDONLY);
+      if ((fd == -1) || fdatasync (fd))
+	rc = errno;
+      if (fd != -1)
+	close (fd);
+      if (rc == 0)
+	{
+	  rc = SASSegStoreCloneByName (name, snap);
+	  // The clone creates the file, unless it already existed.
+	  if (rc != EEXIST)
+	    segsMade++;
+	}
+      if ((rc == 0) && (segnum == 0))
+	rc = SASAnchorImageWrite (snap, image);
+    }
 
+  if (rc)
+    {
+      // Remove the partial snapshot.
+      for (i = 0; i < segsMade; i++)
+	{
+	  sas_sprintf (snap, "%s/SAS%05lX.DAT", snap_dir, segList[i]);
+	  unlink (snap);
+	}
+      if (dirMade)
+	rmdir (snap_dir);
+      sas_printf ("SASSnapshotCreate %s failed; %s\n", snap_dir, strerror (rc));
+    }
+  free (segList);
+  free (image);
   return rc;
 }
 
+sasregion_t
+SASRegionJoin (const char *store_name, unsigned long mode)
+{
+  SASRegionState_t *saved = sasThreadRegion;
+  int i, rc;
+
+  for (i = 0; i < SAS_MAX_REGIONS; i++)
+    {
+      if ((sasRegionTable[i].regionLow == 0)
+	  && (sasRegionTable[i].storePath == NULL))
+	break;
+    }
+  if (i == SAS_MAX_REGIONS)
+    {
+      sas_printf ("SASRegionJoin:%s\n", "too many regions");
+      return -1;
+    }
+
+  sasThreadRegion = &sasRegionTable[i];
+  rc = SASJoinRegionByNameMode (store_name, mode);
+  sasThreadRegion = saved;
+  if (rc)
+    {
+      sas_printf ("SASRegionJoin (%s) failed %d\n", store_name, rc);
+      return -1;
+    }
+  return i;
+}
+
+sasregion_t
+SASRegionSelect (sasregion_t region)
+{
+  sasregion_t prev = getSASRegionState () - &sasRegionTable[0];
+
+  if ((region < 0) || (region >= SAS_MAX_REGIONS))
+    return -1;
+
+  sasThreadRegion = &sasRegionTable[region];
+  return prev;
+}
+
+sasregion_t
+SASRegionByAddr (const void *addr)
+{
+  SASRegionState_t *region =
+    getSASRegionStateByAddr ((unsigned long) addr);
+
+  if ((region == NULL) || ((unsigned long) addr >= region->regionHigh))
+    return -1;
+  return region - &sasRegionTable[0];
+}
+
+void *
+SASRegionBlockAlloc (sasregion_t region, unsigned long blockSize)
+{
+  SASRegionState_t *saved = sasThreadRegion;
+  void *temp;
+
+  if ((region < 0) || (region >= SAS_MAX_REGIONS)
+      || (sasRegionTable[region].regionLow == 0))
+    return NULL;
+
+  sasThreadRegion = &sasRegionTable[region];
+  temp = SASBlockAlloc (blockSize);
+  sasThreadRegion = saved;
+  return temp;
+}
+
+void
+SASRegionCleanUp (sasregion_t region)
+{
+  SASRegionState_t *saved = sasThreadRegion;
+
+  if ((region < 0) || (region >= SAS_MAX_REGIONS)
+      || (sasRegionTable[region].regionLow == 0))
+    return;
+
+  sasThreadRegion = &sasRegionTable[region];
+  SASCleanUp ();
+  sasThreadRegion = saved;
+}
+
+int
+SASJoinRegionByName (const char *store_name)
+{
+  return SASJoinRegionByNameMode (store_name, SAS_REGION_DEFAULT);
+}
+
 int
 SASJoinRegion ()
 {
@@ -1650,6 +4282,202 @@ SASListFreeMem (void **blockAddr, unsigned long *blockSize, int *count)
   SASRelease ();
 }
 
+int
+getSASRegionStats (SASRegionStats_t *stats)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  SASAnchorStats_t *s;
+  int i;
+
+  if (anchor == NULL)
+    return -1;
+  SASStatsFlush ();
+  s = &anchor->anchors.stats;
+  memset (stats, 0, sizeof (*stats));
+  for (i = 0; i < maxLog2; i++)
+    {
+      stats->free_bytes[i] = s->freeBlocks[i] * logTable[i];
+      stats->uncommitted_bytes[i] = s->uncommittedBlocks[i] * logTable[i];
+      stats->used_bytes[i] = s->usedBytes[i];
+      stats->free_total += stats->free_bytes[i];
+      stats->uncommitted_total += stats->uncommitted_bytes[i];
+      stats->used_total += stats->used_bytes[i];
+      if (stats->free_bytes[i] || stats->uncommitted_bytes[i])
+	stats->largest_free = logTable[i];
+    }
+  stats->segments_committed = s->segmentsCommitted;
+  stats->segments_total = RegionSize / SegmentSize;
+  if ((stats->segments_committed < stats->segments_total)
+      && (stats->largest_free < SegmentSize))
+    stats->largest_free = SegmentSize;
+  stats->alloc_count = s->allocCount;
+  stats->alloc_failures = s->allocFailures;
+  stats->dealloc_count = s->deallocCount;
+  stats->lock_acquires = s->lockAcquires;
+  stats->lock_waits = s->lockWaits;
+  stats->lock_wait_usec = SASTimerUsec (s->lockWaitTicks);
+  return 0;
+}
+
+/* Per thread allocation latency counts, added to the histograms of
+   the region (shared) every SAS_LATENCY_BATCH calls.  */
+#define SAS_LATENCY_BATCH	64
+
+typedef struct
+{
+  SASAnchorLatency_t *shared;
+  long pending;
+  long count[SAS_STATS_LAT_POINTS];
+  long totalTicks[SAS_STATS_LAT_POINTS];
+  long maxTicks[SAS_STATS_LAT_POINTS];
+  long hist[SAS_STATS_LAT_POINTS][SAS_STATS_LAT_BUCKETS];
+} SASLatencyThread_t;
+
+static __thread SASLatencyThread_t sasLatencyThread;
+
+static unsigned long
+SASTimerNsec (sphtimer_t ticks)
+{
+  sphtimer_t freq = sphfastcpufreq ();
+
+  if (freq == 0)
+    return 0;
+  return (unsigned long) ((ticks / freq) * 1000000000ULL
+			  + ((ticks % freq) * 1000000000ULL) / freq);
+}
+
+/* Add the counts of this thread to the histograms they were taken
+   for, if that region is still joined, and clear them.  */
+static void
+SASLatencyFlushThread (SASLatencyThread_t *t)
+{
+  SASAnchorLatency_t *shared = t->shared;
+  long old;
+  int i, j;
+
+  if (t->pending && getSASRegionStateByAddr ((unsigned long) shared))
+    {
+      for (i = 0; i < SAS_STATS_LAT_POINTS; i++)
+	{
+	  if (t->count[i] == 0)
+	    continue;
+	  sas_fetch_and_add (&shared->count[i], t->count[i]);
+	  sas_fetch_and_add (&shared->totalTicks[i], t->totalTicks[i]);
+	  for (j = 0; j < SAS_STATS_LAT_BUCKETS; j++)
+	    if (t->hist[i][j])
+	      sas_fetch_and_add (&shared->hist[i][j], t->hist[i][j]);
+	  do
+	    old = shared->maxTicks[i];
+	  while ((t->maxTicks[i] > old)
+		 && !sas_compare_and_swap (&shared->maxTicks[i], old,
+					   t->maxTicks[i]));
+	}
+    }
+  memset (t, 0, sizeof (*t));
+}
+
+sphtimer_t
+SASLatencyStart ()
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+
+  if (anchor && anchor->anchors.latency.enabled)
+    return sphgettimer ();
+  return 0;
+}
+
+void
+SASLatencyRecord (int point, sphtimer_t start)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  SASLatencyThread_t *t = &sasLatencyThread;
+  sphtimer_t ticks;
+  int bucket;
+
+  if ((start == 0) || (anchor == NULL))
+    return;
+  ticks = sphgettimer () - start;
+  if (t->shared != &anchor->anchors.latency)
+    {
+      SASLatencyFlushThread (t);
+      t->shared = &anchor->anchors.latency;
+      SASBlockCacheThreadInit ();
+    }
+  bucket = ticks ? (64 - __builtin_clzll (ticks)) : 0;
+  if (bucket >= SAS_STATS_LAT_BUCKETS)
+    bucket = SAS_STATS_LAT_BUCKETS - 1;
+  t->count[point]++;
+  t->totalTicks[point] += ticks;
+  if ((long) ticks > t->maxTicks[point])
+    t->maxTicks[point] = ticks;
+  t->hist[point][bucket]++;
+  if (++t->pending >= SAS_LATENCY_BATCH)
+    {
+      SASAnchorLatency_t *shared = t->shared;
+      SASLatencyFlushThread (t);
+      t->shared = shared;
+    }
+}
+
+void
+SASLatencyFlush ()
+{
+  SASLatencyFlushThread (&sasLatencyThread);
+}
+
+int
+SASLatencyEnable (int enable)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  int old;
+
+  if (anchor == NULL)
+    return -1;
+  old = anchor->anchors.latency.enabled != 0;
+  anchor->anchors.latency.enabled = enable ? 1 : 0;
+  return old;
+}
+
+void
+SASLatencyReset ()
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  SASAnchorLatency_t *l;
+
+  if (anchor == NULL)
+    return;
+  l = &anchor->anchors.latency;
+  memset (l->count, 0, sizeof (l->count));
+  memset (l->totalTicks, 0, sizeof (l->totalTicks));
+  memset (l->maxTicks, 0, sizeof (l->maxTicks));
+  memset (l->hist, 0, sizeof (l->hist));
+}
+
+int
+getSASLatencyStats (SASLatencyStats_t *stats)
+{
+  SASAnchorBlock_t *anchor = (SASAnchorBlock_t *) memLow;
+  SASAnchorLatency_t *l;
+  int i, j;
+
+  if (anchor == NULL)
+    return -1;
+  l = &anchor->anchors.latency;
+  memset (stats, 0, sizeof (*stats));
+  stats->enabled = l->enabled != 0;
+  for (j = 0; j < SAS_LATENCY_BUCKETS; j++)
+    stats->bucket_nsec[j] = j ? SASTimerNsec ((1ULL << j) - 1) : 0;
+  for (i = 0; i < SAS_LATENCY_POINTS; i++)
+    {
+      stats->count[i] = l->count[i];
+      stats->total_nsec[i] = SASTimerNsec (l->totalTicks[i]);
+      stats->max_nsec[i] = SASTimerNsec (l->maxTicks[i]);
+      for (j = 0; j < SAS_LATENCY_BUCKETS; j++)
+	stats->hist[i][j] = l->hist[i][j];
+    }
+  return 0;
+}
+
 unsigned int
 SASAnchorFreeSpace ()
 {
@@ -1694,6 +4522,34 @@ SASReset ()
   SASRelease ();
 }
 
+/* Release the process local state of the calling thread's region
+   after it is detached or removed, making the region free.  */
+static void
+SASRegionRelease (void)
+{
+  SASRegionState_t *region = getSASRegionState ();
+
+  // Discard blocks threads cached for this region.
+  region->cacheGen++;
+  if (--sasJoinedRegions == 0)
+    SASDisableSigSegv ();
+  munmap ((char *) getMemHigh (), 4096);
+
+  free (mem_IDs);
+  mem_IDs = NULL;
+  SASBlockMapClose (region);
+  SASJoinUnmark (region);
+  if (region == &sasRegionTable[0])
+    sasStorePath = NULL;
+  SASFreeSegPath (region);
+  free (region->storePath);
+  region->storePath = NULL;
+  sasHugePages = 0;
+  sasJoinOptions = 0;
+  memLow = 0;
+  memHigh = 0;
+}
+
 void
 SASRemove ()
 {
@@ -1707,7 +4563,11 @@ SASRemove ()
   SASLockReset ();
   SASLockRemove ();
   destroySASSem (&anchor->anchors);
-  free (mem_IDs);
+  SASBlockMapRemove (getSASRegionState ());
+  // The tmpfs directory of a volatile region.
+  if (getSASRegionState ()->segPath != getSASRegionState ()->storePath)
+    rmdir (getSASRegionState ()->segPath);
+  SASRegionRelease ();
 }
 
 static __thread struct sigaction oldThreadSigSegV;
@@ -1734,11 +4594,10 @@ SASThreadSigSegvHandler(int signal, siginfo_t * info, void *context)
 #endif
 	if (signal == SIGSEGV)
 	{
-		unsigned long reg_low = (unsigned long) memLow;
-		unsigned long reg_high = (unsigned long) memHigh;
 		unsigned long segv_addr = (unsigned long) info->si_addr;
-		if ((segv_addr >= reg_low) && (segv_addr < reg_high)) {
-			SASAttachAllocatedAddr(info->si_addr);
+		SASRegionState_t *region = getSASRegionStateByAddr (segv_addr);
+		if (region && (segv_addr < region->regionHigh)) {
+			SASAttachRegionAddr(region, info->si_addr);
 		} else {
 			if (oldThreadSigSegV.sa_handler != SIG_DFL)
 			{
@@ -1804,17 +4663,15 @@ SASCleanUp ()
   sas_printf ("SASCleanUp()\n");
 #endif
 
+  SASHeapMagazineFlush ();
+  SASBlockCacheFlush ();
+  SASStatsFlush ();
+  SASLatencyFlush ();
   SASDetachAllocatedSegs ();
   if (SASDetachSegByAddr (anchor, SegmentSize))
     {
       sas_printf ("SASCleanUp: SASDetachSegByAddr failed\n");
     }
   SASLockDetach ();
-  SASDisableSigSegv ();
-  munmap ((char *) getMemHigh (), 4096);
-
-  free (mem_IDs);
-  mem_IDs = NULL;
-  free (sasStorePath);
-  sasStorePath = NULL;
+  SASRegionRelease ();
 }
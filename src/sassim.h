@@ -114,6 +114,13 @@
 */
 typedef unsigned long sasseg_t;
 
+/** \brief SAS region handle.
+*
+*	Identifies one of the SAS regions joined by this process,
+*	see SASRegionJoin.
+*/
+typedef int sasregion_t;
+
 #ifdef __cplusplus
 #define __C__ "C"
 #else
@@ -130,6 +137,80 @@ SASS2Log2 (unsigned long size);
 */
 extern __C__ int sasClearOnDealloc;
 
+/** \brief SAS release on block deallocate flag.
+*
+*	When set (the default is 0) SASBlockDealloc frees the backing file
+*	blocks and real memory of deallocated blocks larger than a page,
+*	with sasMsyncRemove(). Segments that become entirely free are
+*	punched out, so a store with allocation churn does not grow its
+*	disk and memory footprint without bound. This costs a system call
+*	per deallocation. It can also be enabled for one region by
+*	joining with SAS_JOIN_RELEASE.
+*
+*	\note A segment released this way is also unmapped in the
+*	calling process (other processes keep their mapping, which reads
+*	as zeros). The next reference to the segment in this process
+*	faults and attaches it again, through the runtime's SIGSEGV
+*	handler, as for segments allocated by other processes.
+*/
+extern __C__ int sasReleaseOnDealloc;
+
+/** \brief Number of size classes held in the per thread block cache,
+*	4KB to 256KB blocks.
+*/
+#define SAS_BLOCK_CACHE_CLASSES	7
+/** \brief Maximum blocks of each size in the per thread block cache.
+*/
+#define SAS_BLOCK_CACHE_DEPTH	8
+
+/** \brief SAS per thread block cache depth.
+*
+*	When non-zero (the default is 0) SASBlockDealloc keeps up to this
+*	many (maximum SAS_BLOCK_CACHE_DEPTH) recently deallocated blocks of
+*	each size, up to 256KB, in a cache local to the calling thread, and
+*	SASBlockAlloc reuses them without taking the region lock. When a
+*	size is full half its blocks are returned to the region together.
+*	Cached blocks remain allocated in the region, and are not punched
+*	out or cleared (see sasReleaseOnDealloc), until the thread exits
+*	or calls SASBlockCacheFlush(). They are also flushed by SASCleanUp()
+*	and at process exit, but blocks cached when a process crashes (or
+*	by threads that are still running at _exit) stay allocated in the
+*	store.
+*/
+extern __C__ int sasBlockCacheDepth;
+
+/** \brief Number of magazines in each thread's heap magazine table.
+*/
+#define SAS_HEAP_MAGAZINES	32
+/** \brief Maximum objects held in each heap magazine.
+*/
+#define SAS_HEAP_MAGAZINE_DEPTH	32
+/** \brief Largest SASSimpleHeap allocation held in a heap magazine.
+*/
+#define SAS_HEAP_MAGAZINE_MAX	1024
+
+/** \brief SAS per thread heap magazine depth.
+*
+*	When non-zero (the default is 0) SASSimpleHeapFree, for sizes up
+*	to SAS_HEAP_MAGAZINE_MAX, and SASCompoundHeapFree keep up to this
+*	many (maximum SAS_HEAP_MAGAZINE_DEPTH) freed objects of each heap
+*	and size in a magazine local to the calling thread, and
+*	SASSimpleHeapAlloc and SASCompoundHeapAlloc reuse them without
+*	taking the heap lock. When a magazine is full half its objects
+*	are freed to the heap together, under one lock.
+*	Objects in a magazine remain allocated in the persistent heap, so
+*	other processes see a consistent heap, until the thread exits or
+*	calls SASHeapMagazineFlush(). Each heap carries a stamp that is
+*	cleared when the heap is destroyed (or a SASSimpleHeap is freed
+*	back to its SASCompoundHeap), so objects other threads hold for
+*	that heap are dropped rather than freed into the memory reused.
+*	A free is range and alignment checked before it is cached, and
+*	freeing an object already in the magazine returns -2.
+*	A free that fails when a magazine is drained is reported on
+*	stdout.
+*/
+extern __C__ int sasHeapMagazineDepth;
+
 /** \brief Get the Region's lowest memory address.
 *
 *	With getMemHigh() defines the Region (starting process address and extent).
@@ -200,6 +281,167 @@ setSASLinearUseList (void);
 extern __C__ void
 setSASCompactUseList (void);
 
+/** \brief Get the block allocation mode flag
+*
+*   @return a 0 value indicates blocks are allocated from the region
+*   trees under the region lock, while 1 indicates blocks smaller than
+*   a segment are allocated lock-free from buddy bitmaps.
+*/
+extern __C__ int
+getSASBlockAllocFlag (void);
+
+/** \brief Set block allocation to Tree mode
+*
+*   SASBlockAlloc allocates all blocks from the region's free and
+*   uncommitted trees, under the region lock (the default). Blocks
+*   already allocated from buddy bitmaps are still freed to them.
+*/
+extern __C__ void
+setSASTreeBlockAlloc (void);
+
+/** \brief Set block allocation to Bitmap mode
+*
+*   SASBlockAlloc allocates blocks smaller than a segment from whole
+*   segments (arenas) managed by a free bitmap for each power of 2
+*   order. Allocation, and coalescing freed blocks with their buddies,
+*   use atomic compare and swap on the bitmaps shared by all processes
+*   joined to the region, so do not take the region lock. The lock is
+*   only taken to add an arena when the existing arenas are full.
+*   Arena segments are kept for the life of the region. They are not
+*   returned to the region trees when all their blocks are freed (or
+*   when the mode is set back to Tree), so their space remains
+*   available only to allocations in Bitmap mode.
+*
+*   The mode is recorded in the region's anchor block.
+*/
+extern __C__ void
+setSASBitmapBlockAlloc (void);
+
+/** \brief Region mode flag for the default (4KB page) region.
+*/
+#define SAS_REGION_DEFAULT	0x0UL
+
+/** \brief Region mode flag requesting huge page backed segments.
+*
+*   Segments of the region are advised (MADV_HUGEPAGE) for
+*   transparent huge pages as they are mapped. This is effective for
+*   SAS stores on tmpfs (with shmem_enabled=advise or better) and for
+*   file systems supporting large folios.
+*   SAS stores on a hugetlbfs mount are always huge page backed and
+*   are recorded as SAS_REGION_HUGEPAGE regardless of the requested mode.
+*/
+#define SAS_REGION_HUGEPAGE	0x1UL
+
+/** \brief Region mode flag requesting a volatile (non persistent) region.
+*
+*   For IPC only use, where the region need not survive a restart.
+*   The segment files of the region are kept on tmpfs (/dev/shm), in a
+*   directory named for the store directory, so they are never written
+*   back to disk. Other processes join the region by the store path as
+*   usual. New segments are created and mapped with a single open.
+*   If the store directory is itself on tmpfs its files are used as is.
+*   SASRemove() removes the tmpfs directory with the segments.
+*/
+#define SAS_REGION_VOLATILE	0x2UL
+
+/** \brief Join option to start read ahead of segments attached at join.
+*
+*   Join options (SAS_JOIN_*) apply only to the joining process and
+*   are not recorded in the anchor block.
+*   With SAS_JOIN_WILLNEED the runtime issues madvise(MADV_WILLNEED)
+*   for each segment attached eagerly (at join or via SASAttachNewSegs())
+*   so the backing file is read into the page cache asynchronously.
+*/
+#define SAS_JOIN_WILLNEED	0x100UL
+
+/** \brief Join option to pre-fault segments attached at join.
+*
+*   As SAS_JOIN_WILLNEED, but also populates the page tables of each
+*   eagerly attached segment before returning. This moves the cost of
+*   first touch page faults to join time, so a restarted consumer
+*   does not see latency spikes on its first references.
+*/
+#define SAS_JOIN_POPULATE	0x200UL
+
+/** \brief Join option to recover the store from its last checkpoint.
+*
+*   Each process joined to a store with a checkpoint (SASCKPT
+*   directory) holds a locked marker file there, removed when it
+*   detaches with SASCleanUp() or SASRemove(). A marker left behind
+*   shows a process crashed, or exited without detaching, or the
+*   system restarted, while the store was joined. Its writes since
+*   the last SASCheckpoint() may be incomplete, so a join with this
+*   option then restores the store's segment files from the
+*   checkpoint (see SASCheckpointRestore()) before the region is
+*   joined, and removes the stale markers. After a clean detach and
+*   restart the store is left as is. The restore is skipped, with a
+*   message, while other processes are still joined to the store.
+*   Processes joined before the first checkpoint of the store are
+*   not tracked until they take a checkpoint.
+*
+*   The checkpoint holds consistent application data only if it was
+*   taken while the application's writers were quiesced, see
+*   SASCheckpoint().
+*/
+#define SAS_JOIN_RECOVER	0x400UL
+
+/** \brief Join option to map a snapshot of a store.
+*
+*   Join a store created by SASSnapshotCreate() as a read only view,
+*   which does not change as the live store does. Segments are mapped copy on write (MAP_PRIVATE) at the
+*   addresses recorded in the snapshot, so pointers within the region
+*   remain valid, and the snapshot files are never modified. Writes by
+*   the process (including SAS lock words) stay private to the process,
+*   so readers need no locking against the writers of the live store.
+*/
+#define SAS_JOIN_SNAPSHOT	0x800UL
+
+/** \brief Join option to release deallocated blocks.
+*
+*   As setting sasReleaseOnDealloc, but only for the region joined
+*   with this option, by this process.
+*/
+#define SAS_JOIN_RELEASE	0x1000UL
+
+/** \brief Mask of the process local join options within a mode.
+*/
+#define SAS_JOIN_MASK		0xff00UL
+
+/** \brief Get the region mode recorded in the anchor block.
+*
+*   The region mode is selected when the region is created
+*   (see SASJoinRegionByNameMode()) and persists with the SAS store.
+*
+*   @return the region mode flags (SAS_REGION_DEFAULT or a combination of
+*   SAS_REGION_* flags) for the joined region.
+*/
+extern __C__ unsigned long
+getSASRegionMode (void);
+
+/** \brief Set the region geometry for new SAS stores.
+*
+*   By default a new SAS store uses the platform region base address,
+*   region size and segment size from sasconf.h. Large stores may
+*   want larger segments (which also raises the maximum SASBlockAlloc
+*   size) and small stores a smaller region and segments to reduce
+*   the address space and backing file sizes committed.
+*
+*   The geometry is recorded in the anchor block when a store is
+*   created. Joining an existing store always uses the recorded
+*   geometry and the requested geometry only applies to new stores.
+*   Must be called before the join, and applies to all later joins.
+*
+*   @param regionBase region base address, aligned to segmentSize.
+*   @param regionSize region size, a power of 2 >= segmentSize.
+*   @param segmentSize segment size, a power of 2 >= 1MB.
+*   A 0 value for any parameter selects the platform default.
+*   @return a 0 value indicates success, otherwise the geometry is
+*   invalid.
+*/
+extern __C__ int setSASRegionGeometry (unsigned long regionBase,
+				       unsigned long regionSize,
+				       unsigned long segmentSize);
+
 /** \brief Join this process to a SAS Region.
 *
 *   Join this process to the SAS Region based on the anchor segment
@@ -258,6 +500,363 @@ extern __C__ int SASJoinRegion();
 */
 extern __C__ int SASJoinRegionByName (const char * store_name);
 
+/** \brief Join this process to a named SAS Region with a region mode.
+*
+*   As SASJoinRegionByName() but if the anchor segment does not exist
+*   the new region is created with the requested mode. For example
+*   SAS_REGION_HUGEPAGE backs the segments with huge pages which
+*   reduces TLB misses for large regions.
+*
+*   \note The region mode is recorded in the anchor block when the
+*   region is created. Processes joining an existing region always use
+*   the recorded region mode and the SAS_REGION_* flags are ignored.
+*
+*   The mode may also include SAS_JOIN_* options. These control how
+*   this process attaches the existing segments of the region, for
+*   example SAS_JOIN_POPULATE pre-faults each segment during the join.
+*
+*   @param store_name C string containing the path to this SAS store directory.
+*   @param mode SAS_REGION_DEFAULT or a combination of SAS_REGION_* flags
+*   and SAS_JOIN_* options.
+*	@return a 0 value indicates success, otherwise failure.
+*/
+extern __C__ int SASJoinRegionByNameMode (const char * store_name,
+					  unsigned long mode);
+
+/** \brief Attach segments allocated by other processes since join.
+*
+*   Segments created by cooperating processes after this process
+*   joined are normally attached on first reference, via the SIGSEGV
+*   handler. Each such lazy attach costs a signal delivery plus the
+*   mmap of the backing file.
+*   SASAttachNewSegs() walks the region's allocated segment list and
+*   attaches any segments not yet mapped into this process, applying
+*   the SAS_JOIN_WILLNEED/SAS_JOIN_POPULATE options of the join.
+*   Applications can call this when notified of new data to make the
+*   warm up cost predictable.
+*
+*   @return the number of segments attached.
+*/
+extern __C__ int SASAttachNewSegs (void);
+
+/** \brief Return the number of segments attached from the SIGSEGV handler.
+*
+*   Counts the lazy (on first reference) segment attaches taken by this
+*   process since it was started.
+*
+*   @return the count of lazy segment attaches.
+*/
+extern __C__ long getSASLazyAttachCount (void);
+
+/** \brief Phase timings of the last region join.
+*
+*   All times are in microseconds. The anchor phase covers attaching
+*   (or creating) the anchor segment, the scan phase the single pass
+*   over the SAS store directory, the attach phase mapping the
+*   allocated segments, and the lock phase initializing the lock
+*   manager. segments is the count of segments attached at join and
+*   threads the number of threads used to attach them.
+*/
+typedef struct SASJoinStats_t
+{
+  unsigned long anchor_usec;
+  unsigned long scan_usec;
+  unsigned long attach_usec;
+  unsigned long lock_usec;
+  unsigned long total_usec;
+  unsigned long segments;
+  unsigned long threads;
+} SASJoinStats_t;
+
+/** \brief Return the phase timings of the last region join.
+*
+*   @param stats pointer to the SASJoinStats_t to fill in.
+*/
+extern __C__ void getSASJoinStats (SASJoinStats_t *stats);
+
+/** \brief Set the number of threads used to attach segments at join.
+*
+*   Joining a large existing region maps every allocated segment.
+*   Segments are independent files, so their attach (and any
+*   SAS_JOIN_WILLNEED/SAS_JOIN_POPULATE work) can be done in parallel.
+*   Must be called before SASJoinRegion to take effect.
+*
+*   @param threads maximum number of attach threads. 0 (the default)
+*   uses one thread per online CPU for regions of 32 or more segments,
+*   and 1 attaches serially.
+*/
+extern __C__ void setSASJoinThreads (int threads);
+
+/** \brief Join an additional SAS Region.
+*
+*   A process can join several SAS stores at the same time, for
+*   example a hot store on tmpfs and a cold store on NVMe, provided
+*   each region is mapped at a distinct base address. Call
+*   setSASRegionGeometry() before creating a store to select a base
+*   address that does not overlap the regions already joined.
+*
+*   The first region joined (by SASJoinRegion* or SASRegionJoin) is
+*   region 0, which is used by threads that have not selected a
+*   region with SASRegionSelect(). Block deallocation, SASFindHeader,
+*   SASLock and the SIGSEGV segment attach handler resolve the region
+*   from the address. Allocations use the calling thread's region or
+*   the region passed to SASRegionBlockAlloc().
+*
+*   @param store_name C string containing the path to the SAS store directory.
+*   @param mode as for SASJoinRegionByNameMode().
+*   @return the region handle, or -1 if the join failed.
+*/
+extern __C__ sasregion_t SASRegionJoin (const char * store_name,
+					unsigned long mode);
+
+/** \brief Select the SAS Region for the calling thread.
+*
+*   Subsequent allocations, SASBlockAlloc and the other region level
+*   functions (getSASFinder, SASCleanUp, ...) called by this thread
+*   apply to the selected region.
+*
+*   @param region handle returned by SASRegionJoin.
+*   @return the previously selected region, or -1 if region is invalid.
+*/
+extern __C__ sasregion_t SASRegionSelect (sasregion_t region);
+
+/** \brief Return the SAS Region containing an address.
+*
+*   @param addr an address within a joined SAS Region.
+*   @return the region handle, or -1 if addr is not within a joined region.
+*/
+extern __C__ sasregion_t SASRegionByAddr (const void *addr);
+
+/** \brief Allocate a block of memory within a specific SAS Region.
+*
+*   As SASBlockAlloc() but from the specified region, independent of
+*   the region selected by the calling thread.
+*
+*   @param region handle returned by SASRegionJoin.
+*   @param blockSize size of the block to allocate.
+*   @return address of the allocated block, or NULL.
+*/
+extern __C__ void *SASRegionBlockAlloc (sasregion_t region,
+					unsigned long blockSize);
+
+/** \brief Detach this process from a specific SAS Region.
+*
+*   As SASCleanUp() for the specified region.
+*
+*   @param region handle returned by SASRegionJoin.
+*/
+extern __C__ void SASRegionCleanUp (sasregion_t region);
+
+/** \brief Number of block orders in SASRegionStats_t.
+*
+*   Order i counts blocks of 4KB << i bytes.
+*/
+#define SAS_REGION_STATS_ORDERS 36
+
+/** \brief Allocation statistics of the current region.
+*
+*   The counters are kept in the region's anchor as blocks are
+*   allocated and freed, by all the processes sharing the region, so
+*   they are read without the region lock or walking the allocation
+*   trees. free_bytes and uncommitted_bytes are the bytes of the free
+*   blocks of each order, used_bytes the bytes of the blocks in use by
+*   the order of their requested size. Blocks of a region in the
+*   buddy bitmap allocation mode are counted as used by their segment.
+*   largest_free is the largest block that can be allocated, including
+*   from segments not yet committed, so an application can alert
+*   before the region runs out of contiguous space. lock_waits counts
+*   the contended acquires of the region lock and lock_wait_usec the
+*   time spent waiting. Each thread adds its alloc_count,
+*   alloc_failures and dealloc_count to the region every 64 calls and
+*   when it exits, so the counts of other running threads may lag by
+*   that much.
+*/
+typedef struct SASRegionStats_t
+{
+  unsigned long free_bytes[SAS_REGION_STATS_ORDERS];
+  unsigned long uncommitted_bytes[SAS_REGION_STATS_ORDERS];
+  unsigned long used_bytes[SAS_REGION_STATS_ORDERS];
+  unsigned long free_total;
+  unsigned long uncommitted_total;
+  unsigned long used_total;
+  unsigned long largest_free;
+  unsigned long segments_committed;
+  unsigned long segments_total;
+  unsigned long alloc_count;
+  unsigned long alloc_failures;
+  unsigned long dealloc_count;
+  unsigned long lock_acquires;
+  unsigned long lock_waits;
+  unsigned long lock_wait_usec;
+} SASRegionStats_t;
+
+/** \brief Return the allocation statistics of the current region.
+*
+*   The allocation counts of the calling thread are added to the region
+*   first.
+*
+*   @param stats pointer to the SASRegionStats_t to fill in.
+*   @return 0 on success, or -1 if no region is joined.
+*/
+extern __C__ int getSASRegionStats (SASRegionStats_t *stats);
+
+/** \brief Allocator entry points with latency histograms.
+*/
+enum
+{
+  SAS_LATENCY_BLOCK_ALLOC = 0,	/**< SASBlockAlloc */
+  SAS_LATENCY_BLOCK_ALLOC_MANY,	/**< SASBlockAllocMany */
+  SAS_LATENCY_COMPOUND_ALLOC,	/**< SASCompoundHeapAlloc */
+  SAS_LATENCY_SIMPLE_ALLOC,	/**< SASSimpleHeapAlloc */
+  SAS_LATENCY_SLAB_ALLOC,	/**< SASSlabHeapAlloc */
+  SAS_LATENCY_POINTS
+};
+
+#define SAS_LATENCY_BUCKETS 32
+
+/** \brief Allocation latency histograms of the current region.
+*
+*   hist[point][i] counts the calls of the entry point taking at most
+*   bucket_nsec[i] nanoseconds (and more than bucket_nsec[i-1]), the
+*   time spent waiting for locks included. The buckets are powers of 2
+*   of the sphgettimer ticks, so the bounds depend on the timebase
+*   frequency. Calls are added to the shared histograms in batches by
+*   each thread, see SASLatencyFlush.
+*/
+typedef struct SASLatencyStats_t
+{
+  int enabled;
+  unsigned long count[SAS_LATENCY_POINTS];
+  unsigned long total_nsec[SAS_LATENCY_POINTS];
+  unsigned long max_nsec[SAS_LATENCY_POINTS];
+  unsigned long bucket_nsec[SAS_LATENCY_BUCKETS];
+  unsigned long hist[SAS_LATENCY_POINTS][SAS_LATENCY_BUCKETS];
+} SASLatencyStats_t;
+
+/** \brief Return the allocation latency histograms of the current
+*   region.
+*
+*   @param stats pointer to the SASLatencyStats_t to fill in.
+*   @return 0 on success, or -1 if no region is joined.
+*/
+extern __C__ int getSASLatencyStats (SASLatencyStats_t *stats);
+
+/** \brief Enable or disable the allocation latency histograms of the
+*   current region.
+*
+*   The setting is kept in the region's anchor, so it applies to all
+*   the processes sharing the region. While disabled the entry points
+*   only test the setting and do not read the timer.
+*
+*   @param enable nonzero to enable, 0 to disable.
+*   @return the previous setting, or -1 if no region is joined.
+*/
+extern __C__ int SASLatencyEnable (int enable);
+
+/** \brief Clear the allocation latency histograms of the current
+*   region.
+*
+*   Counts added concurrently by other threads may be partially lost.
+*/
+extern __C__ void SASLatencyReset (void);
+
+/** \brief Add the allocation latencies counted by the calling thread
+*   to the histograms of the region.
+*
+*   Threads add their counts every 64 calls, when they exit and (for
+*   the calling thread) in SASCleanUp() or at process exit. A thread
+*   should flush before the histograms are read when exact counts are
+*   needed.
+*/
+extern __C__ void SASLatencyFlush (void);
+
+/** \brief Statistics of the last region checkpoint.
+*
+*   generation is the checkpoint generation written, segments the
+*   count of allocated segments in the checkpoint, copied the count of
+*   (dirty) segments copied by this checkpoint, total_usec the time
+*   taken and lock_usec the part of it spent holding the region lock.
+*/
+typedef struct SASCheckpointStats_t
+{
+  unsigned long generation;
+  unsigned long segments;
+  unsigned long copied;
+  unsigned long total_usec;
+  unsigned long lock_usec;
+} SASCheckpointStats_t;
+
+/** \brief Checkpoint the current region.
+*
+*   Writes an incremental copy of the region into the SASCKPT
+*   sub-directory of the SAS store. Only segments written
+*   since the previous checkpoint (their backing file modification time
+*   is later than its start) are synced and copied, other segments are
+*   carried over from the previous checkpoint. Stores on tmpfs do not
+*   record modification times for mapped writes, so every segment is
+*   copied. The checkpoint becomes current when its MANIFEST is renamed
+*   into place, so a crash leaves the previous checkpoint intact.
+*   Copies are reflinks where the file system supports them.
+*
+*   Only an image of the anchor block, holding the anchor and the
+*   allocation trees, is taken with the region lock held, so the
+*   allocation state of the checkpoint is that of a single point in
+*   time. The segments are copied after the lock is released, one at a
+*   time, each as found. Application writes do not take the region
+*   lock, so application data is not a point in time image. It may
+*   even be torn within a segment. For an application consistent
+*   image call this at a point where the application's writers (and
+*   allocations) are quiesced.
+*
+*   @return 0 on success, otherwise the errno of the failing operation.
+*/
+extern __C__ int SASCheckpoint (void);
+
+/** \brief Return the statistics of the last SASCheckpoint().
+*
+*   @param stats pointer to the SASCheckpointStats_t to fill in.
+*/
+extern __C__ void getSASCheckpointStats (SASCheckpointStats_t *stats);
+
+/** \brief Restore a SAS store from its last checkpoint.
+*
+*   Replaces the segment files of the store with the checkpoint copies
+*   and removes segment files created after the checkpoint. The store
+*   must not be joined by any process.
+*
+*   @param store_name C string containing the path to the SAS store directory.
+*   @return 0 on success, ENOENT if the store has no checkpoint,
+*   otherwise the errno of the failing operation.
+*/
+extern __C__ int SASCheckpointRestore (const char *store_name);
+
+/** \brief Create a snapshot of the current region.
+*
+*   Clones the segment files of the region into the (new or empty)
+*   directory snap_dir, which can then be joined with SAS_JOIN_SNAPSHOT
+*   by reader processes. Where the file system supports reflinks
+*   (e.g. XFS, Btrfs) the clones share blocks with the live store, copy
+*   on write, so the snapshot is fast and initially uses no space.
+*   Otherwise the segment files are copied.
+*
+*   As for SASCheckpoint(), only an image of the anchor block (the
+*   anchor and the allocation trees) is taken with the region lock
+*   held, so the allocation state is that of a single point in time.
+*   The segments are cloned or copied after the lock is released, one
+*   at a time, each as found. Application data is not a point in time
+*   image, and may be torn within a segment, unless the application's
+*   writers are quiesced while the snapshot is taken. If the snapshot
+*   fails, the files it created are removed, and snap_dir too if it
+*   was created.
+*
+*   Remove a snapshot which is no longer used by joining it and
+*   calling SASRemove() or with "sasutil remove".
+*
+*   @param snap_dir C string containing the path of the snapshot directory.
+*   @return 0 on success, otherwise the errno of the failing operation.
+*/
+extern __C__ int SASSnapshotCreate (const char *snap_dir);
+
 /** \brief Allocate a block of memory within SAS Storage.
 *
 *	Blocks are allocated within the SAS region.
@@ -287,6 +886,123 @@ extern __C__ void *SASBlockAlloc (unsigned long blockSize);
 */
 extern __C__ void SASBlockDealloc (void *blockAddr, unsigned long blockSize);
 
+/** \brief Allocate a number of blocks of the same size within SAS Storage.
+*
+*	As count calls to SASBlockAlloc() but under a single acquisition
+*	of the region lock. Where the region's free space allows, the
+*	blocks are carved from power of 2 runs of contiguous blocks and
+*	each run is recorded on the used tree as one entry, which is split
+*	as the blocks are deallocated. Intended for building large
+*	structures, for example the nodes of a big index or a pool of
+*	queue buffers.
+*
+*   @param blockSize size of the blocks to be allocated.
+*   @param count number of blocks to allocate.
+*   @param blocks array of at least count entries receiving the addresses
+*	of the allocated blocks.
+*	@return the number of blocks allocated, less than count if the
+*	region is out of space.
+*/
+extern __C__ int SASBlockAllocMany (unsigned long blockSize, int count,
+				    void **blocks);
+
+/** \brief Deallocate a number of blocks of the same size within SAS Storage.
+*
+*	As count calls to SASBlockDealloc() but taking the region lock
+*	once for each run of blocks from the same region. The blocks
+*	bypass the per thread block cache.
+*
+*   @param blockSize size of the blocks to be deallocated.
+*   @param count number of blocks to deallocate.
+*   @param blocks array of the block addresses.
+*/
+extern __C__ void SASBlockDeallocMany (unsigned long blockSize, int count,
+				       void **blocks);
+
+/** \brief Return the calling thread's cached blocks to their regions.
+*
+*	Blocks deallocated by the thread and held in its block cache (see
+*	sasBlockCacheDepth) are freed to the regions they belong to. This
+*	is done when the thread exits, at process exit and by SASCleanUp().
+*/
+extern __C__ void SASBlockCacheFlush (void);
+
+/** \brief Return the calling thread's heap magazines to their heaps.
+*
+*	Objects freed by the thread and held in its heap magazines (see
+*	sasHeapMagazineDepth) are freed to the SASSimpleHeap or
+*	SASCompoundHeap they belong to. This is done when the thread exits
+*	and by SASCleanUp().
+*/
+extern __C__ void SASHeapMagazineFlush (void);
+
+/** \brief NUMA policy, segments follow the process default policy.
+*/
+#define SAS_NUMA_DEFAULT	0
+/** \brief NUMA policy, interleave segment pages across all nodes.
+*/
+#define SAS_NUMA_INTERLEAVE	1
+/** \brief NUMA policy, allocate segment pages on a preferred node.
+*/
+#define SAS_NUMA_PREFERRED	2
+/** \brief NUMA policy, allocate segment pages only on a node.
+*/
+#define SAS_NUMA_BIND		3
+/** \brief Maximum number of NUMA nodes supported by the SAS_NUMA_* policies.
+*/
+#define SAS_NUMA_MAX_NODES	64
+
+/** \brief Set the NUMA placement policy for segments.
+*
+*   Segments created or attached by this process after this call
+*   use the policy for their page allocations. The policy is process
+*   local, other processes sharing the store set their own policy.
+*
+*   For stores on tmpfs (including SAS_REGION_VOLATILE regions) and
+*   hugetlbfs the policy is applied to the segment mappings with
+*   mbind and places every page. The page cache of a disk backed
+*   store ignores mbind and places each page by the policy of the
+*   thread that first faults it in. For those stores the policy only
+*   places the pages faulted in by a SAS_JOIN_POPULATE join, other
+*   pages follow the policy of the thread touching them.
+*
+*   @param policy one of the SAS_NUMA_* policies.
+*   @param node the node for SAS_NUMA_PREFERRED and SAS_NUMA_BIND.
+*   @return a 0 value indicates success, otherwise EINVAL.
+*/
+extern __C__ int setSASNumaPolicy (int policy, int node);
+
+/** \brief Allocate a block of memory on a specific NUMA node.
+*
+*   As SASBlockAlloc() but the block prefers pages on the given node
+*   and pages of the block already faulted in by this process are
+*   migrated to it. For example a producer/consumer queue can be kept
+*   node local to the threads using it. The node preference is
+*   applied to the block's address range, so is intended for larger
+*   (multiple page) blocks. For a disk backed store the block's pages
+*   are also faulted in on the node, as the page cache does not follow
+*   the preference. Pages in the page cache and mapped by other
+*   processes are not moved.
+*
+*   @param blockSize size of the block to be allocated.
+*   @param node the NUMA node for the block.
+*   @return the address of the start of the allocated block,
+*   or NULL if the allocation fails.
+*/
+extern __C__ void *SASBlockAllocNode (unsigned long blockSize, int node);
+
+/** \brief Return the NUMA node residency of the region.
+*
+*   Counts the pages of allocated segments, that are in the page
+*   cache, by the NUMA node they reside on.
+*
+*   @param nodePages array receiving the page count for each node.
+*   @param maxNodes number of entries in nodePages.
+*   @return the number of nodes with resident pages (the highest node
+*   + 1), or -1 if not supported.
+*/
+extern __C__ int SASNumaResidency (unsigned long *nodePages, int maxNodes);
+
 /** \brief Return the maximum depth for the tree tracking allocated
 *   Region segments.
 *
@@ -12,10 +12,9 @@
 #define sas_printf printf
 #include <stdlib.h>
 #include "sasalloc.h"
+#include "sasallocpriv.h"
 #include "freenode.h"
-#ifdef __SASDebugPrint__
 #include "sasio.h"
-#endif
 #include "sasanchr.h"
 #include "sassim.h"
 #include "saslock.h"
@@ -30,9 +29,20 @@ SASSimpleHeapInit (void* heap_seg,  sas_type_t sasType,
     
     if ( heapBlock )
     {
+	if (sasType & SAS_SEGREGATED_VERSION)
+	{
+		initSOMSASBlock(heapBlock, sasType, heap_size, NULL);
+		freeNodeHeap_init(SOMSASGetBlockFreeNodeHeap (heapBlock),
+		                  heap_size - heap_offset);
+	} else {
 		heapStart = (char*) heapBlock + heap_offset;
 		initSOMSASBlock(heapBlock, sasType, 
 		                               heap_size, heapStart);
+	}
+	// Magazines of a previous heap in the block are stale.
+	if ((sasType & SAS_SUBTYPE_CHECK_MASK)
+	    == (SAS_RUNTIME_SIMPLEHEAP & SAS_SUBTYPE_CHECK_MASK))
+		*SASSimpleHeapMagazineStamp(heapBlock) = 0;
     }
 
     return (SASSimpleHeap_t)heapBlock;
@@ -53,6 +63,21 @@ SASSimpleHeapCreate (block_size_t heap_size)
 	    return NULL;
 }
 
+SASSimpleHeap_t
+SASSimpleHeapCreateSegregated (block_size_t heap_size)
+{
+    SASBlockHeader	*heapBlock = NULL;
+    
+    heapBlock = (SASBlockHeader*)SASBlockAlloc ((long)heap_size);
+    if ( heapBlock )
+    {
+	    return SASSimpleHeapInit(heapBlock, 
+	                             SAS_RUNTIME_SIMPLEHEAP | SAS_SEGREGATED_VERSION,
+		                                             heap_size);
+    } else 
+	    return NULL;
+}
+
 void *
 SASSimpleHeapAllocNoLock (SASSimpleHeap_t heap, 
 				block_size_t alloc_size)
@@ -64,10 +89,14 @@ SASSimpleHeapAllocNoLock (SASSimpleHeap_t heap,
     if (SOMSASCheckBlockSigAndType (headerBlock, 
               SAS_RUNTIME_SIMPLEHEAP) )
     {
+		FreeNodeHeap *fheap = SOMSASGetBlockFreeNodeHeap (headerBlock);
 		heapSize = headerBlock->blockSize - heap_offset;
 		if ( alloc_size < heapSize )
 		{
-		    mem = freeNode_allocSpace(headerBlock->blockFreeSpace,
+		    if (fheap)
+			mem = (freeNode*)freeNodeHeap_allocSpace(fheap, alloc_size);
+		    else
+			mem = freeNode_allocSpace(headerBlock->blockFreeSpace,
 		                    &headerBlock->blockFreeSpace, alloc_size);
 #ifdef __SASDebugPrint__
 		} else {
@@ -84,24 +113,73 @@ SASSimpleHeapAllocNoLock (SASSimpleHeap_t heap,
     return mem;
 }
 
+/* Size class of the heap magazines, allocations are rounded to
+   freeNode granules so any size in the class fits.  */
+static inline block_size_t
+SASSimpleHeapMagazineSize (block_size_t alloc_size)
+{
+    return ((alloc_size + nodeRound) / nodeAlign) * nodeAlign;
+}
+
+/* Return the magazine stamp of the compound heap owning a sub heap,
+   or of a stand alone heap itself. NULL if the heap is owned by
+   another kind of block, whose heaps are not held in magazines.  */
+static unsigned long *
+SASSimpleHeapMagazineRoot (SASBlockHeader *headerBlock)
+{
+    SASBlockHeader	*root = headerBlock->baseBlock;
+
+    if (root == headerBlock)
+	return SASSimpleHeapMagazineStamp(headerBlock);
+    // Sub heaps of an expand block belong to its header block.
+    if (root && (root->baseBlock != root))
+	root = root->baseBlock;
+    if (root && SOMSASCheckBlockSigAndType (root, SAS_RUNTIME_COMPOUNDHEAP))
+	return SASCompoundHeapMagazineStamp(root);
+    return NULL;
+}
+
+/* Free a batch of objects from a heap magazine under one lock.  */
+static void
+SASSimpleHeapMagazineDrain (void *heap, void **objs, int n,
+			block_size_t size)
+{
+    int i;
+
+    SASLock(heap, SasUserLock__WRITE);
+    for (i = 0; i < n; i++)
+	if (SASSimpleHeapFreeNoLock(heap, objs[i], size))
+	    sas_printf("SASSimpleHeapFree(%p, %p, %zu) failed in magazine\n",
+	    		heap, objs[i], size);
+    SASUnlock(heap);
+}
+
 void *
 SASSimpleHeapAlloc (SASSimpleHeap_t heap, block_size_t alloc_size)
 {
     SASBlockHeader	*headerBlock = (SASBlockHeader*)heap;
     void		*mem = NULL;
+    sphtimer_t		tStart = SASLatencyStart ();
     
     if (SOMSASCheckBlockSigAndType (headerBlock, 
               SAS_RUNTIME_SIMPLEHEAP) )
     {
-    	SASLock(heap, SasUserLock__WRITE);
-    	mem = SASSimpleHeapAllocNoLock(heap, alloc_size); 
-		SASUnlock(heap);
+	if (sasHeapMagazineDepth && (alloc_size <= SAS_HEAP_MAGAZINE_MAX))
+	    mem = SASHeapMagazineGet(heap,
+			SASSimpleHeapMagazineSize(alloc_size));
+	if (mem == NULL)
+	{
+	    SASLock(heap, SasUserLock__WRITE);
+	    mem = SASSimpleHeapAllocNoLock(heap, alloc_size); 
+	    SASUnlock(heap);
+	}
 #ifdef __SASDebugPrint__
     } else {
     	sas_printf("SASSimpleHeapAlloc(%p, %zu) type check failed\n",
     	          heap, alloc_size);
 #endif
     }
+    SASLatencyRecord (SAS_LATENCY_SIMPLE_ALLOC, tStart);
     return mem;
 }
 
@@ -115,6 +193,20 @@ SASSimpleHeapFreeNoLock (SASSimpleHeap_t heap,
     freeNode		*free_node = (freeNode*)free_block;
     int rc;
 
+    if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE)
+	 && SOMSASGetBlockFreeNodeHeap (headerBlock) )
+    {
+		rc = freeNodeHeap_deallocSpace(
+			SOMSASGetBlockFreeNodeHeap (headerBlock),
+			free_block, alloc_size) ? -2 : 0;
+#ifdef __SASDebugPrint__
+		if (rc)
+        	    sas_printf("SASSimpleHeapFree(%p, %p, %zu) range check failed\n",
+        				heap, free_block, alloc_size);
+#endif
+		return rc;
+    }
+
     freeNode_init(free_node, alloc_size);
     
     if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
@@ -152,6 +244,32 @@ SASSimpleHeapFree (SASSimpleHeap_t heap,
     
     if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
     {
+	// Objects outside the heap, or misaligned, are left to the
+	// range check. Other heap subtypes use the stamp word.
+	if (sasHeapMagazineDepth && (alloc_size <= SAS_HEAP_MAGAZINE_MAX)
+	    && SOMSASCheckBlockSigAndTypeAndSubtype (headerBlock,
+			SAS_RUNTIME_SIMPLEHEAP)
+	    && ((char*)free_block >= ((char*)headerBlock + heap_offset))
+	    && (((char*)free_block + alloc_size)
+		<= ((char*)headerBlock + headerBlock->blockSize))
+	    && !(((char*)free_block - (char*)headerBlock) & nodeRound))
+	{
+	    rc = SASHeapMagazinePut(heap, free_block,
+			SASSimpleHeapMagazineSize(alloc_size),
+			SASSimpleHeapMagazineDrain,
+			SASSimpleHeapMagazineStamp(heap),
+			SASSimpleHeapMagazineRoot(headerBlock));
+	    if (rc > 0)
+		return 0;
+	    if (rc < 0)
+	    {
+#ifdef __SASDebugPrint__
+		sas_printf("SASSimpleHeapFree(%p, %p, %zu) double free\n",
+				heap, free_block, alloc_size);
+#endif
+		return -2;
+	    }
+	}
     	SASLock(heap, SasUserLock__WRITE);
     	rc = SASSimpleHeapFreeNoLock(heap, free_block, alloc_size);
 		SASUnlock(heap);
@@ -205,10 +323,14 @@ SASSimpleHeapNearAllocNoLock(void *nearObj, block_size_t alloc_size)
     {
 	if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
 	{
+	    FreeNodeHeap *fheap = SOMSASGetBlockFreeNodeHeap (headerBlock);
 	    heapSize = headerBlock->blockSize - heap_offset;
 	    if ( alloc_size < heapSize )
 	    {
-		mem = freeNode_allocSpace(headerBlock->blockFreeSpace,
+		if (fheap)
+		    mem = (freeNode*)freeNodeHeap_allocSpace(fheap, alloc_size);
+		else
+		    mem = freeNode_allocSpace(headerBlock->blockFreeSpace,
 		          &headerBlock->blockFreeSpace, alloc_size);
 #ifdef __SASDebugPrint__
 	    } else {
@@ -247,7 +369,19 @@ SASSimpleHeapNearDeallocNoLock(void *nearObj, block_size_t alloc_size)
     headerBlock = (SASBlockHeader*)SASFindHeader (nearObj);
     if (headerBlock)
     {
-	if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
+	if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE)
+	     && SOMSASGetBlockFreeNodeHeap (headerBlock) )
+	{
+	    if (freeNodeHeap_deallocSpace(SOMSASGetBlockFreeNodeHeap (headerBlock),
+	                                  nearObj, alloc_size))
+	    {
+#ifdef __SASDebugPrint__
+		sas_printf("SASSimpleHeapNearDeallocNoLock(%p, %ld) range check failed\n", 
+	    	            nearObj, alloc_size);
+#endif
+	    }
+	}
+	else if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
 	{
 	    freeNode_init(free_node, alloc_size);
 	    heapSize = headerBlock->blockSize - heap_offset;
@@ -288,7 +422,10 @@ SASSimpleHeapFreeSpaceNoLock (SASSimpleHeap_t heap)
     
     if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
     {
-    	if (headerBlock->blockFreeSpace != NULL)
+    	if (SOMSASGetBlockFreeNodeHeap (headerBlock))
+    		heapFree = freeNodeHeap_freeSpaceTotal(
+    			SOMSASGetBlockFreeNodeHeap (headerBlock));
+    	else if (headerBlock->blockFreeSpace != NULL)
     		heapFree = freeNode_freeSpaceTotal(headerBlock->blockFreeSpace);
 #ifdef __SASDebugPrint__
     } else {
@@ -307,6 +444,7 @@ SASSimpleHeapFreeSpace (SASSimpleHeap_t heap)
     
     if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
     {
+	SASHeapMagazineReturn(heap);
     	SASLock(heap, SasUserLock__WRITE);
     	heapFree = SASSimpleHeapFreeSpaceNoLock(heap);
 		SASUnlock(heap);
@@ -329,7 +467,9 @@ SASSimpleHeapEmptyNoLock (SASSimpleHeap_t heap)
     if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
     {
     	heapFree = SASSimpleHeapFreeSpaceNoLock(heap);
-	heapSize = headerBlock->blockSize - heap_offset;
+	heapSize = SOMSASGetBlockFreeNodeHeap (headerBlock)
+		   ? SOMSASGetBlockFreeNodeHeap (headerBlock)->heapSize
+		   : headerBlock->blockSize - heap_offset;
 	empty = ( heapFree == heapSize );
 #ifdef __SASDebugPrint__
     } else {
@@ -349,9 +489,12 @@ SASSimpleHeapEmpty (SASSimpleHeap_t heap)
     
     if ( SOMSASCheckBlockSigAndType (headerBlock, SAS_SIMPLEHEAP_TYPE) )
     {
+	SASHeapMagazineReturn(heap);
     	SASLock(heap, SasUserLock__WRITE);
     	heapFree = SASSimpleHeapFreeSpaceNoLock(heap);
-		heapSize = headerBlock->blockSize - heap_offset;
+		heapSize = SOMSASGetBlockFreeNodeHeap (headerBlock)
+			   ? SOMSASGetBlockFreeNodeHeap (headerBlock)->heapSize
+			   : headerBlock->blockSize - heap_offset;
 		empty = ( heapFree == heapSize );
 		SASUnlock(heap);
 #ifdef __SASDebugPrint__
@@ -374,6 +517,8 @@ SASSimpleHeapDestroyNoLock (SASSimpleHeap_t heap)
               SAS_RUNTIME_SIMPLEHEAP) )
     {
 		heapSize = headerBlock->blockSize;
+		SASHeapMagazineDiscard (heap, heapSize);
+		*SASSimpleHeapMagazineStamp(heap) = 0;
 		SASBlockDealloc (heap, heapSize);
 		rc = 0;
     } else {
@@ -21,7 +21,8 @@
  *
  * Allocate a SAS block to be used as an heap using its internal functions to
  * allocate/deallocate objects. The heap is created with function 
- * SASSimpleHeapCreate and destroyed with SASSimpleHeapDestroy. Objects are 
+ * SASSimpleHeapCreate (or SASSimpleHeapCreateSegregated) and destroyed
+ * with SASSimpleHeapDestroy. Objects are 
  * allocated with function SASSimpleHeapAlloc, SASSimpleHeapNearAlloc, and with
  * their NoLock variants. The objects are freed using SASSimpleHeapFree,
  * SASSimpleHeapNearDealloc, and with their NoLock variants.
@@ -70,6 +71,26 @@ SASSimpleHeapInit (void *heap_block , sas_type_t sasType,
 extern __C__ SASSimpleHeap_t 
 SASSimpleHeapCreate (block_size_t heap_size);
 
+/*!
+ * \brief Allocate a SAS block large enough to contain the requested
+ * SAS Simple Heap, managing its free space by size.
+ *
+ * As SASSimpleHeapCreate, but the heap keeps its free space on size
+ * indexed lists (SAS_SEGREGATED_VERSION), so allocation and free do
+ * not walk the free list. The SAS type returned is
+ * SAS_RUNTIME_SIMPLEHEAP | SAS_SEGREGATED_VERSION.
+ *
+ * Older versions of the library do not check the version of the
+ * block type, and would treat the heap as an address ordered free
+ * list and corrupt it. Only use these heaps in stores that are never
+ * opened by a library without SAS_SEGREGATED_VERSION support.
+ *
+ * @param heap_size Size of the Simple Heap to create.
+ * @return A handle to the created SASSimpleHeap_t.
+ */
+extern __C__ SASSimpleHeap_t 
+SASSimpleHeapCreateSegregated (block_size_t heap_size);
+
 /*!
  * \brief Destroy a SASSimpleHeap_t and free the shared storage block.
  *
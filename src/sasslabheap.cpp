@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2003-2014 IBM Corporation.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Contributors:
+ *     IBM Corporation, Steven Munroe - initial API and implementation
+ */
+
+#define sas_printf printf
+#include <stdlib.h>
+#include <string.h>
+#include "sasalloc.h"
+#include "sasallocpriv.h"
+#ifdef __SASDebugPrint__
+#include "sasio.h"
+#endif
+#include "sasanchr.h"
+#include "sassim.h"
+#include "saslock.h"
+#include "sasslabheap.h"
+
+/* End of a page list.  */
+#define SLAB_NIL	0xffffffff
+
+/* Bits of the allocated map of a slab page, one per object of the
+   smallest class.  */
+#define SLAB_MAP_BITS	(sizeof (unsigned long) * 8)
+#define SLAB_MAP_WORDS	((SAS_SLAB_PAGE_SIZE / 16) / SLAB_MAP_BITS)
+
+/* Descriptor of a slab page. Objects never used are carved from the
+   page at bump, objects freed are chained through freeList. A page
+   with free objects is on the partial list of its class, an unused
+   page on the free page list of the heap. allocMap has a bit set for
+   each allocated object, by its index in the page, so double frees
+   are rejected.  */
+typedef struct SASSlabPage
+{
+  void *freeList;
+  unsigned int next;
+  unsigned int prev;
+  unsigned short inUse;
+  unsigned short bump;
+  unsigned char sizeClass;
+  unsigned char partial;
+  unsigned long allocMap[SLAB_MAP_WORDS];
+} SASSlabPage_t;
+
+typedef struct SASSlabClass
+{
+  unsigned int objSize;
+  unsigned int partial;
+} SASSlabClass_t;
+
+typedef struct SASSlabHeapHeader
+{
+  SASBlockHeader blockHeader;
+  char *pageBase;
+  unsigned int pageCount;
+  unsigned int freePage;
+  block_size_t allocated;
+  SASSlabClass_t classes[SAS_SLAB_CLASSES];
+  SASSlabPage_t pages[1];
+} SASSlabHeapHeader;
+
+/* The size classes are 16, 32, 48, 64 and then two per power of two,
+   96, 128, 192, ..., 768, 1024.  */
+static inline unsigned int
+slabClassSize (int sizeClass)
+{
+  if (sizeClass < 4)
+    return (sizeClass + 1) * 16;
+  sizeClass -= 4;
+  return (3 + (sizeClass & 1)) << (5 + (sizeClass >> 1));
+}
+
+static inline int
+slabClassOf (block_size_t size)
+{
+  int lg;
+
+  if (size <= 64)
+    return size ? (int) ((size - 1) >> 4) : 0;
+  lg = (sizeof (long) * 8 - 1) - __builtin_clzl (size - 1);
+  return 4 + (lg - 6) * 2 + (int) (((size - 1) >> (lg - 1)) & 1);
+}
+
+static inline void
+slabListPush (SASSlabHeapHeader *slab, unsigned int *list, unsigned int n)
+{
+  SASSlabPage_t *page = &slab->pages[n];
+
+  page->prev = SLAB_NIL;
+  page->next = *list;
+  if (*list != SLAB_NIL)
+    slab->pages[*list].prev = n;
+  *list = n;
+}
+
+static inline void
+slabListRemove (SASSlabHeapHeader *slab, unsigned int *list, unsigned int n)
+{
+  SASSlabPage_t *page = &slab->pages[n];
+
+  if (page->prev != SLAB_NIL)
+    slab->pages[page->prev].next = page->next;
+  else
+    *list = page->next;
+  if (page->next != SLAB_NIL)
+    slab->pages[page->next].prev = page->prev;
+}
+
+static inline int
+slabPageFull (SASSlabPage_t *page, unsigned int objSize)
+{
+  return (page->freeList == NULL)
+    && ((page->bump + objSize) > SAS_SLAB_PAGE_SIZE);
+}
+
+SASSlabHeap_t
+SASSlabHeapInit (void *heap_seg, sas_type_t sasType,
+		 block_size_t heap_size)
+{
+  SASSlabHeapHeader *slab = (SASSlabHeapHeader *) heap_seg;
+  block_size_t control;
+  unsigned int n, i;
+
+  if (slab == NULL)
+    return NULL;
+
+  /* The control block and page descriptors are placed ahead of the
+     first page, so take pages from the count until they fit.  */
+  n = heap_size / SAS_SLAB_PAGE_SIZE;
+  for (;;)
+    {
+      control = sizeof (SASSlabHeapHeader) + n * sizeof (SASSlabPage_t);
+      control = (control + SAS_SLAB_PAGE_SIZE - 1)
+		& ~((block_size_t) SAS_SLAB_PAGE_SIZE - 1);
+      if ((n == 0) || ((control + (block_size_t) n * SAS_SLAB_PAGE_SIZE)
+		       <= heap_size))
+	break;
+      n--;
+    }
+  if (n < 2)
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSlabHeapInit(%p, %zu) block too small\n",
+		  heap_seg, heap_size);
+#endif
+      return NULL;
+    }
+
+  initSOMSASBlock ((SASBlockHeader *) slab, sasType, heap_size, NULL);
+  slab->pageBase = (char *) slab + control;
+  slab->pageCount = n;
+  slab->allocated = 0;
+  for (i = 0; i < SAS_SLAB_CLASSES; i++)
+    {
+      slab->classes[i].objSize = slabClassSize (i);
+      slab->classes[i].partial = SLAB_NIL;
+    }
+  slab->freePage = SLAB_NIL;
+  for (i = n; i > 0; i--)
+    {
+      slab->pages[i - 1].freeList = NULL;
+      slab->pages[i - 1].inUse = 0;
+      slab->pages[i - 1].bump = 0;
+      slab->pages[i - 1].sizeClass = 0;
+      slab->pages[i - 1].partial = 0;
+      memset (slab->pages[i - 1].allocMap, 0,
+	      sizeof (slab->pages[i - 1].allocMap));
+      slabListPush (slab, &slab->freePage, i - 1);
+    }
+
+  return (SASSlabHeap_t) slab;
+}
+
+SASSlabHeap_t
+SASSlabHeapCreate (block_size_t heap_size)
+{
+  SASBlockHeader *heapBlock = NULL;
+  SASSlabHeap_t heap;
+
+  heapBlock = (SASBlockHeader *) SASBlockAlloc ((long) heap_size);
+  if (heapBlock)
+    {
+      heap = SASSlabHeapInit (heapBlock, SAS_RUNTIME_SLABHEAP, heap_size);
+      if (heap == NULL)
+	SASBlockDealloc (heapBlock, heap_size);
+      return heap;
+    }
+  else
+    return NULL;
+}
+
+void *
+SASSlabHeapAllocNoLock (SASSlabHeap_t heap, block_size_t alloc_size)
+{
+  SASSlabHeapHeader *slab = (SASSlabHeapHeader *) heap;
+  SASSlabClass_t *sizeClass;
+  SASSlabPage_t *page;
+  unsigned int n, slot;
+  void *mem = NULL;
+
+  if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) slab,
+				  SAS_SLABHEAP_TYPE))
+    {
+      if (alloc_size <= SAS_SLAB_MAX_ALLOC)
+	{
+	  int c = slabClassOf (alloc_size);
+	  sizeClass = &slab->classes[c];
+	  n = sizeClass->partial;
+	  if (n == SLAB_NIL)
+	    {
+	      n = slab->freePage;
+	      if (n == SLAB_NIL)
+		{
+#ifdef __SASDebugPrint__
+		  sas_printf ("SASSlabHeapAlloc(%p, %zu) heap full\n",
+			      heap, alloc_size);
+#endif
+		  return NULL;
+		}
+	      slabListRemove (slab, &slab->freePage, n);
+	      page = &slab->pages[n];
+	      page->freeList = NULL;
+	      page->inUse = 0;
+	      page->bump = 0;
+	      page->sizeClass = c;
+	      page->partial = 1;
+	      memset (page->allocMap, 0, sizeof (page->allocMap));
+	      slabListPush (slab, &sizeClass->partial, n);
+	    }
+	  page = &slab->pages[n];
+	  if (page->freeList != NULL)
+	    {
+	      mem = page->freeList;
+	      page->freeList = *(void **) mem;
+	      slot = ((char *) mem - slab->pageBase
+		      - ((block_size_t) n * SAS_SLAB_PAGE_SIZE))
+		     / sizeClass->objSize;
+	    }
+	  else
+	    {
+	      mem = slab->pageBase + ((block_size_t) n * SAS_SLAB_PAGE_SIZE)
+		    + page->bump;
+	      slot = page->bump / sizeClass->objSize;
+	      page->bump += sizeClass->objSize;
+	    }
+	  page->allocMap[slot / SLAB_MAP_BITS] |= 1UL << (slot % SLAB_MAP_BITS);
+	  page->inUse++;
+	  slab->allocated += sizeClass->objSize;
+	  if (slabPageFull (page, sizeClass->objSize))
+	    {
+	      slabListRemove (slab, &sizeClass->partial, n);
+	      page->partial = 0;
+	    }
+#ifdef __SASDebugPrint__
+	}
+      else
+	{
+	  sas_printf ("SASSlabHeapAlloc(%p, %zu) range check failed\n",
+		      heap, alloc_size);
+#endif
+	}
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapAlloc(%p, %zu) type check failed\n",
+		  heap, alloc_size);
+#endif
+    }
+  return mem;
+}
+
+void *
+SASSlabHeapAlloc (SASSlabHeap_t heap, block_size_t alloc_size)
+{
+  SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
+  void *mem = NULL;
+  sphtimer_t tStart = SASLatencyStart ();
+
+  if (SOMSASCheckBlockSigAndType (headerBlock, SAS_SLABHEAP_TYPE))
+    {
+      SASLock (heap, SasUserLock__WRITE);
+      mem = SASSlabHeapAllocNoLock (heap, alloc_size);
+      SASUnlock (heap);
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapAlloc(%p, %zu) type check failed\n",
+		  heap, alloc_size);
+#endif
+    }
+  SASLatencyRecord (SAS_LATENCY_SLAB_ALLOC, tStart);
+  return mem;
+}
+
+int
+SASSlabHeapFreeNoLock (SASSlabHeap_t heap, void *free_block,
+		       block_size_t alloc_size)
+{
+  SASSlabHeapHeader *slab = (SASSlabHeapHeader *) heap;
+  SASSlabClass_t *sizeClass;
+  SASSlabPage_t *page;
+  unsigned long offset, slotBit;
+  unsigned int n, pageOffset, slot;
+  int c, rc;
+
+  if (!SOMSASCheckBlockSigAndType ((SASBlockHeader *) slab,
+				   SAS_SLABHEAP_TYPE))
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSlabHeapFree(%p, ...) does not match type/subtype\n",
+		  heap);
+#endif
+      return -1;
+    }
+
+  offset = (unsigned long) free_block - (unsigned long) slab->pageBase;
+  n = offset / SAS_SLAB_PAGE_SIZE;
+  pageOffset = offset % SAS_SLAB_PAGE_SIZE;
+  rc = -2;
+  if (((unsigned long) free_block >= (unsigned long) slab->pageBase)
+      && (alloc_size <= SAS_SLAB_MAX_ALLOC) && (n < slab->pageCount))
+    {
+      c = slabClassOf (alloc_size);
+      sizeClass = &slab->classes[c];
+      page = &slab->pages[n];
+      slot = pageOffset / sizeClass->objSize;
+      slotBit = 1UL << (slot % SLAB_MAP_BITS);
+      /* The object must be carved (below bump) and still allocated.  */
+      if ((page->inUse != 0) && (page->sizeClass == c)
+	  && ((pageOffset % sizeClass->objSize) == 0)
+	  && (pageOffset < page->bump)
+	  && (page->allocMap[slot / SLAB_MAP_BITS] & slotBit))
+	{
+	  page->allocMap[slot / SLAB_MAP_BITS] &= ~slotBit;
+	  *(void **) free_block = page->freeList;
+	  page->freeList = free_block;
+	  page->inUse--;
+	  slab->allocated -= sizeClass->objSize;
+	  if (page->inUse == 0)
+	    {
+	      if (page->partial)
+		slabListRemove (slab, &sizeClass->partial, n);
+	      page->partial = 0;
+	      slabListPush (slab, &slab->freePage, n);
+	    }
+	  else if (!page->partial)
+	    {
+	      page->partial = 1;
+	      slabListPush (slab, &sizeClass->partial, n);
+	    }
+	  rc = 0;
+	}
+    }
+#ifdef __SASDebugPrint__
+  if (rc)
+    sas_printf ("SASSlabHeapFree(%p, %p, %zu) range check failed\n",
+		heap, free_block, alloc_size);
+#endif
+  return rc;
+}
+
+int
+SASSlabHeapFree (SASSlabHeap_t heap, void *free_block,
+		 block_size_t alloc_size)
+{
+  SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
+  int rc;
+
+  if (SOMSASCheckBlockSigAndType (headerBlock, SAS_SLABHEAP_TYPE))
+    {
+      SASLock (heap, SasUserLock__WRITE);
+      rc = SASSlabHeapFreeNoLock (heap, free_block, alloc_size);
+      SASUnlock (heap);
+    }
+  else
+    {
+      rc = -1;
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSlabHeapFree(%p, ...) does not match type/subtype\n",
+		  heap);
+#endif
+    }
+  return rc;
+}
+
+SASSlabHeap_t
+SASSlabHeapNearFind (void *nearObj)
+{
+  SASSlabHeap_t result = NULL;
+  SASBlockHeader *headerBlock;
+
+  headerBlock = SASFindHeader (nearObj);
+  if (headerBlock)
+    {
+      if (SOMSASCheckBlockSigAndType (headerBlock, SAS_SLABHEAP_TYPE))
+	{
+	  result = (SASSlabHeap_t) headerBlock;
+#ifdef __SASDebugPrint__
+	}
+      else
+	{
+	  sas_printf ("SASSlabHeapNearFind(%p) doesn't match type/subtype\n",
+		      nearObj);
+#endif
+	}
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapNearFind(%p) header not found\n", nearObj);
+#endif
+    }
+  return result;
+}
+
+block_size_t
+SASSlabHeapFreeSpaceNoLock (SASSlabHeap_t heap)
+{
+  SASSlabHeapHeader *slab = (SASSlabHeapHeader *) heap;
+  block_size_t heapFree = 0;
+
+  if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) slab,
+				  SAS_SLABHEAP_TYPE))
+    {
+      heapFree = ((block_size_t) slab->pageCount * SAS_SLAB_PAGE_SIZE)
+		 - slab->allocated;
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapFreeSpace(%p) does not match type/subtype\n",
+		  heap);
+#endif
+    }
+  return heapFree;
+}
+
+block_size_t
+SASSlabHeapFreeSpace (SASSlabHeap_t heap)
+{
+  SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
+  block_size_t heapFree = 0;
+
+  if (SOMSASCheckBlockSigAndType (headerBlock, SAS_SLABHEAP_TYPE))
+    {
+      SASLock (heap, SasUserLock__WRITE);
+      heapFree = SASSlabHeapFreeSpaceNoLock (heap);
+      SASUnlock (heap);
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapFreeSpace(%p) does not match type/subtype\n",
+		  heap);
+#endif
+    }
+  return heapFree;
+}
+
+int
+SASSlabHeapEmptyNoLock (SASSlabHeap_t heap)
+{
+  SASSlabHeapHeader *slab = (SASSlabHeapHeader *) heap;
+  int empty = 0;
+
+  if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) slab,
+				  SAS_SLABHEAP_TYPE))
+    {
+      empty = (slab->allocated == 0);
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapEmptyNoLock(%p) does not match type/subtype\n",
+		  heap);
+#endif
+    }
+  return empty;
+}
+
+int
+SASSlabHeapEmpty (SASSlabHeap_t heap)
+{
+  SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
+  int empty = 0;
+
+  if (SOMSASCheckBlockSigAndType (headerBlock, SAS_SLABHEAP_TYPE))
+    {
+      SASLock (heap, SasUserLock__WRITE);
+      empty = SASSlabHeapEmptyNoLock (heap);
+      SASUnlock (heap);
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASSlabHeapEmpty(%p) does not match type/subtype\n",
+		  heap);
+#endif
+    }
+  return empty;
+}
+
+int
+SASSlabHeapDestroyNoLock (SASSlabHeap_t heap)
+{
+  SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
+  int rc;
+
+  if (SOMSASCheckBlockSigAndTypeAndSubtype (headerBlock,
+					    SAS_RUNTIME_SLABHEAP))
+    {
+      SASBlockDealloc (heap, headerBlock->blockSize);
+      rc = 0;
+    }
+  else
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSlabHeapDestroy(%p) does not match type/subtype\n",
+		  heap);
+#endif
+      rc = -1;
+    }
+  return rc;
+}
+
+int
+SASSlabHeapDestroy (SASSlabHeap_t heap)
+{
+  SASBlockHeader *headerBlock = (SASBlockHeader *) heap;
+  int rc;
+
+  if (SOMSASCheckBlockSigAndTypeAndSubtype (headerBlock,
+					    SAS_RUNTIME_SLABHEAP))
+    {
+      SASLock (heap, SasUserLock__WRITE);
+      rc = SASSlabHeapDestroyNoLock (heap);
+      SASUnlock (heap);
+    }
+  else
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSlabHeapDestroy(%p) does not match type/subtype\n",
+		  heap);
+#endif
+      rc = -1;
+    }
+  return rc;
+}
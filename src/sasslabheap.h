@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2003-2014 IBM Corporation.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Contributors:
+ *     IBM Corporation, Steven Munroe      - initial API and implementation
+ */
+
+#ifndef __SAS_SLAB_HEAP_H
+#define __SAS_SLAB_HEAP_H
+
+#include "sastype.h"
+
+/*!
+ * \file  sasslabheap.h
+ * \brief Shared Address Space Slab Heap.
+ *
+ * Allocate a SAS block to be used as a heap of small objects. Unlike
+ * the Simple Heap, which searches an address ordered free list, the
+ * Slab Heap divides the block into pages of SAS_SLAB_PAGE_SIZE bytes
+ * and rounds each request up to one of SAS_SLAB_CLASSES size classes.
+ * Each page holds objects of a single class and each class keeps a
+ * list of its pages with free objects, so allocation and deallocation
+ * are constant time whatever the fragmentation of the heap. Requests
+ * larger than SAS_SLAB_MAX_ALLOC bytes are not supported.
+ *
+ * The heap is created with function SASSlabHeapCreate and destroyed
+ * with SASSlabHeapDestroy. Objects are allocated with SASSlabHeapAlloc
+ * and freed with SASSlabHeapFree, or with their NoLock variants.
+ * SASNearAlloc and SASNearDealloc also allocate from the Slab Heap
+ * containing the near object.
+ */
+
+/*!
+ * \brief Handle to SAS Slab Heap.
+ * The type is SAS_RUNTIME_SLABHEAP
+ */
+typedef void *SASSlabHeap_t;
+
+/*! \brief Size of the slab pages of a Slab Heap. */
+#define SAS_SLAB_PAGE_SIZE	4096
+/*! \brief Number of object size classes of a Slab Heap. */
+#define SAS_SLAB_CLASSES	12
+/*! \brief Largest allocation supported by a Slab Heap. */
+#define SAS_SLAB_MAX_ALLOC	1024
+
+#ifdef __cplusplus
+#define __C__ "C"
+#else
+#define __C__
+#endif
+
+/*!
+ * \brief Initialize a shared storage as a slab heap.
+ *
+ * Initialize the control blocks within the specified storage block as a
+ * Slab Heap. The store block must be power of two in size, at least
+ * 16KB, and have the same power of two (or better) alignment.
+ * The SAS type created is SAS_RUNTIME_SLABHEAP.
+ *
+ * @param heap_block Block of allocated SAS storage.
+ * @param sasType Type of SAS object (should contain SAS_SLABHEAP_TYPE type).
+ * @param heap_size Size of the slab heap within the block.
+ * @return A handle to the initialized SASSlabHeap_t or 0 if an error
+ * occurs.
+ */
+extern __C__ SASSlabHeap_t
+SASSlabHeapInit (void *heap_block, sas_type_t sasType,
+		 block_size_t heap_size);
+
+/*!
+ * \brief Allocate a SAS block large enough to contain the requested
+ * SAS Slab Heap.
+ *
+ * Create and initialize a Slab Heap. The storage block must be power
+ * of two in size and SAS type returned is SAS_RUNTIME_SLABHEAP.
+ *
+ * @param heap_size Size of the Slab Heap to create.
+ * @return A handle to the created SASSlabHeap_t.
+ */
+extern __C__ SASSlabHeap_t
+SASSlabHeapCreate (block_size_t heap_size);
+
+/*!
+ * \brief Destroy a SASSlabHeap_t and free the shared storage block.
+ *
+ * The sas_type_t must be SAS_RUNTIME_SLABHEAP. Destroy holds an
+ * exclusive lock write while clearing the control blocks and freeing
+ * the SAS block.
+ *
+ * @param heap Handle of the SASSlabHeap_t to be destroyed.
+ * @return 0 indicates success, otherwise failure.
+ */
+extern __C__ int
+SASSlabHeapDestroy (SASSlabHeap_t heap);
+
+/*!
+ * \brief Return the available space from Slab Heap \a heap.
+ *
+ * The sas_type_t must be SAS_RUNTIME_SLABHEAP. The space of allocated
+ * objects is counted by size class, so the result is the slab page
+ * space less the rounded up size of the objects in use.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @return Size in bytes of the remaining free Heap.
+ */
+extern __C__ block_size_t
+SASSlabHeapFreeSpace (SASSlabHeap_t heap);
+
+/*!
+ * \brief Return if the Slab Heap \a heap has no objects allocated.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @return 1 if no objects are allocated from heap, 0 otherwise.
+ */
+extern __C__ int
+SASSlabHeapEmpty (SASSlabHeap_t heap);
+
+/*!
+ * \brief Allocate a block of \a alloc_size bytes from Slab Heap \a heap.
+ *
+ * The sas_type_t must be SAS_RUNTIME_SLABHEAP. The functions holds an
+ * exclusive write while allocating from heap.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @param alloc_size Size in byte to allocate, at most SAS_SLAB_MAX_ALLOC.
+ * @return A valid memory address or NULL if \a heap is not a
+ * SAS_RUNTIME_SLABHEAP, if \a alloc_size is too large or if there is no
+ * space left in \a heap.
+ */
+extern __C__ void *
+SASSlabHeapAlloc (SASSlabHeap_t heap, block_size_t alloc_size);
+
+/*!
+ * \brief Deallocate the memory block \a free_block of size \a alloc_size
+ * from Slab Heap \a heap.
+ *
+ * The sas_type_t must be SAS_RUNTIME_SLABHEAP. The functions holds an
+ * exclusive write while freeing the allocated block from heap.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @param free_block Memory block previously allocated using
+ * SASSlabHeapAlloc function.
+ * @param alloc_size Size in bytes of the allocated block size.
+ * @return 0 if the block was successfully freed, -1 if \a heap is not a
+ * SAS_RUNTIME_SLABHEAP, or -2 if \a free_block or \a alloc_size do not
+ * match an allocation from \a heap, or the block is already free.
+ */
+extern __C__ int
+SASSlabHeapFree (SASSlabHeap_t heap, void *free_block,
+		 block_size_t alloc_size);
+
+/*!
+ * \brief Find the associate SASSlabHeap_t control block near \a nearObj.
+ * @param nearObj Address within a SAS Slab Heap.
+ * @return Associated Slab Heap handler or NULL if the address \a nearObj
+ * is not within a SASSlabHeap_t.
+ */
+extern __C__ SASSlabHeap_t
+SASSlabHeapNearFind (void *nearObj);
+
+/*!
+ * \brief Destroy a SASSlabHeap_t and free the shared storage block.
+ *
+ * Similar to ::SASSlabHeapDestroy but do not hold any write lock.
+ *
+ * @param heap handle of the SASSlabHeap_t to be destroyed.
+ * @return a 0 value indicates success, otherwise failure.
+ */
+extern __C__ int
+SASSlabHeapDestroyNoLock (SASSlabHeap_t heap);
+
+/*!
+ * \brief Return the available space from Slab Heap \a heap.
+ *
+ * Similar to ::SASSlabHeapFreeSpace but do not hold any write lock.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @return The size in bytes of the available space on heap.
+ */
+extern __C__ block_size_t
+SASSlabHeapFreeSpaceNoLock (SASSlabHeap_t heap);
+
+/*!
+ * \brief Return if the Slab Heap \a heap has no objects allocated.
+ *
+ * Similar to ::SASSlabHeapEmpty but do not hold any write lock.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @return 1 if no objects are allocated from heap, 0 otherwise.
+ */
+extern __C__ int
+SASSlabHeapEmptyNoLock (SASSlabHeap_t heap);
+
+/*!
+ * \brief Allocate a block of \a alloc_size bytes from Slab Heap \a heap.
+ *
+ * Similar to ::SASSlabHeapAlloc but do not hold any write lock.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @param alloc_size Size in byte to allocate.
+ * @return A valid memory address or NULL.
+ */
+extern __C__ void *
+SASSlabHeapAllocNoLock (SASSlabHeap_t heap, block_size_t alloc_size);
+
+/*!
+ * \brief Deallocate the memory block \a free_block of size \a alloc_size
+ * from Slab Heap \a heap.
+ *
+ * Similar to ::SASSlabHeapFree but do not hold any lock.
+ *
+ * @param heap Handle of a SAS Slab Heap.
+ * @param free_block Memory block previously allocated using
+ * SASSlabHeapAlloc function.
+ * @param alloc_size Size in bytes of the allocated block size.
+ * @return 0 if the block was successfully freed, -1 if \a heap is not a
+ * SAS_RUNTIME_SLABHEAP, or -2 if \a free_block or \a alloc_size do not
+ * match an allocation from \a heap, or the block is already free.
+ */
+extern __C__ int
+SASSlabHeapFreeNoLock (SASSlabHeap_t heap, void *free_block,
+		       block_size_t alloc_size);
+
+#endif /* __SAS_SLAB_HEAP_H */
@@ -9,26 +9,40 @@
  *     IBM Corporation, Steven Munroe - initial API and implementation
  */
 
+#define _GNU_SOURCE
 #include <string.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <linux/fs.h>
 
 #include "sasconf.h"
 #include "sassim.h"
+#include "sasallocpriv.h"
+#include "sasstname.h"
 #include "sasio.h"
 
 #define sas_printf printf
 
+/* Store path of region 0, the store of each joined region is kept
+   in its SASRegionState_t.  */
 char *sasStorePath = NULL;
 
 char *
 SASSegNameIndexed (char *name, sasseg_t segnum)
 {
-  if (sasStorePath != NULL)
-    sas_sprintf (name, "%s/SAS%05lX.DAT", sasStorePath, segnum);
+  char *storePath = getSASRegionState ()->segPath;
+
+  if (storePath != NULL)
+    sas_sprintf (name, "%s/SAS%05lX.DAT", storePath, segnum);
   else
     sas_sprintf (name, "SAS%05lX.DAT", segnum);
 
@@ -80,6 +94,49 @@ SASSegIndexExists (sasseg_t segnum)
   return (SASSegNameExists (name));
 }
 
+/* Scan the SAS store directory once and mark each segment index
+   that has a backing file in segMap (of size segs). This avoids a
+   stat per segment when joining a region with many segments.
+   Returns the number of segment files found or -1 if the store
+   directory can not be read.  */
+int
+SASSegStoreScan (char *segMap, unsigned long segs)
+{
+  DIR *dir;
+  struct dirent *ent;
+  char *storePath;
+  unsigned long segnum;
+  char tail;
+  int found = 0;
+
+  storePath = getSASRegionState ()->segPath;
+  dir = opendir (storePath != NULL ? storePath : ".");
+  if (dir == NULL)
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSegStoreScan; %s\n", strerror (errno));
+#endif
+      return -1;
+    }
+
+  while ((ent = readdir (dir)) != NULL)
+    {
+      if ((strlen (ent->d_name) == 12)
+	  && (sscanf (ent->d_name, "SAS%5lX.DA%c", &segnum, &tail) == 2)
+	  && (tail == 'T') && (segnum < segs))
+	{
+	  segMap[segnum] = 1;
+	  found++;
+	}
+    }
+  closedir (dir);
+
+#ifdef __SASDebugPrint__
+  sas_printf ("SASSegStoreScan found %d segments\n", found);
+#endif
+  return found;
+}
+
 int
 SASSegStoreCreateByName (char *name)
 {
@@ -178,3 +235,360 @@ SASSegStoreRemove (sasseg_t segnum)
 
   return rc;
 }
+
+/* Checkpoint files live in the SAS_CKPT_DIR sub-directory of the
+   store, one file per segment and generation, plus the MANIFEST
+   naming the generation that holds each segment of the checkpoint.  */
+char *
+SASSegCkptNameIndexed (char *name, const char *store, sasseg_t segnum,
+		       unsigned long gen)
+{
+  sas_sprintf (name, "%s/%s/SAS%05lX.%08lX", store != NULL ? store : ".",
+	       SAS_CKPT_DIR, segnum, gen);
+  return name;
+}
+
+/* Copy a segment (or checkpoint) file and sync the copy. Only the
+   data extents are copied, so holes punched in the source stay holes
+   in the copy. Returns 0 or the errno of the failing call.  */
+int
+SASSegStoreCopyByName (const char *from, const char *to)
+{
+  char buf[65536];
+  struct stat stat_buf;
+  off_t off, end;
+  ssize_t len;
+  int rc = 0;
+  int in, out;
+
+#ifdef __SASDebugPrint__
+  sas_printf ("SASSegStoreCopyByName(%s, %s)\n", from, to);
+#endif
+  in = open (from, O_RDONLY);
+  if (in == -1)
+    return errno;
+  out = open (to, (O_CREAT | O_TRUNC | O_WRONLY), (0766));
+  if ((out == -1) || fstat (in, &stat_buf)
+      || ftruncate (out, stat_buf.st_size))
+    {
+      rc = errno;
+      goto done;
+    }
+
+  off = 0;
+  while ((rc == 0) && (off < stat_buf.st_size))
+    {
+#ifdef SEEK_DATA
+      off = lseek (in, off, SEEK_DATA);
+      if (off == -1)
+	{
+	  /* ENXIO, no more data. Otherwise copy everything.  */
+	  if (errno == ENXIO)
+	    break;
+	  off = 0;
+	  end = stat_buf.st_size;
+	}
+      else
+	{
+	  end = lseek (in, off, SEEK_HOLE);
+	  if (end == -1)
+	    end = stat_buf.st_size;
+	}
+#else
+      end = stat_buf.st_size;
+#endif
+      while (off < end)
+	{
+	  len = end - off;
+	  if (len > (ssize_t) sizeof (buf))
+	    len = sizeof (buf);
+	  len = pread (in, buf, len, off);
+	  if ((len <= 0) || (pwrite (out, buf, len, off) != len))
+	    {
+	      rc = (len == 0) ? EIO : errno;
+	      break;
+	    }
+	  off += len;
+	}
+    }
+  if ((rc == 0) && fsync (out))
+    rc = errno;
+
+done:
+  if (out != -1)
+    close (out);
+  close (in);
+  if (rc)
+    sas_printf ("SASSegStoreCopyByName %s to %s failed; %s\n",
+		from, to, strerror (rc));
+  return rc;
+}
+
+/* Read the kernel boot id, used to tell if the system restarted
+   since a checkpoint.  */
+int
+SASStoreBootID (char *bootID, int size)
+{
+  FILE *f = fopen ("/proc/sys/kernel/random/boot_id", "r");
+  int rc = 0;
+
+  bootID[0] = 0;
+  if (f == NULL)
+    return errno;
+  if (fgets (bootID, size, f) == NULL)
+    rc = EIO;
+  else
+    bootID[strcspn (bootID, "\n")] = 0;
+  fclose (f);
+  return rc;
+}
+
+/* Read the checkpoint manifest of store. On success m->segGen is a
+   malloc'ed array of m->segs entries, to be freed by the caller.
+   Returns 0, ENOENT if the store has no checkpoint, or EINVAL if the
+   manifest is malformed.  */
+int
+SASStoreCkptRead (const char *store, SASCkptManifest_t *m)
+{
+  char name[STORE_NAME_SIZE];
+  unsigned long segnum, gen;
+  int version = 0;
+  FILE *f;
+  int rc = 0;
+
+  memset (m, 0, sizeof (*m));
+  sas_sprintf (name, "%s/%s/MANIFEST", store != NULL ? store : ".",
+	       SAS_CKPT_DIR);
+  f = fopen (name, "r");
+  if (f == NULL)
+    return errno;
+
+  if ((fscanf (f, "SASCKPT %d\n", &version) != 1) || (version != 1)
+      || (fscanf (f, "generation %lx\n", &m->generation) != 1)
+      || (fscanf (f, "time %ld.%ld\n", &m->time_sec, &m->time_nsec) != 2)
+      || (fscanf (f, "boot %39s\n", m->bootID) != 1)
+      || (fscanf (f, "segments %lx\n", &m->segs) != 1)
+      || (m->segs == 0) || (m->segs > INT_MAX))
+    rc = EINVAL;
+  else
+    {
+      m->segGen = (unsigned long *) calloc (m->segs, sizeof (unsigned long));
+      if (m->segGen == NULL)
+	rc = ENOMEM;
+      while ((rc == 0)
+	     && (fscanf (f, "segment %lx %lx\n", &segnum, &gen) == 2))
+	{
+	  if ((segnum >= m->segs) || (gen == 0) || (gen > m->generation))
+	    rc = EINVAL;
+	  else
+	    m->segGen[segnum] = gen;
+	}
+      if ((rc == 0) && !feof (f))
+	rc = EINVAL;
+    }
+  fclose (f);
+
+  if (rc)
+    {
+      sas_printf ("SASStoreCkptRead %s invalid\n", name);
+      free (m->segGen);
+      m->segGen = NULL;
+    }
+  return rc;
+}
+
+/* Write the checkpoint manifest of store. The new manifest replaces
+   the old with a rename, so a crash leaves one or the other.  */
+int
+SASStoreCkptWrite (const char *store, SASCkptManifest_t *m)
+{
+  char name[STORE_NAME_SIZE];
+  char temp[STORE_NAME_SIZE + 8];
+  unsigned long i;
+  FILE *f;
+  int fd;
+  int rc = 0;
+
+  sas_sprintf (name, "%s/%s/MANIFEST", store != NULL ? store : ".",
+	       SAS_CKPT_DIR);
+  sas_sprintf (temp, "%s.tmp", name);
+  f = fopen (temp, "w");
+  if (f == NULL)
+    return errno;
+
+  fprintf (f, "SASCKPT 1\n");
+  fprintf (f, "generation %lx\n", m->generation);
+  fprintf (f, "time %ld.%09ld\n", m->time_sec, m->time_nsec);
+  fprintf (f, "boot %s\n", m->bootID[0] ? m->bootID : "-");
+  fprintf (f, "segments %lx\n", m->segs);
+  for (i = 0; i < m->segs; i++)
+    if (m->segGen[i])
+      fprintf (f, "segment %lx %lx\n", i, m->segGen[i]);
+
+  if (fflush (f) || fsync (fileno (f)))
+    rc = errno;
+  if (fclose (f) && (rc == 0))
+    rc = errno;
+  if ((rc == 0) && rename (temp, name))
+    rc = errno;
+  if (rc == 0)
+    {
+      /* Make the rename itself durable.  */
+      sas_sprintf (temp, "%s/%s", store != NULL ? store : ".",
+		   SAS_CKPT_DIR);
+      fd = open (temp, O_RDONLY);
+      if (fd != -1)
+	{
+	  fsync (fd);
+	  close (fd);
+	}
+    }
+  else
+    sas_printf ("SASStoreCkptWrite %s failed; %s\n", name, strerror (rc));
+
+  return rc;
+}
+
+/* Restore the segment files of store from its checkpoint. Segment
+   files not in the checkpoint are removed. The store must not be
+   in use by any process.  */
+int
+SASStoreCkptRestore (const char *store)
+{
+  const char *path = store != NULL ? store : ".";
+  char name[STORE_NAME_SIZE];
+  char temp[STORE_NAME_SIZE + 8];
+  char ckpt[STORE_NAME_SIZE];
+  SASCkptManifest_t m;
+  DIR *dir;
+  struct dirent *ent;
+  unsigned long segnum;
+  char tail;
+  int rc;
+
+  rc = SASStoreCkptRead (store, &m);
+  if (rc)
+    return rc;
+
+  for (segnum = 0; (rc == 0) && (segnum < m.segs); segnum++)
+    {
+      if (m.segGen[segnum] == 0)
+	continue;
+      SASSegCkptNameIndexed (ckpt, store, segnum, m.segGen[segnum]);
+      sas_sprintf (name, "%s/SAS%05lX.DAT", path, segnum);
+      sas_sprintf (temp, "%s.tmp", name);
+      rc = SASSegStoreCopyByName (ckpt, temp);
+      if ((rc == 0) && rename (temp, name))
+	rc = errno;
+    }
+
+  if (rc == 0)
+    {
+      dir = opendir (path);
+      if (dir == NULL)
+	rc = errno;
+      else
+	{
+	  while ((ent = readdir (dir)) != NULL)
+	    {
+	      if ((strlen (ent->d_name) == 12)
+		  && (sscanf (ent->d_name, "SAS%5lX.DA%c", &segnum, &tail) == 2)
+		  && (tail == 'T')
+		  && ((segnum >= m.segs) || (m.segGen[segnum] == 0)))
+		{
+		  sas_sprintf (name, "%s/%s", path, ent->d_name);
+		  SASSegStoreRemoveByName (name);
+		}
+	    }
+	  closedir (dir);
+	}
+      // The block map does not describe the restored segments.
+      sas_sprintf (name, "%s/%s", path, SAS_BLOCKMAP_NAME);
+      unlink (name);
+    }
+  free (m.segGen);
+
+#ifdef __SASDebugPrint__
+  sas_printf ("SASStoreCkptRestore(%s) rc=%d\n", path, rc);
+#endif
+  return rc;
+}
+
+/* Count the join markers of store held by joined processes (live)
+   and those left unlocked by processes that stopped, or a system that
+   restarted, while joined (stale). If remove is set the stale
+   markers are removed. The caller holds the lock of the checkpoint
+   directory.  */
+void
+SASStoreJoinMarkScan (const char *store, int *live, int *stale, int remove)
+{
+  char dirName[STORE_NAME_SIZE];
+  char name[STORE_NAME_SIZE + NAME_MAX + 2];
+  struct stat stat_buf;
+  DIR *dir;
+  struct dirent *ent;
+  int fd;
+
+  *live = 0;
+  *stale = 0;
+  sas_sprintf (dirName, "%s/%s", store != NULL ? store : ".", SAS_CKPT_DIR);
+  dir = opendir (dirName);
+  if (dir == NULL)
+    return;
+  while ((ent = readdir (dir)) != NULL)
+    {
+      if (strncmp (ent->d_name, SAS_JOIN_MARK ".",
+		   sizeof (SAS_JOIN_MARK ".") - 1) != 0)
+	continue;
+      sas_sprintf (name, "%s/%s", dirName, ent->d_name);
+      fd = open (name, O_RDONLY);
+      if (fd == -1)
+	continue;
+      if (flock (fd, (LOCK_EX | LOCK_NB)))
+	(*live)++;
+      // A marker unlinked by its detaching process is not stale.
+      else if ((fstat (fd, &stat_buf) == 0) && stat_buf.st_nlink)
+	{
+	  (*stale)++;
+	  if (remove)
+	    unlink (name);
+	}
+      close (fd);
+    }
+  closedir (dir);
+}
+
+/* Clone a segment file into a snapshot. Where the file system
+   supports reflinks (FICLONE) the clone shares the source extents
+   copy on write, otherwise the file is copied.  */
+int
+SASSegStoreCloneByName (const char *from, const char *to)
+{
+#ifdef FICLONE
+  int in, out;
+  int rc = 0;
+
+  in = open (from, O_RDONLY);
+  if (in == -1)
+    return errno;
+  out = open (to, (O_CREAT | O_EXCL | O_WRONLY), (0766));
+  if (out == -1)
+    rc = errno;
+  else if (ioctl (out, FICLONE, in))
+    rc = errno;
+  close (in);
+  if (out != -1)
+    close (out);
+  if ((rc == EOPNOTSUPP) || (rc == EXDEV) || (rc == EINVAL)
+      || (rc == ENOTTY))
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASSegStoreCloneByName no reflink, copying %s\n", from);
+#endif
+      rc = SASSegStoreCopyByName (from, to);
+    }
+  return rc;
+#else
+  return SASSegStoreCopyByName (from, to);
+#endif
+}
@@ -28,6 +28,8 @@ extern __C__ int SASSegNameExists(char *name);
 
 extern __C__ int SASSegIndexExists (sasseg_t segnum);
 
+extern __C__ int SASSegStoreScan (char *segMap, unsigned long segs);
+
 extern __C__ int SASSegStoreCreateByName (char *name);
 
 extern __C__ int SASSegStoreCreate (sasseg_t segnum);
@@ -36,4 +38,40 @@ extern __C__ int SASSegStoreRemoveByName (char *name);
 
 extern __C__ int SASSegStoreRemove (sasseg_t segnum);
 
+/* Store sub-directory holding the region checkpoint.  */
+#define SAS_CKPT_DIR	"SASCKPT"
+
+/* Prefix of the join markers in SAS_CKPT_DIR, one per joined process,
+   locked by the process until it detaches.  */
+#define SAS_JOIN_MARK	"JOINED"
+
+/* Contents of a checkpoint MANIFEST.  */
+typedef struct SASCkptManifest_t
+{
+  unsigned long generation;
+  long time_sec;
+  long time_nsec;
+  char bootID[40];
+  unsigned long segs;
+  unsigned long *segGen;
+} SASCkptManifest_t;
+
+extern __C__ char *SASSegCkptNameIndexed (char *name, const char *store,
+					  sasseg_t segnum, unsigned long gen);
+
+extern __C__ int SASSegStoreCopyByName (const char *from, const char *to);
+
+extern __C__ int SASStoreBootID (char *bootID, int size);
+
+extern __C__ int SASStoreCkptRead (const char *store, SASCkptManifest_t *m);
+
+extern __C__ int SASStoreCkptWrite (const char *store, SASCkptManifest_t *m);
+
+extern __C__ int SASStoreCkptRestore (const char *store);
+
+extern __C__ void SASStoreJoinMarkScan (const char *store, int *live,
+					int *stale, int remove);
+
+extern __C__ int SASSegStoreCloneByName (const char *from, const char *to);
+
 #endif  /* _SAS_STORE_NAME_H */
@@ -1155,6 +1155,267 @@ SASStringBTreeDestroy (SASStringBTree_t heap)
     }
 }
 
+/* Return ptr relocated to the copy at to, if it is within the page
+   of size bytes at from.  */
+static inline void *
+SASStringBTreeRelocPtr (void *ptr, char *from, char *to, block_size_t size)
+{
+  char *p = (char *) ptr;
+
+  if ((p >= from) && (p < (from + size)))
+    return (void *) (to + (p - from));
+  return ptr;
+}
+
+/* Copy the node page to a page allocated from target, relocating the
+   pointers within the page. Returns the new node or NULL if target
+   has no free page.  */
+static SASStringBTreeNodeHeader *
+SASStringBTreeNodeRelocate (SASStringBTreeHeader * target,
+			    SASStringBTreeNodeHeader * node)
+{
+  SASStringBTreeNodeHeader *newNode;
+  block_size_t size = target->pageSize;
+  char *from = (char *) node;
+  char *to;
+  freeNode *free_node;
+  short i;
+
+  newNode = (SASStringBTreeNodeHeader *) SASStringBTreeAllocInternal (target);
+  if (newNode == NULL)
+    return NULL;
+  to = (char *) newNode;
+  memcpy (to, from, size);
+
+  newNode->blockHeader.special = SASStringBTreeRelocPtr (
+      newNode->blockHeader.special, from, to, size);
+  newNode->blockHeader.blockFreeSpace = (freeNode *) SASStringBTreeRelocPtr (
+      newNode->blockHeader.blockFreeSpace, from, to, size);
+  for (free_node = newNode->blockHeader.blockFreeSpace; free_node != NULL;
+       free_node = free_node->nextNode)
+    free_node->nextNode = (freeNode *) SASStringBTreeRelocPtr (
+	free_node->nextNode, from, to, size);
+  newNode->blockHeader.baseBlock = (SASBlockHeader *) target;
+  newNode->blockHeader.nextBlock = (SASBlockHeader *) SASStringBTreeRelocPtr (
+      newNode->blockHeader.nextBlock, from, to, size);
+
+  newNode->keys = (char **) SASStringBTreeRelocPtr (
+      newNode->keys, from, to, size);
+  newNode->branch = (SASStringBTreeNodeHeader **) SASStringBTreeRelocPtr (
+      newNode->branch, from, to, size);
+  newNode->vals = (void **) SASStringBTreeRelocPtr (
+      newNode->vals, from, to, size);
+  // Keys held in spill pages stay where they are.
+  for (i = 0; i <= newNode->max_count; i++)
+    newNode->keys[i] = (char *) SASStringBTreeRelocPtr (
+	newNode->keys[i], from, to, size);
+  newNode->spill = (SASStringBTreeNodeHeader *) SASStringBTreeRelocPtr (
+      newNode->spill, from, to, size);
+  newNode->spill2 = (SASStringBTreeNodeHeader *) SASStringBTreeRelocPtr (
+      newNode->spill2, from, to, size);
+  newNode->spill3 = (SASStringBTreeNodeHeader *) SASStringBTreeRelocPtr (
+      newNode->spill3, from, to, size);
+
+  return newNode;
+}
+
+/* Move the nodes of the subtree at *slot held in blocks marked in
+   evict to the first other block with a free page, updating *slot.
+   Returns the count of nodes moved.  */
+static long
+SASStringBTreeCompactNode (SASCompoundExpandList * list, const char *evict,
+			   SASStringBTreeNodeHeader ** slot)
+{
+  SASStringBTreeNodeHeader *node = *slot;
+  SASStringBTreeNodeHeader *newNode = NULL;
+  long moved = 0;
+  block_size_t i, j;
+  short k;
+
+  for (i = 0; i < list->count; i++)
+    {
+      if (evict[i] && SASStringBTreeContains (list->heap[i],
+					      (SASStringBTreeNode_t) node))
+	{
+	  for (j = 0; (j < list->count) && (newNode == NULL); j++)
+	    if (!evict[j] && SASStringBTreeAvail (list->heap[j]))
+	      newNode = SASStringBTreeNodeRelocate (list->heap[j], node);
+	  if (newNode != NULL)
+	    {
+	      *slot = newNode;
+	      SASStringBTreeFreeInternal (list->heap[i],
+					  (SASStringBTreeNode_t) node);
+	      node = newNode;
+	      moved++;
+	    }
+	  break;
+	}
+    }
+
+  for (k = 0; k <= node->count; k++)
+    if (node->branch[k] != NULL)
+      moved += SASStringBTreeCompactNode (list, evict, &node->branch[k]);
+  return moved;
+}
+
+/* Return the count of node pages in use in the block.  */
+static block_size_t
+SASStringBTreePagesUsed (SASStringBTreeHeader * headerBlock)
+{
+  block_size_t heapFree = 0;
+
+  if (headerBlock->blockHeader.blockFreeSpace != NULL)
+    heapFree =
+      freeNode_freeSpaceTotal (headerBlock->blockHeader.blockFreeSpace);
+  return (headerBlock->blockHeader.blockSize - default_page - heapFree)
+    / headerBlock->pageSize;
+}
+
+/* Return if a spill page is held in, or listed by, the block.  */
+static int
+SASStringBTreeHoldsSpill (SASCompoundExpandList * list,
+			  SASStringBTreeHeader * headerBlock)
+{
+  SASStringBTreeSpillList *spill_lst;
+  block_size_t i;
+  int k;
+
+  if (headerBlock->spillList && headerBlock->spillList->count)
+    return 1;
+  for (i = 0; i < list->count; i++)
+    {
+      spill_lst = list->heap[i]->spillList;
+      if (spill_lst == NULL)
+	continue;
+      for (k = 0; k < spill_lst->count; k++)
+	if (SASStringBTreeContains (headerBlock,
+				    (SASStringBTreeNode_t) spill_lst->
+				    spillHeap[k]))
+	  return 1;
+    }
+  return 0;
+}
+
+int
+SASStringBTreeCompactNoLock (SASStringBTree_t heap)
+{
+  SASStringBTreeHeader *headerBlock = (SASStringBTreeHeader *) heap;
+  SASCompoundExpandList *list;
+  SASStringBTreeHeader *expandBlock;
+  char evict[SASBTREE_EXPANDLIST_SIZE];
+  block_size_t heapSize, freePages, needPages, pages;
+  block_size_t i, j;
+  int freed = 0;
+
+  if (!SOMSASCheckBlockSigAndType ((SASBlockHeader *) headerBlock,
+				   SAS_RUNTIME_STRINGBTREE))
+    {
+#ifdef __SASDebugPrint__
+      sas_printf ("SASStringBTreeCompactNoLock(%p) type check failed\n",
+		  heap);
+#endif
+      return -1;
+    }
+  list = headerBlock->expandList;
+  if ((list == NULL) || (list->count < 2))
+    return 0;
+
+  // Empty the expansion blocks, last first, while the nodes they
+  // hold fit in the free pages of the blocks kept.
+  heapSize = headerBlock->blockHeader.blockSize;
+  freePages = 0;
+  for (i = 0; i < list->count; i++)
+    {
+      evict[i] = 0;
+      freePages += (heapSize - default_page) / headerBlock->pageSize
+	- SASStringBTreePagesUsed (list->heap[i]);
+    }
+  needPages = 0;
+  for (i = list->count - 1; i > 0; i--)
+    {
+      expandBlock = list->heap[i];
+      pages = SASStringBTreePagesUsed (expandBlock);
+      freePages -= (heapSize - default_page) / headerBlock->pageSize - pages;
+      if (((needPages + pages) <= freePages)
+	  && !SASStringBTreeHoldsSpill (list, expandBlock))
+	{
+	  evict[i] = 1;
+	  needPages += pages;
+	}
+      else
+	freePages += (heapSize - default_page) / headerBlock->pageSize - pages;
+    }
+  for (i = 1; (i < list->count) && !evict[i]; i++)
+    ;
+  if (i == list->count)
+    return 0;
+
+  if (headerBlock->root != NULL)
+    SASStringBTreeCompactNode (list, evict,
+			       (SASStringBTreeNodeHeader **) &headerBlock->
+			       root);
+  // Cached node pointers (of enumerations) are no longer valid.
+  headerBlock->common->modCount++;
+
+  // Free the blocks emptied, keeping the list and block chain dense.
+  for (i = 1, j = 1; i < list->count; i++)
+    {
+      expandBlock = list->heap[i];
+      if (evict[i] && (SASStringBTreePagesUsed (expandBlock) == 0))
+	{
+	  SASBlockDealloc (expandBlock, heapSize);
+	  freed++;
+	}
+      else
+	list->heap[j++] = expandBlock;
+    }
+  for (i = j; i < list->count; i++)
+    list->heap[i] = NULL;
+  list->count = j;
+  for (i = 0; i < list->count; i++)
+    list->heap[i]->blockHeader.nextBlock =
+      &list->heap[(i + 1) % list->count]->blockHeader;
+
+  return freed;
+}
+
+int
+SASStringBTreeCompact (SASStringBTree_t heap)
+{
+  SASStringBTreeHeader *headerBlock = (SASStringBTreeHeader *) heap;
+  SASCompoundExpandList *list;
+  SASStringBTreeHeader *expandBlock[SASBTREE_EXPANDLIST_SIZE];
+  block_size_t i, count;
+  int freed = -1;
+
+  if (SOMSASCheckBlockSigAndType ((SASBlockHeader *) headerBlock,
+				  SAS_RUNTIME_STRINGBTREE))
+    {
+      SASLock (heap, SasUserLock__WRITE);
+      list = headerBlock->expandList;
+      count = (list != NULL) ? list->count : 0;
+      for (i = 1; i < count; i++)
+	{
+	  expandBlock[i] = list->heap[i];
+	  SASLock (expandBlock[i], SasUserLock__WRITE);
+	}
+
+      freed = SASStringBTreeCompactNoLock (heap);
+
+      // Blocks freed by the compaction are no longer in the list.
+      for (i = 1; i < count; i++)
+	SASUnlock (expandBlock[i]);
+      SASUnlock (heap);
+#ifdef __SASDebugPrint__
+    }
+  else
+    {
+      sas_printf ("SASStringBTreeCompact(%p) type check failed\n", heap);
+#endif
+    }
+  return freed;
+}
+
 /******************************************************************/
 
 SASStringBTreeNode_t
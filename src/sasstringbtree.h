@@ -198,6 +198,27 @@ SASStringBTreeAllocSize (SASStringBTree_t btree);
 extern __C__ block_size_t
 SASStringBTreeFreeSpace (SASStringBTree_t btree);
 
+/*!
+ * \brief Compact the expanding SAS B-Tree \a btree.
+ *
+ * Moves the nodes held in the expansion blocks of \a btree, last
+ * block first, into the free node pages of the blocks kept, and frees
+ * the expansion blocks emptied. This returns the address space of a
+ * B-Tree that shrank after removes to the region, and segments that
+ * become entirely free are released if sasReleaseOnDealloc is set,
+ * without rebuilding the B-Tree. Blocks holding (or listing) spill pages for
+ * long keys are kept. The function holds the write lock of \a btree
+ * and of its expansion blocks while the nodes are moved. Node pointers
+ * held by enumerations in progress are no longer valid after the
+ * compaction.
+ *
+ * @param btree Handle of the SASStringBTree_t to compact.
+ * @return The count of expansion blocks freed, or -1 if \a btree is
+ * not a SAS_RUNTIME_STRINGBTREE.
+ */
+extern __C__ int
+SASStringBTreeCompact (SASStringBTree_t btree);
+
 /*!
  * \brief Internal function to allocate a new SASStringBTreeNode_t
  * for SAS B-Tree \a btree.
@@ -667,6 +688,18 @@ SASStringBTreeDestroyNoLock (SASStringBTree_t btree);
 extern __C__ block_size_t
 SASStringBTreeFreeSpaceNoLock (SASStringBTree_t btree);
 
+/*!
+ * \brief Compact the expanding SAS B-Tree \a btree.
+ *
+ * Similar to ::SASStringBTreeCompact but this function holds no lock.
+ *
+ * @param btree Handle of the SASStringBTree_t to compact.
+ * @return The count of expansion blocks freed, or -1 if \a btree is
+ * not a SAS_RUNTIME_STRINGBTREE.
+ */
+extern __C__ int
+SASStringBTreeCompactNoLock (SASStringBTree_t btree);
+
 /*!
  * \brief Internal function. Allocate a new SASStringBTreeNode_t from SAS B-Tree \a btree.
  *
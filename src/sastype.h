@@ -51,6 +51,7 @@ typedef unsigned int sas_type_t;
 #define SAS_LOCKFREELOG_TYPE		0x00500000
 #define SAS_LOGPORTAL_TYPE 		0x00600000
 #define SAS_PCQUEUE_TYPE 		0x00700000
+#define SAS_SLABHEAP_TYPE		0x00800000
 #define SAS_PCQUEUE_TM_SUBTYPE 		0x00000200
 #define SAS_COMPOUNDHEAP_TYPE 		0x00110000
 #define SAS_STRINGBTREENODE_SUBTYPE 	0x00000200
@@ -67,10 +68,25 @@ typedef unsigned int sas_type_t;
 #define SAS_RUNTIME_SIMPLEHEAP \
   (SAS_PERSISTENT_GROUP | SAS_SIMPLEHEAP_TYPE | SAS_PRIMARY_SUBTYPE)
 
+/* Version 1 of the simple heap types manages the free space with the
+   size indexed FreeNodeHeap at heap_offset instead of blockFreeSpace.
+   Older libraries ignore the version, so it is only set on request,
+   see SASSimpleHeapCreateSegregated.  */
+#define SAS_SEGREGATED_VERSION		0x00000001
+
+/* SAS RUNTIME SLAB HEAP version 0 */
+#define SAS_RUNTIME_SLABHEAP \
+  (SAS_PERSISTENT_GROUP | SAS_SLABHEAP_TYPE | SAS_PRIMARY_SUBTYPE)
+
 /* SAS RUNTIME COMPOUND HEAP version 0 */
 #define SAS_RUNTIME_COMPOUNDHEAP \
   (SAS_PERSISTENT_GROUP | SAS_COMPOUNDHEAP_TYPE | SAS_PRIMARY_SUBTYPE)
 
+/* Version 1 of the compound heap types initializes the header words
+   holding the room map, expand index and magazine stamp, which
+   version 0 left as uninitialized spares.  */
+#define SAS_COMPOUNDHEAP_ROOM_VERSION	0x00000001
+
 /* SAS RUNTIME SIMPLE STACK version 0 */
 #define SAS_RUNTIME_SIMPLESTACK \
   (SAS_PERSISTENT_GROUP | SAS_SIMPLESTACK_TYPE | SAS_PRIMARY_SUBTYPE)
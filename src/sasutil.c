@@ -26,7 +26,7 @@
  * \page sasutil control program for libsphde project
  *
  * \section sec1 SYNOPSIS
- * sasutil [-h] [-v] [-p path] \<command\> [\<args\>]
+ * sasutil [-h] [-v] [-m] [-p path] \<command\> [\<args\>]
  *
  * \section sec2 DESCRIPTION
  * The sasutil utility is used to control de libsphde share memory segments,
@@ -45,6 +45,11 @@
  * </pre>
  *
  * <pre>
+ * <b>-m</b>
+ *     Machine readable output of the <b>stat</b> and <b>latency</b> commands.
+ * </pre>
+ *
+ * <pre>
  * <b>-p</b>
  *     Path to wherever libsphde segment is located. This also can be
  *     controlled by setting SASSTOREPATH environment variable. If not path is
@@ -53,12 +58,19 @@
  *
  * \section sec4 COMMANDS
  * The available commands are: stat, detail, reset, dump, remove, list, path,
- * and map. 
+ * map, numa, checkpoint, restore, snapshot and latency.
  *
  * <pre>
  * <b>stat</b>
- *     Shows the overall memory statistics: total in use, total free, total
- *     uncommited, total region free, total region used, and anchor free space.
+ *     Shows the overall memory statistics: use list and page (default or
+ *     hugepage) mode, store (persistent or volatile) mode, region base,
+ *     region and segment size, total in use, total free, total uncommited,
+ *     total region free, total region used, and anchor free space.
+ *     With <b>-m</b> prints the region statistics kept in the anchor as
+ *     one key=value pair per line, without walking the allocation trees
+ *     or taking the region lock, for monitoring scripts. The per order
+ *     keys (free_bytes.\<block size\> etc.) cover blocks up to the
+ *     segment size.
  * </pre>
  *
  * <pre>
@@ -104,6 +116,41 @@
  *     Default is current process.
  * </pre>
  *
+ * <pre>
+ * <b>numa</b>
+ *     Shows the NUMA node residency (in KB) of the page cache pages of the
+ *     allocated segments.
+ * </pre>
+ *
+ * <pre>
+ * <b>checkpoint</b>
+ *     Takes an incremental checkpoint of the region into the SASCKPT
+ *     directory of the store, copying only the segments written since the
+ *     previous checkpoint.
+ * </pre>
+ *
+ * <pre>
+ * <b>restore</b>
+ *     Restores the store from its last checkpoint. The store must not be in
+ *     use by any process.
+ * </pre>
+ *
+ * <pre>
+ * <b>snapshot \<dir\></b>
+ *     Creates a snapshot of the region in the directory \<dir\>, which
+ *     readers can join with the SAS_JOIN_SNAPSHOT option for a frozen view.
+ * </pre>
+ *
+ * <pre>
+ * <b>latency [on|off|reset]</b>
+ *     Enables (on) or disables (off) the allocation latency histograms of
+ *     the region, clears them (reset) or, without argument, shows them:
+ *     the count, mean and maximum latency of the allocator entry points
+ *     (SASBlockAlloc, SASBlockAllocMany, SASCompoundHeapAlloc,
+ *     SASSimpleHeapAlloc and SASSlabHeapAlloc) and their counts by power
+ *     of 2 latency. With <b>-m</b> prints them as key=value pairs.
+ * </pre>
+ *
  * \section sec5 ENVIRONMENT VARIABLES
  * The sasutil command accepts te following environment variables:
  *
@@ -150,6 +197,11 @@ static void sasutil_remove_cmd(int, char **);
 static void sasutil_list_cmd(int, char **);
 static void sasutil_path_cmd(int, char **);
 static void sasutil_map_cmd(int, char **);
+static void sasutil_numa_cmd(int, char **);
+static void sasutil_checkpoint_cmd(int, char **);
+static void sasutil_restore_cmd(int, char **);
+static void sasutil_snapshot_cmd(int, char **);
+static void sasutil_latency_cmd(int, char **);
 
 
 typedef void (*cmd_func_t)(int, char **);
@@ -159,9 +211,10 @@ const char sasutil_prog_name[] =
 const char sasutil_prog_version[] =
   "0.2";
 const char sasutil_usage_string[] = 
-  "[-h] [-v] [-p path] <command> [<args>]\n";
+  "[-h] [-v] [-m] [-p path] <command> [<args>]\n";
 
 const char *storepath = NULL;
+int machine_format = 0;
 
 struct sasutils_commands_t 
 {
@@ -170,14 +223,19 @@ struct sasutils_commands_t
   cmd_func_t func;
 } sasutil_commands[] = 
 {
-  { "stat",   "show memory statistics (total in use, free, etc.)",            sasutil_stat_cmd   },
+  { "stat",   "show memory statistics (-m for key=value counters)",           sasutil_stat_cmd   },
   { "detail", "show memory (default), locks (-l) or semaphores (-s) details", sasutil_detail_cmd },
   { "reset",  "resets semaphotes, locks and control structures",              sasutil_reset_cmd  },
   { "dump",   "dump the selected shared memory in hexadecimal",               sasutil_dump_cmd   },
   { "remove", "remove the shared memory segment",                             sasutil_remove_cmd },
   { "list",   "list in use memory segments",                                  sasutil_list_cmd   },
   { "path",   "show current path used",                                       sasutil_path_cmd   },
-  { "map",    "display process memory maps",                                  sasutil_map_cmd    }
+  { "map",    "display process memory maps",                                  sasutil_map_cmd    },
+  { "numa",   "show NUMA node residency of the allocated segments",           sasutil_numa_cmd   },
+  { "checkpoint", "checkpoint the segments changed since the last checkpoint", sasutil_checkpoint_cmd },
+  { "restore", "restore the store from its last checkpoint",                  sasutil_restore_cmd },
+  { "snapshot", "create a snapshot of the region in a directory",             sasutil_snapshot_cmd },
+  { "latency", "show or enable (on/off/reset) allocation latency histograms",  sasutil_latency_cmd }
 };
 
 static void
@@ -271,6 +329,40 @@ sasutil_cleanup()
 
 /* sasutils commands functions */
 
+static void
+sasutil_stat_machine()
+{
+  SASRegionStats_t stats;
+  unsigned long bsize;
+  int i;
+
+  if (getSASRegionStats (&stats))
+    sasutil_fatal_error("getSASRegionStats failed\n");
+
+  printf ("region_base=%lu\n", __SAS_BASE_ADDRESS);
+  printf ("region_size=%lu\n", RegionSize);
+  printf ("segment_size=%lu\n", SegmentSize);
+  printf ("segments_committed=%lu\n", stats.segments_committed);
+  printf ("segments_total=%lu\n", stats.segments_total);
+  printf ("used_total=%lu\n", stats.used_total);
+  printf ("free_total=%lu\n", stats.free_total);
+  printf ("uncommitted_total=%lu\n", stats.uncommitted_total);
+  printf ("largest_free=%lu\n", stats.largest_free);
+  printf ("alloc_count=%lu\n", stats.alloc_count);
+  printf ("alloc_failures=%lu\n", stats.alloc_failures);
+  printf ("dealloc_count=%lu\n", stats.dealloc_count);
+  printf ("lock_acquires=%lu\n", stats.lock_acquires);
+  printf ("lock_waits=%lu\n", stats.lock_waits);
+  printf ("lock_wait_usec=%lu\n", stats.lock_wait_usec);
+  for (i = 0, bsize = 4096;
+       (i < SAS_REGION_STATS_ORDERS) && (bsize <= SegmentSize);
+       i++, bsize <<= 1) {
+    printf ("free_bytes.%lu=%lu\n", bsize, stats.free_bytes[i]);
+    printf ("uncommitted_bytes.%lu=%lu\n", bsize, stats.uncommitted_bytes[i]);
+    printf ("used_bytes.%lu=%lu\n", bsize, stats.used_bytes[i]);
+  }
+}
+
 static void
 sasutil_stat_cmd(int argc, char *argv[])
 {
@@ -281,10 +373,17 @@ sasutil_stat_cmd(int argc, char *argv[])
   unsigned int cUsed, mUsed;
   unsigned int cUsedReg, mUsedReg;
   unsigned int anchorFree;
+  SASRegionStats_t stats;
   int i;
 
   sasutil_join_region(storepath);
 
+  if (machine_format) {
+    sasutil_stat_machine();
+    sasutil_cleanup();
+    return;
+  }
+
   SASListInUseMem (addrList, sizeList, &count);
   tUsed = 0L;
   for (i = 0; i < count; ++i) {
@@ -325,6 +424,21 @@ sasutil_stat_cmd(int argc, char *argv[])
     printf ("Use List Flag     compact\n");
   else
     printf ("Use List Flag     linear\n");
+  if (getSASRegionMode () & SAS_REGION_HUGEPAGE)
+    printf ("Page Mode         hugepage\n");
+  else
+    printf ("Page Mode         default\n");
+  if (getSASRegionMode () & SAS_REGION_VOLATILE)
+    printf ("Store Mode        volatile\n");
+  else
+    printf ("Store Mode        persistent\n");
+  if (getSASBlockAllocFlag () == 1)
+    printf ("Block Alloc Mode  bitmap\n");
+  else
+    printf ("Block Alloc Mode  tree\n");
+  printf ("Region Base       %lx\n", __SAS_BASE_ADDRESS);
+  printf ("Region Size       %ldKB\n", (RegionSize/1024));
+  printf ("Segment Size      %ldKB\n", (SegmentSize/1024));
 
   printf ("Total in use      %ldKB\n", (tUsed/1024));
   printf (" Max Tree Depth:    %d over %d entries\n", mUsed, cUsed);
@@ -334,6 +448,14 @@ sasutil_stat_cmd(int argc, char *argv[])
   printf ("Total Region used %ldKB\n", (tUsedReg/1024));
   printf (" Max Tree Depth:    %d over %d entries\n", mUsedReg, cUsedReg);
   printf ("Anchor Free Space %d\n",    (anchorFree));
+  if (getSASRegionStats (&stats) == 0) {
+    printf ("Largest free      %ldKB\n", (stats.largest_free/1024));
+    printf ("Allocations       %lu (%lu failed)\n",
+	    stats.alloc_count, stats.alloc_failures);
+    printf ("Deallocations     %lu\n", stats.dealloc_count);
+    printf ("Lock waits        %lu of %lu (%luus)\n",
+	    stats.lock_waits, stats.lock_acquires, stats.lock_wait_usec);
+  }
 
   sasutil_cleanup();
 }
@@ -355,6 +477,21 @@ sasutil_detail_cmd(int argc, char *argv[])
     printf ("Use List Flag     compact\n");
   else
     printf ("Use List Flag     linear\n");
+  if (getSASRegionMode () & SAS_REGION_HUGEPAGE)
+    printf ("Page Mode         hugepage\n");
+  else
+    printf ("Page Mode         default\n");
+  if (getSASRegionMode () & SAS_REGION_VOLATILE)
+    printf ("Store Mode        volatile\n");
+  else
+    printf ("Store Mode        persistent\n");
+  if (getSASBlockAllocFlag () == 1)
+    printf ("Block Alloc Mode  bitmap\n");
+  else
+    printf ("Block Alloc Mode  tree\n");
+  printf ("Region Base       %lx\n", __SAS_BASE_ADDRESS);
+  printf ("Region Size       %ldKB\n", (RegionSize/1024));
+  printf ("Segment Size      %ldKB\n", (SegmentSize/1024));
 
   SASListInUseMem (addrList, sizeList, &count);
   printf ("Memory in use:\n");
@@ -627,6 +764,138 @@ sasutil_map_cmd(int argc, char *argv[])
   }
 }
 
+static void
+sasutil_numa_cmd(int argc, char *argv[])
+{
+  unsigned long nodePages[SAS_NUMA_MAX_NODES];
+  unsigned long pgsize = getpagesize ();
+  int nodes, i;
+
+  sasutil_join_region(storepath);
+
+  nodes = SASNumaResidency (nodePages, SAS_NUMA_MAX_NODES);
+  if (nodes < 0)
+    printf ("NUMA residency not supported\n");
+  for (i = 0; i < nodes; i++)
+    printf ("Node %-3d          %ldKB\n", i, (nodePages[i] * pgsize)/1024);
+
+  sasutil_cleanup();
+}
+
+static void
+sasutil_checkpoint_cmd(int argc, char *argv[])
+{
+  SASCheckpointStats_t stats;
+  int rc;
+
+  sasutil_join_region(storepath);
+
+  rc = SASCheckpoint ();
+  getSASCheckpointStats (&stats);
+  if (rc)
+    printf ("Checkpoint failed: %s\n", strerror (rc));
+  else
+    printf ("Checkpoint %lu: %lu of %lu segments copied in %luus"
+	    " (%luus locked)\n", stats.generation, stats.copied,
+	    stats.segments, stats.total_usec, stats.lock_usec);
+
+  sasutil_cleanup();
+}
+
+static void
+sasutil_restore_cmd(int argc, char *argv[])
+{
+  const char *path = storepath ? storepath : getenv ("SASSTOREPATH");
+  int rc;
+
+  rc = SASCheckpointRestore (path);
+  if (rc)
+    {
+      printf ("Restore failed: %s\n", strerror (rc));
+      exit (EXIT_FAILURE);
+    }
+}
+
+static void
+sasutil_snapshot_cmd(int argc, char *argv[])
+{
+  int rc;
+
+  if (argc < 1)
+    sasutil_fatal_error("snapshot requires a directory\n");
+
+  sasutil_join_region(storepath);
+
+  rc = SASSnapshotCreate (argv[0]);
+  if (rc)
+    printf ("Snapshot failed: %s\n", strerror (rc));
+
+  sasutil_cleanup();
+}
+
+static const char *sasutil_latency_names[SAS_LATENCY_POINTS] =
+{
+  "block_alloc",
+  "block_alloc_many",
+  "compound_alloc",
+  "simple_alloc",
+  "slab_alloc"
+};
+
+static void
+sasutil_latency_cmd(int argc, char *argv[])
+{
+  SASLatencyStats_t stats;
+  int i, j;
+
+  sasutil_join_region(storepath);
+
+  if (argc > 0) {
+    if (strcmp(argv[0], "on") == 0)
+      SASLatencyEnable (1);
+    else if (strcmp(argv[0], "off") == 0)
+      SASLatencyEnable (0);
+    else if (strcmp(argv[0], "reset") == 0)
+      SASLatencyReset ();
+    else
+      sasutil_fatal_error("invalid latency argument: %s\n", argv[0]);
+    sasutil_cleanup();
+    return;
+  }
+
+  if (getSASLatencyStats (&stats))
+    sasutil_fatal_error("getSASLatencyStats failed\n");
+
+  if (machine_format) {
+    printf ("latency_enabled=%d\n", stats.enabled);
+    for (i = 0; i < SAS_LATENCY_POINTS; i++) {
+      printf ("%s.count=%lu\n", sasutil_latency_names[i], stats.count[i]);
+      printf ("%s.total_nsec=%lu\n", sasutil_latency_names[i],
+	      stats.total_nsec[i]);
+      printf ("%s.max_nsec=%lu\n", sasutil_latency_names[i],
+	      stats.max_nsec[i]);
+      for (j = 0; j < SAS_LATENCY_BUCKETS; j++)
+	if (stats.hist[i][j])
+	  printf ("%s.le_nsec.%lu=%lu\n", sasutil_latency_names[i],
+		  stats.bucket_nsec[j], stats.hist[i][j]);
+    }
+  } else {
+    printf ("Latency histograms %s\n", stats.enabled ? "enabled" : "disabled");
+    for (i = 0; i < SAS_LATENCY_POINTS; i++) {
+      if (stats.count[i] == 0)
+	continue;
+      printf ("%-18s count %lu mean %luns max %luns\n",
+	      sasutil_latency_names[i], stats.count[i],
+	      stats.total_nsec[i] / stats.count[i], stats.max_nsec[i]);
+      for (j = 0; j < SAS_LATENCY_BUCKETS; j++)
+	if (stats.hist[i][j])
+	  printf ("  <= %12luns %lu\n", stats.bucket_nsec[j],
+		  stats.hist[i][j]);
+    }
+  }
+
+  sasutil_cleanup();
+}
 
 
 int
@@ -635,12 +904,15 @@ main(int argc, char *argv[])
   int opt, i;
   const char *cmd;
 
-  while ((opt = getopt(argc, argv, "hvp:")) != -1) {
+  while ((opt = getopt(argc, argv, "hvmp:")) != -1) {
     switch (opt) {
     case 'h':
       sasutil_help(NULL);
     case 'v':
       sasutil_version();
+    case 'm':
+      machine_format = 1;
+      break;
     case 'p':
       storepath = optarg;
       break;
@@ -658,6 +658,41 @@ SPHContextFreeSpace (SPHContext_t heap)
     return heapFree;
 }
 
+int
+SPHContextCompact (SPHContext_t contxt)
+{
+    SASBlockHeader	*headerBlock = (SASBlockHeader*)contxt;
+    int freed = -1;
+    int rc;
+    
+    if ( SOMSASCheckBlockSigAndTypeAndSubtype (headerBlock, 
+              SAS_RUNTIME_CONTEXT) )
+    {
+		SPHContextHeader	*header = (SPHContextHeader*) headerBlock;
+    	SASLock(contxt, SasUserLock__WRITE);
+		freed = 0;
+		if (header->name)
+		{
+			rc = SASStringBTreeCompact(header->name);
+			if (rc > 0)
+				freed += rc;
+		}
+		if (header->objID)
+		{
+			rc = SASIndexCompact(header->objID);
+			if (rc > 0)
+				freed += rc;
+		}
+		SASUnlock(contxt);
+#ifdef __SASDebugPrint__
+    } else {
+        sas_printf("SPHContextCompact(%p) does not match type/subtype\n",
+        				contxt);
+#endif
+    }
+    return freed;
+}
+
 int
 SPHContextDestroyNoLock (SPHContext_t heap)
 {
@@ -205,6 +205,21 @@ SPHContextRemoveByAddr (SPHContext_t contxt, const void *value);
 extern __C__ block_size_t 
 SPHContextFreeSpace (SPHContext_t contxt);
 
+/** \brief Compact the name and address indexes of the specified
+*	context.
+*
+*	Moves the B-Tree nodes of the name (SASStringBTree_t) and address
+*	(SASIndex_t) indexes out of their trailing expansion blocks and frees
+*	the blocks emptied. Enumerations in progress over the context are
+*	invalidated.
+*
+*	@param contxt to be compacted.
+*	@return the count of expansion blocks freed, or -1 if contxt is not
+*	a SPHContext_t.
+*/
+extern __C__ int
+SPHContextCompact (SPHContext_t contxt);
+
 /** \brief Setup the root and named project contexts. A project context
 *   is just a second level context named in the regions root context.
 *
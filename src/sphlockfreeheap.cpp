@@ -21,6 +21,7 @@
 #include "sassim.h"
 #include "saslock.h"
 #include "sphlockfreeheap.h"
+#include "sasatom.h"
 #include <bitv_priv.h>
 
 /* Define a common maximum units for allocation to be the same for
@@ -28,16 +29,387 @@
    results for both. */
 #define MAX_UNITS 32
 
+/* Marks a heap whose header carries the summary vector.  Heaps
+   initialized before the summary existed fall back to the linear
+   scan of alloc_vec.  */
+#define SUMMARY_SIG 0x53554d56
+
 typedef struct SPHLockFreeHeapHeader
 {
   SASBlockHeader blockHeader;
   bitv_cb_t bitv_cb;
   unsigned short vec_cnt;
+  /* Number of summary_vec words.  Bit j of summary_vec is set when
+     alloc_vec[j] may have free units.  sum_cnt and sum_sig sit in
+     what was the alignment padding after vec_cnt, and the summary
+     words follow endmrk_vec.  */
+  unsigned short sum_cnt;
+  unsigned int sum_sig;
   bitv_word *alloc_vec;
   bitv_word *endmrk_vec;
   bitv_word vecbuf[8];
 } SPHLockFreeHeapHeader;
 
+/* Each thread starts its search at its own alloc_vec word and then
+   follows the last word it allocated from or freed into.  This keeps concurrent
+   allocators from all hammering alloc_vec[0] with compare-and-swap.
+   The cursor is only a hint, it is reduced modulo vec_cnt on use.  */
+typedef struct SPHLockFreeHeapCursor_t
+{
+  unsigned long word;
+  int set;
+} SPHLockFreeHeapCursor_t;
+
+static __thread SPHLockFreeHeapCursor_t SPHLockFreeHeapCursor
+  __attribute__ ((tls_model ("initial-exec")));
+static long SPHLockFreeHeapThreadSeq;
+
+static inline bitv_word *
+SPHLockFreeHeapSummary (SPHLockFreeHeapHeader * heapHdr)
+{
+  if (heapHdr->sum_sig == SUMMARY_SIG)
+    return &heapHdr->endmrk_vec[heapHdr->vec_cnt];
+  else
+    return NULL;
+}
+
+static inline unsigned long
+SPHLockFreeHeapStart (SPHLockFreeHeapHeader * heapHdr)
+{
+  if (!SPHLockFreeHeapCursor.set)
+    {
+      long seq = sas_fetch_and_add (&SPHLockFreeHeapThreadSeq, 1);
+      /* Spread the threads across the heap, the first thread starts
+         at the front as the single threaded search always did.  */
+      SPHLockFreeHeapCursor.word = (unsigned long) seq * 0x9e3779b1UL;
+      SPHLockFreeHeapCursor.set = 1;
+    }
+  return SPHLockFreeHeapCursor.word % heapHdr->vec_cnt;
+}
+
+/* alloc_vec[word] was seen empty after an allocation.  Clear its
+   summary bit then recheck, as a concurrent free may have returned
+   units after our load and set the bit before we cleared it.  */
+static void
+SPHLockFreeHeapSummaryClear (SPHLockFreeHeapHeader * heapHdr,
+			     bitv_word * summary, unsigned long word)
+{
+  bitv_word bit = 1UL << (word % bits_per_long);
+  unsigned long *sum_word = &summary[word / bits_per_long];
+
+  sas_fetch_and_and_long (sum_word, ~bit);
+  if (heapHdr->alloc_vec[word] != 0)
+    sas_fetch_and_or_long (sum_word, bit);
+}
+
+/* Units of alloc_vec[word] were freed, make sure allocators can
+   find them.  */
+static inline void
+SPHLockFreeHeapSummarySet (bitv_word * summary, unsigned long word)
+{
+  bitv_word bit = 1UL << (word % bits_per_long);
+  unsigned long *sum_word = &summary[word / bits_per_long];
+
+  if (!(*sum_word & bit))
+    sas_fetch_and_or_long (sum_word, bit);
+}
+
+/* Try one alloc_vec word.  Returns the offset of the allocation from
+   the start of the area covered by this word or -1.  */
+static inline ssize_t
+SPHLockFreeHeapTryWord (SPHLockFreeHeapHeader * heapHdr, long i,
+			size_t alloc_size, block_size_t alignment)
+{
+#ifdef __SASDebugPrint__
+  sas_printf ("SPHLockFreeHeapTryWord:[%ld] %lx %lx\n",
+	      i, heapHdr->alloc_vec[i], heapHdr->endmrk_vec[i]);
+#endif
+  if (alignment)
+    return bitv_aligned_alloc_marked (&heapHdr->bitv_cb,
+				      &heapHdr->alloc_vec[i],
+				      &heapHdr->endmrk_vec[i],
+				      alloc_size, alignment);
+  else
+    return bitv_alloc_marked (&heapHdr->bitv_cb,
+			      &heapHdr->alloc_vec[i],
+			      &heapHdr->endmrk_vec[i], alloc_size);
+}
+
+/* Search alloc_vec for alloc_size bytes (aligned if alignment is non
+   zero) starting at this thread's cursor and wrapping around.  With
+   a summary vector whole words of alloc_vec that are full are skipped
+   64 at a time, and within those bitv_find_run tests several words at
+   once for a long enough run of free units.  Returns the byte offset from the heap start or -1.  */
+static ssize_t
+SPHLockFreeHeapSearch (SPHLockFreeHeapHeader * heapHdr,
+		       size_t alloc_size, block_size_t alignment)
+{
+  long unit_shift = heapHdr->bitv_cb.alloc_shift;
+  long cnt = heapHdr->vec_cnt;
+  bitv_word *summary = SPHLockFreeHeapSummary (heapHdr);
+  unsigned long start = SPHLockFreeHeapStart (heapHdr);
+  /* Words without a run this long are skipped by bitv_find_run
+     without trying the compare-and-swap.  */
+  size_t units = bitv_round_unit (&heapHdr->bitv_cb, alloc_size);
+  ssize_t offset;
+  long i;
+
+  if (units == 0)
+    units = 1;
+
+  if (summary)
+    {
+      long sum_cnt = heapHdr->sum_cnt;
+      long sw = start / bits_per_long;
+      long sb = start % bits_per_long;
+
+      /* Visit the starting summary word twice, first for the words at
+         and after the cursor, last for the words before it.  */
+      for (long k = 0; k <= sum_cnt; k++)
+	{
+	  bitv_word bits = summary[sw];
+
+	  if (k == 0)
+	    bits &= (~0UL << sb);
+	  else if (k == sum_cnt)
+	    bits &= ~(~0UL << sb);
+
+	  if (bits)
+	    {
+	      long base = sw * bits_per_long;
+	      long end = base + bits_per_long - __builtin_clzl (bits);
+
+	      i = base + __builtin_ctzl (bits);
+	      while ((i = bitv_find_run (heapHdr->alloc_vec, i, end,
+					 units)) != -1)
+		{
+		  offset = SPHLockFreeHeapTryWord (heapHdr, i,
+						   alloc_size, alignment);
+		  if (offset != -1)
+		    {
+		      SPHLockFreeHeapCursor.word = i;
+		      if (heapHdr->alloc_vec[i] == 0)
+			SPHLockFreeHeapSummaryClear (heapHdr, summary, i);
+		      return ((i * bits_per_long) << unit_shift) + offset;
+		    }
+		  i++;
+		}
+	    }
+	  if (++sw == sum_cnt)
+	    sw = 0;
+	}
+    }
+  else
+    {
+      /* From the cursor to the end, then from the front up to the
+         cursor.  */
+      for (long k = 0; k < 2; k++)
+	{
+	  long end = k ? (long) start : cnt;
+
+	  i = k ? 0 : start;
+	  while ((i = bitv_find_run (heapHdr->alloc_vec, i, end,
+				     units)) != -1)
+	    {
+	      offset = SPHLockFreeHeapTryWord (heapHdr, i,
+					       alloc_size, alignment);
+	      if (offset != -1)
+		{
+		  SPHLockFreeHeapCursor.word = i;
+		  return ((i * bits_per_long) << unit_shift) + offset;
+		}
+	      i++;
+	    }
+	}
+    }
+  return -1;
+}
+
+/* Allocations that do not fit in one alloc_vec word are carved as a
+   span of units that crosses word boundaries: the free tail of one
+   word, zero or more completely free words, and the free head of the
+   last word.  The span is reserved in two phases.  First each word's
+   share is claimed in address order with compare-and-swap, and if a
+   later word has been taken in the meantime the words already claimed
+   are released again.  Then the end mark is set in the last word.
+   Only the last word carries an end mark, so the first word has none
+   at or after the span's start; that is how free tells a span from a
+   single word allocation.  */
+
+/* Mask of the bits for len units starting at unit off of a word.  */
+static inline bitv_word
+SPHLockFreeHeapSpanMask (long off, long len)
+{
+  return bitv_units_to_mask (len) >> off;
+}
+
+/* Release the span words claimed so far, [word, end) starting at unit
+   off.  Returns nonzero if any of those units were already free.  */
+static int
+SPHLockFreeHeapSpanRelease (SPHLockFreeHeapHeader * heapHdr,
+			    long word, long off, size_t units, long end)
+{
+  bitv_word *summary = SPHLockFreeHeapSummary (heapHdr);
+  int rc = 0;
+
+  for (long w = word; (w < end) && (units > 0); w++)
+    {
+      long len = bits_per_long - off;
+      bitv_word mask, prv;
+
+      if ((size_t) len > units)
+	len = units;
+      mask = SPHLockFreeHeapSpanMask (off, len);
+      prv = sas_fetch_and_or_long (&heapHdr->alloc_vec[w], mask);
+      if (prv & mask)
+	rc = 1;
+      if (summary)
+	SPHLockFreeHeapSummarySet (summary, w);
+      units -= len;
+      off = 0;
+    }
+  return rc;
+}
+
+/* Allocate units as a span, first fit from the start of the heap.
+   Returns the byte offset from the heap start or -1.  */
+static ssize_t
+SPHLockFreeHeapSpanAlloc (SPHLockFreeHeapHeader * heapHdr, size_t units)
+{
+  long unit_shift = heapHdr->bitv_cb.alloc_shift;
+  long cnt = heapHdr->vec_cnt;
+  bitv_word *summary = SPHLockFreeHeapSummary (heapHdr);
+
+  if (units == 0)
+    return -1;
+
+  for (long i = 0; i < cnt; i++)
+    {
+      bitv_word cur = heapHdr->alloc_vec[i];
+      long tail, off, w;
+      size_t left;
+
+      if (cur == 0)
+	continue;
+      /* Free units at the end of this word.  */
+      tail = (~cur) ? __builtin_ctzl (~cur) : (long) bits_per_long;
+      if (tail == 0)
+	continue;
+      off = bits_per_long - tail;
+
+      /* Check the following words can complete the span.  */
+      left = units;
+      for (w = i; (w < cnt) && (left > 0); w++)
+	{
+	  long len = bits_per_long - (w == i ? off : 0);
+	  bitv_word mask;
+
+	  if ((size_t) len > left)
+	    len = left;
+	  mask = SPHLockFreeHeapSpanMask (w == i ? off : 0, len);
+	  if ((heapHdr->alloc_vec[w] & mask) != mask)
+	    break;
+	  left -= len;
+	}
+      if (left > 0)
+	{
+	  /* Word w blocks this span, it may start the next one.  */
+	  if (w > i + 1)
+	    i = w - 1;
+	  continue;
+	}
+
+      /* Phase 1, claim each word's share in order.  */
+      left = units;
+      for (w = i; left > 0; w++)
+	{
+	  long woff = (w == i) ? off : 0;
+	  long len = bits_per_long - woff;
+	  bitv_word mask;
+
+	  if ((size_t) len > left)
+	    len = left;
+	  mask = SPHLockFreeHeapSpanMask (woff, len);
+	  do
+	    {
+	      cur = heapHdr->alloc_vec[w];
+	      if ((cur & mask) != mask)
+		break;
+	    }
+	  while (!__sync_bool_compare_and_swap (&heapHdr->alloc_vec[w],
+						cur, cur & ~mask));
+	  if ((cur & mask) != mask)
+	    break;
+	  if (summary && (heapHdr->alloc_vec[w] == 0))
+	    SPHLockFreeHeapSummaryClear (heapHdr, summary, w);
+	  left -= len;
+	  if (left == 0)
+	    {
+	      /* Phase 2, the span is ours, mark its end.  */
+	      sas_fetch_and_or_long (&heapHdr->endmrk_vec[w],
+				     bitv_mask_to_end_mrk (mask));
+	    }
+	}
+      if (left == 0)
+	return ((i * bits_per_long) + off) << unit_shift;
+
+      /* Lost a race for word w, give back what we claimed.  */
+      SPHLockFreeHeapSpanRelease (heapHdr, i, off, units, w);
+    }
+  return -1;
+}
+
+/* Return the number of units in the multi-word span starting at unit
+   off of alloc_vec[word], or 0 if there is no such span.  */
+static size_t
+SPHLockFreeHeapSpanUnits (SPHLockFreeHeapHeader * heapHdr,
+			  long word, long off)
+{
+  long cnt = heapHdr->vec_cnt;
+  size_t units;
+
+  if ((heapHdr->endmrk_vec[word] << off) != 0)
+    return 0;
+  if ((heapHdr->alloc_vec[word] << off) & bit_zero)
+    return 0;
+
+  units = bits_per_long - off;
+  for (long w = word + 1; w < cnt; w++)
+    {
+      bitv_word end = heapHdr->endmrk_vec[w];
+
+      if (end == 0)
+	{
+	  if (heapHdr->alloc_vec[w] != 0)
+	    return 0;
+	  units += bits_per_long;
+	}
+      else
+	{
+	  return units + __builtin_clzl (end) + 1;
+	}
+    }
+  return 0;
+}
+
+/* Free the span of units starting at unit off of alloc_vec[word].
+   Returns nonzero if part of it was already free.  */
+static int
+SPHLockFreeHeapSpanFree (SPHLockFreeHeapHeader * heapHdr,
+			 long word, long off, size_t units)
+{
+  size_t last_units = (off + units) % bits_per_long;
+  long last = word + ((off + units - 1) / bits_per_long);
+  bitv_word end_mrk;
+
+  if (last_units == 0)
+    last_units = bits_per_long;
+  end_mrk = bit_zero >> (last_units - 1);
+  sas_fetch_and_and_long (&heapHdr->endmrk_vec[last], ~end_mrk);
+
+  return SPHLockFreeHeapSpanRelease (heapHdr, word, off, units, last + 1);
+}
+
 SPHLockFreeHeap_t
 SPHLockFreeHeapInit (void *heap_seg, sas_type_t sasType,
 		     block_size_t heap_size, size_t unit_size)
@@ -65,9 +437,13 @@ SPHLockFreeHeapInit (void *heap_seg, sas_type_t sasType,
       bitv_init (&heapHdr->bitv_cb, unit_size);
 
       heapHdr->vec_cnt = (heap_size / bits_per_long) / unit_size;
+      heapHdr->sum_cnt =
+	(heapHdr->vec_cnt + bits_per_long - 1) / bits_per_long;
+      heapHdr->sum_sig = SUMMARY_SIG;
       heapHdr->alloc_vec = heapHdr->vecbuf;
       heapHdr->endmrk_vec = &heapHdr->vecbuf[heapHdr->vec_cnt];
-      endbuf_vec = &heapHdr->vecbuf[(heapHdr->vec_cnt) * 2];
+      endbuf_vec = &heapHdr->vecbuf[(heapHdr->vec_cnt) * 2
+				    + heapHdr->sum_cnt];
       endbuf = bitv_round_ptr_to_unit (&heapHdr->bitv_cb, endbuf_vec);
       header_size = (unsigned long) endbuf - (unsigned long) heapBlock;
 #ifdef __SASDebugPrint__
@@ -127,6 +503,21 @@ SPHLockFreeHeapInit (void *heap_seg, sas_type_t sasType,
 	      heapBlock = (SASBlockHeader *) - 1;
 	    }
 	}
+
+      if (heapBlock != (SASBlockHeader *) - 1)
+	{
+	  bitv_word *summary = SPHLockFreeHeapSummary (heapHdr);
+
+	  /* Set the summary bit of every alloc_vec word with free units
+	     left after the header was marked allocated.  */
+	  for (int i = 0; i < heapHdr->sum_cnt; i++)
+	    summary[i] = 0;
+	  for (int i = 0; i < heapHdr->vec_cnt; i++)
+	    {
+	      if (heapHdr->alloc_vec[i] != 0)
+		summary[i / bits_per_long] |= 1UL << (i % bits_per_long);
+	    }
+	}
     }
 
   return (SPHLockFreeHeap_t) heapBlock;
@@ -182,36 +573,29 @@ SPHLockFreeHeapAllocNoLock (SPHLockFreeHeap_t heap, size_t alloc_size)
 #else
       maxAlloc = MAX_UNITS << unit_shift;
 #endif
-      if (alloc_size < maxAlloc)
+      if (alloc_size < headerBlock->blockSize)
 	{
 	  ssize_t offset = -1;
-	  long cnt = heapHdr->vec_cnt;
 
-	  for (long i = 0; i < cnt; i++)
+	  /* Requests that fit in one word take the per word search, and
+	     fall back to a span across word boundaries when the free
+	     units are split between neighbouring words.  Larger requests
+	     are always spans.  */
+	  if (alloc_size < maxAlloc)
+	    offset = SPHLockFreeHeapSearch (heapHdr, alloc_size, 0);
+	  if ((offset == -1) && (alloc_size > (1UL << unit_shift)))
+	    offset = SPHLockFreeHeapSpanAlloc (heapHdr,
+					       bitv_round_unit (&heapHdr->
+								bitv_cb,
+								alloc_size));
+
+	  if (offset != -1)
 	    {
-	      if (heapHdr->alloc_vec[i] != 0)
-		{
+	      result = (bitv_word) heap + offset;
 #ifdef __SASDebugPrint__
-		  sas_printf ("SPHLockFreeHeapAlloc:[%ld] %lx %lx\n",
-			      i, heapHdr->alloc_vec[i],
-			      heapHdr->endmrk_vec[i]);
+	      sas_printf ("SPHLockFreeHeapAlloc:[%zu]->%lx\n",
+			  offset, result);
 #endif
-		  offset = bitv_alloc_marked (&heapHdr->bitv_cb,
-					      &heapHdr->alloc_vec[i],
-					      &heapHdr->endmrk_vec[i],
-					      alloc_size);
-		  if (offset != -1)
-		    {
-		      bitv_word byte_off;
-		      byte_off = ((i * bits_per_long) << unit_shift) + offset;
-		      result = (bitv_word) heap + byte_off;
-#ifdef __SASDebugPrint__
-		      sas_printf ("SPHLockFreeHeapAlloc:[%ld,%zu]->%lx\n",
-				  i, offset, result);
-#endif
-		      break;
-		    }
-		}
 	    }
 #ifdef __SASDebugPrint__
 	}
@@ -265,35 +649,16 @@ SPHLockFreeHeapAlignAllocNoLock (SPHLockFreeHeap_t heap,
       if ((alloc_size < maxAlloc)
 	  && bitv_popcountl_one (alignment) && (alignment <= (maxAlign)))
 	{
-	  ssize_t offset = -1;
-	  long cnt = heapHdr->vec_cnt;
+	  ssize_t offset = SPHLockFreeHeapSearch (heapHdr, alloc_size,
+						  alignment);
 
-	  for (long i = 0; i < cnt; i++)
+	  if (offset != -1)
 	    {
-	      if (heapHdr->alloc_vec[i] != 0)
-		{
+	      result = (bitv_word) heap + offset;
 #ifdef __SASDebugPrint__
-		  sas_printf
-		    ("SPHLockFreeHeapAlignAllocNoLock:[%ld] %lx, %lx\n", i,
-		     heapHdr->alloc_vec[i], heapHdr->endmrk_vec[i]);
+	      sas_printf ("SPHLockFreeHeapAlignAllocNoLock:[%zu]->%lx\n",
+			  offset, result);
 #endif
-		  offset = bitv_aligned_alloc_marked (&heapHdr->bitv_cb,
-						      &heapHdr->alloc_vec[i],
-						      &heapHdr->endmrk_vec[i],
-						      alloc_size, alignment);
-		  if (offset != -1)
-		    {
-		      bitv_word byte_off;
-		      byte_off = ((i * bits_per_long) << unit_shift) + offset;
-		      result = (bitv_word) heap + byte_off;
-#ifdef __SASDebugPrint__
-		      sas_printf
-			("SPHLockFreeHeapAlignAllocNoLock:[%ld,%zu]->%lx\n",
-			 i, offset, result);
-#endif
-		      break;
-		    }
-		}
 	    }
 #ifdef __SASDebugPrint__
 	}
@@ -378,17 +743,31 @@ SPHLockFreeHeapFreeInNoLock (SPHLockFreeHeap_t heap,
 	  block_size_t cnt = heapHdr->vec_cnt;
 	  block_size_t maxAlloc;
 	  block_size_t allocated = 1;
+	  long word_off = index % bits_per_long;
+	  size_t span_units = 0;
 
+	  if (word_index < cnt)
+	    span_units = SPHLockFreeHeapSpanUnits (heapHdr, word_index,
+						   word_off);
 	  if (alloc_size > 0)
 	    {			/* only perform this check if alloc_size non-zero */
-	      maxAlloc = MAX_UNITS << unit_shift;
+	      maxAlloc = heapSize;
 
-	      allocated = bitv_allocated_size_chk (&heapHdr->bitv_cb,
-						   &heapHdr->
-						   alloc_vec[word_index],
-						   &heapHdr->
-						   endmrk_vec[word_index],
-						   offset, alloc_size);
+	      if (span_units)
+		{
+		  if (bitv_round_unit (&heapHdr->bitv_cb, alloc_size)
+		      == span_units)
+		    allocated = span_units << unit_shift;
+		  else
+		    allocated = 0;
+		}
+	      else
+		allocated = bitv_allocated_size_chk (&heapHdr->bitv_cb,
+						     &heapHdr->
+						     alloc_vec[word_index],
+						     &heapHdr->
+						     endmrk_vec[word_index],
+						     offset, alloc_size);
 #ifdef __SASDebugPrint__
 	      sas_printf
 		("SPHLockFreeHeapFree: size=%ld, allocated=%ld max=%ld\n",
@@ -406,10 +785,28 @@ SPHLockFreeHeapFreeInNoLock (SPHLockFreeHeap_t heap,
 #endif
 	  if ((word_index < cnt) && (allocated != 0))
 	    {
-	      if (bitv_free_marked (&heapHdr->bitv_cb,
-				    &heapHdr->alloc_vec[word_index],
-				    &heapHdr->endmrk_vec[word_index], offset))
+	      if (span_units)
+		{
+		  if (SPHLockFreeHeapSpanFree (heapHdr, word_index, word_off,
+					       span_units))
+		    rc = -4;
+		  else
+		    SPHLockFreeHeapCursor.word = word_index;
+		}
+	      else if (bitv_free_marked (&heapHdr->bitv_cb,
+					 &heapHdr->alloc_vec[word_index],
+					 &heapHdr->endmrk_vec[word_index],
+					 offset))
 		rc = -4;
+	      else
+		{
+		  bitv_word *summary = SPHLockFreeHeapSummary (heapHdr);
+		  if (summary)
+		    SPHLockFreeHeapSummarySet (summary, word_index);
+		  /* Reuse the units just freed while they are still in
+		     this thread's cache.  */
+		  SPHLockFreeHeapCursor.word = word_index;
+		}
 	    }
 	  else
 	    {
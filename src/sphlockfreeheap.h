@@ -40,15 +40,34 @@
 *	However for biarch systems we may choose that smaller granual
 *	of the supported modes for consistency, normally 32-bits.
 *
-*	So any specific heap instance will support a maximum allocation
-*	request of 32 * unit-size. The Minimun unit size is 16-bytes so
-*	a heap configured with this size can support allocations of
-*	16-byte multiples up to 512 bytes. If an application needs a
-*	larger allocation size a different heap needs to be configured
-*	with an appropriate unit size. For example if allocation up to
-*	4K are need then a unit size of at least 128 bytes is needed.
-*	Of course this unit-size will also be the minimum allocation
-*	size and alignment for that heap.
+*	So any specific heap instance will support single word
+*	allocations of up to 32 * unit-size. The Minimun unit size is
+*	16-bytes so a heap configured with this size can support single
+*	word allocations of 16-byte multiples up to 512 bytes. If an
+*	application mostly needs larger allocations a different heap
+*	should be configured with an appropriate unit size. For example
+*	if allocation up to 4K are need then a unit size of at least 128
+*	bytes is needed. Of course this unit-size will also be the
+*	minimum allocation size and alignment for that heap.
+*
+*	Requests larger than this, and requests whose free units are
+*	split between the end of one bit vector word and the start of
+*	the next, are allocated as a span that crosses word boundaries.
+*	The span is reserved in two phases, claiming each word's share
+*	in address order with compare-and-swap and backing out if a
+*	later word was taken meanwhile, then setting the end mark.
+*	Spans are first fit and slower than single word allocations,
+*	but they let one heap serve variable size payloads up to the
+*	heap size. The aligned forms are still limited to one word.
+*
+*	To scale with the number of threads, each thread starts its
+*	search at its own rotating cursor into the bit vector (the
+*	word it last allocated from or freed into), rather than all
+*	threads contending on the first word. A summary bit vector, one
+*	bit per allocation word, lets the search skip words that are
+*	completely allocated. The summary is a hint maintained with
+*	atomic and/or, the allocation itself is still decided by the
+*	compare-and-swap on the allocation word.
 *
 *	We assume that this simple lock free heap will be used in the
 *	implementation of a compound lock free heap. Such a compound
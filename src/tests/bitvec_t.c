@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
+#include "sphtimer.h"
 
 /* #define CHECK_BITV_PRIMATIVES 1 */
 
@@ -1128,6 +1129,141 @@ bitv_free_marked_test (void)
 	return err;
 }
 
+static long
+bitv_find_run_ref (const bitv_word *bvec, long start, long end,
+		size_t units)
+{
+	long i;
+	size_t b, run;
+
+	for (i = start; i < end; i++) {
+		run = 0;
+		for (b = 0; b < bits_per_long; b++) {
+			if (bvec[i] & (bit_zero >> b)) {
+				if (++run >= units)
+					return i;
+			} else {
+				run = 0;
+			}
+		}
+	}
+	return -1;
+}
+
+int
+bitv_find_run_test (void)
+{
+	int err = 0;
+	bitv_word vec[67];
+	unsigned long seed = 12345;
+	long i, start, end, rc, chk;
+	size_t units;
+	int pass;
+
+	for (pass = 0; pass < 2000; pass++) {
+		/* Mostly allocated words with a few free holes, so that
+		   short runs are common and long runs rare. */
+		for (i = 0; i < 67; i++) {
+			seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+			vec[i] = seed & (seed >> 7) & (seed >> 13);
+			if (((seed >> 40) & 31) == 0)
+				vec[i] |= ((-1UL) << (bits_per_long - 1
+					- ((seed >> 20) % (bits_per_long - 1))))
+					>> ((seed >> 50) % bits_per_long);
+		}
+		start = (seed >> 33) % 67;
+		end = start + ((seed >> 43) % (68 - start));
+		units = 1 + ((seed >> 27) % bits_per_long);
+
+		rc = bitv_find_run (vec, start, end, units);
+		chk = bitv_find_run_ref (vec, start, end, units);
+		if (rc != chk) {
+			printf("error bitv_find_run(%ld, %ld, %zu)=%ld expected %ld\n",
+				start, end, units, rc, chk);
+			err++;
+		}
+	}
+
+	for (i = 0; i < 67; i++)
+		vec[i] = 0;
+	vec[66] = -1L;
+	rc = bitv_find_run (vec, 0, 67, bits_per_long);
+	if (rc != 66) {
+		printf("error bitv_find_run(0, 67, %zu)=%ld expected 66\n",
+			bits_per_long, rc);
+		err++;
+	}
+	rc = bitv_find_run (vec, 0, 66, 1);
+	if (rc != -1) {
+		printf("error bitv_find_run(0, 66, 1)=%ld expected -1\n", rc);
+		err++;
+	}
+
+	printf ("bitv_find_run_test %d errors\n", err);
+	return err;
+}
+
+/* Compare the per word bitv_alloc_marked scan with bitv_find_run
+   locating the candidate first.  Every word has free units but only
+   in runs of 3, except the last one.  */
+int
+bitv_find_run_timing (void)
+{
+	int err = 0;
+	bitv_word vec[256], mrk[256];
+	bitv_cb_t cb;
+	sphtimer_t startt, endt, freqt;
+	double scan_ns, find_ns;
+	long i, k, n = 20000;
+	ssize_t rsz;
+	size_t sz = 8 * 16;
+
+	bitv_init(&cb, 16);
+	for (i = 0; i < 256; i++) {
+		vec[i] = (bitv_word) 0x7777777777777777UL;
+		mrk[i] = 0;
+	}
+	vec[255] = -1L;
+
+	startt = sphgettimer();
+	for (k = 0; k < n; k++) {
+		rsz = -1;
+		for (i = 0; i < 256; i++) {
+			if (vec[i] != 0) {
+				rsz = bitv_alloc_marked(&cb, &vec[i], &mrk[i], sz);
+				if (rsz != -1)
+					break;
+			}
+		}
+		if (i != 255 || rsz != 0)
+			err++;
+		vec[255] = -1L;
+		mrk[255] = 0;
+	}
+	endt = sphgettimer();
+	freqt = sphfastcpufreq();
+	scan_ns = ((double)(endt - startt) * 1000000000.0) / freqt / n;
+
+	startt = sphgettimer();
+	for (k = 0; k < n; k++) {
+		rsz = -1;
+		i = bitv_find_run (vec, 0, 256, sz / 16);
+		if (i != -1)
+			rsz = bitv_alloc_marked(&cb, &vec[i], &mrk[i], sz);
+		if (i != 255 || rsz != 0)
+			err++;
+		vec[255] = -1L;
+		mrk[255] = 0;
+	}
+	endt = sphgettimer();
+	find_ns = ((double)(endt - startt) * 1000000000.0) / freqt / n;
+
+	printf ("bitv_find_run_timing 256 words bitv_alloc_marked scan=%8.1fns"
+		" bitv_find_run=%8.1fns\n", scan_ns, find_ns);
+	printf ("bitv_find_run_timing %d errors\n", err);
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc = 0;
@@ -1156,6 +1292,10 @@ int main(int argc, char *argv[])
 	rc += bitv_aligned_alloc_marked_test();
 
 	rc += bitv_free_marked_test();
+
+	rc += bitv_find_run_test();
+
+	rc += bitv_find_run_timing();
 	
 	return (rc);
 }
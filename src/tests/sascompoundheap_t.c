@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "sasshm.h"
 #include "sasalloc.h"
 #include "sasstdio.h"
@@ -1411,6 +1412,440 @@ sassim_compound_heap_test6 ()
 }
 #endif
 
+#define EXPAND_PAGES 4000
+/* Small blocks hold 2 pages at the default load factor, so the expand
+   list grows past its initial 254 entries and its first directory.  */
+static int
+sassim_compound_heap_test7 ()
+{
+  SASCompoundHeap_t compoundHeap;
+  static SASSimpleHeap_t pages[EXPAND_PAGES];
+  unsigned long blockSize = block__Size16K;
+  block_size_t cur_alloc, cur_alloc2;
+  int i;
+
+  compoundHeap = SASCompoundHeapCreate (blockSize);
+  if (!compoundHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapCreate(%lu)", blockSize);
+      return 1;
+    }
+  for (i = 0; i < EXPAND_PAGES; i++)
+    {
+      pages[i] = SASCompoundHeapAlloc (compoundHeap);
+      if (!pages[i])
+	{
+	  SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p) page %d", compoundHeap,
+			    i);
+	  return 1;
+	}
+      memset ((char *) pages[i] + 256, i & 0xff, 256);
+    }
+  cur_alloc = SASCompoundHeapAllocSpace (compoundHeap);
+  SASSIM_PRINT_MSG ("\n\tSASCompoundHeapAllocSpace() = %zu for %d pages",
+		    cur_alloc, EXPAND_PAGES);
+  if (cur_alloc < ((EXPAND_PAGES / 2) * blockSize))
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAllocSpace(%p) = %zu", compoundHeap,
+			cur_alloc);
+      return 1;
+    }
+
+  /* Free every other page, half by the heap and half near.  */
+  for (i = 0; i < EXPAND_PAGES; i += 2)
+    {
+      if (i & 2)
+	SASCompoundHeapNearDealloc (pages[i]);
+      else
+	SASCompoundHeapFree (compoundHeap, pages[i]);
+      pages[i] = NULL;
+    }
+  /* The pages freed are allocated again, without expanding.  */
+  for (i = 0; i < EXPAND_PAGES; i += 2)
+    {
+      pages[i] = SASCompoundHeapAlloc (compoundHeap);
+      if (!pages[i])
+	{
+	  SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p) page %d again",
+			    compoundHeap, i);
+	  return 1;
+	}
+    }
+  cur_alloc2 = SASCompoundHeapAllocSpace (compoundHeap);
+  if (cur_alloc2 != cur_alloc)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAllocSpace(%p) = %zu after free"
+			" expected %zu", compoundHeap, cur_alloc2, cur_alloc);
+      return 1;
+    }
+  for (i = 1; i < EXPAND_PAGES; i += 2)
+    {
+      char *p = (char *) pages[i] + 256;
+      if ((p[0] != (char) (i & 0xff)) || (p[255] != (char) (i & 0xff)))
+	{
+	  SASSIM_PRINT_ERR ("page %d @%p overwritten", i, pages[i]);
+	  return 1;
+	}
+    }
+
+  SASCompoundHeapDestroy (compoundHeap);
+  return 0;
+}
+
+#define MAGAZINE_OBJS 64
+#define MAGAZINE_LOOPS 100000
+
+static SASSimpleHeap_t magazineHeap;
+
+/* Free objects into the thread's magazines and exit, which returns
+   them to the heap.  */
+static void *
+sassim_magazine_thread (void *arg)
+{
+  void *objs[MAGAZINE_OBJS];
+  int i;
+
+  SASThreadSetUp ();
+  for (i = 0; i < MAGAZINE_OBJS; i++)
+    objs[i] = SASSimpleHeapAlloc (magazineHeap, 48);
+  for (i = 0; i < MAGAZINE_OBJS; i++)
+    if (objs[i])
+      SASSimpleHeapFree (magazineHeap, objs[i], 48);
+  SASThreadCleanUp ();
+  return arg;
+}
+
+static int
+sassim_compound_heap_test8 ()
+{
+  SASCompoundHeap_t compoundHeap;
+  SASSimpleHeap_t subHeap, subHeap2;
+  void *objs[MAGAZINE_OBJS];
+  unsigned long blockSize = block__Size256K;
+  block_size_t heap_free, cur_free, comp_free;
+  sphtimer_t start, lockt, magt;
+  pthread_t thread;
+  int depth = sasHeapMagazineDepth;
+  int i, j;
+
+  compoundHeap = SASCompoundHeapCreatePageSize (blockSize, (16 * 1024));
+  if (!compoundHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapCreatePageSize(%lu)", blockSize);
+      return 1;
+    }
+  comp_free = SASCompoundHeapFreeSpace (compoundHeap);
+  subHeap = SASCompoundHeapAlloc (compoundHeap);
+  if (!subHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p)", compoundHeap);
+      return 1;
+    }
+  heap_free = SASSimpleHeapFreeSpace (subHeap);
+
+  start = sphgettimer ();
+  for (i = 0; i < MAGAZINE_LOOPS; i++)
+    {
+      objs[0] = SASSimpleHeapAlloc (subHeap, 64);
+      SASSimpleHeapFree (subHeap, objs[0], 64);
+    }
+  lockt = sphgettimer () - start;
+
+  sasHeapMagazineDepth = SAS_HEAP_MAGAZINE_DEPTH;
+  start = sphgettimer ();
+  for (i = 0; i < MAGAZINE_LOOPS; i++)
+    {
+      objs[0] = SASSimpleHeapAlloc (subHeap, 64);
+      SASSimpleHeapFree (subHeap, objs[0], 64);
+    }
+  magt = sphgettimer () - start;
+  SASSIM_PRINT_MSG ("\n\talloc/free %d locked %lld magazine %lld ticks",
+		    MAGAZINE_LOOPS, (long long) lockt, (long long) magt);
+
+  /* Sizes in a magazine class are reused, last freed first.  */
+  for (i = 0; i < MAGAZINE_OBJS; i++)
+    {
+      objs[i] = SASSimpleHeapAlloc (subHeap, (i % 8) * 16 + 1);
+      if (!objs[i])
+	{
+	  SASSIM_PRINT_ERR ("SASSimpleHeapAlloc(%p, %d)", subHeap,
+			    (i % 8) * 16 + 1);
+	  return 1;
+	}
+      memset (objs[i], i, (i % 8) * 16 + 1);
+    }
+  for (i = MAGAZINE_OBJS - 8; i < MAGAZINE_OBJS; i++)
+    SASSimpleHeapFree (subHeap, objs[i], (i % 8) * 16 + 1);
+  for (i = MAGAZINE_OBJS - 8; i < MAGAZINE_OBJS; i++)
+    {
+      void *obj = SASSimpleHeapAlloc (subHeap, (i % 8) * 16 + 16);
+      if (obj != objs[i])
+	{
+	  SASSIM_PRINT_ERR ("SASSimpleHeapAlloc(%p, %d) = %p expected %p",
+			    subHeap, (i % 8) * 16 + 16, obj, objs[i]);
+	  return 1;
+	}
+      memset (objs[i], i, (i % 8) * 16 + 1);
+    }
+  for (i = 0; i < MAGAZINE_OBJS; i++)
+    {
+      char *p = (char *) objs[i];
+      for (j = 0; j <= (i % 8) * 16; j++)
+	if (p[j] != (char) i)
+	  {
+	    SASSIM_PRINT_ERR ("object %d @%p overwritten", i, objs[i]);
+	    return 1;
+	  }
+    }
+  /* Free more than a magazine holds, the free space counts them all
+     once the caller's magazines are returned.  */
+  for (i = 0; i < MAGAZINE_OBJS; i++)
+    SASSimpleHeapFree (subHeap, objs[i], (i % 8) * 16 + 1);
+  cur_free = SASSimpleHeapFreeSpace (subHeap);
+  if (cur_free != heap_free)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFreeSpace(%p) = %zu expected %zu",
+			subHeap, cur_free, heap_free);
+      return 1;
+    }
+
+  /* Objects held by a thread are returned when it exits.  */
+  magazineHeap = subHeap;
+  if (pthread_create (&thread, NULL, sassim_magazine_thread, NULL)
+      || pthread_join (thread, NULL))
+    {
+      SASSIM_PRINT_ERR ("pthread_create/join failed");
+      return 1;
+    }
+  cur_free = SASSimpleHeapFreeSpace (subHeap);
+  if (cur_free != heap_free)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFreeSpace(%p) = %zu after thread"
+			" expected %zu", subHeap, cur_free, heap_free);
+      return 1;
+    }
+
+  /* A freed sub heap is held, its objects are discarded, and it is
+     reused cleared.  */
+  objs[0] = SASSimpleHeapAlloc (subHeap, 64);
+  SASSimpleHeapFree (subHeap, objs[0], 64);
+  SASCompoundHeapFree (compoundHeap, subHeap);
+  subHeap2 = SASCompoundHeapAlloc (compoundHeap);
+  if (subHeap2 != subHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p) = %p expected %p",
+			compoundHeap, subHeap2, subHeap);
+      return 1;
+    }
+  cur_free = SASSimpleHeapFreeSpace (subHeap2);
+  if (cur_free != heap_free)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFreeSpace(%p) = %zu reused"
+			" expected %zu", subHeap2, cur_free, heap_free);
+      return 1;
+    }
+  SASCompoundHeapFree (compoundHeap, subHeap2);
+  if (SASCompoundHeapFreeSpaceNoLock (compoundHeap) == comp_free)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapFreeSpaceNoLock(%p) sub heap"
+			" not held", compoundHeap);
+      return 1;
+    }
+  SASHeapMagazineFlush ();
+  cur_free = SASCompoundHeapFreeSpaceNoLock (compoundHeap);
+  if (cur_free != comp_free)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapFreeSpace(%p) = %zu after flush"
+			" expected %zu", compoundHeap, cur_free, comp_free);
+      return 1;
+    }
+  sasHeapMagazineDepth = depth;
+
+  SASCompoundHeapDestroy (compoundHeap);
+  return 0;
+}
+
+static pthread_barrier_t staleBarrier;
+
+/* Free objects into the thread's magazines, then hold them while the
+   main thread frees and reuses their sub heap.  */
+static void *
+sassim_stale_thread (void *arg)
+{
+  void *objs[MAGAZINE_OBJS];
+  int i;
+
+  SASThreadSetUp ();
+  for (i = 0; i < MAGAZINE_OBJS / 4; i++)
+    objs[i] = SASSimpleHeapAlloc (magazineHeap, 48);
+  for (i = 0; i < MAGAZINE_OBJS / 4; i++)
+    if (objs[i])
+      SASSimpleHeapFree (magazineHeap, objs[i], 48);
+  pthread_barrier_wait (&staleBarrier);
+  pthread_barrier_wait (&staleBarrier);
+  SASHeapMagazineFlush ();
+  SASThreadCleanUp ();
+  return arg;
+}
+
+static int
+sassim_compound_heap_test9 ()
+{
+  SASCompoundHeap_t compoundHeap;
+  SASSimpleHeap_t subHeap, subHeap2;
+  void *objs[MAGAZINE_OBJS];
+  unsigned long blockSize = block__Size256K;
+  block_size_t heap_free, cur_free;
+  pthread_t thread;
+  int depth = sasHeapMagazineDepth;
+  int i, rc;
+
+  compoundHeap = SASCompoundHeapCreatePageSize (blockSize, (16 * 1024));
+  if (!compoundHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapCreatePageSize(%lu)", blockSize);
+      return 1;
+    }
+  sasHeapMagazineDepth = SAS_HEAP_MAGAZINE_DEPTH;
+  subHeap = SASCompoundHeapAlloc (compoundHeap);
+  if (!subHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p)", compoundHeap);
+      return 1;
+    }
+  heap_free = SASSimpleHeapFreeSpace (subHeap);
+
+  /* A double free is caught before the object is cached twice.  */
+  objs[0] = SASSimpleHeapAlloc (subHeap, 48);
+  SASSimpleHeapFree (subHeap, objs[0], 48);
+  rc = SASSimpleHeapFree (subHeap, objs[0], 48);
+  if (rc != -2)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFree(%p, %p) double free = %d"
+			" expected -2", subHeap, objs[0], rc);
+      return 1;
+    }
+  SASHeapMagazineFlush ();
+
+  /* Objects another thread holds for a sub heap freed and reused
+     meanwhile are dropped, not freed into the new sub heap.  */
+  magazineHeap = subHeap;
+  pthread_barrier_init (&staleBarrier, NULL, 2);
+  if (pthread_create (&thread, NULL, sassim_stale_thread, NULL))
+    {
+      SASSIM_PRINT_ERR ("pthread_create failed");
+      return 1;
+    }
+  pthread_barrier_wait (&staleBarrier);
+  SASCompoundHeapFree (compoundHeap, subHeap);
+  subHeap2 = SASCompoundHeapAlloc (compoundHeap);
+  if (subHeap2 != subHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p) = %p expected %p",
+			compoundHeap, subHeap2, subHeap);
+      return 1;
+    }
+  for (i = 0; i < MAGAZINE_OBJS / 4; i++)
+    objs[i] = SASSimpleHeapAlloc (subHeap2, 48);
+  pthread_barrier_wait (&staleBarrier);
+  pthread_join (thread, NULL);
+  pthread_barrier_destroy (&staleBarrier);
+
+  for (i = 0; i < MAGAZINE_OBJS / 4; i++)
+    SASSimpleHeapFree (subHeap2, objs[i], 48);
+  SASHeapMagazineFlush ();
+  cur_free = SASSimpleHeapFreeSpace (subHeap2);
+  if (cur_free != heap_free)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFreeSpace(%p) = %zu after stale"
+			" thread expected %zu", subHeap2, cur_free, heap_free);
+      return 1;
+    }
+  sasHeapMagazineDepth = depth;
+
+  SASCompoundHeapDestroy (compoundHeap);
+  return 0;
+}
+
+/* Header of a compound heap as created before the room map, whose
+   spare words were never initialized.  */
+typedef struct
+{
+  SASBlockHeader blockHeader;
+  block_size_t pageSize;
+  long loadFactor;
+  void *spare[3];
+} sassim_old_compound_header;
+
+#define OLD_HEAP_PAGES 64
+
+static int
+sassim_compound_heap_test10 ()
+{
+  SASCompoundHeap_t compoundHeap;
+  sassim_old_compound_header *oldHeader;
+  SASSimpleHeap_t pages[OLD_HEAP_PAGES];
+  unsigned long blockSize = block__Size16K;
+  block_size_t cur_alloc, cur_alloc2;
+  int i;
+
+  compoundHeap = SASCompoundHeapCreate (blockSize);
+  if (!compoundHeap)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapCreate(%lu)", blockSize);
+      return 1;
+    }
+  for (i = 0; i < OLD_HEAP_PAGES; i++)
+    {
+      pages[i] = SASCompoundHeapAlloc (compoundHeap);
+      if (!pages[i])
+	{
+	  SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p) page %d", compoundHeap,
+			    i);
+	  return 1;
+	}
+    }
+  cur_alloc = SASCompoundHeapAllocSpace (compoundHeap);
+
+  /* Make the heap look as if created by an older library, with
+     garbage in the spare words, which are ignored and rebuilt.  */
+  oldHeader = (sassim_old_compound_header *) compoundHeap;
+  oldHeader->blockHeader.blockType &= ~SAS_COMPOUNDHEAP_ROOM_VERSION;
+  for (i = 0; i < 3; i++)
+    oldHeader->spare[i] = (void *) 0xdeadbeef0UL;
+
+  for (i = 0; i < OLD_HEAP_PAGES; i += 2)
+    {
+      SASCompoundHeapFree (compoundHeap, pages[i]);
+      pages[i] = NULL;
+    }
+  for (i = 0; i < OLD_HEAP_PAGES; i += 2)
+    {
+      pages[i] = SASCompoundHeapAlloc (compoundHeap);
+      if (!pages[i])
+	{
+	  SASSIM_PRINT_ERR ("SASCompoundHeapAlloc(%p) old page %d",
+			    compoundHeap, i);
+	  return 1;
+	}
+    }
+  if (!(oldHeader->blockHeader.blockType & SAS_COMPOUNDHEAP_ROOM_VERSION))
+    {
+      SASSIM_PRINT_ERR ("compound heap %p not upgraded", compoundHeap);
+      return 1;
+    }
+  cur_alloc2 = SASCompoundHeapAllocSpace (compoundHeap);
+  if (cur_alloc2 != cur_alloc)
+    {
+      SASSIM_PRINT_ERR ("SASCompoundHeapAllocSpace(%p) = %zu after upgrade"
+			" expected %zu", compoundHeap, cur_alloc2, cur_alloc);
+      return 1;
+    }
+
+  SASCompoundHeapDestroy (compoundHeap);
+  return 0;
+}
+
 int
 main ()
 {
@@ -1445,6 +1880,10 @@ main ()
 #ifdef __LP64__
   failures += sassim_compound_heap_test6 ();
 #endif
+  failures += sassim_compound_heap_test7 ();
+  failures += sassim_compound_heap_test8 ();
+  failures += sassim_compound_heap_test9 ();
+  failures += sassim_compound_heap_test10 ();
 
   SASRemove ();
 
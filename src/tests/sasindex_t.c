@@ -3041,6 +3041,88 @@ sassim_index_test1 ()
   return 0;
 }
 
+#define COMPACT_KEYS 3000
+static int
+sassim_index_test_compact ()
+{
+  SASIndex_t index;
+  SASIndexHeader *header;
+  unsigned long blockSize = block__Size64K;
+  SASIndexKey_t ndxkey;
+  block_size_t blocks;
+  void *val;
+  int i, freed;
+
+  index = SASIndexCreate (blockSize);
+  if (!index)
+    {
+      SASSIM_PRINT_ERR ("SASIndexCreate(%lu)", blockSize);
+      return 1;
+    }
+  header = (SASIndexHeader *) index;
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      SASIndexKeyInitUInt64 (&ndxkey, i);
+      if (!SASIndexPut (index, &ndxkey, (void *) (long) (i + 1)))
+	{
+	  SASSIM_PRINT_ERR ("SASIndexPut (%p, %d)", index, i);
+	  return 1;
+	}
+    }
+  // Keep one key in 20, leaving the expansion blocks sparse.
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      if (i % 20)
+	{
+	  SASIndexKeyInitUInt64 (&ndxkey, i);
+	  SASIndexRemove (index, &ndxkey);
+	}
+    }
+  blocks = header->expandList->count;
+  freed = SASIndexCompact (index);
+  SASSIM_PRINT_MSG ("SASIndexCompact(%p) freed %d of %zu blocks",
+		    index, freed, blocks);
+  if ((freed <= 0) || (header->expandList->count != blocks - freed))
+    {
+      SASSIM_PRINT_ERR ("SASIndexCompact(%p) = %d for %zu blocks",
+			index, freed, blocks);
+      return 1;
+    }
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      SASIndexKeyInitUInt64 (&ndxkey, i);
+      val = SASIndexGet (index, &ndxkey);
+      if (val != ((i % 20) ? NULL : (void *) (long) (i + 1)))
+	{
+	  SASSIM_PRINT_ERR ("SASIndexGet (%p, %d) = %p after compact",
+			    index, i, val);
+	  return 1;
+	}
+    }
+  // The compacted index grows again.
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      if (i % 20)
+	{
+	  SASIndexKeyInitUInt64 (&ndxkey, i);
+	  if (!SASIndexPut (index, &ndxkey, (void *) (long) (i + 1)))
+	    {
+	      SASSIM_PRINT_ERR ("SASIndexPut (%p, %d) after compact",
+				index, i);
+	      return 1;
+	    }
+	}
+    }
+  if (header->common->count != COMPACT_KEYS)
+    {
+      SASSIM_PRINT_ERR ("SASIndex (%p) count = %ld", index,
+			header->common->count);
+      return 1;
+    }
+  SASIndexDestroy (index);
+  return 0;
+}
+
 int
 main ()
 {
@@ -3065,6 +3147,9 @@ main ()
 #endif
 #if 1
   failures += sassim_index_test_split ();
+#endif
+#if 1
+  failures += sassim_index_test_compact ();
 #endif
   // for int64 keys
 #if 1
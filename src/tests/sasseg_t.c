@@ -218,6 +218,7 @@ test_child_2 (void)
 {
 	seg_test_t *shared_block;
 	char 		*new_block;
+	SASJoinStats_t join_stats;
 	int rc = 0;
 
 	/* This is the child process */
@@ -234,6 +235,13 @@ test_child_2 (void)
 	printf ("Child2 __SAS_BASE_ADDRESS=%lx\n", __SAS_BASE_ADDRESS);
 	printf ("Child2 RegionSize        =%lx\n", RegionSize);
 	printf ("Child2 SegmentSize       =%lx\n", SegmentSize);
+	getSASJoinStats (&join_stats);
+	printf ("Child2 join %lu segments %lu threads %luus"
+		" (anchor %lu scan %lu attach %lu lock %lu)\n",
+		join_stats.segments, join_stats.threads,
+		join_stats.total_usec, join_stats.anchor_usec,
+		join_stats.scan_usec, join_stats.attach_usec,
+		join_stats.lock_usec);
 
 	shared_block = (seg_test_t*)getSASFinder ();
 	printf ("Child2 shared_block      =%p\n", shared_block);
@@ -243,14 +251,33 @@ test_child_2 (void)
 	 * error.  */
 	sas_fetch_and_add (&shared_block->child_status,
 			-(JOIN_EXIT_FAILURE));
+	if ((join_stats.threads < 1)
+	    || (join_stats.total_usec < join_stats.attach_usec))
+	{
+		SASSIM_PRINT_ERR ("getSASJoinStats inconsistent");
+		sas_fetch_and_add (&shared_block->child_status, 1);
+	}
 
 	new_block = SASBlockAlloc (SegmentSize);
 	shared_block->block2 = strcpy (new_block, "new_block 2");
 	printf ("Child2 shared_block.blk2 =%p\n", shared_block->block2);
 
 	relax_ptr ((void**)&shared_block->block3);
+	/* Eagerly attach the segment the parent allocated for block3,
+	 * the following reference should not need a lazy attach.  */
+	if (SASAttachNewSegs () < 1)
+	{
+		SASSIM_PRINT_ERR ("SASAttachNewSegs did not attach block3");
+		sas_fetch_and_add (&shared_block->child_status, 1);
+	}
 	printf ("Child2 shared_block.blk3 =%p\n", shared_block->block3);
 	printf ("Child2 shared_block.blk3 =<%s>\n", shared_block->block3);
+	if (getSASLazyAttachCount () != 0)
+	{
+		SASSIM_PRINT_ERR ("getSASLazyAttachCount = %ld",
+				getSASLazyAttachCount ());
+		sas_fetch_and_add (&shared_block->child_status, 1);
+	}
 
 	fprintf (stdout, "Child2 process exit\n");
 
@@ -15,13 +15,21 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <dirent.h>
 #include "sasshm.h"
 #include "sasalloc.h"
 #include "sasstdio.h"
 #include "sasmsync.h"
 #include "sasstname.h"
 #include "sassim.h"
+#include "saslock.h"
 #include "sassimpleheap.h"
+#include "sasslabheap.h"
 #include "sassimplestack.h"
 #include "sassimplespace.h"
 #include "sascompoundheap.h"
@@ -506,6 +514,294 @@ sassim_heap_test2 ()
   return 0;
 }
 
+static int
+sassim_heap_segregated_test ()
+{
+  SASSimpleHeap_t simpleHeap;
+  FreeNodeHeap *fheap;
+  unsigned long blockSize = block__Size256K;
+  static char *objs[1024];
+  static unsigned int sizes[1024];
+  block_size_t heapFree;
+  unsigned int seed = 12345;
+  int i, j, k;
+
+  /* Only created on request, older libraries do not know the layout.  */
+  simpleHeap = SASSimpleHeapCreate (blockSize);
+  if (!simpleHeap
+      || SOMSASGetBlockFreeNodeHeap ((SASBlockHeader *) simpleHeap))
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapCreate(%lu) segregated", blockSize);
+      return 1;
+    }
+  SASSimpleHeapDestroy (simpleHeap);
+
+  simpleHeap = SASSimpleHeapCreateSegregated (blockSize);
+  if (!simpleHeap)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapCreateSegregated(%lu)", blockSize);
+      return 1;
+    }
+  fheap = SOMSASGetBlockFreeNodeHeap ((SASBlockHeader *) simpleHeap);
+  if (!fheap)
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapCreateSegregated(%lu) not segregated",
+			blockSize);
+      return 1;
+    }
+  heapFree = SASSimpleHeapFreeSpace (simpleHeap);
+  SASSIM_PRINT_MSG ("SASSimpleHeapCreateSegregated (%lu) free=%zu",
+		    blockSize, heapFree);
+
+  memset (objs, 0, sizeof (objs));
+  for (k = 0; k < 20000; k++)
+    {
+      seed = seed * 1103515245 + 12345;
+      i = (seed >> 8) % 1024;
+      if (objs[i])
+	{
+	  for (j = 0; j < (int) sizes[i]; j++)
+	    if (objs[i][j] != (char) i)
+	      {
+		SASSIM_PRINT_ERR ("object %d@%p overwritten at %d", i, objs[i],
+				  j);
+		return 1;
+	      }
+	  if ((k & 1) == 0)
+	    SASNearDealloc (objs[i], sizes[i]);
+	  else if (SASSimpleHeapFree (simpleHeap, objs[i], sizes[i]))
+	    {
+	      SASSIM_PRINT_ERR ("SASSimpleHeapFree(%p, %p, %u) failed",
+				simpleHeap, objs[i], sizes[i]);
+	      return 1;
+	    }
+	  objs[i] = NULL;
+	}
+      else
+	{
+	  sizes[i] = 1 + (seed >> 20) % 400;
+	  objs[i] = (char *) SASSimpleHeapAlloc (simpleHeap, sizes[i]);
+	  if (!objs[i])
+	    {
+	      SASSIM_PRINT_ERR ("SASSimpleHeapAlloc(%p, %u) failed", simpleHeap,
+				sizes[i]);
+	      return 1;
+	    }
+	  memset (objs[i], i, sizes[i]);
+	}
+    }
+  SASSIM_PRINT_MSG ("segregated heap free=%zu fragments=%lu max=%lu",
+		    SASSimpleHeapFreeSpace (simpleHeap),
+		    freeNodeHeap_freeFragmentsTotal (fheap),
+		    freeNodeHeap_maxFragment (fheap));
+  for (i = 0; i < 1024; i++)
+    if (objs[i])
+      SASSimpleHeapFree (simpleHeap, objs[i], sizes[i]);
+
+  /* Everything freed must have coalesced back to a single node.  */
+  if ((SASSimpleHeapFreeSpace (simpleHeap) != heapFree)
+      || (freeNodeHeap_freeFragmentsTotal (fheap) != 1)
+      || (freeNodeHeap_maxFragment (fheap) != heapFree)
+      || !SASSimpleHeapEmpty (simpleHeap))
+    {
+      SASSIM_PRINT_ERR ("segregated heap free=%zu fragments=%lu max=%lu"
+			" expected %zu",
+			SASSimpleHeapFreeSpace (simpleHeap),
+			freeNodeHeap_freeFragmentsTotal (fheap),
+			freeNodeHeap_maxFragment (fheap), heapFree);
+      return 1;
+    }
+
+  /* A double free must not merge the live neighbour into free space.  */
+  objs[0] = (char *) SASSimpleHeapAlloc (simpleHeap, 64);
+  objs[1] = (char *) SASSimpleHeapAlloc (simpleHeap, 64);
+  if (!objs[0] || !objs[1]
+      || SASSimpleHeapFree (simpleHeap, objs[0], 64))
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFree(%p, %p, 64) failed", simpleHeap,
+			objs[0]);
+      return 1;
+    }
+  heapFree = SASSimpleHeapFreeSpace (simpleHeap);
+  if ((SASSimpleHeapFree (simpleHeap, objs[0], 64) != -2)
+      || (SASSimpleHeapFreeSpace (simpleHeap) != heapFree))
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapFree(%p, %p, 64) double free accepted",
+			simpleHeap, objs[0]);
+      return 1;
+    }
+  SASSimpleHeapFree (simpleHeap, objs[1], 64);
+  objs[0] = objs[1] = NULL;
+
+  if (SASSimpleHeapDestroy (simpleHeap))
+    {
+      SASSIM_PRINT_ERR ("SASSimpleHeapDestroy(%p) failed", simpleHeap);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+sassim_slab_heap_test ()
+{
+  SASSlabHeap_t slabHeap;
+  unsigned long blockSize = block__Size256K;
+  static char *objs[512];
+  block_size_t heapFree, size;
+  char *near1;
+  int i, j;
+
+  slabHeap = SASSlabHeapCreate (blockSize);
+  if (!slabHeap)
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapCreate(%lu)", blockSize);
+      return 1;
+    }
+  heapFree = SASSlabHeapFreeSpace (slabHeap);
+  SASSIM_PRINT_MSG ("SASSlabHeapCreate (%lu) success free=%zu",
+		    blockSize, heapFree);
+  if (!SASSlabHeapEmpty (slabHeap) || SASSlabHeapNearFind (slabHeap) != slabHeap)
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeap(%p) not empty", slabHeap);
+      return 1;
+    }
+  if (SASSlabHeapAlloc (slabHeap, SAS_SLAB_MAX_ALLOC + 1))
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapAlloc(%p, %d) should fail", slabHeap,
+			SAS_SLAB_MAX_ALLOC + 1);
+      return 1;
+    }
+
+  /* Fill the heap with a mix of sizes, tagging each object.  */
+  for (i = 0; i < 512; i++)
+    {
+      size = 8 + (i * 37) % 200;
+      objs[i] = (char *) SASSlabHeapAlloc (slabHeap, size);
+      if (!objs[i])
+	{
+	  SASSIM_PRINT_ERR ("SASSlabHeapAlloc(%p, %zu) #%d failed", slabHeap,
+			    size, i);
+	  return 1;
+	}
+      if (SASSlabHeapNearFind (objs[i]) != slabHeap)
+	{
+	  SASSIM_PRINT_ERR ("SASSlabHeapNearFind(%p) != %p", objs[i],
+			    slabHeap);
+	  return 1;
+	}
+      memset (objs[i], i & 0xff, size);
+    }
+  /* Free every other object and allocate them again, the holes must
+     be reused without disturbing the neighbours.  */
+  for (i = 0; i < 512; i += 2)
+    {
+      size = 8 + (i * 37) % 200;
+      if (SASSlabHeapFree (slabHeap, objs[i], size))
+	{
+	  SASSIM_PRINT_ERR ("SASSlabHeapFree(%p, %p, %zu) failed", slabHeap,
+			    objs[i], size);
+	  return 1;
+	}
+    }
+  for (i = 0; i < 512; i += 2)
+    {
+      size = 8 + (i * 37) % 200;
+      objs[i] = (char *) SASSlabHeapAlloc (slabHeap, size);
+      if (!objs[i])
+	{
+	  SASSIM_PRINT_ERR ("SASSlabHeapAlloc(%p, %zu) #%d realloc failed",
+			    slabHeap, size, i);
+	  return 1;
+	}
+      memset (objs[i], i & 0xff, size);
+    }
+  for (i = 0; i < 512; i++)
+    {
+      size = 8 + (i * 37) % 200;
+      for (j = 0; j < (int) size; j++)
+	if (objs[i][j] != (char) (i & 0xff))
+	  {
+	    SASSIM_PRINT_ERR ("object %d@%p overwritten at %d", i, objs[i], j);
+	    return 1;
+	  }
+    }
+
+  /* SASNearAlloc and SASNearDealloc dispatch to the slab heap.  */
+  near1 = (char *) SASNearAlloc (objs[0], 100);
+  if (!near1 || SASSlabHeapNearFind (near1) != slabHeap)
+    {
+      SASSIM_PRINT_ERR ("SASNearAlloc(%p, 100) = %p", objs[0], near1);
+      return 1;
+    }
+  SASNearDealloc (near1, 100);
+
+  if (SASSlabHeapFree (slabHeap, objs[1] + 1, 8 + 37) != -2)
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapFree(%p, %p) misaligned free accepted",
+			slabHeap, objs[1] + 1);
+      return 1;
+    }
+  /* A double free, or a free of a slot never carved from its page,
+     is rejected without changing the page.  */
+  size = 8 + 37;
+  if (SASSlabHeapFree (slabHeap, objs[1], size)
+      || (SASSlabHeapFree (slabHeap, objs[1], size) != -2))
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapFree(%p, %p) double free accepted",
+			slabHeap, objs[1]);
+      return 1;
+    }
+  objs[1] = (char *) SASSlabHeapAlloc (slabHeap, size);
+  if (!objs[1])
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapAlloc(%p, %zu) after free failed",
+			slabHeap, size);
+      return 1;
+    }
+  near1 = (char *) SASSlabHeapAlloc (slabHeap, 1024);
+  if (!near1 || (SASSlabHeapFree (slabHeap, near1 + 2048, 1024) != -2))
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapFree(%p, %p) free above bump accepted",
+			slabHeap, near1 ? near1 + 2048 : NULL);
+      return 1;
+    }
+  SASSlabHeapFree (slabHeap, near1, 1024);
+  for (i = 0; i < 512; i++)
+    {
+      size = 8 + (i * 37) % 200;
+      if (SASSlabHeapFree (slabHeap, objs[i], size))
+	{
+	  SASSIM_PRINT_ERR ("SASSlabHeapFree(%p, %p, %zu) failed", slabHeap,
+			    objs[i], size);
+	  return 1;
+	}
+    }
+  if (!SASSlabHeapEmpty (slabHeap)
+      || SASSlabHeapFreeSpace (slabHeap) != heapFree)
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeap(%p) free=%zu after free all, was %zu",
+			slabHeap, SASSlabHeapFreeSpace (slabHeap), heapFree);
+      return 1;
+    }
+
+  /* All pages were released, so a single size can use the whole heap.  */
+  for (i = 0; i < 512; i++)
+    {
+      objs[i] = (char *) SASSlabHeapAlloc (slabHeap, 96);
+      if (!objs[i])
+	{
+	  SASSIM_PRINT_ERR ("SASSlabHeapAlloc(%p, 96) #%d failed", slabHeap, i);
+	  return 1;
+	}
+    }
+  if (SASSlabHeapDestroy (slabHeap))
+    {
+      SASSIM_PRINT_ERR ("SASSlabHeapDestroy(%p) failed", slabHeap);
+      return 1;
+    }
+  return 0;
+}
+
 static int
 sassim_space_test1 ()
 {
@@ -557,6 +853,10 @@ sassim_display_uselist_flag ()
     printf ("Use List Flag = compact\n");
   else
     printf ("Use List Flag = linear\n");
+  if (getSASRegionMode () & SAS_REGION_HUGEPAGE)
+    printf ("Page Mode = hugepage\n");
+  else
+    printf ("Page Mode = default\n");
 }
 
 static void
@@ -768,34 +1068,1321 @@ sassim_UseList ()
   return rc;
 }
 
-int
-main ()
+#define BALANCE_BLOCKS 2048
+static void *blocks_b [BALANCE_BLOCKS];
+
+/* Sequential allocation inserts the use list keys in address order,
+   which degenerated the old unbalanced trees into a list.  Check the
+   tree depth stays logarithmic.  */
+static int
+sassim_balance_test ()
 {
-  int rc;
-  int failures = 0;
+  int useList = getSASUseListFlag ();
+  int cnt, maxd;
+  int rc = 0;
 
-  if ((rc = SASJoinRegion ()))
+  setSASLinearUseList ();
+  for (cnt = 0; cnt < BALANCE_BLOCKS; cnt++)
+    blocks_b[cnt] = SASBlockAlloc (block__Size4K);
+
+  maxd = SASMaxDepthUseMem ();
+  printf ("Use List Depth %d after %d allocs\n", maxd, BALANCE_BLOCKS);
+  if (maxd > 48)
     {
-      SASSIM_PRINT_ERR ("SASJoinRegion: %i", rc);
-      exit (JOIN_EXIT_FAILURE);
+      SASSIM_PRINT_ERR ("SASMaxDepthUseMem () = %d", maxd);
+      rc++;
     }
-  printf ("__SAS_BASE_ADDRESS=%lx\n", __SAS_BASE_ADDRESS);
-  printf ("RegionSize        =%lx\n", RegionSize);
-  printf ("SegmentSize       =%lx\n", SegmentSize);
-  printf ("__SAS_TEMP_ADDRESS=%lx\n", __SAS_TEMP_ADDRESS);
-  printf ("__SAS_TEMP_FREE   =%lx\n", __SAS_TEMP_FREE);
 
-  failures += sassim_sasseg_test ();
+  for (cnt = 0; cnt < BALANCE_BLOCKS; cnt++)
+    if (blocks_b[cnt])
+      SASBlockDealloc (blocks_b[cnt], block__Size4K);
 
-  failures += sassim_msync_test ();
+  if (useList == 1)
+    setSASCompactUseList ();
 
-  failures += sassim_heap_test1 ();
+  return rc;
+}
 
-  failures += sassim_heap_test2 ();
+/* A deallocated small block is kept in the thread's block cache and
+   reused, with its header cleared, by the next allocation.  */
+static int
+sassim_block_cache_test ()
+{
+  void *blocks[SAS_BLOCK_CACHE_DEPTH + 1];
+  int cacheDepth = sasBlockCacheDepth;
+  char *blk1, *blk2;
+  int i, rc = 0;
+
+  sasBlockCacheDepth = SAS_BLOCK_CACHE_DEPTH;
+  blk1 = (char *) SASBlockAlloc (block__Size16K);
+  if (blk1 == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%x) failed", block__Size16K);
+      sasBlockCacheDepth = cacheDepth;
+      return 1;
+    }
+  memset (blk1, 0xa5, block__Size16K);
+  SASBlockDealloc (blk1, block__Size16K);
+  blk2 = (char *) SASBlockAlloc (block__Size16K);
+  if (blk2 != blk1)
+    {
+      SASSIM_PRINT_ERR ("cached block %p not reused, got %p", blk1, blk2);
+      rc++;
+    }
+  if ((blk2 != NULL) && (blk2[0] != 0))
+    {
+      SASSIM_PRINT_ERR ("cached block %p not cleared", blk2);
+      rc++;
+    }
+  if (blk2 != NULL)
+    SASBlockDealloc (blk2, block__Size16K);
+
+  /* Overflow the cache, then return everything to the region.  */
+  for (i = 0; i <= SAS_BLOCK_CACHE_DEPTH; i++)
+    blocks[i] = SASBlockAlloc (block__Size16K);
+  for (i = 0; i <= SAS_BLOCK_CACHE_DEPTH; i++)
+    if (blocks[i])
+      SASBlockDealloc (blocks[i], block__Size16K);
+  SASBlockCacheFlush ();
+
+  sasBlockCacheDepth = cacheDepth;
+  return rc;
+}
 
-  failures += sassim_space_test1 ();
+#define MANY_BLOCKS 300
 
-  failures += sassim_UseList ();
+static int
+sassim_alloc_many_test ()
+{
+  static void *blocks[MANY_BLOCKS];
+  unsigned long blkSize = block__Size4K;
+  int i, j, n, rc = 0;
+
+  n = SASBlockAllocMany (blkSize, MANY_BLOCKS, blocks);
+  if (n != MANY_BLOCKS)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAllocMany (%lx, %d) = %d", blkSize,
+			MANY_BLOCKS, n);
+      return 1;
+    }
+  for (i = 0; i < n; i++)
+    {
+      if ((blocks[i] == NULL) || ((unsigned long) blocks[i] & (blkSize - 1)))
+	{
+	  SASSIM_PRINT_ERR ("SASBlockAllocMany block %d = %p", i, blocks[i]);
+	  return 1;
+	}
+      memset (blocks[i], i & 0xff, blkSize);
+    }
+  for (i = 0; i < n; i++)
+    for (j = 0; j < (int) blkSize; j += 512)
+      if (((char *) blocks[i])[j] != (char) (i & 0xff))
+	{
+	  SASSIM_PRINT_ERR ("SASBlockAllocMany block %d@%p overlaps", i,
+			    blocks[i]);
+	  return 1;
+	}
+
+  /* Blocks of a run are deallocated one at a time or together.  */
+  for (i = 0; i < n; i += 3)
+    SASBlockDealloc (blocks[i], blkSize);
+  for (i = 0, j = 0; i < n; i++)
+    if (i % 3)
+      blocks[j++] = blocks[i];
+  SASBlockDeallocMany (blkSize, j, blocks);
+
+  /* And are allocated again.  */
+  n = SASBlockAllocMany (blkSize, MANY_BLOCKS, blocks);
+  if (n != MANY_BLOCKS)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAllocMany (%lx, %d) again = %d", blkSize,
+			MANY_BLOCKS, n);
+      rc++;
+    }
+  SASBlockDeallocMany (blkSize, n, blocks);
+
+  return rc;
+}
+
+/* The region statistics kept in the anchor must match the trees.  */
+static int
+sassim_stats_check (const char *when)
+{
+  static void *addrList[8192];
+  static unsigned long sizeList[8192];
+  SASRegionStats_t stats;
+  unsigned long tFree = 0, tUncom = 0, tUsed = 0;
+  int count, i;
+
+  if (getSASRegionStats (&stats))
+    {
+      SASSIM_PRINT_ERR ("getSASRegionStats %s failed", when);
+      return 1;
+    }
+  SASListFreeMem (addrList, sizeList, &count);
+  for (i = 0; i < count; i++)
+    tFree += sizeList[i];
+  SASListUncommittedMem (addrList, sizeList, &count);
+  for (i = 0; i < count; i++)
+    tUncom += sizeList[i];
+  SASListInUseMem (addrList, sizeList, &count);
+  for (i = 0; i < count; i++)
+    tUsed += sizeList[i];
+  if ((stats.free_total != tFree) || (stats.uncommitted_total != tUncom)
+      || (stats.used_total != tUsed))
+    {
+      SASSIM_PRINT_ERR ("region stats %s free=%lu/%lu uncommitted=%lu/%lu"
+			" used=%lu/%lu", when, stats.free_total, tFree,
+			stats.uncommitted_total, tUncom, stats.used_total,
+			tUsed);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+sassim_region_stats_test ()
+{
+  SASRegionStats_t before, after;
+  unsigned long blkSize = block__Size64K;
+  void *blocks[16];
+  int i, rc = 0;
+
+  rc += sassim_stats_check ("at start");
+  getSASRegionStats (&before);
+  for (i = 0; i < 16; i++)
+    blocks[i] = SASBlockAlloc (blkSize);
+  rc += sassim_stats_check ("after alloc");
+  getSASRegionStats (&after);
+  /* Order 4 is 64KB.  */
+  if ((after.used_bytes[4] - before.used_bytes[4] != 16 * blkSize)
+      || (after.alloc_count - before.alloc_count != 16))
+    {
+      SASSIM_PRINT_ERR ("region stats used=%lu allocs=%lu after 16 allocs",
+			after.used_bytes[4] - before.used_bytes[4],
+			after.alloc_count - before.alloc_count);
+      rc++;
+    }
+  if ((after.lock_acquires <= before.lock_acquires)
+      || (after.largest_free < blkSize)
+      || (after.segments_committed == 0)
+      || (after.segments_committed > after.segments_total))
+    {
+      SASSIM_PRINT_ERR ("region stats locks=%lu largest=%lu segments=%lu/%lu",
+			after.lock_acquires, after.largest_free,
+			after.segments_committed, after.segments_total);
+      rc++;
+    }
+
+  for (i = 0; i < 16; i++)
+    SASBlockDealloc (blocks[i], blkSize);
+  rc += sassim_stats_check ("after dealloc");
+  getSASRegionStats (&after);
+  if ((after.used_bytes[4] != before.used_bytes[4])
+      || (after.dealloc_count - before.dealloc_count != 16))
+    {
+      SASSIM_PRINT_ERR ("region stats used=%lu/%lu deallocs=%lu",
+			after.used_bytes[4], before.used_bytes[4],
+			after.dealloc_count - before.dealloc_count);
+      rc++;
+    }
+
+  /* Larger than a segment always fails.  */
+  if (SASBlockAlloc (SegmentSize * 2) != NULL)
+    rc++;
+  getSASRegionStats (&before);
+  if (before.alloc_failures != after.alloc_failures + 1)
+    {
+      SASSIM_PRINT_ERR ("region stats failures=%lu expected %lu",
+			before.alloc_failures, after.alloc_failures + 1);
+      rc++;
+    }
+  SASSIM_PRINT_MSG ("region stats used=%lu free=%lu uncommitted=%lu"
+		    " largest=%lu lock waits=%lu/%lu",
+		    before.used_total, before.free_total,
+		    before.uncommitted_total, before.largest_free,
+		    before.lock_waits, before.lock_acquires);
+  return rc;
+}
+
+#define BITMAP_THREADS 4
+#define BITMAP_BLOCKS 256
+
+static void *
+sassim_bitmap_worker (void *arg)
+{
+  void *blocks[BITMAP_BLOCKS];
+  unsigned long sizes[BITMAP_BLOCKS];
+  unsigned long seed = (unsigned long) arg;
+  long errors = 0;
+  int pass, i;
+
+  for (pass = 0; pass < 8; pass++)
+    {
+      for (i = 0; i < BITMAP_BLOCKS; i++)
+	{
+	  seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	  sizes[i] = block__Size4K << ((seed >> 33) % 5);
+	  blocks[i] = SASBlockAlloc (sizes[i]);
+	  if ((blocks[i] == NULL)
+	      || ((unsigned long) blocks[i] & (sizes[i] - 1)))
+	    errors++;
+	  else
+	    memset (blocks[i], (int) (unsigned long) arg, sizes[i]);
+	}
+      for (i = 0; i < BITMAP_BLOCKS; i++)
+	{
+	  if (blocks[i] == NULL)
+	    continue;
+	  if ((((char *) blocks[i])[0] != (char) (unsigned long) arg)
+	      || (((char *) blocks[i])[sizes[i] - 1]
+		  != (char) (unsigned long) arg))
+	    errors++;
+	  SASBlockDealloc (blocks[i], sizes[i]);
+	}
+    }
+  return (void *) errors;
+}
+
+/* Allocate and free concurrently in bitmap mode, then check freed
+   blocks coalesced back into their arena.  */
+static int
+sassim_bitmap_test ()
+{
+  pthread_t threads[BITMAP_THREADS];
+  int cacheDepth = sasBlockCacheDepth;
+  unsigned long arena;
+  void *reuse[2];
+  void *result;
+  char *blk1, *blk2;
+  int i, rc = 0;
+
+  sasBlockCacheDepth = 0;
+  setSASBitmapBlockAlloc ();
+  if (getSASBlockAllocFlag () != 1)
+    {
+      SASSIM_PRINT_ERR ("getSASBlockAllocFlag () = %d", getSASBlockAllocFlag ());
+      rc++;
+    }
+
+  blk1 = (char *) SASBlockAlloc (block__Size4K);
+  if (blk1 == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) failed", block__Size4K);
+      setSASTreeBlockAlloc ();
+      sasBlockCacheDepth = cacheDepth;
+      return ++rc;
+    }
+  arena = (unsigned long) blk1 & ~(SegmentSize - 1);
+
+  for (i = 0; i < BITMAP_THREADS; i++)
+    pthread_create (&threads[i], NULL, sassim_bitmap_worker,
+		    (void *) (unsigned long) (i + 1));
+  for (i = 0; i < BITMAP_THREADS; i++)
+    {
+      pthread_join (threads[i], &result);
+      if (result != NULL)
+	{
+	  SASSIM_PRINT_ERR ("thread %d: %ld errors", i, (long) result);
+	  rc++;
+	}
+    }
+  SASBlockDealloc (blk1, block__Size4K);
+
+  /* Everything coalesced, so the high half of the arena is free.  */
+  blk2 = (char *) SASBlockAlloc (SegmentSize / 2);
+  if ((unsigned long) blk2 != (arena + (SegmentSize / 2)))
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) = %p, expected %lx",
+			SegmentSize / 2, blk2, arena + (SegmentSize / 2));
+      rc++;
+    }
+  if (blk2 != NULL)
+    SASBlockDealloc (blk2, SegmentSize / 2);
+
+  /* A full arena adds another, and blocks are freed to their own.  */
+  blk1 = (char *) SASBlockAlloc (SegmentSize / 2);
+  blk2 = (char *) SASBlockAlloc (SegmentSize / 2);
+  if ((blk1 == NULL) || (blk2 == NULL)
+      || ((((unsigned long) blk1) ^ ((unsigned long) blk2)) < SegmentSize))
+    {
+      SASSIM_PRINT_ERR ("arena blocks %p %p", blk1, blk2);
+      rc++;
+    }
+  if (blk1 != NULL)
+    SASBlockDealloc (blk1, SegmentSize / 2);
+  if (blk2 != NULL)
+    SASBlockDealloc (blk2, SegmentSize / 2);
+  for (i = 0; i < 2; i++)
+    {
+      reuse[i] = SASBlockAlloc (SegmentSize / 2);
+      if ((reuse[i] != blk1) && (reuse[i] != blk2))
+	{
+	  SASSIM_PRINT_ERR ("arena block %p not reused", reuse[i]);
+	  rc++;
+	}
+    }
+  for (i = 0; i < 2; i++)
+    if (reuse[i] != NULL)
+      SASBlockDealloc (reuse[i], SegmentSize / 2);
+
+  setSASTreeBlockAlloc ();
+  sasBlockCacheDepth = cacheDepth;
+  return rc;
+}
+
+/* SASFindHeader finds the innermost block header for addresses in a
+   block, in nested blocks and in blocks smaller than a page.  */
+static int
+sassim_find_header_test ()
+{
+  char *blk, *inner, *small;
+  SASBlockHeader *hdr;
+  int rc = 0;
+
+  blk = (char *) SASBlockAlloc (block__Size1M);
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) failed", block__Size1M);
+      return 1;
+    }
+  initSOMSASBlock ((SASBlockHeader *) blk, SAS_RUNTIME_SIMPLEHEAP,
+		   block__Size1M, NULL);
+  inner = blk + block__Size256K;
+  initSOMSASBlock ((SASBlockHeader *) inner, SAS_RUNTIME_SIMPLEHEAP,
+		   block__Size64K, NULL);
+  small = blk + block__Size16K + block__Size512;
+  initSOMSASBlock ((SASBlockHeader *) small, SAS_RUNTIME_SIMPLEHEAP,
+		   block__Size512, NULL);
+
+  if ((hdr = SASFindHeader (blk + block__Size1M - 8)) != (SASBlockHeader *) blk)
+    {
+      SASSIM_PRINT_ERR ("SASFindHeader (%p) = %p", blk + block__Size1M - 8, hdr);
+      rc++;
+    }
+  if ((hdr = SASFindHeader (inner + 4000)) != (SASBlockHeader *) inner)
+    {
+      SASSIM_PRINT_ERR ("SASFindHeader (%p) = %p", inner + 4000, hdr);
+      rc++;
+    }
+  if ((hdr = SASFindHeader (inner + block__Size64K)) != (SASBlockHeader *) blk)
+    {
+      SASSIM_PRINT_ERR ("SASFindHeader (%p) = %p", inner + block__Size64K, hdr);
+      rc++;
+    }
+  if ((hdr = SASFindHeader (small + 100)) != (SASBlockHeader *) small)
+    {
+      SASSIM_PRINT_ERR ("SASFindHeader (%p) = %p", small + 100, hdr);
+      rc++;
+    }
+  if ((hdr = SASFindHeader (small - 100)) != (SASBlockHeader *) blk)
+    {
+      SASSIM_PRINT_ERR ("SASFindHeader (%p) = %p", small - 100, hdr);
+      rc++;
+    }
+
+  SASBlockDealloc (blk, block__Size1M);
+  return rc;
+}
+
+/* Called before the join, checks that invalid region geometries are
+   rejected and selects the platform default geometry for the store.  */
+static int
+sassim_geometry_test ()
+{
+  int rc = 0;
+
+  if (!setSASRegionGeometry (0, 0, 0x1800000UL))
+    {
+      SASSIM_PRINT_ERR ("setSASRegionGeometry accepted 24MB segments");
+      rc++;
+    }
+  if (!setSASRegionGeometry (0, 0x100000UL, 0x1000000UL))
+    {
+      SASSIM_PRINT_ERR ("setSASRegionGeometry accepted region < segment");
+      rc++;
+    }
+  if (!setSASRegionGeometry (0x1000UL, 0, 0))
+    {
+      SASSIM_PRINT_ERR ("setSASRegionGeometry accepted unaligned base");
+      rc++;
+    }
+  if (setSASRegionGeometry (0, 0, 0))
+    {
+      SASSIM_PRINT_ERR ("setSASRegionGeometry rejected the defaults");
+      rc++;
+    }
+
+  return rc;
+}
+
+/* Join a second (small) region in its own store below the default
+   region, and check that blocks, finders and locks resolve to the
+   region they belong to.  */
+static int
+sassim_region_test ()
+{
+  const char *store2 = "sassim_t_region";
+  unsigned long base2 = (getMemLow () / 2) & ~(SegmentSize - 1);
+  unsigned long size2 = 16 * SegmentSize;
+  sasregion_t r1, prev;
+  char *blk0, *blk1;
+  void *finder0 = getSASFinder ();
+  int rc = 0;
+
+  mkdir (store2, 0777);
+  if (setSASRegionGeometry (base2, size2, SegmentSize))
+    {
+      SASSIM_PRINT_ERR ("setSASRegionGeometry (%lx, %lx, %lx)",
+			base2, size2, SegmentSize);
+      return 1;
+    }
+  r1 = SASRegionJoin (store2, SAS_REGION_DEFAULT);
+  setSASRegionGeometry (0, 0, 0);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s) = %d", store2, r1);
+      return 1;
+    }
+  printf ("Region %d base=%lx size=%lx\n", r1, base2, size2);
+
+  if (SASRegionByAddr ((void *) getMemLow ()) != 0)
+    {
+      SASSIM_PRINT_ERR ("SASRegionByAddr (%lx) != 0", getMemLow ());
+      rc++;
+    }
+
+  blk1 = SASRegionBlockAlloc (r1, 4096);
+  blk0 = SASBlockAlloc (4096);
+  if ((blk1 == NULL) || (SASRegionByAddr (blk1) != r1)
+      || ((unsigned long) blk1 < base2)
+      || ((unsigned long) blk1 >= (base2 + size2)))
+    {
+      SASSIM_PRINT_ERR ("SASRegionBlockAlloc (%d) = %p", r1, blk1);
+      return rc + 1;
+    }
+  if ((blk0 == NULL) || (SASRegionByAddr (blk0) != 0))
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc = %p", blk0);
+      rc++;
+    }
+
+  prev = SASRegionSelect (r1);
+  if ((prev != 0) || (getMemLow () != base2) || (RegionSize != size2))
+    {
+      SASSIM_PRINT_ERR ("SASRegionSelect (%d) = %d, memLow=%lx",
+			r1, prev, getMemLow ());
+      rc++;
+    }
+  setSASFinder (blk1);
+  SASRegionSelect (prev);
+  if (getSASFinder () != finder0)
+    {
+      SASSIM_PRINT_ERR ("getSASFinder = %p", getSASFinder ());
+      rc++;
+    }
+
+  strcpy (blk1, "region1");
+  SASLock (blk1, SasUserLock__WRITE);
+  SASUnlock (blk1);
+  SASBlockDealloc (blk1, 4096);
+  if (blk0)
+    SASBlockDealloc (blk0, 4096);
+
+  prev = SASRegionSelect (r1);
+  SASRemove ();
+  SASRegionSelect (prev);
+  rmdir (store2);
+
+  return rc;
+}
+
+/* Check that a deallocated multi-page block is left in place by
+   default and, with sasReleaseOnDealloc set, punched out of its
+   segment file, so it reads as zeros without sasClearOnDealloc.  */
+static int
+sassim_release_test ()
+{
+  unsigned long blkSize = 16 * getpagesize ();
+  unsigned long i;
+  char *blk;
+  int rc = 0;
+
+  blk = (char *) SASBlockAlloc (blkSize);
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) failed", blkSize);
+      return ++rc;
+    }
+  memset (blk, 0xa5, blkSize);
+  SASBlockDealloc (blk, blkSize);
+  if (blk[blkSize - 1] != (char) 0xa5)
+    {
+      SASSIM_PRINT_ERR ("block %p released by default", blk);
+      rc++;
+    }
+
+  blk = (char *) SASBlockAlloc (blkSize);
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) failed", blkSize);
+      return ++rc;
+    }
+  memset (blk, 0xa5, blkSize);
+  if (sasMsyncRemove (blk, getpagesize ()))
+    {
+      /* The store file system can not punch holes.  */
+      SASBlockDealloc (blk, blkSize);
+      return rc;
+    }
+  memset (blk, 0xa5, blkSize);
+  sasReleaseOnDealloc = 1;
+  SASBlockDealloc (blk, blkSize);
+  sasReleaseOnDealloc = 0;
+
+  for (i = 0; i < blkSize; i++)
+    {
+      if (blk[i] != 0)
+	{
+	  SASSIM_PRINT_ERR ("released block %p not zero at %lx", blk, i);
+	  rc++;
+	  break;
+	}
+    }
+
+  return rc;
+}
+
+/* Remove the checkpoint directory of store, with the join marker
+   of this process.  */
+static void
+sassim_ckpt_remove (const char *store)
+{
+  char name[STORE_NAME_SIZE];
+  char file[STORE_NAME_SIZE * 2];
+  struct dirent *ent;
+  DIR *dir;
+
+  sprintf (name, "%s/SASCKPT", store);
+  dir = opendir (name);
+  if (dir == NULL)
+    return;
+  while ((ent = readdir (dir)) != NULL)
+    {
+      if (ent->d_name[0] == '.')
+	continue;
+      sprintf (file, "%s/%s", name, ent->d_name);
+      unlink (file);
+    }
+  closedir (dir);
+  rmdir (name);
+}
+
+/* Take incremental checkpoints of the region, check that an unchanged
+   segment is not copied again and that the copy of a changed segment
+   holds the new data. Then remove the checkpoint.  */
+static int
+sassim_checkpoint_test ()
+{
+  SASCheckpointStats_t stats;
+  SASCkptManifest_t m;
+  char name[STORE_NAME_SIZE];
+  unsigned long segnum, blkSize = SegmentSize;
+  char *blk;
+  char val = 0;
+  int fd;
+  int rc = 0;
+
+  blk = (char *) SASBlockAlloc (blkSize);
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) failed", blkSize);
+      return ++rc;
+    }
+  memset (blk, 0x11, getpagesize ());
+  segnum = ((unsigned long) blk - getMemLow ()) / SegmentSize;
+
+  if (SASCheckpoint () || SASCheckpoint ())
+    {
+      SASSIM_PRINT_ERR ("SASCheckpoint failed");
+      rc++;
+      goto done;
+    }
+  getSASCheckpointStats (&stats);
+  printf ("checkpoint %lu: %lu of %lu segments copied in %luus"
+	  " (%luus locked)\n", stats.generation, stats.copied,
+	  stats.segments, stats.total_usec, stats.lock_usec);
+  if ((stats.segments < 2) || (stats.copied >= stats.segments))
+    {
+      SASSIM_PRINT_ERR ("checkpoint copied %lu of %lu unchanged segments",
+			stats.copied, stats.segments);
+      rc++;
+    }
+  if (stats.lock_usec > stats.total_usec)
+    {
+      SASSIM_PRINT_ERR ("checkpoint locked %luus of %luus",
+			stats.lock_usec, stats.total_usec);
+      rc++;
+    }
+
+  blk[0] = 0x22;
+  if (SASCheckpoint ())
+    {
+      SASSIM_PRINT_ERR ("SASCheckpoint failed");
+      rc++;
+      goto done;
+    }
+  if (SASStoreCkptRead (sasStorePath, &m))
+    {
+      SASSIM_PRINT_ERR ("SASStoreCkptRead failed");
+      rc++;
+      goto done;
+    }
+  SASSegCkptNameIndexed (name, sasStorePath, segnum, m.segGen[segnum]);
+  fd = open (name, O_RDONLY);
+  if ((fd == -1) || (pread (fd, &val, 1, 0) != 1) || (val != 0x22))
+    {
+      SASSIM_PRINT_ERR ("checkpoint %s not updated (%x)", name, val);
+      rc++;
+    }
+  if (fd != -1)
+    close (fd);
+  free (m.segGen);
+
+done:
+  if (SASStoreCkptRead (sasStorePath, &m) == 0)
+    {
+      for (segnum = 0; segnum < m.segs; segnum++)
+	if (m.segGen[segnum])
+	  unlink (SASSegCkptNameIndexed (name, sasStorePath, segnum,
+					 m.segGen[segnum]));
+      free (m.segGen);
+    }
+  sassim_ckpt_remove (sasStorePath);
+  SASBlockDealloc (blk, blkSize);
+
+  return rc;
+}
+
+/* Checkpoint a store and join it with SAS_JOIN_RECOVER, after a
+   clean detach (which keeps later writes) and after a process exited
+   while joined (which restores the checkpoint).  */
+static int
+sassim_recover_test ()
+{
+  const char *store2 = "sassim_t_recover";
+  unsigned long base2 = (getMemLow () / 2) & ~(SegmentSize - 1);
+  unsigned long size2 = 16 * SegmentSize;
+  sasregion_t r1, prev;
+  char *blk = NULL;
+  int live, stale;
+  int status = 0;
+  pid_t pid;
+  int rc = 0;
+
+  mkdir (store2, 0777);
+  setSASRegionGeometry (base2, size2, SegmentSize);
+  r1 = SASRegionJoin (store2, SAS_REGION_DEFAULT);
+  setSASRegionGeometry (0, 0, 0);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s) = %d", store2, r1);
+      rmdir (store2);
+      return 1;
+    }
+  prev = SASRegionSelect (r1);
+  blk = (char *) SASBlockAlloc (4096);
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%s) failed", store2);
+      rc++;
+      goto done;
+    }
+  blk[0] = 0x11;
+  if (SASCheckpoint ())
+    {
+      SASSIM_PRINT_ERR ("SASCheckpoint of %s failed", store2);
+      rc++;
+      goto done;
+    }
+  blk[0] = 0x22;
+  SASCleanUp ();
+  SASRegionSelect (prev);
+
+  r1 = SASRegionJoin (store2, SAS_JOIN_RECOVER);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s, RECOVER) = %d", store2, r1);
+      rc++;
+      goto done;
+    }
+  prev = SASRegionSelect (r1);
+  if (blk[0] != 0x22)
+    {
+      SASSIM_PRINT_ERR ("clean detach restored %s (%x)", store2, blk[0]);
+      rc++;
+    }
+  SASCleanUp ();
+  SASRegionSelect (prev);
+
+  // A process that exits while joined leaves its marker behind.
+  pid = fork ();
+  if (pid == 0)
+    {
+      r1 = SASRegionJoin (store2, SAS_REGION_DEFAULT);
+      if (r1 < 1)
+	_exit (1);
+      SASRegionSelect (r1);
+      blk[0] = 0x44;
+      _exit (0);
+    }
+  if ((pid == -1) || (waitpid (pid, &status, 0) != pid)
+      || !WIFEXITED (status) || WEXITSTATUS (status))
+    {
+      SASSIM_PRINT_ERR ("joining %s in child failed", store2);
+      rc++;
+      goto done;
+    }
+
+  r1 = SASRegionJoin (store2, SAS_JOIN_RECOVER);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s, RECOVER) = %d", store2, r1);
+      rc++;
+      goto done;
+    }
+  prev = SASRegionSelect (r1);
+  if (blk[0] != 0x11)
+    {
+      SASSIM_PRINT_ERR ("crashed join not restored %s (%x)", store2, blk[0]);
+      rc++;
+    }
+  SASStoreJoinMarkScan (store2, &live, &stale, 0);
+  if ((live != 1) || (stale != 0))
+    {
+      SASSIM_PRINT_ERR ("join markers of %s live %d stale %d",
+			store2, live, stale);
+      rc++;
+    }
+
+done:
+  if (getMemLow () == base2)
+    {
+      SASRemove ();
+      SASRegionSelect (prev);
+    }
+  sassim_ckpt_remove (store2);
+  rmdir (store2);
+
+  return rc;
+}
+
+/* Snapshot the region, change a block of the live region and check
+   the snapshot still holds the data of the snapshot time.  */
+static int
+sassim_snapshot_test ()
+{
+  const char *snapDir = "sassim_t_snap";
+  char name[STORE_NAME_SIZE];
+  unsigned long segnum, offset;
+  char *blk;
+  char val = 0;
+  int fd;
+  int rc = 0;
+
+  blk = (char *) SASBlockAlloc (getpagesize ());
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc failed");
+      return ++rc;
+    }
+  blk[0] = 0x33;
+  if (SASSnapshotCreate (snapDir))
+    {
+      SASSIM_PRINT_ERR ("SASSnapshotCreate failed");
+      rc++;
+    }
+  blk[0] = 0x44;
+
+  segnum = ((unsigned long) blk - getMemLow ()) / SegmentSize;
+  offset = ((unsigned long) blk - getMemLow ()) % SegmentSize;
+  sprintf (name, "%s/SAS%05lX.DAT", snapDir, segnum);
+  fd = open (name, O_RDONLY);
+  if ((fd == -1) || (pread (fd, &val, 1, offset) != 1) || (val != 0x33))
+    {
+      SASSIM_PRINT_ERR ("snapshot %s changed (%x)", name, val);
+      rc++;
+    }
+  if (fd != -1)
+    close (fd);
+
+  // A failed snapshot leaves the files it did not create alone.
+  if (SASSnapshotCreate (snapDir) != EEXIST)
+    {
+      SASSIM_PRINT_ERR ("SASSnapshotCreate over a snapshot succeeded");
+      rc++;
+    }
+  fd = open (name, O_RDONLY);
+  if ((fd == -1) || (pread (fd, &val, 1, offset) != 1) || (val != 0x33))
+    {
+      SASSIM_PRINT_ERR ("failed snapshot removed %s", name);
+      rc++;
+    }
+  if (fd != -1)
+    close (fd);
+
+  for (segnum = 0; segnum < (RegionSize / SegmentSize); segnum++)
+    {
+      sprintf (name, "%s/SAS%05lX.DAT", snapDir, segnum);
+      unlink (name);
+    }
+  rmdir (snapDir);
+  SASBlockDealloc (blk, getpagesize ());
+
+  return rc;
+}
+
+/* Check the NUMA policy setter and a node local block allocation.
+   Works on single node systems (and kernels without NUMA), as the
+   policy is only a placement hint for SASBlockAllocNode.  */
+/* Return the highest NUMA node with normal memory, 0 if there is
+   only one or it can not be found.  */
+static int
+sassim_numa_last_node ()
+{
+  FILE *f = fopen ("/sys/devices/system/node/has_normal_memory", "r");
+  char buf[256];
+  char *p;
+  int node = 0;
+
+  if (f == NULL)
+    return 0;
+  if (fgets (buf, sizeof (buf), f) != NULL)
+    {
+      p = buf + strcspn (buf, "\n");
+      while ((p > buf) && ((p[-1] >= '0') && (p[-1] <= '9')))
+	p--;
+      node = atoi (p);
+    }
+  fclose (f);
+  if ((node < 0) || (node >= SAS_NUMA_MAX_NODES))
+    node = 0;
+  return node;
+}
+
+static int
+sassim_numa_test ()
+{
+  unsigned long nodePages[SAS_NUMA_MAX_NODES];
+  unsigned long blkSize = 4 * getpagesize ();
+  void *pages[4];
+  int status[4];
+  int node = sassim_numa_last_node ();
+  char *blk;
+  int i;
+  int rc = 0;
+
+  if (!setSASNumaPolicy (SAS_NUMA_BIND + 1, 0))
+    {
+      SASSIM_PRINT_ERR ("setSASNumaPolicy accepted invalid policy");
+      rc++;
+    }
+  if (!setSASNumaPolicy (SAS_NUMA_PREFERRED, SAS_NUMA_MAX_NODES))
+    {
+      SASSIM_PRINT_ERR ("setSASNumaPolicy accepted invalid node");
+      rc++;
+    }
+  if (setSASNumaPolicy (SAS_NUMA_DEFAULT, 0))
+    {
+      SASSIM_PRINT_ERR ("setSASNumaPolicy rejected the default");
+      rc++;
+    }
+
+  blk = (char *) SASBlockAllocNode (blkSize, node);
+  if (blk == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAllocNode (%lx, %d) failed", blkSize, node);
+      return ++rc;
+    }
+  memset (blk, 0x5a, blkSize);
+  /* The block's pages are on the node, for a disk backed store too.
+     Kernels without NUMA support fail move_pages.  */
+  for (i = 0; i < 4; i++)
+    pages[i] = blk + (i * getpagesize ());
+  if (syscall (SYS_move_pages, 0, 4, pages, NULL, status, 0) == 0)
+    {
+      for (i = 0; i < 4; i++)
+	if (status[i] != node)
+	  {
+	    SASSIM_PRINT_ERR ("SASBlockAllocNode (%lx, %d) page %d on node %d",
+			      blkSize, node, i, status[i]);
+	    rc++;
+	  }
+    }
+  else
+    printf ("sassim_numa_test: move_pages: %s\n", strerror (errno));
+  if (SASNumaResidency (nodePages, SAS_NUMA_MAX_NODES) == 0)
+    {
+      SASSIM_PRINT_ERR ("SASNumaResidency found no resident pages");
+      rc++;
+    }
+  SASBlockDealloc (blk, blkSize);
+
+  return rc;
+}
+
+/* Join a second, volatile, region and check its segments are kept
+   out of the store directory and removed with the region.  */
+static int
+sassim_volatile_test ()
+{
+  const char *store2 = "sassim_t_volatile";
+  unsigned long base2 = (getMemLow () / 2) & ~(SegmentSize - 1);
+  unsigned long size2 = 16 * SegmentSize;
+  char name[STORE_NAME_SIZE];
+  sasregion_t r1, prev;
+  char *blk1;
+  int rc = 0;
+
+  mkdir (store2, 0777);
+  setSASRegionGeometry (base2, size2, SegmentSize);
+  r1 = SASRegionJoin (store2, SAS_REGION_VOLATILE);
+  setSASRegionGeometry (0, 0, 0);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s) = %d", store2, r1);
+      rmdir (store2);
+      return 1;
+    }
+
+  prev = SASRegionSelect (r1);
+  if (!(getSASRegionMode () & SAS_REGION_VOLATILE))
+    {
+      SASSIM_PRINT_ERR ("region mode %lx not volatile", getSASRegionMode ());
+      rc++;
+    }
+  blk1 = SASBlockAlloc (SegmentSize);
+  if (blk1 == NULL)
+    {
+      SASSIM_PRINT_ERR ("SASBlockAlloc (%lx) failed", SegmentSize);
+      rc++;
+    }
+  else
+    strcpy (blk1, "volatile");
+
+  sprintf (name, "%s/SAS00000.DAT", store2);
+  if (SASSegNameExists (name))
+    {
+      SASSIM_PRINT_ERR ("volatile region created %s", name);
+      rc++;
+    }
+  SASRemove ();
+  SASRegionSelect (prev);
+  if (rmdir (store2))
+    {
+      SASSIM_PRINT_ERR ("store %s not empty after SASRemove", store2);
+      rc++;
+    }
+
+  return rc;
+}
+
+/* Return 1 if the mapping containing addr is advised for huge pages
+   (the hg VmFlag in /proc/self/smaps), 0 if not, or -1 if unknown.  */
+static int
+sassim_vma_hugepage (unsigned long addr)
+{
+  char line[MAX_LINE_LEN];
+  unsigned long lo, hi;
+  int found = 0;
+  int rc = -1;
+  FILE *smaps;
+
+  smaps = fopen ("/proc/self/smaps", "r");
+  if (smaps == NULL)
+    return -1;
+  while (fgets (line, sizeof (line), smaps))
+    {
+      if (sscanf (line, "%lx-%lx ", &lo, &hi) == 2)
+	found = (addr >= lo) && (addr < hi);
+      else if (found && (strncmp (line, "VmFlags:", 8) == 0))
+	{
+	  rc = (strstr (line, " hg") != NULL);
+	  break;
+	}
+    }
+  fclose (smaps);
+
+  return rc;
+}
+
+/* Join a second region in huge page mode and check the mode is
+   recorded in its anchor and used again when the region is rejoined
+   without asking for it.  */
+static int
+sassim_hugepage_test ()
+{
+  const char *store2 = "sassim_t_hugepage";
+  unsigned long base2 = (getMemLow () / 2) & ~(SegmentSize - 1);
+  unsigned long size2 = 16 * SegmentSize;
+  char line[MAX_LINE_LEN];
+  sasregion_t r1, prev;
+  char *blk;
+  FILE *thp;
+  int rc = 0;
+
+  /* Needs transparent huge pages, unless the store is on hugetlbfs.  */
+  thp = fopen ("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if ((thp == NULL) || !fgets (line, sizeof (line), thp)
+      || strstr (line, "[never]"))
+    {
+      SASSIM_PRINT_MSG ("transparent huge pages not available, skipped");
+      if (thp)
+	fclose (thp);
+      return 0;
+    }
+  fclose (thp);
+
+  mkdir (store2, 0777);
+  setSASRegionGeometry (base2, size2, SegmentSize);
+  r1 = SASRegionJoin (store2, SAS_REGION_HUGEPAGE);
+  setSASRegionGeometry (0, 0, 0);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s, HUGEPAGE) = %d", store2, r1);
+      rmdir (store2);
+      return 1;
+    }
+  prev = SASRegionSelect (r1);
+  if (!(getSASRegionMode () & SAS_REGION_HUGEPAGE))
+    {
+      SASSIM_PRINT_ERR ("region mode %lx not hugepage", getSASRegionMode ());
+      rc++;
+    }
+  blk = (char *) SASBlockAlloc (SegmentSize);
+  if (blk)
+    strcpy (blk, "hugepage");
+  SASCleanUp ();
+  SASRegionSelect (prev);
+
+  /* The mode comes from the anchor, not from the rejoin.  */
+  r1 = SASRegionJoin (store2, SAS_REGION_DEFAULT);
+  if (r1 < 1)
+    {
+      SASSIM_PRINT_ERR ("SASRegionJoin (%s) rejoin = %d", store2, r1);
+      rc++;
+      goto done;
+    }
+  prev = SASRegionSelect (r1);
+  if (!(getSASRegionMode () & SAS_REGION_HUGEPAGE))
+    {
+      SASSIM_PRINT_ERR ("rejoined region mode %lx not hugepage",
+			getSASRegionMode ());
+      rc++;
+    }
+  if (sassim_vma_hugepage (base2) == 0)
+    {
+      SASSIM_PRINT_ERR ("rejoined anchor %lx not advised for huge pages",
+			base2);
+      rc++;
+    }
+  if ((blk == NULL) || strcmp (blk, "hugepage"))
+    {
+      SASSIM_PRINT_ERR ("block %p lost on rejoin of %s", blk, store2);
+      rc++;
+    }
+
+done:
+  if (getMemLow () == base2)
+    {
+      SASRemove ();
+      SASRegionSelect (prev);
+    }
+  rmdir (store2);
+
+  return rc;
+}
+
+/* Count a few allocations, fewer than a batch, and exit without
+   flushing them.  */
+static void *
+sassim_latency_worker (void *arg)
+{
+  void *blk;
+  long i;
+
+  for (i = 0; i < (long) arg; i++)
+    {
+      blk = SASBlockAlloc (block__Size4K);
+      if (blk != NULL)
+	SASBlockDealloc (blk, block__Size4K);
+    }
+  return NULL;
+}
+
+static int
+sassim_latency_test ()
+{
+  SASLatencyStats_t stats;
+  SASSimpleHeap_t heap;
+  pthread_t thread;
+  unsigned long blkSize = block__Size64K;
+  unsigned long total;
+  void *blocks[16];
+  void *mem[100];
+  int i, rc = 0;
+
+  SASLatencyReset ();
+  /* Disabled by default, nothing is counted.  */
+  if (SASLatencyEnable (1) != 0)
+    {
+      SASSIM_PRINT_ERR ("SASLatencyEnable(1) was enabled");
+      rc++;
+    }
+  for (i = 0; i < 16; i++)
+    blocks[i] = SASBlockAlloc (blkSize);
+  heap = SASSimpleHeapCreate (blkSize);
+  for (i = 0; i < 100; i++)
+    mem[i] = SASSimpleHeapAlloc (heap, 64);
+  SASLatencyFlush ();
+  if (SASLatencyEnable (0) != 1)
+    {
+      SASSIM_PRINT_ERR ("SASLatencyEnable(0) was disabled");
+      rc++;
+    }
+
+  getSASLatencyStats (&stats);
+  /* SASSimpleHeapCreate allocates its block with SASBlockAlloc.  */
+  if ((stats.count[SAS_LATENCY_BLOCK_ALLOC] != 17)
+      || (stats.count[SAS_LATENCY_SIMPLE_ALLOC] != 100)
+      || (stats.count[SAS_LATENCY_SLAB_ALLOC] != 0)
+      || stats.enabled)
+    {
+      SASSIM_PRINT_ERR ("latency counts block=%lu simple=%lu slab=%lu",
+			stats.count[SAS_LATENCY_BLOCK_ALLOC],
+			stats.count[SAS_LATENCY_SIMPLE_ALLOC],
+			stats.count[SAS_LATENCY_SLAB_ALLOC]);
+      rc++;
+    }
+  for (i = 0, total = 0; i < SAS_LATENCY_BUCKETS; i++)
+    total += stats.hist[SAS_LATENCY_SIMPLE_ALLOC][i];
+  if ((total != 100)
+      || (stats.max_nsec[SAS_LATENCY_SIMPLE_ALLOC]
+	  > stats.total_nsec[SAS_LATENCY_SIMPLE_ALLOC]))
+    {
+      SASSIM_PRINT_ERR ("latency histogram total=%lu max=%lu sum=%lu", total,
+			stats.max_nsec[SAS_LATENCY_SIMPLE_ALLOC],
+			stats.total_nsec[SAS_LATENCY_SIMPLE_ALLOC]);
+      rc++;
+    }
+  SASSIM_PRINT_MSG ("latency block_alloc mean=%luns max=%luns",
+		    stats.total_nsec[SAS_LATENCY_BLOCK_ALLOC] / 17,
+		    stats.max_nsec[SAS_LATENCY_BLOCK_ALLOC]);
+
+  /* Disabled again, nothing is counted.  */
+  for (i = 0; i < 100; i++)
+    SASSimpleHeapFree (heap, mem[i], 64);
+  mem[0] = SASSimpleHeapAlloc (heap, 64);
+  SASLatencyFlush ();
+  getSASLatencyStats (&stats);
+  if (stats.count[SAS_LATENCY_SIMPLE_ALLOC] != 100)
+    {
+      SASSIM_PRINT_ERR ("latency counted while disabled");
+      rc++;
+    }
+  SASSimpleHeapDestroy (heap);
+  for (i = 0; i < 16; i++)
+    SASBlockDealloc (blocks[i], blkSize);
+
+  SASLatencyReset ();
+  getSASLatencyStats (&stats);
+  if (stats.count[SAS_LATENCY_BLOCK_ALLOC] != 0)
+    {
+      SASSIM_PRINT_ERR ("SASLatencyReset count=%lu",
+			stats.count[SAS_LATENCY_BLOCK_ALLOC]);
+      rc++;
+    }
+
+  /* The counts of a thread are added when it exits.  */
+  SASLatencyEnable (1);
+  pthread_create (&thread, NULL, sassim_latency_worker, (void *) 10L);
+  pthread_join (thread, NULL);
+  SASLatencyEnable (0);
+  getSASLatencyStats (&stats);
+  if (stats.count[SAS_LATENCY_BLOCK_ALLOC] != 10)
+    {
+      SASSIM_PRINT_ERR ("latency count=%lu after thread exit",
+			stats.count[SAS_LATENCY_BLOCK_ALLOC]);
+      rc++;
+    }
+  SASLatencyReset ();
+  return rc;
+}
+
+int
+main ()
+{
+  int rc;
+  int failures = 0;
+
+  failures += sassim_geometry_test ();
+
+  if ((rc = SASJoinRegion ()))
+    {
+      SASSIM_PRINT_ERR ("SASJoinRegion: %i", rc);
+      exit (JOIN_EXIT_FAILURE);
+    }
+  printf ("__SAS_BASE_ADDRESS=%lx\n", __SAS_BASE_ADDRESS);
+  printf ("RegionSize        =%lx\n", RegionSize);
+  printf ("SegmentSize       =%lx\n", SegmentSize);
+  printf ("__SAS_TEMP_ADDRESS=%lx\n", __SAS_TEMP_ADDRESS);
+  printf ("__SAS_TEMP_FREE   =%lx\n", __SAS_TEMP_FREE);
+
+  failures += sassim_sasseg_test ();
+
+  failures += sassim_msync_test ();
+
+  failures += sassim_heap_test1 ();
+
+  failures += sassim_heap_test2 ();
+
+  failures += sassim_heap_segregated_test ();
+
+  failures += sassim_slab_heap_test ();
+
+  failures += sassim_space_test1 ();
+
+  failures += sassim_UseList ();
+
+  failures += sassim_balance_test ();
+
+  failures += sassim_block_cache_test ();
+
+  failures += sassim_alloc_many_test ();
+
+  failures += sassim_region_stats_test ();
+
+  failures += sassim_latency_test ();
+
+  failures += sassim_bitmap_test ();
+
+  failures += sassim_find_header_test ();
+
+  failures += sassim_region_test ();
+
+  failures += sassim_volatile_test ();
+
+  failures += sassim_hugepage_test ();
+
+  failures += sassim_numa_test ();
+
+  failures += sassim_release_test ();
+
+  failures += sassim_checkpoint_test ();
+
+  failures += sassim_recover_test ();
+
+  failures += sassim_snapshot_test ();
 
   SASRemove ();
 
@@ -746,6 +746,88 @@ sassim_btree_test1 ()
   return 0;
 }
 
+#define COMPACT_KEYS 3000
+static int
+sassim_btree_test_compact ()
+{
+  SASStringBTree_t stringBTree;
+  SASStringBTreeHeader *header;
+  unsigned long blockSize = block__Size64K;
+  block_size_t blocks;
+  char key[32];
+  void *val;
+  int i, freed;
+
+  stringBTree = SASStringBTreeCreate (blockSize);
+  if (!stringBTree)
+    {
+      SASSIM_PRINT_ERR ("SASStringBTreeCreate(%lu)", blockSize);
+      return 1;
+    }
+  header = (SASStringBTreeHeader *) stringBTree;
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      sprintf (key, "compact%05d", i);
+      if (!SASStringBTreePut (stringBTree, key, (void *) (long) (i + 1)))
+	{
+	  SASSIM_PRINT_ERR ("SASStringBTreePut (%p, %s)", stringBTree, key);
+	  return 1;
+	}
+    }
+  // Keep one key in 20, leaving the expansion blocks sparse.
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      if (i % 20)
+	{
+	  sprintf (key, "compact%05d", i);
+	  SASStringBTreeRemove (stringBTree, key);
+	}
+    }
+  blocks = header->expandList->count;
+  freed = SASStringBTreeCompact (stringBTree);
+  SASSIM_PRINT_MSG ("SASStringBTreeCompact(%p) freed %d of %zu blocks",
+		    stringBTree, freed, blocks);
+  if ((freed <= 0) || (header->expandList->count != blocks - freed))
+    {
+      SASSIM_PRINT_ERR ("SASStringBTreeCompact(%p) = %d for %zu blocks",
+			stringBTree, freed, blocks);
+      return 1;
+    }
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      sprintf (key, "compact%05d", i);
+      val = SASStringBTreeGet (stringBTree, key);
+      if (val != ((i % 20) ? NULL : (void *) (long) (i + 1)))
+	{
+	  SASSIM_PRINT_ERR ("SASStringBTreeGet (%p, %s) = %p after compact",
+			    stringBTree, key, val);
+	  return 1;
+	}
+    }
+  // The compacted B-Tree grows again.
+  for (i = 0; i < COMPACT_KEYS; i++)
+    {
+      if (i % 20)
+	{
+	  sprintf (key, "compact%05d", i);
+	  if (!SASStringBTreePut (stringBTree, key, (void *) (long) (i + 1)))
+	    {
+	      SASSIM_PRINT_ERR ("SASStringBTreePut (%p, %s) after compact",
+				stringBTree, key);
+	      return 1;
+	    }
+	}
+    }
+  if (SASStringBTreeGetCurCount (stringBTree) != COMPACT_KEYS)
+    {
+      SASSIM_PRINT_ERR ("SASStringBTreeGetCurCount (%p) = %ld", stringBTree,
+			SASStringBTreeGetCurCount (stringBTree));
+      return 1;
+    }
+  SASStringBTreeDestroy (stringBTree);
+  return 0;
+}
+
 int
 main ()
 {
@@ -765,6 +847,7 @@ main ()
 
   failures += sassim_btree_test1 ();
   failures += sassim_btree_test_split();
+  failures += sassim_btree_test_compact ();
 
   //SASCleanUp();
   printf("SAS removed\n");
@@ -943,21 +943,31 @@ lockfree_basic_test (char *x4k)
 	    return 10;
 	}
 #if 1
+	/* Larger than one word can hold, allocated as a span.  */
 	aSize = 512;
 	temp3 = (char*)SPHLockFreeHeapAlloc (lfHeap, aSize);
-	if (!temp3)
+	if (temp3)
 	{
 	    printf("lockfree_basic_test SPHLockFreeHeapAlloc(%p, %zu) = %p\n",
 		lfHeap, aSize, temp3);
+	    memset (temp3, 0x5a, aSize);
 	    lfTemp = SPHLockFreeHeapFreeSpace (lfHeap);
-	    if (lfspace != (lfTemp+496+96+128))
+	    if (lfspace != (lfTemp+aSize+496+96+128))
 	    {
 	    	printf("error lockfree_basic_test(%p)  lfspace (%zu != (%zu+%ld))\n",
-		lfHeap, lfspace, lfTemp, 496L+96L+128L);
+		lfHeap, lfspace, lfTemp, 512L+496L+96L+128L);
+		rc++;
+	    }
+	    status = SPHLockFreeHeapFreeChk (lfHeap, temp3, aSize);
+	    lfTemp = SPHLockFreeHeapFreeSpace (lfHeap);
+	    if (status || (lfspace != (lfTemp+496+96+128)))
+	    {
+	    	printf("error lockfree_basic_test(%p)  SPHLockFreeHeapFreeChk(%p,%p,%zu) = %d\n",
+		lfHeap, lfHeap, temp3, aSize, status);
 		rc++;
 	    }
 	} else {
-	    printf("error lockfree_basic_test  SPHLockFreeHeapAlloc(%p,%zu) exceeds mask limit\n",
+	    printf("error lockfree_basic_test  SPHLockFreeHeapAlloc(%p,%zu) span failed\n",
 		lfHeap, aSize);
 	    return 10;
 	}
@@ -2458,6 +2468,148 @@ lockfree_recycle_test (char *x4k, char *y4k)
 /* Fake out the SAS region range checking for these tests.
 */
 
+int
+lockfree_span_test (char *x4k)
+{
+    int rc = 0;
+    int status;
+    long int i, n;
+    SPHLockFreeHeap_t lfHeap;
+    block_size_t lfspace, lfTemp;
+    block_size_t aSize, hSize, uSize;
+    char *temp0, *temp1, *temp2;
+    char *chunk[128];
+
+    hSize = (32*1024);
+    uSize = 16;
+    memset (x4k, 0, hSize);
+
+    lfHeap = SPHLockFreeHeapInit (x4k , SAS_RUNTIME_LOCKFREEHEAP,
+		hSize, uSize);
+    if ((lfHeap == NULL) || (lfHeap == (SPHLockFreeHeap_t)(-1L)))
+    {
+	printf("error lockfree_span_test(%p)  SPHLockFreeHeapInit(%p,%x,%zu,%zu) failed\n",
+		x4k, x4k, SAS_RUNTIME_LOCKFREEHEAP, hSize, uSize);
+	return 10;
+    }
+    lfspace = SPHLockFreeHeapFreeSpace (lfHeap);
+    printf("lockfree_span_test(%p)  SPHLockFreeHeapFreeSpace(%p) = %zu\n",
+		x4k, lfHeap, lfspace);
+
+    /* 200 units crosses at least three word boundaries.  */
+    aSize = 200 * uSize;
+    temp0 = (char*)SPHLockFreeHeapAlloc (lfHeap, aSize);
+    temp1 = (char*)SPHLockFreeHeapAlloc (lfHeap, 40 * uSize);
+    if (!temp0 || !temp1)
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapAlloc(%p,%zu) = %p, %p\n",
+		lfHeap, aSize, temp0, temp1);
+	return 10;
+    }
+    memset (temp0, 0xa5, aSize);
+    memset (temp1, 0x5a, 40 * uSize);
+    lfTemp = SPHLockFreeHeapFreeSpace (lfHeap);
+    if (lfspace != (lfTemp + aSize + (40 * uSize)))
+    {
+	printf("error lockfree_span_test(%p)  lfspace (%zu != (%zu+%zu))\n",
+		lfHeap, lfspace, lfTemp, aSize + (40 * uSize));
+	rc++;
+    }
+    if (((temp1 >= temp0) && (temp1 < (temp0 + aSize)))
+     || ((temp0 >= temp1) && (temp0 < (temp1 + (40 * uSize)))))
+    {
+	printf("error lockfree_span_test spans overlap %p, %p\n",
+		temp0, temp1);
+	rc++;
+    }
+
+    status = SPHLockFreeHeapFreeChk (lfHeap, temp0, aSize - uSize);
+    if (status == 0)
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapFreeChk(%p,%p,%zu) wrong size accepted\n",
+		lfHeap, temp0, aSize - uSize);
+	rc++;
+    }
+    status = SPHLockFreeHeapFreeChk (lfHeap, temp0, aSize);
+    status |= SPHLockFreeHeapFree (lfHeap, temp1);
+    if (status)
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapFree(%p,%p) = %d\n",
+		lfHeap, temp0, status);
+	rc++;
+    }
+    status = SPHLockFreeHeapFree (lfHeap, temp0);
+    if (status == 0)
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapFree(%p,%p) double free not detected\n",
+		lfHeap, temp0);
+	rc++;
+    }
+    if ((SPHLockFreeHeapFreeSpace (lfHeap) != lfspace)
+     || !SPHLockFreeHeapEmpty (lfHeap))
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapFreeSpace(%p) = %zu, expected %zu\n",
+		lfHeap, SPHLockFreeHeapFreeSpace (lfHeap), lfspace);
+	rc++;
+    }
+
+    /* Fill the heap with 16 unit chunks, 4 per word, then free the
+       last chunk of one word and the first of the next.  The only
+       32 unit hole straddles the word boundary.  */
+    n = 0;
+    while ((n < 128)
+	&& (chunk[n] = (char*)SPHLockFreeHeapAlloc (lfHeap, 16 * uSize)))
+	n++;
+    for (i = 0; i < n; i++)
+    {
+	if ((((unsigned long)chunk[i] - (unsigned long)lfHeap)
+		/ (16 * uSize)) % 4 == 3)
+	    break;
+    }
+    if ((i + 1) >= n)
+    {
+	printf("error lockfree_span_test no word edge in %ld chunks\n", n);
+	return 10;
+    }
+    temp2 = chunk[i];
+    SPHLockFreeHeapFree (lfHeap, chunk[i]);
+    SPHLockFreeHeapFree (lfHeap, chunk[i + 1]);
+    chunk[i] = chunk[i + 1] = NULL;
+
+    aSize = 32 * uSize;
+    temp0 = (char*)SPHLockFreeHeapAlloc (lfHeap, aSize);
+    if (temp0 == temp2)
+    {
+	printf("lockfree_span_test SPHLockFreeHeapAlloc(%p,%zu) = %p crosses word edge\n",
+		lfHeap, aSize, temp0);
+	memset (temp0, 0xa5, aSize);
+    } else {
+	printf("error lockfree_span_test SPHLockFreeHeapAlloc(%p,%zu) = %p expected %p\n",
+		lfHeap, aSize, temp0, temp2);
+	rc++;
+    }
+    if (SPHLockFreeHeapFreeNear (temp0))
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapFreeNear(%p) failed\n",
+		temp0);
+	rc++;
+    }
+    for (i = 0; i < n; i++)
+    {
+	if (chunk[i])
+	    SPHLockFreeHeapFree (lfHeap, chunk[i]);
+    }
+    if ((SPHLockFreeHeapFreeSpace (lfHeap) != lfspace)
+     || !SPHLockFreeHeapEmpty (lfHeap))
+    {
+	printf("error lockfree_span_test SPHLockFreeHeapFreeSpace(%p) = %zu, expected %zu\n",
+		lfHeap, SPHLockFreeHeapFreeSpace (lfHeap), lfspace);
+	rc++;
+    }
+
+    return rc;
+}
+
 void
 setmemrange (unsigned long low, unsigned long high)
 {
@@ -2522,6 +2674,10 @@ int main(int argc, char *argv[])
     setmemrange (a4k, b4k+stack_block_size);
     rc += lockfree_large_test (source_address);
 #endif
+#if 1
+    setmemrange (a4k, b4k+stack_block_size);
+    rc += lockfree_span_test (source_address);
+#endif
 #if 0
     setmemrange (a4k, b4k+stack_block_size);
     rc += lockfree_cycle_test (source_address);
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2011 IBM Corporation.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Contributors:
+ *     IBM Corporation, Steven Munroe - initial API and implementation
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sasstdio.h"
+#include "sassim.h"
+#include "sasalloc.h"
+#include "sphlockfreeheap.h"
+#include "sphthread.h"
+#include "sphtimer.h"
+
+#ifdef LONGCHECK
+# define ITERATIONS 10000000
+#else
+# define ITERATIONS 200000
+#endif
+
+/* Number of objects each thread keeps live at any time.  */
+#define LIVE_SLOTS 32
+
+static const int max_threads = 64;
+
+static long thread_iterations;
+static long size_units = 4;
+
+static SPHLockFreeHeap_t lfHeap;
+static block_size_t heap_size, unit_size;
+
+typedef void* (*test_ptr_t)(void*);
+
+/* Each thread cycles through LIVE_SLOTS objects of 1 to size_units units,
+   freeing the oldest and allocating a new one on every iteration.
+   The first word of each object is stamped with its owner and
+   checked before the free.  Returns the number of failures.  */
+static void *
+alloc_free_test_thread (void *arg)
+{
+    int tn = (int) (long int) arg;
+    long result = 0;
+    unsigned long *slot[LIVE_SLOTS];
+    unsigned long tag;
+    block_size_t size;
+    long i, j;
+
+    SASThreadSetUp ();
+
+    memset (slot, 0, sizeof (slot));
+    for (i = 0; i < thread_iterations; i++)
+    {
+	j = i % LIVE_SLOTS;
+	if (slot[j])
+	{
+	    if (slot[j][0] != (((unsigned long)tn << 32) | j))
+	    {
+		printf("error thread %d slot %ld overwritten %lx\n",
+			tn, j, slot[j][0]);
+		result++;
+	    }
+	    if (SPHLockFreeHeapFree (lfHeap, slot[j]))
+		result++;
+	    slot[j] = NULL;
+	}
+	size = (((i + tn) % size_units) + 1) * unit_size;
+	slot[j] = (unsigned long *)SPHLockFreeHeapAlloc (lfHeap, size);
+	if (slot[j])
+	{
+	    tag = ((unsigned long)tn << 32) | j;
+	    slot[j][0] = tag;
+	} else {
+	    result++;
+	}
+    }
+
+    for (j = 0; j < LIVE_SLOTS; j++)
+    {
+	if (slot[j])
+	    SPHLockFreeHeapFree (lfHeap, slot[j]);
+    }
+
+    SASThreadCleanUp ();
+
+    return (void*)result;
+}
+
+static int
+launch_test_threads (int t_cnt, test_ptr_t test_f,
+			long iterations)
+{
+  long int n;
+  pthread_t th[max_threads];
+  long thread_result;
+  int result = 0;
+
+  thread_iterations = iterations;
+
+  for (n = 0; n < t_cnt; ++n)
+	{
+		void *arg;
+		arg = (void*)n;
+		if (pthread_create (&th[n], NULL, test_f, arg) != 0)
+		{
+			puts ("create failed");
+			exit (1);
+		}
+	}
+
+  for (n = 0; n < t_cnt; ++n)
+    if (pthread_join (th[n], (void**)&thread_result) != 0)
+      {
+	puts ("join failed");
+	exit (2);
+      } else {
+	result += thread_result;
+      }
+
+  return result;
+}
+
+int main ()
+{
+    int	rc, t_cnt, N_PROC_CONF;
+    long ops;
+    double clock, nano, rate, rate1 = 0.0;
+    sphtimer_t	tempt, startt, endt, freqt;
+
+	N_PROC_CONF = sysconf(_SC_NPROCESSORS_ONLN);
+
+    SAS_IO_INIT		// init the io stuff
+
+    rc = SASJoinRegion();
+
+    if (rc)
+    {
+		printf("SASJoinRegion Error# %d\n", rc);
+
+		return 1;
+    }
+
+	printf("SAS Joined with %d processors\n", N_PROC_CONF);
+
+	/* 256 allocation words, 4 summary words.  */
+	heap_size = block__Size4M;
+	unit_size = 256;
+	lfHeap = SPHLockFreeHeapCreate (heap_size, unit_size);
+	if (!lfHeap)
+	{
+		printf("error SPHLockFreeHeapCreate (%zu, %zu) failed\n",
+			heap_size, unit_size);
+		SASRemove();
+		return 1;
+	}
+	printf("SPHLockFreeHeapCreate (%zu, %zu) = %p free=%zu\n",
+		heap_size, unit_size, lfHeap,
+		SPHLockFreeHeapFreeSpace (lfHeap));
+
+	/* Each thread does the same work, so perfect scaling keeps the
+	   time constant and multiplies the rate by the thread count.  */
+	for (t_cnt = 1; t_cnt <= max_threads; t_cnt *= 2)
+	{
+		startt = sphgettimer();
+		rc += launch_test_threads (t_cnt, alloc_free_test_thread,
+			ITERATIONS);
+		endt = sphgettimer();
+		tempt = endt -startt;
+		clock = tempt;
+		freqt = sphfastcpufreq();
+		ops = (long)t_cnt * ITERATIONS * 2;
+		nano = (clock * 1000000000.0) / (double)freqt;
+		nano = nano / ops;
+		rate = ops / (clock / (double)freqt);
+		if (t_cnt == 1)
+			rate1 = rate;
+
+		printf ("lockfree_heap_test threads=%2d X %ld ave= %6.2fns rate=%12.1f/s speedup=%5.2f\n",
+			t_cnt, ops, nano, rate, rate / rate1);
+
+		if (!SPHLockFreeHeapEmpty (lfHeap))
+		{
+			printf("error SPHLockFreeHeapEmpty (%p) false after %d threads\n",
+				lfHeap, t_cnt);
+			rc++;
+		}
+	}
+	/* Mix in requests larger than one bit vector word, so concurrent
+	   spans race with each other and with single word allocations.  */
+	size_units = 48;
+	t_cnt = 8;
+	startt = sphgettimer();
+	rc += launch_test_threads (t_cnt, alloc_free_test_thread,
+		ITERATIONS / 10);
+	endt = sphgettimer();
+	clock = endt - startt;
+	freqt = sphfastcpufreq();
+	ops = (long)t_cnt * (ITERATIONS / 10) * 2;
+	nano = ((clock * 1000000000.0) / (double)freqt) / ops;
+	printf ("lockfree_span_test threads=%2d X %ld ave= %6.2fns\n",
+		t_cnt, ops, nano);
+	if (!SPHLockFreeHeapEmpty (lfHeap))
+	{
+		printf("error SPHLockFreeHeapEmpty (%p) false after spans\n",
+			lfHeap);
+		rc++;
+	}
+	printf("end   lockfree_heap_test = %d\n", rc);
+
+	SPHLockFreeHeapDestroy (lfHeap);
+
+    printf("SAS removed\n");
+    SASRemove();
+    return rc;
+}
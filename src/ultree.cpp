@@ -19,6 +19,53 @@
 #include "sasalloc.h"
 #include "ultree.h"
 
+/* The trees are kept as treaps so that depth stays O(log n) even when
+   keys arrive in address order, as they do for segment and block
+   allocation.  The heap priority of a node is a hash of its key, so
+   the node layout (and existing persistent trees) are unchanged and
+   any slot returned by a search can be removed in place.  */
+static inline unsigned long
+nodePriority (search_t k)
+{
+#if __SIZEOF_LONG__ == 8
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdUL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53UL;
+  k ^= k >> 33;
+#else
+  k ^= k >> 16;
+  k *= 0x85ebca6bUL;
+  k ^= k >> 13;
+  k *= 0xc2b2ae35UL;
+  k ^= k >> 16;
+#endif
+  return k;
+}
+
+/* Join the left subtree a and right subtree b (all keys in a less than
+   all keys in b) into the slot pp, preserving the heap order.  */
+static inline void
+mergeNodes (uLongTreeNode **pp, uLongTreeNode *a, uLongTreeNode *b)
+{
+  while (a && b)
+    {
+      if (nodePriority (a->getKey ()) >= nodePriority (b->getKey ()))
+	{
+	  *pp = a;
+	  pp = a->rightSlot ();
+	  a = *pp;
+	}
+      else
+	{
+	  *pp = b;
+	  pp = b->leftSlot ();
+	  b = *pp;
+	}
+    }
+  *pp = a ? a : b;
+}
+
 void
 uLongTreeNode::init(search_t k, info_t i)
 {
@@ -273,152 +320,93 @@ uLongTreeNode
 void
 uLongTreeNode::deleteNode (uLongTreeNode **pp)
 {
-   uLongTreeNode	*q;
-   uLongTreeNode *p = *pp;
+   uLongTreeNode *q = removeNode (pp);
 
-   if ( p )
-	{
-      if ( p->right == NULL )
-      {	// re-attach left subtree in place of node p
-         q = p;
-         *pp = p->left;
-         q->kill();
-      } else {
-         if ( p->left == NULL )
-         {	// re-attach right subtree in place of p
-            q = p;
-            *pp = p->right;
-            q->kill();
-         } else {	// neither subtree is empty
-            q = p->right;	// move right then as far left as possible
-            while ( q->left ) q = q->left;
-            q->left = p->left;
-            q = p;
-            *pp = p->right;
-            q->kill();
-			};
-		};
-	};
+   if ( q )
+      q->kill();
 };
 
 uLongTreeNode
 *uLongTreeNode::removeNode (uLongTreeNode **pp)
 {
-   uLongTreeNode  *q = NULL;
    uLongTreeNode  *p = *pp;
 
    if ( p )
 	{
-      if ( p->right == NULL )
-      {	// re-attach left subtree in place of node p
-         q = p;
-         *pp = p->left;
-      } else {
-         if ( p->left == NULL )
-         {	// re-attach right subtree in place of p
-            q = p;
-            *pp = p->right;
-         } else {	// neither subtree is empty
-			   q = p->right;	// move right then as far left as possible
-            while ( q->left ) q = q->left;
-            q->left = p->left;
-            q = p;
-            *pp = p->right;
-
-			};
-		};
+      // replace p with the merge of its subtrees
+      mergeNodes (pp, p->left, p->right);
+      p->left = NULL;
+      p->right = NULL;
 	};
-   return q;
+   return p;
 };
 
 uLongTreeNode
 *uLongTreeNode::insertNode (uLongTreeNode **root, search_t k, info_t i)
 {
-    uLongTreeNode	*p;
 #ifdef __SOMDebugPrint__
     sas_printf("uLongTreeNode::insertNode\n");
 #endif
     uLongTreeNode *n = (uLongTreeNode *)SASNearAlloc(root, sizeof(uLongTreeNode));
     n->init(k, i);
 
-    p = *root;
-    if (*root != NULL)
+    if (insertNode (root, n) == NULL)
 	{
-	do {
-	    if ( k < p->key )
-		{
-		if ( p->left )
-		    {
-		    p = p->left;
-		    } else {
-			p->left = n;
-			p = NULL;
-			};
-		} else {
-		    if ( k > p->key )
-			{
-			if ( p->right )
-			    {
-			    p = p->right;
-			    } else {
-				p->right = n;
-				p = NULL;
-				};
-			} else {
-			    n->kill();
-			    n = NULL;
-			    p = NULL;
-			    };
-		    };
-	    } while ( p );
-	} else {
-	    *root = n;
-	    };
+	n->kill();
+	n = NULL;
+	};
 
-	    return n;
+    return n;
 };
 
 uLongTreeNode
 *uLongTreeNode::insertNode (uLongTreeNode **root, uLongTreeNode *n)
 {
    uLongTreeNode	*p;
+   uLongTreeNode	**pp = root;
+   uLongTreeNode	**l, **r;
 #ifdef __SASDebugPrint__
    sas_printf("uLongTreeNode::insertNode\n");
 #endif
    search_t       k = n->getKey();
+   unsigned long  pri = nodePriority (k);
+
+   // descend past the nodes that stay above n in the heap order
+   while ( (p = *pp) && (nodePriority (p->key) >= pri) )
+   {
+      if ( k < p->key )
+         pp = &p->left;
+      else if ( k > p->key )
+         pp = &p->right;
+      else
+         return NULL;
+   };
 
-   p = *root;
-   if (*root != NULL)
-	{
-      do {
-         if ( k < p->key )
-         {
-            if ( p->left )
-            {
-               p = p->left;
-            } else {
-               p->left = n;
-               p = NULL;
-            };
-         } else {
-            if ( k > p->key )
-            {
-               if ( p->right )
-               {
-                  p = p->right;
-               } else {
-                  p->right = n;
-                  p = NULL;
-				   };
-            } else {
-               n = NULL;
-               p = NULL;
-            };
-         };
-      } while ( p );
-   } else {
-      *root = n;
+   // reject a duplicate in the subtree n is about to replace
+   for ( p = *pp; p; p = (k < p->key) ? p->left : p->right )
+      if ( p->key == k )
+         return NULL;
+
+   // split the subtree at k under n
+   l = &n->left;
+   r = &n->right;
+   p = *pp;
+   while ( p )
+   {
+      if ( p->key < k )
+      {
+         *l = p;
+         l = &p->right;
+         p = p->right;
+      } else {
+         *r = p;
+         r = &p->left;
+         p = p->left;
+      };
    };
+   *l = NULL;
+   *r = NULL;
+   *pp = n;
 
    return n;
 };
@@ -47,6 +47,14 @@ class uLongTreeNode {
 		  {
 		    return key;
 		  };
+		uLongTreeNode ** leftSlot()
+		  {
+		    return &left;
+		  };
+		uLongTreeNode ** rightSlot()
+		  {
+		    return &right;
+		  };
 		void init(search_t k, info_t i);
 		void kill();
 		void * operator new (size_t, uLongTreeNode * root);